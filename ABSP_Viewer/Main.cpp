@@ -1,10 +1,12 @@
+#include "ABSPFile.h"
 #include "AnvilBSPFormat.h"
+#include "AVertexFormat.h"
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <fstream>
+#include <cstring>
 
 glm::vec3 cPos(0, 10, 30), cFront(0, 0, -1);
 float yaw = -90.f, pitch = 0.f, dt = 0, lastF = 0;
@@ -28,20 +30,28 @@ int main() {
     glfwSetInputMode(W, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(W, mouse_cb);
 
-    std::ifstream is("world.absp", std::ios::binary);
-    ABSPHeader h; is.read((char*)&h, sizeof(h));
-    std::vector<AVertex> vr(h.numVertices); std::vector<AFace> fr(h.numFaces);
-    is.read((char*)vr.data(), h.numVertices * sizeof(AVertex));
-    is.read((char*)fr.data(), h.numFaces * sizeof(AFace));
+    // geometry only, the textures in the file are never touched
+    ABSPFile file; file.Open("world.absp");
+    std::vector<AVertex> vr; std::vector<AFace> fr; std::vector<uint32_t> fv; std::vector<uint8_t> vc;
+    file.ReadLump("VERT", vr); file.ReadLump("FACE", fr);
+    // welded maps reach face corners through FVTX, compact ones keep their vertices in VTXC
+    file.ReadLump("FVTX", fv); file.ReadLump("VTXC", vc);
+    AVertexStreamHeader vh;
+    if (vc.size() >= sizeof(vh)) { memcpy(&vh, vc.data(), sizeof(vh)); AVertexFormat::Decode(vh, vc.data() + sizeof(vh), vc.size() - sizeof(vh), vr); }
+    std::vector<uint32_t> ix;
+    auto corner = [&](const AFace& f, uint32_t k) { uint32_t at = f.firstVertex + k; return fv.empty() ? at : (at < fv.size() ? fv[at] : 0); };
+    for (auto& f : fr) for (uint32_t k = 1; k + 1 < f.numVertices; k++) { ix.push_back(corner(f, 0)); ix.push_back(corner(f, k)); ix.push_back(corner(f, k + 1)); }
     std::cout << "Rendering " << fr.size() << " faces." << std::endl;
 
     auto vs = glCreateShader(GL_VERTEX_SHADER); glShaderSource(vs, 1, &vS, 0); glCompileShader(vs);
     auto fs = glCreateShader(GL_FRAGMENT_SHADER); glShaderSource(fs, 1, &fS, 0); glCompileShader(fs);
     auto p = glCreateProgram(); glAttachShader(p, vs); glAttachShader(p, fs); glLinkProgram(p);
 
-    uint32_t VAO, VBO; glGenVertexArrays(1, &VAO); glGenBuffers(1, &VBO);
+    uint32_t VAO, VBO, EBO; glGenVertexArrays(1, &VAO); glGenBuffers(1, &VBO); glGenBuffers(1, &EBO);
     glBindVertexArray(VAO); glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, vr.size() * sizeof(AVertex), vr.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, ix.size() * sizeof(uint32_t), ix.data(), GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(AVertex), (void*)0); glEnableVertexAttribArray(0);
     glVertexAttribPointer(2, 3, GL_FLOAT, 0, sizeof(AVertex), (void*)(5 * sizeof(float))); glEnableVertexAttribArray(2);
 
@@ -55,7 +65,7 @@ int main() {
         glUniformMatrix4fv(glGetUniformLocation(p, "pj"), 1, 0, glm::value_ptr(glm::perspective(45.f, 1.77f, 0.1f, 1000.f)));
         glUniformMatrix4fv(glGetUniformLocation(p, "v"), 1, 0, glm::value_ptr(glm::lookAt(cPos, cPos + cFront, { 0,1,0 })));
         glBindVertexArray(VAO);
-        for (auto& f : fr) glDrawArrays(GL_TRIANGLE_FAN, f.firstVertex, f.numVertices);
+        glDrawElements(GL_TRIANGLES, (GLsizei)ix.size(), GL_UNSIGNED_INT, 0);
         glfwSwapBuffers(W); glfwPollEvents();
     }
     return 0;
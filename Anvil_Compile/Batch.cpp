@@ -0,0 +1,284 @@
+#include "Batch.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+enum class EJobStatus
+{
+    Built,
+    UpToDate,
+    Failed
+};
+
+struct JobResult
+{
+    EJobStatus status  = EJobStatus::Failed;
+    double     seconds = 0.0;
+    uintmax_t  bytes   = 0;
+};
+
+bool IsMeshExtension(const std::string& ext)
+{
+    // What we actually feed Assimp, not everything it can read
+    static const char* meshExtensions[] = {".obj", ".fbx", ".gltf", ".glb", ".dae", ".3ds", ".ply", ".stl"};
+    for (const char* e : meshExtensions)
+    {
+        if (ext == e)
+            return true;
+    }
+    return false;
+}
+
+bool KindFromPath(const fs::path& path, EBatchKind& kind)
+{
+    std::string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char) std::tolower(c); });
+    if (ext == ".map")
+    {
+        kind = EBatchKind::Map;
+        return true;
+    }
+    if (IsMeshExtension(ext))
+    {
+        kind = EBatchKind::Mesh;
+        return true;
+    }
+    return false;
+}
+
+fs::path DefaultOutput(const fs::path& input, const fs::path& root, EBatchKind kind, const BatchOptions& options)
+{
+    fs::path out = input;
+    if (!options.outDir.empty())
+    {
+        // Keep the folder layout so two "crate.obj" in different folders don't collide
+        fs::path relative = input.lexically_relative(root);
+        if (relative.empty() || *relative.begin() == "..")
+            relative = input.filename();
+        out = fs::path(options.outDir) / relative;
+    }
+    return out.replace_extension(kind == EBatchKind::Map ? ".absp" : ".anvmesh");
+}
+
+// Whitespace separated, "quoted" tokens may contain spaces, # comments out the rest of the line
+std::vector<std::string> SplitManifestLine(const std::string& line)
+{
+    std::vector<std::string> tokens;
+    size_t                   i = 0;
+    while (i < line.size())
+    {
+        while (i < line.size() && std::isspace((unsigned char) line[i]))
+            i++;
+        if (i >= line.size() || line[i] == '#')
+            break;
+        std::string token;
+        if (line[i] == '"')
+        {
+            size_t end = line.find('"', i + 1);
+            if (end == std::string::npos)
+                end = line.size();
+            token = line.substr(i + 1, end - i - 1);
+            i     = end + 1;
+        }
+        else
+        {
+            while (i < line.size() && !std::isspace((unsigned char) line[i]))
+                token += line[i++];
+        }
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+fs::file_time_type WriteTime(const fs::path& path)
+{
+    std::error_code ec;
+    fs::file_time_type t = fs::last_write_time(path, ec);
+    return ec ? fs::file_time_type::max() : t;
+}
+
+// Maps read every texture from textures/, so any of them changing rebuilds every map
+fs::file_time_type NewestTexture()
+{
+    fs::file_time_type newest = fs::file_time_type::min();
+    std::error_code    ec;
+    for (fs::recursive_directory_iterator it("textures", ec), end; !ec && it != end; it.increment(ec))
+    {
+        if (it->is_regular_file(ec))
+            newest = std::max(newest, WriteTime(it->path()));
+    }
+    return newest;
+}
+
+bool IsUpToDate(const BatchJob& job, fs::file_time_type newestTexture)
+{
+    std::error_code ec;
+    if (!fs::exists(job.output, ec))
+        return false;
+    fs::file_time_type built = WriteTime(job.output);
+    if (WriteTime(job.input) > built)
+        return false;
+    return job.kind != EBatchKind::Map || newestTexture <= built;
+}
+
+const char* StatusName(EJobStatus status)
+{
+    switch (status)
+    {
+    case EJobStatus::Built:
+        return "built";
+    case EJobStatus::UpToDate:
+        return "skipped";
+    default:
+        return "FAILED";
+    }
+}
+} // namespace
+
+bool CollectBatchJobs(const std::string& path, const BatchOptions& options, std::vector<BatchJob>& jobs)
+{
+    std::error_code ec;
+    if (fs::is_directory(path, ec))
+    {
+        std::vector<fs::path> inputs;
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+        {
+            EBatchKind kind;
+            if (it->is_regular_file(ec) && KindFromPath(it->path(), kind))
+                inputs.push_back(it->path());
+        }
+        // Directory order isn't stable between file systems, the table should be
+        std::sort(inputs.begin(), inputs.end());
+        for (const auto& input : inputs)
+        {
+            EBatchKind kind;
+            KindFromPath(input, kind);
+            jobs.push_back({kind, input.string(), DefaultOutput(input, path, kind, options).string()});
+        }
+        return true;
+    }
+
+    std::ifstream manifest(path);
+    if (!manifest)
+    {
+        std::cout << "[Anvil Compiler] Error: Batch manifest not found " << path << std::endl;
+        return false;
+    }
+    fs::path    root = fs::path(path).parent_path();
+    std::string line;
+    int         lineNumber = 0;
+    while (std::getline(manifest, line))
+    {
+        lineNumber++;
+        std::vector<std::string> tokens = SplitManifestLine(line);
+        if (tokens.empty())
+            continue;
+
+        EBatchKind kind;
+        bool       hasKind = tokens[0] == "map" || tokens[0] == "mesh";
+        if (hasKind)
+        {
+            kind = tokens[0] == "map" ? EBatchKind::Map : EBatchKind::Mesh;
+            tokens.erase(tokens.begin());
+        }
+        if (tokens.empty() || tokens.size() > 2 || (!hasKind && !KindFromPath(tokens[0], kind)))
+        {
+            std::cout << "[Anvil Compiler] Warning: " << path << "(" << lineNumber
+                      << "): expected [map|mesh] input [output], line skipped" << std::endl;
+            continue;
+        }
+        fs::path input  = root / tokens[0];
+        fs::path output = tokens.size() > 1 ? root / tokens[1] : DefaultOutput(input, root, kind, options);
+        jobs.push_back({kind, input.lexically_normal().string(), output.lexically_normal().string()});
+    }
+    return true;
+}
+
+size_t RunBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options, const BatchCompileFn& compile)
+{
+    using Clock = std::chrono::steady_clock;
+    auto batchStart = Clock::now();
+
+    ThreadPool& pool  = ThreadPool::Get();
+    size_t      slots = options.jobs ? options.jobs : pool.GetThreadCount();
+    slots             = std::max<size_t>(1, std::min(slots, jobs.size()));
+    std::cout << "[Anvil Compiler] Batch: " << jobs.size() << " jobs, " << slots << " at a time on "
+              << pool.GetThreadCount() << " threads" << std::endl;
+
+    fs::file_time_type     newestTexture = NewestTexture();
+    std::vector<JobResult> results(jobs.size());
+    std::atomic<size_t>    next{0};
+    std::mutex             printLock;
+
+    // Each slot keeps pulling jobs until there are none left, so only `slots` compiles are ever
+    // in flight while their own ParallelFors still spread over the whole pool
+    pool.ParallelFor(slots, [&](size_t) {
+        for (size_t i = next++; i < jobs.size(); i = next++)
+        {
+            const BatchJob& job    = jobs[i];
+            JobResult&      result = results[i];
+            if (!options.force && IsUpToDate(job, newestTexture))
+            {
+                std::error_code ec;
+                result.status = EJobStatus::UpToDate;
+                result.bytes  = fs::file_size(job.output, ec);
+                continue;
+            }
+
+            std::error_code ec;
+            fs::path        outDir = fs::path(job.output).parent_path();
+            if (!outDir.empty())
+                fs::create_directories(outDir, ec);
+
+            std::ostringstream log;
+            auto               start = Clock::now();
+            bool               ok    = compile(job, log);
+            result.seconds           = std::chrono::duration<double>(Clock::now() - start).count();
+            result.status            = ok ? EJobStatus::Built : EJobStatus::Failed;
+            result.bytes             = ok ? fs::file_size(job.output, ec) : 0;
+
+            std::lock_guard<std::mutex> lock(printLock);
+            std::cout << log.str();
+        }
+    });
+
+    size_t built = 0, upToDate = 0, failed = 0;
+    std::cout << "[Anvil Compiler] Batch summary:" << std::endl;
+    std::cout << "  " << std::left << std::setw(9) << "Status" << std::setw(10) << "Time" << std::setw(10) << "Size"
+              << "Input -> Output" << std::endl;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const JobResult& r = results[i];
+        std::ostringstream time, size;
+        if (r.status == EJobStatus::Built)
+            time << std::fixed << std::setprecision(2) << r.seconds << " s";
+        else
+            time << "-";
+        if (r.status != EJobStatus::Failed)
+            size << (r.bytes + 1023) / 1024 << " KB";
+        else
+            size << "-";
+        std::cout << "  " << std::setw(9) << StatusName(r.status) << std::setw(10) << time.str() << std::setw(10)
+                  << size.str() << jobs[i].input << " -> " << jobs[i].output << std::endl;
+
+        built += r.status == EJobStatus::Built;
+        upToDate += r.status == EJobStatus::UpToDate;
+        failed += r.status == EJobStatus::Failed;
+    }
+    std::cout << std::right;
+    std::cout << "  - " << built << " built, " << upToDate << " up to date, " << failed << " failed in "
+              << std::chrono::duration<double>(Clock::now() - batchStart).count() << " s" << std::endl;
+    return failed;
+}
@@ -0,0 +1,55 @@
+#pragma once
+// Batch.h
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class EBatchKind
+{
+    Map,
+    Mesh
+};
+
+struct BatchJob
+{
+    EBatchKind  kind;
+    std::string input;
+    std::string output;
+};
+
+struct BatchOptions
+{
+    std::string outDir;        // empty writes every output next to its input
+    unsigned    jobs  = 0;     // compiles running at once, 0 is one per pool thread
+    bool        force = false; // rebuild even when the output is up to date
+};
+
+/**
+ * @brief Compiles one job, writing everything it reports to log
+ * @return false when nothing usable was written
+ */
+using BatchCompileFn = std::function<bool(const BatchJob& job, std::ostream& log)>;
+
+/**
+ * @brief Lists the jobs of a manifest file or of every map and mesh under a directory
+ * A manifest has one job per line: [map|mesh] input [output]. The kind defaults to the input's
+ * extension, paths can be quoted and are relative to the manifest, # starts a comment.
+ * Outputs that aren't given go to options.outDir, mirroring the input folders, or next to the
+ * input when there is no outDir.
+ * @param path Manifest file or directory
+ * @param options Where outputs go
+ * @param jobs Receives the jobs in a stable order
+ * @return false if the manifest couldn't be read
+ */
+bool CollectBatchJobs(const std::string& path, const BatchOptions& options, std::vector<BatchJob>& jobs);
+
+/**
+ * @brief Runs the jobs on the compiler thread pool and prints a summary table
+ * At most options.jobs compiles run at once, the stages inside them share the rest of the pool.
+ * Jobs whose output is newer than every input they read are skipped unless options.force is set.
+ * Each job's log is printed in one piece once it finishes so parallel compiles don't interleave.
+ * @return Number of failed jobs
+ */
+size_t RunBatch(const std::vector<BatchJob>& jobs, const BatchOptions& options,
+                const BatchCompileFn& compile);
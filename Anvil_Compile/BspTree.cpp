@@ -0,0 +1,477 @@
+#include "BspTree.h"
+#include "CompileCache.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <utility>
+
+namespace
+{
+// Engine units, a tenth of a .map unit once the compiler has scaled the world
+constexpr float  BSP_EPSILON          = 0.001f;
+// Splitter candidates tried per node, faces are sampled evenly above that
+constexpr size_t MAX_SPLIT_CANDIDATES = 128;
+
+struct BuildFace
+{
+    Winding winding;
+    APlane  plane;
+};
+
+struct BspBuilder
+{
+    const std::vector<APlane>&    brushPlanes;
+    const std::vector<ABSPBrush>& brushes;
+    std::vector<APlane>           bounds; // box around the world, interior behind the planes
+    BspTree&                      tree;
+};
+
+APlane FlipPlane(const APlane& p)
+{
+    return {-p.normal, -p.distance};
+}
+
+bool IsAxial(const APlane& p)
+{
+    return std::abs(p.normal.x) == 1.0f || std::abs(p.normal.y) == 1.0f ||
+           std::abs(p.normal.z) == 1.0f;
+}
+
+bool IsPointSolid(const BspBuilder& b, const glm::vec3& p)
+{
+    for (const auto& brush : b.brushes)
+    {
+        bool inside = true;
+        for (uint32_t i = 0; i < brush.numPlanes && inside; i++)
+        {
+            const APlane& plane = b.brushPlanes[brush.firstPlane + i];
+            if (glm::dot(plane.normal, p) - plane.distance > -BSP_EPSILON)
+                inside = false;
+        }
+        if (inside)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Creates a leaf for the cell bounded by clips. The cell vertices are averaged into a point
+ * that is strictly inside it, and since every brush side is a splitter a cell is either fully
+ * inside a brush or fully outside all of them.
+ */
+int32_t MakeLeaf(BspBuilder& b, const std::vector<APlane>& clips)
+{
+    std::vector<APlane> sides = b.bounds;
+    sides.insert(sides.end(), clips.begin(), clips.end());
+
+    glm::vec3 sum(0.0f);
+    size_t    count    = 0;
+    bool      onBounds = false;
+    uint64_t  key      = 0;
+    for (size_t i = 0; i < sides.size(); i++)
+    {
+        Winding w = BaseWindingForPlane(sides[i]);
+        for (size_t j = 0; j < sides.size() && !w.empty(); j++)
+        {
+            if (j != i)
+                ChopWinding(w, FlipPlane(sides[j]), BSP_EPSILON);
+        }
+        for (const auto& p : w)
+            sum += p;
+        count += w.size();
+        onBounds |= i < b.bounds.size() && !w.empty();
+        // The planes the cell actually touches, in any order, so it keeps its key whatever
+        // path the tree took to it
+        if (!w.empty())
+            key += HashBytes(&sides[i], sizeof(APlane));
+    }
+
+    ABSPLeaf leaf{};
+    bool     solid = count == 0 || IsPointSolid(b, sum / (float) count);
+    leaf.cluster   = solid ? -1 : (int32_t) b.tree.numClusters++;
+    b.tree.leafs.push_back(leaf);
+    b.tree.leafOnBounds.push_back(onBounds ? 1 : 0);
+    b.tree.leafKeys.push_back(key);
+    return -(int32_t) b.tree.leafs.size();
+}
+
+/**
+ * Picks the face plane that splits the fewest faces while keeping both sides balanced,
+ * with a small bonus for axial planes.
+ * Candidates are sampled by a hash of their plane rather than by where they are in the list,
+ * so an edit somewhere else in the map doesn't change which ones are tried (and with them the
+ * whole tree, its leafs and portals).
+ */
+size_t SelectSplitter(const std::vector<BuildFace>& faces)
+{
+    uint64_t mask = 0;
+    while ((mask + 1) * MAX_SPLIT_CANDIDATES < faces.size())
+        mask = mask * 2 + 1;
+
+    size_t                best      = 0;
+    int                   bestValue = INT_MAX;
+    uint64_t              bestHash  = 0;
+    std::vector<uint64_t> tried;
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        const APlane& split = faces[i].plane;
+        uint64_t      hash  = HashBytes(&split, sizeof(split));
+        if ((hash & mask) != 0 || std::find(tried.begin(), tried.end(), hash) != tried.end())
+            continue;
+        tried.push_back(hash);
+
+        int front = 0, back = 0, splits = 0;
+        for (const auto& f : faces)
+        {
+            switch (ClassifyWinding(f.winding, split, BSP_EPSILON))
+            {
+            case SIDE_FRONT:
+                front++;
+                break;
+            case SIDE_BACK:
+                back++;
+                break;
+            case SIDE_CROSS:
+                splits++;
+                break;
+            default:
+                break;
+            }
+        }
+        int value = 5 * splits + std::abs(front - back);
+        if (IsAxial(split))
+            value -= 5;
+        if (value < bestValue || (value == bestValue && hash < bestHash))
+        {
+            bestValue = value;
+            bestHash  = hash;
+            best      = i;
+        }
+    }
+    return best;
+}
+
+int32_t BuildNode(BspBuilder& b, std::vector<BuildFace>& faces, std::vector<APlane>& clips)
+{
+    if (faces.empty())
+        return MakeLeaf(b, clips);
+
+    APlane split = faces[SelectSplitter(faces)].plane;
+
+    std::vector<BuildFace> front, back;
+    for (auto& f : faces)
+    {
+        // Faces on the splitter (either way round) are done with
+        if (PlanesCoincide(f.plane, split, BSP_EPSILON))
+            continue;
+
+        switch (ClassifyWinding(f.winding, split, BSP_EPSILON))
+        {
+        case SIDE_FRONT:
+            front.push_back(std::move(f));
+            break;
+        case SIDE_BACK:
+            back.push_back(std::move(f));
+            break;
+        case SIDE_CROSS:
+        {
+            BuildFace ff{{}, f.plane}, bf{{}, f.plane};
+            SplitWinding(f.winding, split, BSP_EPSILON, ff.winding, bf.winding);
+            if (!ff.winding.empty())
+                front.push_back(std::move(ff));
+            if (!bf.winding.empty())
+                back.push_back(std::move(bf));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    faces.clear();
+    faces.shrink_to_fit();
+
+    int32_t index = (int32_t) b.tree.nodes.size();
+    b.tree.nodes.push_back({split, {0, 0}});
+
+    clips.push_back(FlipPlane(split));
+    int32_t frontChild = BuildNode(b, front, clips);
+    clips.back()       = split;
+    int32_t backChild  = BuildNode(b, back, clips);
+    clips.pop_back();
+
+    b.tree.nodes[index].children[0] = frontChild;
+    b.tree.nodes[index].children[1] = backChild;
+    return index;
+}
+
+void FilterFace(BspBuilder& b, const Winding& w, const APlane& facePlane, int32_t node,
+                uint32_t faceIndex, std::vector<std::vector<uint32_t>>& perLeaf)
+{
+    if (node < 0)
+    {
+        int32_t leaf  = -node - 1;
+        auto&   faces = perLeaf[leaf];
+        if (b.tree.leafs[leaf].cluster >= 0 && (faces.empty() || faces.back() != faceIndex))
+            faces.push_back(faceIndex);
+        return;
+    }
+
+    const ABSPNode& n = b.tree.nodes[node];
+    bool            flipped;
+    if (PlanesCoincide(facePlane, n.plane, BSP_EPSILON, &flipped))
+    {
+        // A face on the node plane is only seen from the side it faces
+        FilterFace(b, w, facePlane, n.children[flipped ? 1 : 0], faceIndex, perLeaf);
+        return;
+    }
+
+    Winding front, back;
+    SplitWinding(w, n.plane, BSP_EPSILON, front, back);
+    if (!front.empty())
+        FilterFace(b, front, facePlane, n.children[0], faceIndex, perLeaf);
+    if (!back.empty())
+        FilterFace(b, back, facePlane, n.children[1], faceIndex, perLeaf);
+}
+
+void FilterPortal(BspBuilder& b, const Winding& w, int32_t node,
+                  std::vector<std::pair<Winding, int32_t>>& out)
+{
+    if (node < 0)
+    {
+        out.push_back({w, -node - 1});
+        return;
+    }
+
+    const ABSPNode& n = b.tree.nodes[node];
+    Winding         front, back;
+    SplitWinding(w, n.plane, BSP_EPSILON, front, back);
+    if (!front.empty())
+        FilterPortal(b, front, n.children[0], out);
+    if (!back.empty())
+        FilterPortal(b, back, n.children[1], out);
+}
+
+/**
+ * The node plane, cut down to the node's cell, is pushed through both subtrees.
+ * Every piece that ends up between two empty leafs becomes a portal.
+ */
+void MakePortals(BspBuilder& b, int32_t node, std::vector<APlane>& clips)
+{
+    if (node < 0)
+        return;
+
+    const ABSPNode n = b.tree.nodes[node];
+
+    Winding w = BaseWindingForPlane(n.plane);
+    for (const auto& c : b.bounds)
+    {
+        if (!ChopWinding(w, FlipPlane(c), BSP_EPSILON))
+            break;
+    }
+    for (const auto& c : clips)
+    {
+        if (w.empty() || !ChopWinding(w, FlipPlane(c), BSP_EPSILON))
+            break;
+    }
+
+    if (!w.empty())
+    {
+        std::vector<std::pair<Winding, int32_t>> fronts, backs;
+        FilterPortal(b, w, n.children[0], fronts);
+        for (const auto& [fw, frontLeaf] : fronts)
+        {
+            if (b.tree.leafs[frontLeaf].cluster < 0)
+                continue;
+            backs.clear();
+            FilterPortal(b, fw, n.children[1], backs);
+            for (auto& [bw, backLeaf] : backs)
+            {
+                if (b.tree.leafs[backLeaf].cluster < 0 || WindingArea(bw) < BSP_EPSILON * BSP_EPSILON)
+                    continue;
+                b.tree.portals.push_back({std::move(bw), n.plane, {backLeaf, frontLeaf}});
+            }
+        }
+    }
+
+    clips.push_back(FlipPlane(n.plane));
+    MakePortals(b, n.children[0], clips);
+    clips.back() = n.plane;
+    MakePortals(b, n.children[1], clips);
+    clips.pop_back();
+}
+} // namespace
+
+BspTree BuildBspTree(const std::vector<AVertex>& verts, const std::vector<AFace>& faces,
+                     const std::vector<APlane>& brushPlanes, const std::vector<ABSPBrush>& brushes)
+{
+    BspTree tree;
+    if (faces.empty())
+        return tree;
+
+    std::vector<BuildFace> buildFaces;
+    buildFaces.reserve(faces.size());
+    glm::vec3 mins(1e9f), maxs(-1e9f);
+    for (const auto& f : faces)
+    {
+        BuildFace bf;
+        for (uint32_t i = 0; i < f.numVertices; i++)
+        {
+            const glm::vec3& p = verts[f.firstVertex + i].position;
+            bf.winding.push_back(p);
+            mins = glm::min(mins, p);
+            maxs = glm::max(maxs, p);
+        }
+        bf.plane.normal   = verts[f.firstVertex].normal;
+        bf.plane.distance = glm::dot(bf.plane.normal, WindingCenter(bf.winding));
+        buildFaces.push_back(std::move(bf));
+    }
+
+    BspBuilder b{brushPlanes, brushes, {}, tree};
+    mins -= glm::vec3(1.0f);
+    maxs += glm::vec3(1.0f);
+    for (int k = 0; k < 3; k++)
+    {
+        glm::vec3 n(0.0f);
+        n[k] = 1.0f;
+        b.bounds.push_back({n, maxs[k]});
+        b.bounds.push_back({-n, -mins[k]});
+    }
+
+    std::vector<APlane> clips;
+    BuildNode(b, buildFaces, clips);
+
+    // Mark surfaces: which faces each empty leaf can see
+    std::vector<std::vector<uint32_t>> perLeaf(tree.leafs.size());
+    for (uint32_t i = 0; i < faces.size(); i++)
+    {
+        const AFace& f = faces[i];
+        Winding      w(f.numVertices);
+        for (uint32_t j = 0; j < f.numVertices; j++)
+            w[j] = verts[f.firstVertex + j].position;
+        APlane plane{verts[f.firstVertex].normal, 0.0f};
+        plane.distance = glm::dot(plane.normal, WindingCenter(w));
+        FilterFace(b, w, plane, 0, i, perLeaf);
+    }
+    for (size_t i = 0; i < tree.leafs.size(); i++)
+    {
+        tree.leafs[i].firstLeafFace = (uint32_t) tree.leafFaces.size();
+        tree.leafs[i].numLeafFaces  = (uint32_t) perLeaf[i].size();
+        tree.leafFaces.insert(tree.leafFaces.end(), perLeaf[i].begin(), perLeaf[i].end());
+    }
+
+    MakePortals(b, 0, clips);
+    return tree;
+}
+
+FillResult FillOutside(BspTree& tree, const std::vector<glm::vec3>& seeds,
+                       std::vector<AVertex>& verts, std::vector<AFace>& faces)
+{
+    FillResult result;
+    if (tree.nodes.empty())
+        return result;
+
+    std::vector<std::vector<uint32_t>> leafPortals(tree.leafs.size());
+    for (uint32_t i = 0; i < tree.portals.size(); i++)
+    {
+        leafPortals[tree.portals[i].leafs[0]].push_back(i);
+        leafPortals[tree.portals[i].leafs[1]].push_back(i);
+    }
+
+    std::vector<uint8_t> reached(tree.leafs.size(), 0);
+    bool                 anySeed = false;
+    for (size_t s = 0; s < seeds.size(); s++)
+    {
+        int32_t node = 0;
+        while (node >= 0)
+        {
+            const ABSPNode& n = tree.nodes[node];
+            node = glm::dot(n.plane.normal, seeds[s]) - n.plane.distance >= 0.0f ? n.children[0]
+                                                                                 : n.children[1];
+        }
+        int32_t start = -node - 1;
+        if (tree.leafs[start].cluster < 0 || reached[start])
+            continue;
+        anySeed = true;
+
+        std::vector<int32_t> stack = {start};
+        reached[start]             = 1;
+        while (!stack.empty())
+        {
+            int32_t leaf = stack.back();
+            stack.pop_back();
+            if (tree.leafOnBounds[leaf])
+            {
+                result.leaked   = true;
+                result.leakSeed = s;
+                return result;
+            }
+            for (uint32_t p : leafPortals[leaf])
+            {
+                const BspPortal& portal = tree.portals[p];
+                int32_t          other  = portal.leafs[0] == leaf ? portal.leafs[1] : portal.leafs[0];
+                if (!reached[other])
+                {
+                    reached[other] = 1;
+                    stack.push_back(other);
+                }
+            }
+        }
+    }
+    if (!anySeed)
+        return result;
+
+    // Only faces seen from a leaf that's still open survive
+    std::vector<int32_t> faceRemap(faces.size(), -1);
+    for (size_t i = 0; i < tree.leafs.size(); i++)
+    {
+        if (!reached[i])
+            continue;
+        const ABSPLeaf& leaf = tree.leafs[i];
+        for (uint32_t j = 0; j < leaf.numLeafFaces; j++)
+            faceRemap[tree.leafFaces[leaf.firstLeafFace + j]] = 0;
+    }
+
+    std::vector<AVertex> keptVerts;
+    std::vector<AFace>   keptFaces;
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        if (faceRemap[i] < 0)
+            continue;
+        faceRemap[i] = (int32_t) keptFaces.size();
+        AFace f      = faces[i];
+        f.firstVertex = (uint32_t) keptVerts.size();
+        keptVerts.insert(keptVerts.end(), verts.begin() + faces[i].firstVertex,
+                         verts.begin() + faces[i].firstVertex + faces[i].numVertices);
+        keptFaces.push_back(f);
+    }
+    result.removedFaces = faces.size() - keptFaces.size();
+    verts.swap(keptVerts);
+    faces.swap(keptFaces);
+
+    // Leafs the flood never got to are solid now, so vis doesn't bother with them
+    std::vector<uint32_t> leafFaces;
+    tree.numClusters = 0;
+    for (size_t i = 0; i < tree.leafs.size(); i++)
+    {
+        ABSPLeaf& leaf     = tree.leafs[i];
+        uint32_t  first    = leaf.firstLeafFace;
+        uint32_t  count    = reached[i] ? leaf.numLeafFaces : 0;
+        leaf.cluster       = reached[i] ? (int32_t) tree.numClusters++ : -1;
+        leaf.firstLeafFace = (uint32_t) leafFaces.size();
+        leaf.numLeafFaces  = count;
+        for (uint32_t j = 0; j < count; j++)
+            leafFaces.push_back((uint32_t) faceRemap[tree.leafFaces[first + j]]);
+    }
+    tree.leafFaces.swap(leafFaces);
+
+    std::vector<BspPortal> portals;
+    for (auto& p : tree.portals)
+    {
+        if (reached[p.leafs[0]] && reached[p.leafs[1]])
+            portals.push_back(std::move(p));
+    }
+    tree.portals.swap(portals);
+
+    result.filled = true;
+    return result;
+}
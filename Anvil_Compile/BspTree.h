@@ -0,0 +1,58 @@
+#pragma once
+// BspTree.h
+#include "Winding.h"
+#include <cstdint>
+#include <vector>
+
+// Opening between two empty leafs, used by the vis pass
+struct BspPortal
+{
+    Winding winding;
+    APlane  plane;    // faces from leafs[0] towards leafs[1]
+    int32_t leafs[2]; // leaf indices
+};
+
+struct BspTree
+{
+    std::vector<ABSPNode>  nodes;
+    std::vector<ABSPLeaf>  leafs;
+    std::vector<uint32_t>  leafFaces;
+    std::vector<BspPortal> portals;
+    uint32_t               numClusters = 0; // one per empty leaf
+    std::vector<uint8_t>   leafOnBounds;    // 1 if the leaf reaches the box around the world
+    std::vector<uint64_t>  leafKeys;        // hash of the planes the leaf touches, the same
+                                            // cell gets the same key in the next compile
+};
+
+struct FillResult
+{
+    bool   filled       = false;
+    bool   leaked       = false; // a seed can reach the outside of the world
+    size_t leakSeed     = 0;     // the seed that leaked
+    size_t removedFaces = 0;
+};
+
+/**
+ * @brief Builds a BSP tree out of the compiled world faces
+ * Leafs inside a brush are marked solid (cluster -1), every empty leaf gets its own cluster,
+ * the faces that can be seen from it and the portals to its empty neighbours.
+ * @param verts Face vertices, in engine units
+ * @param faces Faces to partition
+ * @param brushPlanes Brush side planes in the same space as the vertices, interior behind them
+ * @param brushes Brushes indexing brushPlanes
+ */
+BspTree BuildBspTree(const std::vector<AVertex>& verts, const std::vector<AFace>& faces,
+                     const std::vector<APlane>& brushPlanes, const std::vector<ABSPBrush>& brushes);
+
+/**
+ * @brief Fills in the outside of the map
+ * The empty leafs are flooded through the portals starting from the seed points. When the flood
+ * stays inside the world every leaf it didn't reach becomes solid, and faces that can only be
+ * seen from those leafs are removed. Nothing changes if a seed can reach the outside.
+ * @param tree Tree built by BuildBspTree, updated in place
+ * @param seeds Points known to be inside the map, usually entity origins
+ * @param verts Face vertices, compacted if faces go away
+ * @param faces Faces the tree was built from, compacted if faces go away
+ */
+FillResult FillOutside(BspTree& tree, const std::vector<glm::vec3>& seeds,
+                       std::vector<AVertex>& verts, std::vector<AFace>& faces);
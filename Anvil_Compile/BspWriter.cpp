@@ -0,0 +1,111 @@
+#include "BspWriter.h"
+#include "ALZ4.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+void BspWriter::AddLump(const char id[4], const void* data, size_t size, uint32_t alignment)
+{
+    Pending pending = {};
+    memcpy(pending.lump.id, id, 4);
+    pending.lump.alignment = alignment ? alignment : 1;
+    pending.lump.size      = size;
+    pending.lump.rawSize   = size;
+    pending.data           = (const uint8_t*) data;
+    m_lumps.push_back(std::move(pending));
+}
+
+void BspWriter::AddLump(const char id[4], std::vector<uint8_t>&& data, uint32_t alignment)
+{
+    // A deque never moves what it already holds, so the pointer stays good
+    m_owned.push_back(std::move(data));
+    AddLump(id, m_owned.back().data(), m_owned.back().size(), alignment);
+}
+
+void BspWriter::Compress(EBSPCompression method)
+{
+    if (method != EBSPCompression::LZ4)
+        return;
+    // Biggest first, so the texture data doesn't start last and hold everyone up
+    std::vector<size_t> order(m_lumps.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return m_lumps[a].lump.rawSize > m_lumps[b].lump.rawSize; });
+
+    ThreadPool::Get().ParallelFor(order.size(), [&](size_t i) {
+        Pending& pending = m_lumps[order[i]];
+        // Past the loader's limit a lump stays stored, it wouldn't load compressed
+        if (pending.lump.compression != (uint32_t) EBSPCompression::None ||
+            pending.lump.rawSize > ALZ4::MAX_RAW_SIZE)
+            return;
+        std::vector<uint8_t> packed;
+        ALZ4::Compress(pending.data, (size_t) pending.lump.rawSize, packed);
+        if (packed.size() >= pending.lump.rawSize)
+            return;
+        pending.packed           = std::move(packed);
+        pending.lump.compression = (uint32_t) method;
+        pending.lump.size        = pending.packed.size();
+    });
+}
+
+uint64_t BspWriter::GetRawSize() const
+{
+    uint64_t total = 0;
+    for (const auto& pending : m_lumps)
+        total += pending.lump.rawSize;
+    return total;
+}
+
+uint64_t BspWriter::GetStoredSize() const
+{
+    uint64_t total = 0;
+    for (const auto& pending : m_lumps)
+        total += pending.lump.size;
+    return total;
+}
+
+bool BspWriter::Write(const std::string& path, uint64_t* bytesWritten) const
+{
+    // Lay the lumps out after the directory first, so it can be written in one go
+    std::vector<ABSPLump> directory;
+    uint64_t              offset = sizeof(ABSPHeaderV3) + m_lumps.size() * sizeof(ABSPLump);
+    for (const auto& pending : m_lumps)
+    {
+        ABSPLump lump = pending.lump;
+        offset        = (offset + lump.alignment - 1) / lump.alignment * lump.alignment;
+        lump.offset   = offset;
+        offset += lump.size;
+        directory.push_back(lump);
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    ABSPHeaderV3 header = {{'A', 'B', 'S', 'P'}, ABSP_VERSION, (uint32_t) directory.size(), 0};
+    out.write((const char*) &header, sizeof(header));
+    out.write((const char*) directory.data(), directory.size() * sizeof(ABSPLump));
+
+    static const char padding[256] = {};
+    uint64_t          position     = sizeof(header) + directory.size() * sizeof(ABSPLump);
+    for (size_t i = 0; i < m_lumps.size(); i++)
+    {
+        while (position < directory[i].offset)
+        {
+            uint64_t gap = std::min<uint64_t>(directory[i].offset - position, sizeof(padding));
+            out.write(padding, (std::streamsize) gap);
+            position += gap;
+        }
+        const Pending& pending = m_lumps[i];
+        out.write((const char*) (pending.packed.empty() ? pending.data : pending.packed.data()),
+                  (std::streamsize) directory[i].size);
+        position += directory[i].size;
+    }
+    out.close();
+    if (out.fail())
+        return false;
+    if (bytesWritten)
+        *bytesWritten = position;
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+// BspWriter.h
+#include "AnvilBSPFormat.h"
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Enough for any array the engine views in place, and for the serialized BVH
+constexpr uint32_t BSP_LUMP_ALIGNMENT = 16;
+
+/**
+ * @class BspWriter
+ * @brief Collects lumps and writes them as a version 3 .absp, directory first
+ * Lumps added by pointer aren't copied, they have to stay alive until Write.
+ */
+class BspWriter
+{
+  public:
+    void AddLump(const char id[4], const void* data, size_t size, uint32_t alignment = BSP_LUMP_ALIGNMENT);
+    // Keeps its own copy, for lumps put together just for the file
+    void AddLump(const char id[4], std::vector<uint8_t>&& data, uint32_t alignment = BSP_LUMP_ALIGNMENT);
+
+    template <typename T> void AddArray(const char id[4], const std::vector<T>& items)
+    {
+        AddLump(id, items.data(), items.size() * sizeof(T));
+    }
+
+    /**
+     * @brief Compresses every lump added so far, in parallel. Lumps that don't get smaller are
+     * left stored as they are
+     */
+    void Compress(EBSPCompression method);
+
+    // Bytes of all lumps before and after Compress
+    uint64_t GetRawSize() const;
+    uint64_t GetStoredSize() const;
+
+    /**
+     * @brief Writes the header, the directory and every lump in the order they were added
+     * @param bytesWritten Receives the file size
+     * @return false if the file couldn't be written
+     */
+    bool Write(const std::string& path, uint64_t* bytesWritten = nullptr) const;
+
+  private:
+    struct Pending
+    {
+        ABSPLump             lump;
+        const uint8_t*       data;
+        std::vector<uint8_t> packed; // compressed data, when smaller than data
+    };
+    std::vector<Pending>             m_lumps;
+    std::deque<std::vector<uint8_t>> m_owned;
+};
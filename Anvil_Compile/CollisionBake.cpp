@@ -0,0 +1,46 @@
+#include "CollisionBake.h"
+#include <btBulletDynamicsCommon.h>
+#include <cstring>
+
+std::vector<uint8_t> BakeCollisionBvh(const std::vector<AVertex>& verts,
+                                      const std::vector<uint32_t>& indices)
+{
+    std::vector<uint8_t> lump;
+    if (verts.empty() || indices.size() < 3)
+        return lump;
+
+    // Same layout AnvilPhysics::SetWorldData gives Bullet
+    std::vector<float> positions(verts.size() * 3);
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        positions[i * 3]     = verts[i].position.x;
+        positions[i * 3 + 1] = verts[i].position.y;
+        positions[i * 3 + 2] = verts[i].position.z;
+    }
+    std::vector<int> triangles(indices.begin(), indices.end());
+    btTriangleIndexVertexArray mesh((int) (triangles.size() / 3), triangles.data(), 3 * sizeof(int),
+                                    (int) verts.size(), positions.data(), 3 * sizeof(float));
+
+    // The bounds btBvhTriangleMeshShape would quantize against
+    btVector3 aabbMin, aabbMax;
+    mesh.calculateAabbBruteForce(aabbMin, aabbMax);
+    btOptimizedBvh bvh;
+    bvh.build(&mesh, true, aabbMin, aabbMax);
+
+    // serialize() wants a 16 byte aligned buffer
+    unsigned size   = bvh.calculateSerializeBufferSize();
+    void*    buffer = btAlignedAlloc(size, 16);
+    if (!bvh.serialize(buffer, size, false))
+    {
+        btAlignedFree(buffer);
+        return lump;
+    }
+
+    ABSPBvhHeader header = {BT_BULLET_VERSION, (uint32_t) sizeof(void*), (uint32_t) verts.size(),
+                            (uint32_t) (indices.size() / 3)};
+    lump.resize(sizeof(header) + size);
+    memcpy(lump.data(), &header, sizeof(header));
+    memcpy(lump.data() + sizeof(header), buffer, size);
+    btAlignedFree(buffer);
+    return lump;
+}
@@ -0,0 +1,16 @@
+#pragma once
+// CollisionBake.h
+#include "AnvilBSPFormat.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Builds the quantized Bullet BVH over the world triangles for the "BVH " lump
+ * The engine hands the same vertices and indices to Bullet, so the tree can be attached to its
+ * btBvhTriangleMeshShape as is.
+ * @param verts World vertices
+ * @param indices The triangle list written to the "INDX" lump
+ * @return ABSPBvhHeader followed by the serialized btOptimizedBvh
+ */
+std::vector<uint8_t> BakeCollisionBvh(const std::vector<AVertex>& verts,
+                                      const std::vector<uint32_t>& indices);
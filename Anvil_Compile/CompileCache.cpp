@@ -0,0 +1,228 @@
+#include "CompileCache.h"
+#include "AMappedFile.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+// Bounds checked reads out of the mapped cache file
+struct CacheReader
+{
+    const uint8_t* data;
+    size_t         size;
+    size_t         pos = 0;
+
+    bool Read(void* out, size_t bytes)
+    {
+        if (bytes > size - pos)
+            return false;
+        memcpy(out, data + pos, bytes);
+        pos += bytes;
+        return true;
+    }
+};
+
+void Write(std::ofstream& out, const void* data, size_t size)
+{
+    out.write((const char*) data, size);
+}
+} // namespace
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint64_t       hash  = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void CompileCache::Load(const std::string& path)
+{
+    AMappedFile file;
+    if (!file.Open(path.c_str()))
+        return;
+
+    CacheReader  in{file.GetData(), file.GetSize()};
+    ACacheHeader header;
+    if (!in.Read(&header, sizeof(header)) || memcmp(header.magic, "ACCH", 4) != 0 ||
+        header.version != VERSION)
+        return;
+
+    std::unordered_map<uint64_t, std::vector<CachedFace>> faces;
+    std::unordered_map<uint64_t, CachedTexture>           textures;
+    for (uint32_t i = 0; i < header.numFaceSets; i++)
+    {
+        uint64_t key;
+        uint32_t count;
+        if (!in.Read(&key, sizeof(key)) || !in.Read(&count, sizeof(count)))
+            return;
+        std::vector<CachedFace>& set = faces[key];
+        for (uint32_t f = 0; f < count; f++)
+        {
+            CachedFace face;
+            uint32_t   numPoints;
+            if (!in.Read(&face.side, sizeof(face.side)) || !in.Read(&numPoints, sizeof(numPoints)) ||
+                numPoints > (in.size - in.pos) / sizeof(glm::vec3))
+                return;
+            face.winding.resize(numPoints);
+            in.Read(face.winding.data(), numPoints * sizeof(glm::vec3));
+            set.push_back(std::move(face));
+        }
+    }
+    for (uint32_t i = 0; i < header.numTextures; i++)
+    {
+        uint64_t      key;
+        CachedTexture tex;
+        uint32_t      numLevels, dataSize;
+        if (!in.Read(&key, sizeof(key)) || !in.Read(&tex.width, sizeof(tex.width)) ||
+            !in.Read(&tex.height, sizeof(tex.height)) || !in.Read(&tex.format, sizeof(tex.format)) ||
+            !in.Read(&tex.albedo, sizeof(tex.albedo)) || !in.Read(&numLevels, sizeof(numLevels)) || !in.Read(&dataSize, sizeof(dataSize)) ||
+            numLevels > (in.size - in.pos) / sizeof(ATextureLevel))
+            return;
+        tex.levels.resize(numLevels);
+        in.Read(tex.levels.data(), numLevels * sizeof(ATextureLevel));
+        tex.data.resize(dataSize);
+        if (!in.Read(tex.data.data(), dataSize))
+            return;
+        textures[key] = std::move(tex);
+    }
+    std::unordered_map<uint64_t, std::vector<uint8_t>> stages;
+    for (uint32_t i = 0; i < header.numStages; i++)
+    {
+        uint64_t key, dataSize;
+        if (!in.Read(&key, sizeof(key)) || !in.Read(&dataSize, sizeof(dataSize)) ||
+            dataSize > in.size - in.pos)
+            return;
+        std::vector<uint8_t>& data = stages[key];
+        data.resize(dataSize);
+        in.Read(data.data(), dataSize);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_faces.swap(faces);
+    m_textures.swap(textures);
+    m_stages.swap(stages);
+}
+
+bool CompileCache::Save(const std::string& path) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::ofstream               out(path, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "[Anvil Compiler] Warning: Could not write the cache " << path << std::endl;
+        return false;
+    }
+
+    ACacheHeader header = {{'A', 'C', 'C', 'H'}, VERSION, (uint32_t) m_usedFaces.size(),
+                           (uint32_t) m_usedTextures.size(), (uint32_t) m_usedStages.size()};
+    Write(out, &header, sizeof(header));
+    for (const auto& [key, set] : m_usedFaces)
+    {
+        uint32_t count = (uint32_t) set.size();
+        Write(out, &key, sizeof(key));
+        Write(out, &count, sizeof(count));
+        for (const auto& face : set)
+        {
+            uint32_t numPoints = (uint32_t) face.winding.size();
+            Write(out, &face.side, sizeof(face.side));
+            Write(out, &numPoints, sizeof(numPoints));
+            Write(out, face.winding.data(), numPoints * sizeof(glm::vec3));
+        }
+    }
+    for (const auto& [key, tex] : m_usedTextures)
+    {
+        uint32_t numLevels = (uint32_t) tex.levels.size(), dataSize = (uint32_t) tex.data.size();
+        Write(out, &key, sizeof(key));
+        Write(out, &tex.width, sizeof(tex.width));
+        Write(out, &tex.height, sizeof(tex.height));
+        Write(out, &tex.format, sizeof(tex.format));
+        Write(out, &tex.albedo, sizeof(tex.albedo));
+        Write(out, &numLevels, sizeof(numLevels));
+        Write(out, &dataSize, sizeof(dataSize));
+        Write(out, tex.levels.data(), numLevels * sizeof(ATextureLevel));
+        Write(out, tex.data.data(), dataSize);
+    }
+    for (const auto& [key, data] : m_usedStages)
+    {
+        uint64_t dataSize = data.size();
+        Write(out, &key, sizeof(key));
+        Write(out, &dataSize, sizeof(dataSize));
+        Write(out, data.data(), dataSize);
+    }
+    return (bool) out;
+}
+
+bool CompileCache::FindFaces(uint64_t key, std::vector<CachedFace>& out)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto                        used = m_usedFaces.find(key);
+    if (used != m_usedFaces.end())
+    {
+        out = used->second;
+        return true;
+    }
+    auto it = m_faces.find(key);
+    if (it == m_faces.end())
+        return false;
+    out = it->second;
+    m_usedFaces.emplace(key, it->second);
+    return true;
+}
+
+void CompileCache::StoreFaces(uint64_t key, std::vector<CachedFace> faces)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_usedFaces[key] = std::move(faces);
+}
+
+bool CompileCache::FindTexture(uint64_t key, CachedTexture& out)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto                        used = m_usedTextures.find(key);
+    if (used != m_usedTextures.end())
+    {
+        out = used->second;
+        return true;
+    }
+    auto it = m_textures.find(key);
+    if (it == m_textures.end())
+        return false;
+    out = it->second;
+    m_usedTextures.emplace(key, it->second);
+    return true;
+}
+
+void CompileCache::StoreTexture(uint64_t key, CachedTexture texture)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_usedTextures[key] = std::move(texture);
+}
+
+bool CompileCache::FindStage(uint64_t key, std::vector<uint8_t>& out)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto                        used = m_usedStages.find(key);
+    if (used != m_usedStages.end())
+    {
+        out = used->second;
+        return true;
+    }
+    auto it = m_stages.find(key);
+    if (it == m_stages.end())
+        return false;
+    out = it->second;
+    m_usedStages.emplace(key, it->second);
+    return true;
+}
+
+void CompileCache::StoreStage(uint64_t key, std::vector<uint8_t> data)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_usedStages[key] = std::move(data);
+}
@@ -0,0 +1,85 @@
+#pragma once
+// CompileCache.h
+#include "AnvilBSPFormat.h"
+#include "Winding.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief 64 bit FNV-1a, chain calls by passing the previous hash as the seed
+ */
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull);
+
+// A face of a brush, the plane and texture come from the brush side when it's read back
+struct CachedFace
+{
+    uint32_t side;
+    Winding  winding;
+};
+
+// A texture ready to be written to the .absp, levels point into data
+struct CachedTexture
+{
+    uint32_t                   width  = 0;
+    uint32_t                   height = 0;
+    uint32_t                   format = 0; // ETextureFormat
+    glm::vec3                  albedo = glm::vec3(0.0f); // linear average color, for bounced light
+    std::vector<ATextureLevel> levels;
+    std::vector<uint8_t>       data;
+};
+
+// .acache, next to the map:
+// ACacheHeader, the face sets, the textures, then the stage outputs
+struct ACacheHeader
+{
+    char     magic[4]; // "ACCH"
+    uint32_t version;  // CompileCache::VERSION
+    uint32_t numFaceSets;
+    uint32_t numTextures;
+    uint32_t numStages;
+};
+
+/**
+ * @class CompileCache
+ * @brief Results of earlier map compiles, keyed by a hash of everything they were built from
+ * Lookups and stores can come from any thread. Only entries looked up or stored since Load are
+ * written back, so the file doesn't keep data for brushes that are long gone.
+ */
+class CompileCache
+{
+  public:
+    // Bump whenever the cached data would come out different
+    static constexpr uint32_t VERSION = 4;
+
+    /**
+     * @brief Reads a cache file, a missing or outdated one just leaves the cache empty
+     */
+    void Load(const std::string& path);
+    bool Save(const std::string& path) const;
+
+    bool FindFaces(uint64_t key, std::vector<CachedFace>& out);
+    void StoreFaces(uint64_t key, std::vector<CachedFace> faces);
+
+    bool FindTexture(uint64_t key, CachedTexture& out);
+    void StoreTexture(uint64_t key, CachedTexture texture);
+
+    /**
+     * @brief Pieces of the later stages (the vis of a portal, a tile of the lightmap), keyed by a
+     * hash of everything the piece was made from. The cache doesn't look into the data
+     */
+    bool FindStage(uint64_t key, std::vector<uint8_t>& out);
+    void StoreStage(uint64_t key, std::vector<uint8_t> data);
+
+  private:
+    std::unordered_map<uint64_t, std::vector<CachedFace>> m_faces;
+    std::unordered_map<uint64_t, CachedTexture>           m_textures;
+    std::unordered_map<uint64_t, std::vector<CachedFace>> m_usedFaces;
+    std::unordered_map<uint64_t, CachedTexture>           m_usedTextures;
+    std::unordered_map<uint64_t, std::vector<uint8_t>>    m_stages;
+    std::unordered_map<uint64_t, std::vector<uint8_t>>    m_usedStages;
+    mutable std::mutex                                    m_lock;
+};
@@ -0,0 +1,126 @@
+#include "Csg.h"
+#include "ThreadPool.h"
+
+namespace
+{
+struct BrushBounds
+{
+    glm::vec3 mins;
+    glm::vec3 maxs;
+};
+
+bool BoundsTouch(const BrushBounds& a, const BrushBounds& b, float epsilon)
+{
+    for (int k = 0; k < 3; k++)
+    {
+        if (a.mins[k] > b.maxs[k] + epsilon || b.mins[k] > a.maxs[k] + epsilon)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Cuts a face fragment by the planes of another brush. The pieces outside the brush are added to
+ * out, the piece inside is thrown away. A fragment that turns out not to be inside at all is
+ * passed on whole, so faces don't get diced up for nothing.
+ */
+void ClipToBrush(const Winding& fragment, const APlane& facePlane,
+                 const std::vector<BrushFace>& brush, bool keepCoplanar, float epsilon,
+                 std::vector<Winding>& out)
+{
+    std::vector<Winding> outside;
+    Winding              inside = fragment;
+    for (const auto& side : brush)
+    {
+        bool flipped;
+        if (PlanesCoincide(facePlane, side.plane, epsilon, &flipped))
+        {
+            // Facing into the other brush means pressed against it, which counts as inside.
+            // Facing the same way only one of the two faces may survive
+            if (flipped || !keepCoplanar)
+                continue;
+            out.push_back(fragment);
+            return;
+        }
+
+        Winding front, back;
+        SplitWinding(inside, side.plane, epsilon, front, back);
+        if (!front.empty())
+            outside.push_back(std::move(front));
+        inside = std::move(back);
+        if (inside.empty())
+        {
+            out.push_back(fragment);
+            return;
+        }
+    }
+
+    for (auto& w : outside)
+    {
+        if (WindingArea(w) > epsilon * epsilon)
+            out.push_back(std::move(w));
+    }
+}
+} // namespace
+
+std::vector<std::vector<BrushFace>> RemoveHiddenFaces(
+    const std::vector<std::vector<BrushFace>>& brushes, float epsilon)
+{
+    std::vector<std::vector<size_t>>    touching = FindTouchingBrushes(brushes, epsilon);
+    std::vector<std::vector<BrushFace>> result(brushes.size());
+    ThreadPool::Get().ParallelFor(brushes.size(), [&](size_t a) {
+        result[a] = ClipBrushFaces(brushes, a, touching[a], epsilon);
+    }, 4);
+    return result;
+}
+
+std::vector<std::vector<size_t>> FindTouchingBrushes(
+    const std::vector<std::vector<BrushFace>>& brushes, float epsilon)
+{
+    std::vector<BrushBounds> bounds(brushes.size());
+    for (size_t i = 0; i < brushes.size(); i++)
+    {
+        bounds[i] = {glm::vec3(1e30f), glm::vec3(-1e30f)};
+        for (const auto& f : brushes[i])
+        {
+            for (const auto& p : f.winding)
+            {
+                bounds[i].mins = glm::min(bounds[i].mins, p);
+                bounds[i].maxs = glm::max(bounds[i].maxs, p);
+            }
+        }
+    }
+
+    std::vector<std::vector<size_t>> touching(brushes.size());
+    ThreadPool::Get().ParallelFor(brushes.size(), [&](size_t a) {
+        for (size_t b = 0; b < brushes.size(); b++)
+        {
+            if (b != a && !brushes[b].empty() && BoundsTouch(bounds[a], bounds[b], epsilon))
+                touching[a].push_back(b);
+        }
+    }, 16);
+    return touching;
+}
+
+std::vector<BrushFace> ClipBrushFaces(const std::vector<std::vector<BrushFace>>& brushes,
+                                      size_t brush, const std::vector<size_t>& touching,
+                                      float epsilon)
+{
+    std::vector<BrushFace> result;
+    for (const auto& face : brushes[brush])
+    {
+        std::vector<Winding> fragments = {face.winding}, next;
+        for (size_t b : touching)
+        {
+            next.clear();
+            for (const auto& frag : fragments)
+                ClipToBrush(frag, face.plane, brushes[b], brush < b, epsilon, next);
+            fragments.swap(next);
+            if (fragments.empty())
+                break;
+        }
+        for (auto& w : fragments)
+            result.push_back({std::move(w), face.plane, face.texIdx, face.side});
+    }
+    return result;
+}
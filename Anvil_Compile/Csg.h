@@ -0,0 +1,44 @@
+#pragma once
+// Csg.h
+#include "Winding.h"
+#include <cstdint>
+#include <vector>
+
+// One side of a brush, in the scaled brush space the windings are built in
+struct BrushFace
+{
+    Winding  winding;
+    APlane   plane;
+    uint32_t texIdx;
+    uint32_t side; // index of the brush side it came from
+};
+
+/**
+ * @brief Removes the parts of brush faces that can never be seen
+ * Every face is clipped against the other brushes it touches, and the pieces inside a brush are
+ * dropped. That takes out faces buried in other brushes and the two faces where brushes meet.
+ * When two brushes share a face plane facing the same way, the earlier brush keeps its face.
+ * @param brushes Faces of every brush, in file order
+ * @param epsilon Distance under which a point counts as lying on a plane
+ * @return The visible fragments of every brush, faces that weren't cut come through unchanged
+ */
+std::vector<std::vector<BrushFace>> RemoveHiddenFaces(
+    const std::vector<std::vector<BrushFace>>& brushes, float epsilon);
+
+/**
+ * @brief Finds the brushes each brush can hide faces of, from their bounds
+ * @return For every brush, the other brushes it touches in ascending order
+ */
+std::vector<std::vector<size_t>> FindTouchingBrushes(
+    const std::vector<std::vector<BrushFace>>& brushes, float epsilon);
+
+/**
+ * @brief The RemoveHiddenFaces work for a single brush
+ * The result only depends on the brush, the brushes it touches and which of them come first, so
+ * it can be cached on those.
+ * @param brush Index of the brush whose faces are clipped
+ * @param touching The brushes FindTouchingBrushes found for it
+ */
+std::vector<BrushFace> ClipBrushFaces(const std::vector<std::vector<BrushFace>>& brushes,
+                                      size_t brush, const std::vector<size_t>& touching,
+                                      float epsilon);
@@ -0,0 +1,247 @@
+#include "FaceMerge.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+
+namespace
+{
+// Cell size of the point grid FixTJunctions searches, in brush space
+constexpr float TJUNCTION_CELL = 8.0f;
+
+bool PointsEqual(const glm::vec3& a, const glm::vec3& b, float epsilon)
+{
+    return std::abs(a.x - b.x) <= epsilon && std::abs(a.y - b.y) <= epsilon &&
+           std::abs(a.z - b.z) <= epsilon;
+}
+
+float DistanceToLine(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b)
+{
+    glm::vec3 dir = b - a;
+    float     len = glm::length(dir);
+    if (len == 0.0f)
+        return glm::length(p - a);
+    return glm::length(glm::cross(p - a, dir)) / len;
+}
+
+void RemoveColinearPoints(Winding& w, float epsilon)
+{
+    for (size_t i = 0; i < w.size() && w.size() > 3;)
+    {
+        const glm::vec3& prev = w[(i + w.size() - 1) % w.size()];
+        const glm::vec3& next = w[(i + 1) % w.size()];
+        if (DistanceToLine(w[i], prev, next) < epsilon)
+            w.erase(w.begin() + i);
+        else
+            i++;
+    }
+}
+
+// Every corner has to turn the same way as the polygon itself
+bool IsConvex(const Winding& w, const glm::vec3& normal)
+{
+    glm::vec3 area(0.0f);
+    for (size_t i = 0; i < w.size(); i++)
+        area += glm::cross(w[i], w[(i + 1) % w.size()]);
+    float orientation = glm::dot(area, normal) >= 0.0f ? 1.0f : -1.0f;
+
+    for (size_t i = 0; i < w.size(); i++)
+    {
+        glm::vec3 e1 = w[(i + 1) % w.size()] - w[i];
+        glm::vec3 e2 = w[(i + 2) % w.size()] - w[(i + 1) % w.size()];
+        if (glm::dot(glm::cross(e1, e2), normal) * orientation <= 0.0f)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Joins two faces along the edge they share, both wound the same way. The shared edge runs a[i]
+ * to a[i + 1] in one and backwards in the other.
+ */
+bool TryMerge(const Winding& a, const Winding& b, const glm::vec3& normal, float epsilon,
+              Winding& out)
+{
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        const glm::vec3& p1 = a[i];
+        const glm::vec3& p2 = a[(i + 1) % a.size()];
+        for (size_t j = 0; j < b.size(); j++)
+        {
+            if (!PointsEqual(b[j], p2, epsilon) || !PointsEqual(b[(j + 1) % b.size()], p1, epsilon))
+                continue;
+
+            Winding merged;
+            merged.reserve(a.size() + b.size() - 2);
+            for (size_t k = 0; k < a.size(); k++)
+                merged.push_back(a[(i + 1 + k) % a.size()]);
+            for (size_t k = 0; k + 2 < b.size(); k++)
+                merged.push_back(b[(j + 2 + k) % b.size()]);
+
+            RemoveColinearPoints(merged, epsilon);
+            if (merged.size() < 3 || !IsConvex(merged, normal))
+                return false;
+            out = std::move(merged);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::array<int64_t, 3> CellOf(const glm::vec3& p)
+{
+    return {(int64_t) std::floor(p.x / TJUNCTION_CELL), (int64_t) std::floor(p.y / TJUNCTION_CELL),
+            (int64_t) std::floor(p.z / TJUNCTION_CELL)};
+}
+
+uint64_t CellKey(int64_t x, int64_t y, int64_t z)
+{
+    return ((uint64_t) (x & 0x1FFFFF) << 42) | ((uint64_t) (y & 0x1FFFFF) << 21) |
+           (uint64_t) (z & 0x1FFFFF);
+}
+} // namespace
+
+std::vector<BrushFace> MergeCoplanarFaces(const std::vector<BrushFace>& faces, float epsilon)
+{
+    // Planes of different brushes are built from different points, so they're bucketed on a
+    // rounded key and checked properly afterwards
+    std::map<std::array<int64_t, 5>, size_t> groupOf;
+    std::vector<std::vector<size_t>>         groups;
+    for (size_t i = 0; i < faces.size(); i++)
+    {
+        const APlane&          p   = faces[i].plane;
+        std::array<int64_t, 5> key = {(int64_t) faces[i].texIdx, std::llround(p.normal.x * 1000.0f),
+                                      std::llround(p.normal.y * 1000.0f),
+                                      std::llround(p.normal.z * 1000.0f),
+                                      std::llround(p.distance / epsilon)};
+        auto it = groupOf.find(key);
+        if (it == groupOf.end())
+        {
+            it = groupOf.emplace(key, groups.size()).first;
+            groups.emplace_back();
+        }
+        groups[it->second].push_back(i);
+    }
+
+    std::vector<std::vector<Winding>> merged(groups.size());
+    ThreadPool::Get().ParallelFor(groups.size(), [&](size_t g) {
+        std::vector<Winding>& windings = merged[g];
+        const APlane&         plane    = faces[groups[g][0]].plane;
+        for (size_t i : groups[g])
+        {
+            bool flipped;
+            if (PlanesCoincide(plane, faces[i].plane, epsilon, &flipped) && !flipped)
+                windings.push_back(faces[i].winding);
+        }
+
+        bool mergedAny = true;
+        while (mergedAny)
+        {
+            mergedAny = false;
+            for (size_t i = 0; i < windings.size(); i++)
+            {
+                for (size_t j = i + 1; j < windings.size() && !windings[i].empty(); j++)
+                {
+                    Winding joined;
+                    if (!windings[j].empty() &&
+                        TryMerge(windings[i], windings[j], plane.normal, epsilon, joined))
+                    {
+                        windings[i] = std::move(joined);
+                        windings[j].clear();
+                        mergedAny   = true;
+                    }
+                }
+            }
+        }
+    });
+
+    std::vector<BrushFace> out;
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        const BrushFace& first = faces[groups[g][0]];
+        for (auto& w : merged[g])
+        {
+            if (!w.empty())
+                out.push_back({std::move(w), first.plane, first.texIdx, first.side});
+        }
+        // Faces whose plane didn't really match the group's go through as they are
+        for (size_t i : groups[g])
+        {
+            bool flipped;
+            if (!PlanesCoincide(first.plane, faces[i].plane, epsilon, &flipped) || flipped)
+                out.push_back(faces[i]);
+        }
+    }
+    return out;
+}
+
+size_t FixTJunctions(std::vector<BrushFace>& faces, float epsilon)
+{
+    std::unordered_map<uint64_t, std::vector<glm::vec3>> grid;
+    for (const auto& f : faces)
+    {
+        for (const auto& p : f.winding)
+        {
+            auto c = CellOf(p);
+            grid[CellKey(c[0], c[1], c[2])].push_back(p);
+        }
+    }
+
+    std::vector<size_t> added(faces.size(), 0);
+    ThreadPool::Get().ParallelFor(faces.size(), [&](size_t f) {
+        const Winding&                           w = faces[f].winding;
+        Winding                                  fixed;
+        std::vector<std::pair<float, glm::vec3>> onEdge;
+        for (size_t i = 0; i < w.size(); i++)
+        {
+            const glm::vec3& a = w[i];
+            const glm::vec3& b = w[(i + 1) % w.size()];
+            glm::vec3        dir  = b - a;
+            float            len2 = glm::dot(dir, dir);
+            auto             lo   = CellOf(glm::min(a, b) - glm::vec3(epsilon));
+            auto             hi   = CellOf(glm::max(a, b) + glm::vec3(epsilon));
+
+            onEdge.clear();
+            for (int64_t x = lo[0]; x <= hi[0]; x++)
+            {
+                for (int64_t y = lo[1]; y <= hi[1]; y++)
+                {
+                    for (int64_t z = lo[2]; z <= hi[2]; z++)
+                    {
+                        auto cell = grid.find(CellKey(x, y, z));
+                        if (cell == grid.end())
+                            continue;
+                        for (const auto& p : cell->second)
+                        {
+                            if (PointsEqual(p, a, epsilon) || PointsEqual(p, b, epsilon))
+                                continue;
+                            float t = glm::dot(p - a, dir) / len2;
+                            if (t > 0.0f && t < 1.0f && DistanceToLine(p, a, b) < epsilon)
+                                onEdge.push_back({t, p});
+                        }
+                    }
+                }
+            }
+
+            fixed.push_back(a);
+            std::sort(onEdge.begin(), onEdge.end(),
+                      [](const auto& l, const auto& r) { return l.first < r.first; });
+            for (const auto& [t, p] : onEdge)
+            {
+                if (PointsEqual(p, fixed.back(), epsilon))
+                    continue;
+                fixed.push_back(p);
+                added[f]++;
+            }
+        }
+        if (added[f])
+            faces[f].winding = std::move(fixed);
+    });
+
+    size_t total = 0;
+    for (size_t n : added)
+        total += n;
+    return total;
+}
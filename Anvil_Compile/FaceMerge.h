@@ -0,0 +1,25 @@
+#pragma once
+// FaceMerge.h
+#include "Csg.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief Merges faces that lie on the same plane and use the same texture
+ * Two faces are joined when they share an edge and the result is still convex. Points left in the
+ * middle of a straight edge by the merge are removed, FixTJunctions puts back the ones neighbours
+ * need.
+ * @param faces Visible faces of every brush, in brush space
+ * @param epsilon Distance under which two points or a point and a line count as touching
+ * @return The merged faces, grouped by plane and texture in the order the groups first appear
+ */
+std::vector<BrushFace> MergeCoplanarFaces(const std::vector<BrushFace>& faces, float epsilon);
+
+/**
+ * @brief Adds the points of neighbouring faces that lie on an edge to that edge
+ * Without them the rasterizer leaves sparkling cracks where a long edge meets two shorter ones.
+ * @param faces Faces to fix, in brush space
+ * @param epsilon Distance under which a point counts as lying on an edge
+ * @return How many points were added
+ */
+size_t FixTJunctions(std::vector<BrushFace>& faces, float epsilon);
@@ -0,0 +1,710 @@
+#include "Lightmap.h"
+#include "CompileCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+// Biggest luxel grid side of one face, larger faces get coarser luxels
+constexpr int   MAX_FACE_LUXELS = 64;
+constexpr int   MAX_ATLAS_SIZE  = 4096;
+constexpr int   MIN_ATLAS_SIZE  = 256;
+// Samples sit this far off the surface so they don't shadow themselves, vertex space
+constexpr float SURFACE_OFFSET  = 0.01f;
+// How much light still reaches a surface lit edge on, like qbsp's anglescale
+constexpr float ANGLE_SCALE     = 0.5f;
+constexpr float PI              = 3.14159265f;
+// BVH boxes are grown this much on every side, vertex space
+constexpr float BVH_PADDING     = 0.0001f;
+// Luxels per side of a tile, the piece of a face that's cached on its own
+constexpr int   LIGHT_TILE      = 8;
+
+struct Triangle
+{
+    glm::vec3 v0, e1, e2;
+    uint32_t  face;
+};
+
+// Inner nodes have count 0 and their children at first and first + 1
+struct BvhNode
+{
+    glm::vec3 mins, maxs;
+    uint32_t  first;
+    uint32_t  count;
+};
+
+struct TriangleBvh
+{
+    std::vector<Triangle> tris;
+    std::vector<BvhNode>  nodes;
+    std::vector<uint64_t> keys; // of every triangle, hits at the same distance go to the lower one
+
+    void Build(uint32_t node, uint32_t first, uint32_t count)
+    {
+        glm::vec3 mins(1e30f), maxs(-1e30f), cmins(1e30f), cmaxs(-1e30f);
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            const Triangle& t = tris[i];
+            glm::vec3       a = t.v0, b = t.v0 + t.e1, c = t.v0 + t.e2;
+            mins              = glm::min(mins, glm::min(a, glm::min(b, c)));
+            maxs              = glm::max(maxs, glm::max(a, glm::max(b, c)));
+            glm::vec3 center  = (a + b + c) / 3.0f;
+            cmins             = glm::min(cmins, center);
+            cmaxs             = glm::max(cmaxs, center);
+        }
+        // A little larger, so a ray starting right on a box (samples in a corner) gets the same
+        // answer whatever way the tree came out
+        nodes[node] = {mins - glm::vec3(BVH_PADDING), maxs + glm::vec3(BVH_PADDING), first, count};
+
+        glm::vec3 extent = cmaxs - cmins;
+        int       axis   = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (count <= 4 || extent[axis] <= 0.0f)
+            return;
+
+        // Median split, good enough for brush geometry and always balanced
+        uint32_t mid = first + count / 2;
+        std::nth_element(tris.begin() + first, tris.begin() + mid, tris.begin() + first + count,
+                         [axis](const Triangle& a, const Triangle& b) {
+                             return (a.v0[axis] * 3.0f + a.e1[axis] + a.e2[axis]) <
+                                    (b.v0[axis] * 3.0f + b.e1[axis] + b.e2[axis]);
+                         });
+        uint32_t child = (uint32_t) nodes.size();
+        nodes.resize(nodes.size() + 2);
+        nodes[node].first = child;
+        nodes[node].count = 0;
+        Build(child, first, mid - first);
+        Build(child + 1, mid, first + count - mid);
+    }
+
+    /**
+     * Finds the closest triangle the ray hits before maxT. With anyHit it stops at the first
+     * one, which is all a shadow ray needs.
+     */
+    bool Trace(const glm::vec3& origin, const glm::vec3& dir, float maxT, bool anyHit, float& hitT,
+               uint32_t& hitTri) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inv = 1.0f / dir;
+        uint32_t  stack[64];
+        int       sp   = 0;
+        bool      hit  = false;
+        float     best = maxT;
+        stack[sp++]    = 0;
+        while (sp > 0)
+        {
+            const BvhNode& n  = nodes[stack[--sp]];
+            glm::vec3      t1 = (n.mins - origin) * inv, t2 = (n.maxs - origin) * inv;
+            glm::vec3      lo = glm::min(t1, t2), hi = glm::max(t1, t2);
+            float          enter = std::max(std::max(lo.x, lo.y), std::max(lo.z, 0.0f));
+            float          exit  = std::min(std::min(hi.x, hi.y), std::min(hi.z, best));
+            if (enter > exit)
+                continue;
+
+            if (n.count == 0)
+            {
+                stack[sp++] = n.first;
+                stack[sp++] = n.first + 1;
+                continue;
+            }
+            for (uint32_t i = n.first; i < n.first + n.count; i++)
+            {
+                // Moller-Trumbore, both sides
+                const Triangle& t   = tris[i];
+                glm::vec3       p   = glm::cross(dir, t.e2);
+                float           det = glm::dot(t.e1, p);
+                if (std::abs(det) < 1e-12f)
+                    continue;
+                float     invDet = 1.0f / det;
+                glm::vec3 s      = origin - t.v0;
+                float     u      = glm::dot(s, p) * invDet;
+                if (u < 0.0f || u > 1.0f)
+                    continue;
+                glm::vec3 q = glm::cross(s, t.e1);
+                float     v = glm::dot(dir, q) * invDet;
+                if (v < 0.0f || u + v > 1.0f)
+                    continue;
+                float d = glm::dot(t.e2, q) * invDet;
+                // Which of two triangles on an edge wins mustn't depend on how the BVH came out
+                if (d <= 0.0f || d > best || (d == best && (!hit || keys[i] >= keys[hitTri])))
+                    continue;
+                best   = d;
+                hitTri = i;
+                hit    = true;
+                if (anyHit)
+                    return true;
+            }
+        }
+        hitT = best;
+        return hit;
+    }
+
+    // Calls visit(i) for every triangle whose bounds overlap the box
+    template <typename Visit>
+    void Overlap(const glm::vec3& mins, const glm::vec3& maxs, Visit&& visit) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[64];
+        int      sp = 0;
+        stack[sp++] = 0;
+        while (sp > 0)
+        {
+            const BvhNode& n = nodes[stack[--sp]];
+            if (glm::any(glm::greaterThan(n.mins, maxs)) || glm::any(glm::lessThan(n.maxs, mins)))
+                continue;
+            if (n.count == 0)
+            {
+                stack[sp++] = n.first;
+                stack[sp++] = n.first + 1;
+                continue;
+            }
+            for (uint32_t i = n.first; i < n.first + n.count; i++)
+            {
+                const Triangle& t    = tris[i];
+                glm::vec3       tmin = glm::min(t.v0, glm::min(t.v0 + t.e1, t.v0 + t.e2));
+                glm::vec3       tmax = glm::max(t.v0, glm::max(t.v0 + t.e1, t.v0 + t.e2));
+                if (!glm::any(glm::greaterThan(tmin, maxs)) && !glm::any(glm::lessThan(tmax, mins)))
+                    visit(i);
+            }
+        }
+    }
+};
+
+// Luxel grid of one face, laid out on the two axes the face is most parallel to
+struct FaceGrid
+{
+    int                    axisS = 0, axisT = 1, axisN = 2;
+    glm::vec3              normal;
+    float                  distance = 0.0f;
+    uint32_t               texture  = 0;
+    float                  minS = 0.0f, minT = 0.0f;
+    float                  luxel  = 0.0f;
+    int                    width  = 0;
+    int                    height = 0;
+    int                    x = 0, y = 0; // position in the atlas
+    std::vector<glm::vec2> polygon;      // the face in (s, t)
+    glm::vec2              center;
+    glm::vec2              extent;
+};
+
+// Square of luxels that's lit and cached as one piece
+struct LightTile
+{
+    uint32_t  face;
+    int       x, y, width, height; // in the face's grid
+    glm::vec3 mins, maxs;          // of the sample points
+    uint64_t  geometry;            // the grid and the sample points
+};
+
+glm::vec3 PointOnFace(const FaceGrid& g, glm::vec2 st)
+{
+    glm::vec3 p;
+    p[g.axisS] = st.x;
+    p[g.axisT] = st.y;
+    p[g.axisN] = (g.distance - g.normal[g.axisS] * st.x - g.normal[g.axisT] * st.y) / g.normal[g.axisN];
+    return p;
+}
+
+float Cross2(glm::vec2 a, glm::vec2 b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+/**
+ * Luxels hanging over the edge of the face are sampled at the closest point of the face
+ * instead, otherwise they'd often end up inside the neighbouring wall and bleed black along
+ * every corner.
+ */
+glm::vec2 ClampToFace(const FaceGrid& g, glm::vec2 st)
+{
+    float area = 0.0f;
+    for (size_t i = 0; i < g.polygon.size(); i++)
+        area += Cross2(g.polygon[i], g.polygon[(i + 1) % g.polygon.size()]);
+    float orientation = area >= 0.0f ? 1.0f : -1.0f;
+
+    bool      inside  = true;
+    float     closest = 1e30f;
+    glm::vec2 best    = st;
+    for (size_t i = 0; i < g.polygon.size(); i++)
+    {
+        glm::vec2 a = g.polygon[i], b = g.polygon[(i + 1) % g.polygon.size()];
+        if (Cross2(b - a, st - a) * orientation < 0.0f)
+            inside = false;
+        glm::vec2 ab = b - a;
+        float     t  = glm::dot(ab, ab) > 0.0f ? glm::clamp(glm::dot(st - a, ab) / glm::dot(ab, ab), 0.0f, 1.0f) : 0.0f;
+        glm::vec2 p  = a + ab * t;
+        float     d  = glm::dot(st - p, st - p);
+        if (d < closest)
+        {
+            closest = d;
+            best    = p;
+        }
+    }
+    if (inside)
+        return st;
+
+    // Just inside the edge so the corner doesn't shadow it
+    glm::vec2 toCenter = g.center - best;
+    float     len      = glm::length(toCenter);
+    return len > SURFACE_OFFSET ? best + toCenter / len * SURFACE_OFFSET : best;
+}
+
+void SizeGrid(FaceGrid& g, float luxel)
+{
+    g.luxel = luxel;
+    float largest = std::max(g.extent.x, g.extent.y);
+    if (largest / luxel + 1.0f > MAX_FACE_LUXELS)
+        g.luxel = largest / (MAX_FACE_LUXELS - 1);
+    g.width  = std::min(MAX_FACE_LUXELS, (int) std::ceil(g.extent.x / g.luxel) + 1);
+    g.height = std::min(MAX_FACE_LUXELS, (int) std::ceil(g.extent.y / g.luxel) + 1);
+}
+
+// Shelf packing, tallest first, with a luxel of padding so filtering doesn't bleed
+bool PackGrids(std::vector<FaceGrid>& grids, int size, int& usedHeight)
+{
+    std::vector<size_t> order(grids.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return grids[a].height > grids[b].height; });
+
+    int x = 0, y = 0, shelf = 0;
+    for (size_t i : order)
+    {
+        FaceGrid& g = grids[i];
+        if (x + g.width > size)
+        {
+            x = 0;
+            y += shelf + 1;
+            shelf = 0;
+        }
+        if (y + g.height > size)
+            return false;
+        g.x = x;
+        g.y = y;
+        x += g.width + 1;
+        shelf = std::max(shelf, g.height);
+    }
+    usedHeight = y + shelf;
+    return true;
+}
+
+uint32_t NextRandom(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+float RandomFloat(uint32_t& state)
+{
+    return (NextRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+} // namespace
+
+LightmapResult BakeLightmaps(const std::vector<AVertex>& verts, const std::vector<AFace>& faces,
+                             const std::vector<uint32_t>& indices, const std::vector<MapLight>& lights,
+                             const std::vector<glm::vec3>& albedo, const LightmapOptions& options,
+                             CompileCache* cache)
+{
+    LightmapResult result;
+    if (faces.empty())
+        return result;
+    if (lights.empty())
+    {
+        // Nothing to trace, every vertex samples the same texel
+        uint8_t level = options.ambient > 0.0f
+                            ? (uint8_t) std::clamp((int) std::lround(options.ambient), 0, 255)
+                            : 128;
+        result.width  = 1;
+        result.height = 1;
+        result.rgb.assign(3, level);
+        result.uvs.assign(verts.size(), glm::vec2(0.5f));
+        result.luxels = 1;
+        return result;
+    }
+
+    TriangleBvh bvh;
+    for (uint32_t f = 0, next = 0; f < faces.size(); f++)
+    {
+        for (uint32_t k = 0; k + 2 < faces[f].numVertices; k++, next += 3)
+        {
+            glm::vec3 a = verts[indices[next]].position, b = verts[indices[next + 1]].position,
+                      c = verts[indices[next + 2]].position;
+            bvh.tris.push_back({a, b - a, c - a, f});
+        }
+    }
+    bvh.nodes.resize(1);
+    bvh.Build(0, 0, (uint32_t) bvh.tris.size());
+
+    std::vector<FaceGrid> grids(faces.size());
+    for (size_t f = 0; f < faces.size(); f++)
+    {
+        FaceGrid&   g  = grids[f];
+        const AFace& face = faces[f];
+        g.normal   = verts[face.firstVertex].normal;
+        g.distance = glm::dot(g.normal, verts[face.firstVertex].position);
+        g.texture  = face.textureID;
+        glm::vec3 a = glm::abs(g.normal);
+        g.axisN     = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+        g.axisS     = g.axisN == 0 ? 1 : 0;
+        g.axisT     = g.axisN == 2 ? 1 : 2;
+
+        glm::vec2 mins(1e30f), maxs(-1e30f), sum(0.0f);
+        for (uint32_t k = 0; k < face.numVertices; k++)
+        {
+            const glm::vec3& p = verts[face.firstVertex + k].position;
+            glm::vec2        st(p[g.axisS], p[g.axisT]);
+            g.polygon.push_back(st);
+            mins = glm::min(mins, st);
+            maxs = glm::max(maxs, st);
+            sum += st;
+        }
+        g.minS   = mins.x;
+        g.minT   = mins.y;
+        g.extent = maxs - mins;
+        g.center = sum / (float) face.numVertices;
+    }
+
+    // Start small and grow the atlas, coarser luxels everywhere if even the largest won't do
+    float luxel = options.luxelSize;
+    int   size = MIN_ATLAS_SIZE, usedHeight = 0;
+    for (;;)
+    {
+        for (auto& g : grids)
+            SizeGrid(g, luxel);
+        while (size <= MAX_ATLAS_SIZE && !PackGrids(grids, size, usedHeight))
+            size *= 2;
+        if (size <= MAX_ATLAS_SIZE)
+            break;
+        size = MIN_ATLAS_SIZE;
+        luxel *= 2.0f;
+    }
+
+    // Sample points of every luxel, off the surface a little
+    std::vector<std::vector<glm::vec3>> samples(faces.size());
+    ThreadPool::Get().ParallelFor(faces.size(), [&](size_t f) {
+        const FaceGrid& g = grids[f];
+        samples[f].resize((size_t) g.width * g.height);
+        for (int j = 0; j < g.height; j++)
+        {
+            for (int i = 0; i < g.width; i++)
+            {
+                glm::vec2 st = ClampToFace(g, {g.minS + i * g.luxel, g.minT + j * g.luxel});
+                samples[f][j * g.width + i] = PointOnFace(g, st) + g.normal * SURFACE_OFFSET;
+            }
+        }
+    }, 16);
+
+    // Nothing gets light from further than the brightest light reaches. Bounce rays stop there
+    // too, so everything that lights a luxel is in a box around it grown by that much
+    float reach = 0.0f;
+    for (const auto& light : lights)
+        reach = std::max(reach, light.intensity / options.mapUnitsPerUnit);
+
+    // Faces are lit and cached in tiles, a big face (a whole floor after merging) would
+    // otherwise depend on everything around all of it
+    std::vector<LightTile> tiles;
+    std::vector<uint32_t>  firstTile(faces.size());
+    for (uint32_t f = 0; f < faces.size(); f++)
+    {
+        const FaceGrid& g = grids[f];
+        firstTile[f]      = (uint32_t) tiles.size();
+        for (int y = 0; y < g.height; y += LIGHT_TILE)
+        {
+            for (int x = 0; x < g.width; x += LIGHT_TILE)
+            {
+                LightTile t;
+                t.face   = f;
+                t.x      = x;
+                t.y      = y;
+                t.width  = std::min(LIGHT_TILE, g.width - x);
+                t.height = std::min(LIGHT_TILE, g.height - y);
+                t.mins   = glm::vec3(1e30f);
+                t.maxs   = glm::vec3(-1e30f);
+
+                // The grid decides which luxel a bounce ray that hits the face reads
+                float    origin[3] = {g.minS, g.minT, g.luxel};
+                int      rect[4]   = {g.width, g.height, x, y};
+                uint64_t key       = HashBytes(&g.normal, sizeof(glm::vec3), HashBytes("LMTL", 4));
+                key                = HashBytes(origin, sizeof(origin), key);
+                key                = HashBytes(rect, sizeof(rect), key);
+                for (int j = y; j < y + t.height; j++)
+                {
+                    for (int i = x; i < x + t.width; i++)
+                    {
+                        const glm::vec3& p = samples[f][j * g.width + i];
+                        t.mins             = glm::min(t.mins, p);
+                        t.maxs             = glm::max(t.maxs, p);
+                        key                = HashBytes(&p, sizeof(p), key);
+                    }
+                }
+                t.geometry = key;
+                tiles.push_back(t);
+            }
+        }
+    }
+
+    bvh.keys.resize(bvh.tris.size());
+    for (size_t i = 0; i < bvh.tris.size(); i++)
+    {
+        const Triangle& t     = bvh.tris[i];
+        const FaceGrid& g     = grids[t.face];
+        glm::vec3       color = g.texture < albedo.size() ? albedo[g.texture] : glm::vec3(0.5f);
+        uint64_t        key   = HashBytes(&t, sizeof(glm::vec3) * 3, HashBytes("LMTR", 4));
+        key                   = HashBytes(&g.normal, sizeof(glm::vec3), key);
+        bvh.keys[i]           = HashBytes(&color, sizeof(color), key);
+    }
+
+    // Level 0 is the direct light, then one level per bounce. Both are keyed by the tile. Direct
+    // light adds the lights that reach it and what's between them, a bounce adds the triangles
+    // around it and the light a bounce ray can read in the level before. Sums so the order
+    // things are found in doesn't matter
+    uint64_t bakeKey = HashBytes(&luxel, sizeof(luxel), HashBytes("LMAP", 4));
+    bakeKey          = HashBytes(&reach, sizeof(reach), bakeKey);
+    bakeKey          = HashBytes(&options.mapUnitsPerUnit, sizeof(float), bakeKey);
+    bakeKey          = HashBytes(&options.bounceSamples, sizeof(int), bakeKey);
+    int numLevels    = 1 + (options.bounceSamples > 0 ? std::max(options.bounces, 0) : 0);
+    std::vector<std::vector<uint32_t>> nearTiles(tiles.size());
+    std::vector<uint64_t>              directKeys(tiles.size()), bounceKeys(tiles.size());
+    ThreadPool::Get().ParallelFor(tiles.size(), [&](size_t t) {
+        const LightTile&      tile = tiles[t];
+        glm::vec3             mins = tile.mins - glm::vec3(reach), maxs = tile.maxs + glm::vec3(reach);
+        uint64_t              around = 0;
+        std::vector<uint32_t> nearFaces;
+        bvh.Overlap(mins, maxs, [&](uint32_t i) {
+            around += bvh.keys[i];
+            nearFaces.push_back(bvh.tris[i].face);
+        });
+        std::sort(nearFaces.begin(), nearFaces.end());
+        nearFaces.erase(std::unique(nearFaces.begin(), nearFaces.end()), nearFaces.end());
+
+        // Luxels of those faces a hit in the box rounds to
+        for (uint32_t h : nearFaces)
+        {
+            const FaceGrid& hg = grids[h];
+            auto luxelOf = [&](float v, float min, int size) {
+                return glm::clamp((int) std::lround((v - min) / hg.luxel), 0, size - 1);
+            };
+            int x0 = luxelOf(mins[hg.axisS], hg.minS, hg.width), x1 = luxelOf(maxs[hg.axisS], hg.minS, hg.width);
+            int y0 = luxelOf(mins[hg.axisT], hg.minT, hg.height), y1 = luxelOf(maxs[hg.axisT], hg.minT, hg.height);
+            int across = (hg.width + LIGHT_TILE - 1) / LIGHT_TILE;
+            for (int y = y0 / LIGHT_TILE; y <= y1 / LIGHT_TILE; y++)
+            {
+                for (int x = x0 / LIGHT_TILE; x <= x1 / LIGHT_TILE; x++)
+                    nearTiles[t].push_back(firstTile[h] + y * across + x);
+            }
+        }
+
+        // Shadow rays stay in the box around the tile and the light
+        uint64_t reaching = 0;
+        for (const auto& light : lights)
+        {
+            glm::vec3 closest = glm::clamp(light.position, tile.mins, tile.maxs);
+            if (glm::length(light.position - closest) * options.mapUnitsPerUnit >= light.intensity)
+                continue;
+            uint64_t occluders = 0;
+            bvh.Overlap(glm::min(tile.mins, light.position), glm::max(tile.maxs, light.position),
+                        [&](uint32_t i) { occluders += bvh.keys[i]; });
+            reaching += HashBytes(&occluders, sizeof(occluders), HashBytes(&light, sizeof(light)));
+        }
+
+        uint64_t key  = HashBytes(&tile.geometry, sizeof(uint64_t), bakeKey);
+        directKeys[t] = HashBytes(&reaching, sizeof(reaching), key);
+        bounceKeys[t] = HashBytes(&around, sizeof(around), key);
+    }, 16);
+
+    std::atomic<size_t> rays{0};
+    auto directLight = [&](const LightTile& tile, std::vector<glm::vec3>& out) {
+        const FaceGrid& g = grids[tile.face];
+        size_t          faceRays = 0;
+        for (int j = tile.y; j < tile.y + tile.height; j++)
+        {
+            for (int i = tile.x; i < tile.x + tile.width; i++)
+            {
+                size_t           s = (size_t) j * g.width + i;
+                const glm::vec3& p = samples[tile.face][s];
+                out[s]             = glm::vec3(0.0f);
+                for (const auto& light : lights)
+                {
+                    glm::vec3 toLight = light.position - p;
+                    float     dist    = glm::length(toLight);
+                    if (dist <= 0.0f)
+                        continue;
+                    glm::vec3 l      = toLight / dist;
+                    float     cosine = glm::dot(g.normal, l);
+                    float     value  = light.intensity - dist * options.mapUnitsPerUnit;
+                    if (cosine <= 0.0f || value <= 0.0f)
+                        continue;
+
+                    float    t;
+                    uint32_t tri;
+                    faceRays++;
+                    if (bvh.Trace(p, l, dist, true, t, tri))
+                        continue;
+                    out[s] += light.color * value * ((1.0f - ANGLE_SCALE) + ANGLE_SCALE * cosine);
+                }
+            }
+        }
+        rays += faceRays;
+    };
+
+    // Each bounce gathers the light of the previous one, weighted by the surface color it
+    // came off
+    auto bounceLight = [&](const LightTile& tile, int bounce, const std::vector<std::vector<glm::vec3>>& source,
+                           std::vector<glm::vec3>& out) {
+        const FaceGrid& g = grids[tile.face];
+        glm::vec3       tangent =
+            glm::normalize(glm::cross(g.normal, std::abs(g.normal.y) < 0.99f ? glm::vec3(0, 1, 0)
+                                                                              : glm::vec3(1, 0, 0)));
+        glm::vec3 bitangent = glm::cross(g.normal, tangent);
+        size_t    faceRays  = 0;
+
+        for (int j = tile.y; j < tile.y + tile.height; j++)
+        {
+            for (int i = tile.x; i < tile.x + tile.width; i++)
+            {
+                size_t s = (size_t) j * g.width + i;
+                // Seeded per luxel of the tile, so the result doesn't depend on which thread got
+                // it or where the face ended up in the list
+                uint32_t rng = (uint32_t) tile.geometry ^ (uint32_t) (((j - tile.y) * LIGHT_TILE + i - tile.x) * 40503u) ^
+                               (uint32_t) (bounce * 97u) ^ 0x9E3779B9u;
+                NextRandom(rng);
+
+                glm::vec3 sum(0.0f);
+                for (int k = 0; k < options.bounceSamples; k++)
+                {
+                    // Cosine weighted, so the estimate is just the average
+                    float     r   = std::sqrt(RandomFloat(rng));
+                    float     phi = 2.0f * PI * RandomFloat(rng);
+                    glm::vec3 dir = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) +
+                                    g.normal * std::sqrt(std::max(0.0f, 1.0f - r * r));
+
+                    float    t;
+                    uint32_t tri;
+                    faceRays++;
+                    if (!bvh.Trace(samples[tile.face][s], dir, reach, false, t, tri))
+                        continue;
+                    uint32_t        hitFace = bvh.tris[tri].face;
+                    const FaceGrid& hg      = grids[hitFace];
+                    if (glm::dot(hg.normal, dir) >= 0.0f)
+                        continue; // the back of a face, inside a brush
+
+                    glm::vec3 hit = samples[tile.face][s] + dir * t;
+                    int       hi  = glm::clamp((int) std::lround((hit[hg.axisS] - hg.minS) / hg.luxel), 0, hg.width - 1);
+                    int       hj  = glm::clamp((int) std::lround((hit[hg.axisT] - hg.minT) / hg.luxel), 0, hg.height - 1);
+                    glm::vec3 color = hg.texture < albedo.size() ? albedo[hg.texture] : glm::vec3(0.5f);
+                    sum += source[hitFace][hj * hg.width + hi] * color;
+                }
+                out[s] = sum / (float) options.bounceSamples;
+            }
+        }
+        rays += faceRays;
+    };
+
+    // Levels are cached per tile as the raw luxels, only the tiles missing one are traced.
+    // Bounces are keyed by the light they read rather than by how it was made, so a tile lit
+    // again the same way doesn't take the bounces around it along
+    std::vector<std::vector<std::vector<glm::vec3>>> levels(numLevels);
+    std::vector<uint8_t>                             reused(tiles.size(), 1);
+    std::vector<uint64_t>                            keys = directKeys, lightKeys(tiles.size());
+    for (int level = 0; level < numLevels; level++)
+    {
+        auto& light = levels[level];
+        light.resize(faces.size());
+        for (size_t f = 0; f < faces.size(); f++)
+            light[f].resize(samples[f].size());
+
+        if (level > 0)
+        {
+            for (size_t t = 0; t < tiles.size(); t++)
+            {
+                uint64_t around = 0;
+                for (uint32_t n : nearTiles[t])
+                    around += lightKeys[n];
+                keys[t] = HashBytes(&around, sizeof(around), HashBytes(&level, sizeof(level), bounceKeys[t]));
+            }
+        }
+
+        std::vector<uint32_t> missing;
+        std::vector<uint8_t>  cached, traced(tiles.size(), 0);
+        for (uint32_t t = 0; t < tiles.size(); t++)
+        {
+            const LightTile& tile = tiles[t];
+            size_t           row  = tile.width * sizeof(glm::vec3);
+            if (cache && cache->FindStage(keys[t], cached) && cached.size() == row * tile.height)
+            {
+                for (int j = 0; j < tile.height; j++)
+                    memcpy(&light[tile.face][(size_t) (tile.y + j) * grids[tile.face].width + tile.x],
+                           cached.data() + j * row, row);
+                continue;
+            }
+            missing.push_back(t);
+            traced[t] = 1;
+            reused[t] = 0;
+        }
+
+        ThreadPool::Get().ParallelFor(missing.size(), [&](size_t m) {
+            const LightTile& tile = tiles[missing[m]];
+            if (level == 0)
+                directLight(tile, light[tile.face]);
+            else
+                bounceLight(tile, level - 1, levels[level - 1], light[tile.face]);
+        }, 4);
+
+        for (uint32_t t = 0; t < tiles.size(); t++)
+        {
+            const LightTile&     tile = tiles[t];
+            size_t               row  = tile.width * sizeof(glm::vec3);
+            std::vector<uint8_t> data(row * tile.height);
+            for (int j = 0; j < tile.height; j++)
+                memcpy(data.data() + j * row,
+                       &light[tile.face][(size_t) (tile.y + j) * grids[tile.face].width + tile.x], row);
+            lightKeys[t] = HashBytes(data.data(), data.size(), tile.geometry);
+            if (cache && traced[t])
+                cache->StoreStage(keys[t], std::move(data));
+        }
+    }
+    result.tiles = tiles.size();
+    for (uint8_t r : reused)
+        result.reusedTiles += r;
+
+    result.width  = (uint32_t) size;
+    result.height = (uint32_t) std::max(usedHeight, 1);
+    result.rgb.assign((size_t) result.width * result.height * 3, 0);
+    result.uvs.resize(verts.size());
+    for (size_t f = 0; f < faces.size(); f++)
+    {
+        const FaceGrid& g = grids[f];
+        for (int j = 0; j < g.height; j++)
+        {
+            for (int i = 0; i < g.width; i++)
+            {
+                glm::vec3 light(options.ambient);
+                for (const auto& l : levels)
+                    light += l[f][j * g.width + i];
+                uint8_t*  out = &result.rgb[((size_t) (g.y + j) * result.width + g.x + i) * 3];
+                for (int c = 0; c < 3; c++)
+                    out[c] = (uint8_t) std::clamp((int) std::lround(light[c]), 0, 255);
+            }
+        }
+        result.luxels += samples[f].size();
+
+        // Luxel centers line up with the texel centers of the atlas
+        const AFace& face = faces[f];
+        for (uint32_t k = 0; k < face.numVertices; k++)
+        {
+            const glm::vec3& p = verts[face.firstVertex + k].position;
+            result.uvs[face.firstVertex + k] =
+                glm::vec2((g.x + 0.5f + (p[g.axisS] - g.minS) / g.luxel) / result.width,
+                          (g.y + 0.5f + (p[g.axisT] - g.minT) / g.luxel) / result.height);
+        }
+    }
+    result.rays = rays;
+    return result;
+}
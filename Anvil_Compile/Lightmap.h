@@ -0,0 +1,61 @@
+#pragma once
+// Lightmap.h
+#include "AnvilBSPFormat.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class CompileCache;
+
+// A point light from a .map "light" entity
+struct MapLight
+{
+    glm::vec3 position;  // vertex space
+    glm::vec3 color;     // brightest channel is 1
+    float     intensity; // "light" key, Quake style: brightness at the light, drops 1 per map unit
+};
+
+struct LightmapOptions
+{
+    float luxelSize       = 0.16f;  // vertex space, 16 map units
+    float mapUnitsPerUnit = 100.0f; // map units in one vertex space unit, for the falloff
+    int   bounces         = 1;
+    int   bounceSamples   = 32; // hemisphere rays per luxel and bounce
+    float ambient         = 0.0f; // added to every luxel, 128 is the texture's own color
+};
+
+struct LightmapResult
+{
+    uint32_t               width  = 0;
+    uint32_t               height = 0;
+    std::vector<uint8_t>   rgb;    // atlas, RGB8, 128 is the texture's own color
+    std::vector<glm::vec2> uvs;    // lightmap coordinates of every vertex
+    size_t                 luxels = 0;
+    size_t                 rays   = 0;
+    size_t                 tiles       = 0; // squares of luxels cached on their own
+    size_t                 reusedTiles = 0; // of those, how many came from the cache
+};
+
+/**
+ * @brief Bakes direct and bounced light for the world into one lightmap atlas
+ * Every face gets a luxel grid on the plane of its two largest axes, the grids are packed into
+ * a single atlas, then shadow rays to every light and cosine weighted bounce rays are traced
+ * against a BVH of the world triangles. Faces are lit in parallel on the compiler thread pool
+ * and the result doesn't depend on the thread count.
+ * Light (bounces too) doesn't go further than the brightest light reaches, so the light of a
+ * luxel only depends on what's that close to it. With a cache, tiles of luxels keep the light
+ * they had last time while that stays the same, only the ones near an edit are baked again.
+ * A map without lights still gets a lightmap, one flat texel of the ambient (or 128, the
+ * texture's own color, without one), so it's drawn the same way as a lit map.
+ * @param verts World vertices
+ * @param faces World faces
+ * @param indices Triangle list of the faces, the "INDX" lump
+ * @param lights Lights to bake
+ * @param albedo Average color of every texture, for the bounces
+ * @param options Luxel size and bounce settings
+ * @param cache Results of the last compile, can be null
+ */
+LightmapResult BakeLightmaps(const std::vector<AVertex>& verts, const std::vector<AFace>& faces,
+                             const std::vector<uint32_t>& indices, const std::vector<MapLight>& lights,
+                             const std::vector<glm::vec3>& albedo, const LightmapOptions& options,
+                             CompileCache* cache = nullptr);
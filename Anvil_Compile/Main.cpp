@@ -3,41 +3,41 @@
 #include "AnvilBSPFormat.h"
 #include "AMeshLoader.h"
 #include "AMesh.h"
+#include "AMeshOptimizer.h"
 #include "AMath.h"
+#include "AMappedFile.h"
+#include "ATextureMips.h"
+#include "AStageProfiler.h"
+#include "AVertexFormat.h"
+#include "Batch.h"
+#include "BspWriter.h"
+#include "BspTree.h"
+#include "CompileCache.h"
+#include "CollisionBake.h"
+#include "Csg.h"
+#include "FaceMerge.h"
+#include "Lightmap.h"
+#include "MapLexer.h"
+#include "TextureCompress.h"
+#include "ThreadPool.h"
+#include "Vis.h"
+#include "Weld.h"
+#include "Winding.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <map>
 #include <filesystem>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
 #include <stb_image.h>
 
 constexpr float SIZE = 0.1f;
 namespace fs = std::filesystem;
 
-// Some helpers
-APlane PlaneFromPoints(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) {
-    glm::vec3 v1 = p2 - p1, v2 = p3 - p1;
-    glm::vec3 n = glm::normalize(glm::cross(v2, v1));
-    return { n, glm::dot(n, p1) };
-}
-
-void ClipWinding(std::vector<glm::vec3>& pts, APlane& plane) {
-    std::vector<glm::vec3> newPts;
-    const float EPS = 0.01f;
-    for (size_t i = 0; i < pts.size(); i++) {
-        glm::vec3 p1 = pts[i], p2 = pts[(i + 1) % pts.size()];
-        float d1 = glm::dot(p1, plane.normal) - plane.distance;
-        float d2 = glm::dot(p2, plane.normal) - plane.distance;
-
-        if (d1 <= EPS) newPts.push_back(p1);
-        if ((d1 > EPS && d2 < -EPS) || (d1 < -EPS && d2 > EPS)) {
-            float t = d1 / (d1 - d2);
-            newPts.push_back(p1 + t * (p2 - p1));
-        }
-    }
-    pts = newPts;
-}
 struct TempPlane {
     APlane plane;
     uint32_t texIdx;
@@ -46,82 +46,175 @@ struct EmbeddedTex {
     std::string name;
     uint32_t width;
     uint32_t height;
-    uint32_t format; // 3 = RGB, 4 = RGBA
+    uint32_t format; // ETextureFormat
+    glm::vec3 albedo = glm::vec3(0.5f); // linear average color, for bounced light
 	std::vector<uint8_t> data;
 };
 
+struct MapCompileOptions {
+    bool powerOfTwo = false; // resample textures to power of two sizes before making mips
+    bool fillOutside = false; // drop everything the entities can't reach
+    bool useCache = true; // reuse windings, textures, vis and the lightmap from the last compile of the map
+    int bounces = 1; // light bounces, 0 is direct light only
+    float ambient = -1.0f; // -ambient N, light every luxel gets on top, < 0 takes worldspawn's "_ambient"
+    bool profile = false; // per stage time and memory, as a table and as JSON next to the output
+    EVertexFormat vertexFormat = EVertexFormat::Float; // -compactverts / -quantize, for maps and meshes
+    bool compress = false; // -compress, LZ4 every lump (or mesh chunk) that gets smaller from it
+    bool optimizeMeshes = true; // -nomeshopt turns off the vertex cache / overdraw reorder of meshes
+    unsigned meshLODs = 4; // -lods N, levels of detail per mesh counting the full one
+    unsigned meshHulls = 16; // -hulls N, convex pieces for mesh collision, 0 for none
+};
+
+// Point entity the outside fill floods from
+struct FillSeed {
+    std::string className;
+    glm::vec3 position; // vertex space
+};
+
+// Brush space, same as ClipWinding
+constexpr float CSG_EPSILON = 0.01f;
+// Vertex space, the same distance
+constexpr float WELD_EPSILON = CSG_EPSILON * SIZE;
+// Cluster size, same as the mesh exporter's
+constexpr uint32_t CLUSTER_MAX_VERTICES = 64;
+constexpr uint32_t CLUSTER_MAX_TRIANGLES = 124;
+
+// Clips every side of the brush by all the others, touches nothing shared so brushes can run in parallel
+std::vector<BrushFace> BuildBrushFaces(const std::vector<TempPlane>& brushPlanes) {
+    std::vector<BrushFace> out;
+    for (size_t i = 0; i < brushPlanes.size(); i++) {
+        Winding w = BaseWindingForPlane(brushPlanes[i].plane);
+
+        for (size_t j = 0; j < brushPlanes.size(); j++) {
+            if (i != j) ClipWinding(w, brushPlanes[j].plane);
+        }
+
+        if (w.size() >= 3) out.push_back({ std::move(w), brushPlanes[i].plane, brushPlanes[i].texIdx, (uint32_t)i });
+    }
+    return out;
+}
+
+// -profile: the table goes to the log, the same numbers go next to the output as JSON for tracking between builds
+void ReportProfile(const AStageProfiler& profiler, const std::string& inputPath, const std::string& outputPath, std::ostream& log) {
+    profiler.PrintTable(log, inputPath);
+    std::string jsonPath = outputPath + ".profile.json";
+    if (profiler.SaveJson(jsonPath, inputPath)) log << "  - Profile written to " << jsonPath << std::endl;
+    else log << "[Anvil Compiler] Warning: Could not write " << jsonPath << std::endl;
+}
+
 // Big boy
 // Add support for texturing
 // Embedded textures would be nice
-void CompileMap(const char* inputPath) {
-    std::ifstream file(inputPath);
-    if (!file) {
-        std::cout << "[Anvil Compiler] Error: Map not found " << inputPath << std::endl;
-        return;
+bool CompileMap(const char* inputPath, const std::string& outputPath, const MapCompileOptions& options, std::ostream& log) {
+    // Cheap enough to always run, only reported with -profile
+    AStageProfiler profiler;
+    profiler.Begin("parse");
+    AMappedFile mapFile;
+    if (!mapFile.Open(inputPath)) {
+        log << "[Anvil Compiler] Error: Map not found " << inputPath << std::endl;
+        return false;
     }
 
-    std::string token, currentClassName = "";
+    std::string currentClassName = "";
     std::vector<AVertex> all_v;
     std::vector<AFace> all_f;
     std::vector<ABspEntity> entities;
     std::vector<APlane> all_planes;
     std::vector<ABSPBrush> all_brushes;
+    std::vector<APlane> solid_planes; // all_planes in vertex space, for the BSP
     std::vector<TempPlane> brushPlanes;
+    std::vector<std::vector<TempPlane>> parsedBrushes; // scaled sides of every brush, in file order
     std::vector<EmbeddedTex> textures;
-    std::map<std::string, uint32_t> texNameToIndex;
+    std::map<std::string, uint32_t, std::less<>> texNameToIndex; // less<> so string_views can look it up
     glm::vec3 entMin(1e9), entMax(-1e9);
+    std::vector<FillSeed> seeds;
+    std::string entityClassName; // currentClassName gets cleared by the first brush
+    bool hasOrigin = false;
+    glm::vec3 origin(0.0f);
+    std::vector<MapLight> lights;
+    float lightValue = 300.0f; // Quake's default
+    float ambient = 0.0f; // worldspawn "_ambient" (or "_minlight")
+    float entityAmbient = 0.0f;
+    glm::vec3 lightColor(1.0f);
+    int depth = 0;
 
-    while (file >> token) {
-        if (token == "\"classname\"") {
-            file >> token;
-            currentClassName = token.substr(1, token.length() - 2);
+    MapLexer lex(mapFile.GetText(), inputPath);
+    MapToken token;
+    while (lex.Next(token)) {
+        if (token.quoted) {
+            // Entity "key" "value" pair
+            MapToken value;
+            if (!lex.Require(value, "a value")) break;
+            if (token.text == "classname") currentClassName = entityClassName = std::string(value.text);
+            if (token.text == "origin") {
+                float v[3];
+                if (ParseMapNumbers(value.text, v, 3)) {
+                    origin = glm::vec3(v[0], v[2], -v[1]) * SIZE * SIZE;
+                    hasOrigin = true;
+                }
+            }
+            if (token.text == "light") {
+                float v;
+                if (ParseMapNumber(value.text, v)) lightValue = v;
+            }
+            if (token.text == "_ambient" || token.text == "_minlight") {
+                // Only used when the entity turns out to be worldspawn
+                float v;
+                if (ParseMapNumber(value.text, v)) entityAmbient = std::max(0.0f, v);
+            }
+            if (token.text == "_color") {
+                // 0-1 or 0-255, only the hue matters
+                float v[3];
+                if (ParseMapNumbers(value.text, v, 3)) {
+                    float brightest = std::max(v[0], std::max(v[1], v[2]));
+                    if (brightest > 0.0f) lightColor = glm::vec3(v[0], v[1], v[2]) / brightest;
+                }
+            }
+            continue;
         }
-        if (token == "(") {
-            float x1, y1, z1, x2, y2, z2, x3, y3, z3;
-            file >> x1 >> y1 >> z1; file >> token >> token;
-            file >> x2 >> y2 >> z2; file >> token >> token;
-            file >> x3 >> y3 >> z3; file >> token;
-
-            std::string texName;
-            file >> texName;
+        if (token.text == "(") {
+            // ( x1 y1 z1 ) ( x2 y2 z2 ) ( x3 y3 z3 ) texture ...
+            float v[9];
+            for (int k = 0; k < 3; k++) {
+                if (k > 0 && !lex.Expect("(")) break;
+                if (!lex.ExpectNumber(v[k * 3]) || !lex.ExpectNumber(v[k * 3 + 1]) || !lex.ExpectNumber(v[k * 3 + 2])) break;
+                if (!lex.Expect(")")) break;
+            }
+            MapToken texToken;
+            if (lex.Failed() || !lex.Require(texToken, "a texture name")) break;
+            std::string_view texName = texToken.text;
 
             if (texNameToIndex.find(texName) == texNameToIndex.end()) {
-                uint32_t newIdx = (uint32_t)textures.size();
-                texNameToIndex[texName] = newIdx;
-                std::string imgPath = "textures/"+texName + ".png";
-                int w, h, channels;
-                uint8_t* pixels = stbi_load(imgPath.c_str(), &w, &h, &channels, 4);
+                // Loaded after parsing, the cache may already have it
+                texNameToIndex.emplace(std::string(texName), (uint32_t)textures.size());
                 EmbeddedTex tex;
                 tex.name = texName;
-                if (pixels) {
-                    tex.width = w;
-                    tex.height = h;
-                    tex.format = 4;
-                    tex.data.assign(pixels, pixels + (w * h * 4));
-					stbi_image_free(pixels);
-                }
-                else {
-                    std::cout << "Warning: Could not load texture " << texName << std::endl;
-                    tex.width = 2;
-					tex.height = 2;
-					tex.format = 4;
-                    // don't mind reading this lmao, it's magenta black checkerboard
-                    tex.data = { 255,0,255,255, 0,0,0,255, 0,0,0,255, 255,0,255,255 };
-                }
                 textures.push_back(tex);
             }
-            uint32_t currentTexIdx = texNameToIndex[texName];
+            uint32_t currentTexIdx = texNameToIndex.find(texName)->second;
             // OpenGL and GLM only supports right-handed coordinate system
             // so, XYZ-> XZY
-            glm::vec3 p1{ x1, z1, -y1 }, p2{ x2, z2, -y2 }, p3{ x3, z3, -y3 };
+            glm::vec3 p1{ v[0], v[2], -v[1] }, p2{ v[3], v[5], -v[4] }, p3{ v[6], v[8], -v[7] };
             brushPlanes.push_back({ PlaneFromPoints(p1, p2, p3) , currentTexIdx});
 
             entMin = glm::min(entMin, glm::min(p1, glm::min(p2, p3)));
             entMax = glm::max(entMax, glm::max(p1, glm::max(p2, p3)));
 
-            std::string junk; std::getline(file, junk);
+            // Offsets, rotation and scale aren't used yet
+            lex.SkipLine();
         }
-        if (token == "}") {
+        if (token.text == "{") depth++;
+        if (token.text == "}") {
+            if (--depth == 0) {
+                if (hasOrigin) seeds.push_back({ entityClassName, origin });
+                if (hasOrigin && entityClassName.rfind("light", 0) == 0) lights.push_back({ origin, lightColor, lightValue });
+                if (entityClassName == "worldspawn") ambient = entityAmbient;
+                hasOrigin = false;
+                entityClassName.clear();
+                lightValue = 300.0f;
+                lightColor = glm::vec3(1.0f);
+                entityAmbient = 0.0f;
+            }
             if (brushPlanes.size() >= 4) {
                 ABSPBrush b;
                 b.firstPlane = (uint32_t)all_planes.size();
@@ -130,35 +223,11 @@ void CompileMap(const char* inputPath) {
                 for (auto& p : brushPlanes) {
                     p.plane.distance *= SIZE;
 					all_planes.push_back(p.plane);
+                    // Windings come from the scaled plane and get scaled again on output
+                    solid_planes.push_back({ p.plane.normal, p.plane.distance * SIZE });
                 }
 
-                for (size_t i = 0; i < brushPlanes.size(); i++) {
-                    APlane& p = brushPlanes[i].plane;
-                    uint32_t faceTexIdx = brushPlanes[i].texIdx;
-
-                    glm::vec3 up = (std::abs(p.normal.y) > 0.99f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
-                    glm::vec3 r = glm::normalize(glm::cross(p.normal, up));
-                    up = glm::cross(r, p.normal);
-
-                    std::vector<glm::vec3> w = {
-                        (p.normal * p.distance) + (r * 1e4f) + (up * 1e4f),
-                        (p.normal * p.distance) - (r * 1e4f) + (up * 1e4f),
-                        (p.normal * p.distance) - (r * 1e4f) - (up * 1e4f),
-                        (p.normal * p.distance) + (r * 1e4f) - (up * 1e4f)
-                    };
-
-                    for (size_t j = 0; j < brushPlanes.size(); j++) {
-                        if (i != j) ClipWinding(w, brushPlanes[j].plane);
-                    }
-
-                    if (w.size() >= 3) {
-                        all_f.push_back({ (uint32_t)all_v.size(), (uint32_t)w.size(), faceTexIdx });
-                        for (auto& vPos : w) {
-                            glm::vec2 uv = (std::abs(p.normal.y) > 0.5f) ? glm::vec2(vPos.x, vPos.z) : glm::vec2(vPos.x, vPos.y);                            // Applying 0.01f scale for engine units
-                            all_v.push_back({ vPos * SIZE, uv * 0.01f, p.normal });
-                        }
-                    }
-                }
+                parsedBrushes.push_back(brushPlanes);
             }
             if (currentClassName.find("trigger") != std::string::npos) {
                 ABspEntity e;
@@ -174,14 +243,339 @@ void CompileMap(const char* inputPath) {
             entMax = glm::vec3(-1e9);
         }
     }
-    std::ofstream out("world.absp", std::ios::binary);
-    ABSPHeader h = { {'A','B','S','P'}, 2, (uint32_t)all_v.size(), (uint32_t)all_f.size(), (uint32_t)entities.size(), (uint32_t)all_planes.size(), (uint32_t)all_brushes.size() };
-    out.write((char*)&h, sizeof(h));
-    out.write((char*)all_v.data(), all_v.size() * sizeof(AVertex));
-    out.write((char*)all_f.data(), all_f.size() * sizeof(AFace));
-    out.write((char*)entities.data(), entities.size() * sizeof(ABspEntity));
-    out.write((char*)all_planes.data(), all_planes.size() * sizeof(APlane));
-    out.write((char*)all_brushes.data(), all_brushes.size() * sizeof(ABSPBrush));
+    if (lex.Failed()) return false;
+    profiler.End(parsedBrushes.size());
+
+    // Everything below that only depends on a brush or an image is looked up by its hash first
+    CompileCache cache;
+    std::string cachePath = fs::path(inputPath).replace_extension(".acache").string();
+    if (options.useCache) cache.Load(cachePath);
+    std::atomic<size_t> texturesReused{ 0 }, brushesReused{ 0 }, clipsReused{ 0 };
+
+    // Mip chains are built offline in linear space, then every level is block compressed.
+    // BC3 only where there's alpha worth keeping
+    std::vector<ATextureLevel> texLevels;
+    std::vector<std::vector<ATextureLevel>> levelsPerTexture(textures.size());
+    std::atomic<size_t> rawTextureBytes{ 0 };
+    std::vector<uint8_t> missingTexture(textures.size(), 0); // warned about after the loop, log isn't thread safe
+    size_t packedTextureBytes = 0;
+    profiler.Begin("textures");
+    ThreadPool::Get().ParallelFor(textures.size(), [&](size_t t) {
+        EmbeddedTex& tex = textures[t];
+        std::string imgPath = "textures/" + tex.name + ".png";
+        AMappedFile image;
+        uint64_t key = 0;
+        if (image.Open(imgPath.c_str())) {
+            key = HashBytes(image.GetData(), image.GetSize());
+            key = HashBytes(&options.powerOfTwo, sizeof(options.powerOfTwo), key);
+            CachedTexture cached;
+            if (options.useCache && cache.FindTexture(key, cached) && !cached.levels.empty()) {
+                tex.width = cached.width;
+                tex.height = cached.height;
+                tex.format = cached.format;
+                tex.albedo = cached.albedo;
+                tex.data = std::move(cached.data);
+                for (auto& level : cached.levels) {
+                    level.texture = (uint32_t)t;
+                    levelsPerTexture[t].push_back(level);
+                }
+                rawTextureBytes += (size_t)cached.levels[0].width * cached.levels[0].height * 4;
+                texturesReused++;
+                return;
+            }
+        }
+
+        int w, h, channels;
+        uint8_t* pixels = image.IsOpen() ? stbi_load_from_memory(image.GetData(), (int)image.GetSize(), &w, &h, &channels, 4) : nullptr;
+        bool decoded = pixels != nullptr;
+        if (decoded) {
+            tex.width = w;
+            tex.height = h;
+            tex.format = (uint32_t)ETextureFormat::RGBA8;
+            tex.data.assign(pixels, pixels + (w * h * 4));
+            stbi_image_free(pixels);
+        }
+        else {
+            missingTexture[t] = 1;
+            tex.width = 2;
+            tex.height = 2;
+            tex.format = (uint32_t)ETextureFormat::RGBA8;
+            // don't mind reading this lmao, it's magenta black checkerboard
+            tex.data = { 255,0,255,255, 0,0,0,255, 0,0,0,255, 255,0,255,255 };
+        }
+        rawTextureBytes += tex.data.size();
+        std::vector<AMipLevel> mips = ATextureMips::Build(tex.data.data(), tex.width, tex.height, options.powerOfTwo);
+        bool alpha = HasTranslucentPixels(mips[0].pixels.data(), mips[0].pixels.size() / 4);
+        // The 1x1 level is the average, filtered in linear space already
+        const uint8_t* average = mips.back().pixels.data();
+        for (int c = 0; c < 3; c++) tex.albedo[c] = std::pow(average[c] / 255.0f, 2.2f);
+
+        tex.width = mips[0].width;
+        tex.height = mips[0].height;
+        tex.format = (uint32_t)(alpha ? ETextureFormat::BC3 : ETextureFormat::BC1);
+        tex.data.clear();
+        for (const auto& mip : mips) {
+            std::vector<uint8_t> block = alpha ? CompressBC3(mip.pixels.data(), mip.width, mip.height)
+                                               : CompressBC1(mip.pixels.data(), mip.width, mip.height);
+            levelsPerTexture[t].push_back({ (uint32_t)t, mip.width, mip.height, (uint32_t)tex.data.size(), (uint32_t)block.size() });
+            tex.data.insert(tex.data.end(), block.begin(), block.end());
+        }
+        if (decoded && options.useCache)
+            cache.StoreTexture(key, { tex.width, tex.height, tex.format, tex.albedo, levelsPerTexture[t], tex.data });
+    });
+    for (size_t t = 0; t < textures.size(); t++) {
+        if (missingTexture[t]) log << "Warning: Could not load texture " << textures[t].name << std::endl;
+        packedTextureBytes += textures[t].data.size();
+        texLevels.insert(texLevels.end(), levelsPerTexture[t].begin(), levelsPerTexture[t].end());
+    }
+    profiler.End(textures.size());
+
+    // Cached faces only keep the side they came from, the plane and texture are the current ones
+    auto fromCache = [&](const std::vector<CachedFace>& cached, size_t brush) {
+        std::vector<BrushFace> faces;
+        for (const auto& f : cached) {
+            const TempPlane& side = parsedBrushes[brush][f.side];
+            faces.push_back({ f.winding, side.plane, side.texIdx, f.side });
+        }
+        return faces;
+    };
+    auto toCache = [](const std::vector<BrushFace>& faces) {
+        std::vector<CachedFace> cached;
+        for (const auto& f : faces) cached.push_back({ f.side, f.winding });
+        return cached;
+    };
+
+    // Windings are independent per brush, build them on every core and stitch them back
+    // together in file order so the output matches a single threaded compile byte for byte.
+    // A brush is keyed by its planes, textures don't change the shape
+    profiler.Begin("windings");
+    std::vector<uint64_t> brushKeys(parsedBrushes.size());
+    std::vector<std::vector<BrushFace>> brushFaces(parsedBrushes.size());
+    ThreadPool::Get().ParallelFor(parsedBrushes.size(), [&](size_t i) {
+        uint64_t key = HashBytes("BRSH", 4);
+        for (const auto& side : parsedBrushes[i]) key = HashBytes(&side.plane, sizeof(APlane), key);
+        brushKeys[i] = key;
+
+        std::vector<CachedFace> cached;
+        if (options.useCache && cache.FindFaces(key, cached)) {
+            brushFaces[i] = fromCache(cached, i);
+            brushesReused++;
+            return;
+        }
+        brushFaces[i] = BuildBrushFaces(parsedBrushes[i]);
+        if (options.useCache) cache.StoreFaces(key, toCache(brushFaces[i]));
+    }, 16);
+
+    size_t facesBeforeCsg = 0;
+    for (const auto& faces : brushFaces) facesBeforeCsg += faces.size();
+    profiler.End(facesBeforeCsg);
+
+    // What CSG leaves of a brush depends on the brushes it touches and which of them come first
+    profiler.Begin("csg");
+    std::vector<std::vector<size_t>> touching = FindTouchingBrushes(brushFaces, CSG_EPSILON);
+    std::vector<std::vector<BrushFace>> visibleBrushFaces(brushFaces.size());
+    ThreadPool::Get().ParallelFor(brushFaces.size(), [&](size_t a) {
+        uint64_t key = HashBytes(&brushKeys[a], sizeof(uint64_t), HashBytes("CSG ", 4));
+        for (size_t b : touching[a]) {
+            bool first = a < b;
+            key = HashBytes(&brushKeys[b], sizeof(uint64_t), key);
+            key = HashBytes(&first, sizeof(first), key);
+        }
+
+        std::vector<CachedFace> cached;
+        if (options.useCache && cache.FindFaces(key, cached)) {
+            visibleBrushFaces[a] = fromCache(cached, a);
+            clipsReused++;
+            return;
+        }
+        visibleBrushFaces[a] = ClipBrushFaces(brushFaces, a, touching[a], CSG_EPSILON);
+        if (options.useCache) cache.StoreFaces(key, toCache(visibleBrushFaces[a]));
+    }, 4);
+    brushFaces.swap(visibleBrushFaces);
+    visibleBrushFaces.clear();
+
+    // Every face is its own fan, so join what lies on one plane with one texture
+    // and fix up the edges the bigger faces leave hanging
+    std::vector<BrushFace> visibleFaces;
+    for (auto& faces : brushFaces) {
+        for (auto& f : faces) visibleFaces.push_back(std::move(f));
+    }
+    brushFaces.clear();
+    auto countTriangles = [](const std::vector<BrushFace>& faces) {
+        size_t n = 0;
+        for (const auto& f : faces) n += f.winding.size() - 2;
+        return n;
+    };
+    size_t facesAfterCsg = visibleFaces.size();
+    profiler.End(facesAfterCsg);
+    profiler.Begin("merge");
+    size_t trianglesBeforeMerge = countTriangles(visibleFaces);
+    visibleFaces = MergeCoplanarFaces(visibleFaces, CSG_EPSILON);
+    size_t facesAfterMerge = visibleFaces.size();
+    size_t tjunctions = FixTJunctions(visibleFaces, CSG_EPSILON);
+    size_t trianglesAfterMerge = countTriangles(visibleFaces);
+    // Faces of one texture end up next to each other, so each texture is one draw
+    std::stable_sort(visibleFaces.begin(), visibleFaces.end(), [](const BrushFace& a, const BrushFace& b) {
+        return a.texIdx < b.texIdx;
+    });
+
+    for (const auto& f : visibleFaces) {
+        const APlane& p = f.plane;
+        all_f.push_back({ (uint32_t)all_v.size(), (uint32_t)f.winding.size(), f.texIdx });
+        for (auto& vPos : f.winding) {
+            glm::vec2 uv = (std::abs(p.normal.y) > 0.5f) ? glm::vec2(vPos.x, vPos.z) : glm::vec2(vPos.x, vPos.y);
+            // Applying 0.01f scale for engine units
+            all_v.push_back({ vPos * SIZE, uv * 0.01f, p.normal });
+        }
+    }
+    visibleFaces.clear();
+    profiler.End(facesAfterMerge);
+
+    profiler.Begin("bsp");
+    BspTree tree = BuildBspTree(all_v, all_f, solid_planes, all_brushes);
+    profiler.End(tree.nodes.size());
+
+    // Anything the entities can't reach is outside the map, fill it in
+    FillResult fill;
+    if (options.fillOutside && !tree.nodes.empty()) {
+        profiler.Begin("fill");
+        std::vector<glm::vec3> seedPoints;
+        for (const auto& seed : seeds) seedPoints.push_back(seed.position);
+        fill = FillOutside(tree, seedPoints, all_v, all_f);
+        if (fill.leaked) {
+            const auto& seed = seeds[fill.leakSeed];
+            glm::vec3 at = seed.position / (SIZE * SIZE);
+            log << "[Anvil Compiler] Warning: map leaks, " << seed.className << " at (" << at.x << " " << -at.z << " " << at.y
+                << ") can see the outside. Outside not filled" << std::endl;
+        }
+        else if (!fill.filled) {
+            log << "[Anvil Compiler] Warning: no entity inside the map to fill from" << std::endl;
+        }
+        profiler.End(fill.removedFaces);
+    }
+    // Final index buffer and per texture draw ranges, so loading doesn't triangulate anything
+    profiler.Begin("draws");
+    std::vector<uint32_t> indices;
+    std::vector<ABSPDrawRange> drawRanges;
+    for (uint32_t i = 0; i < all_f.size(); i++) {
+        const AFace& f = all_f[i];
+        if (drawRanges.empty() || drawRanges.back().textureID != f.textureID)
+            drawRanges.push_back({ f.textureID, (uint32_t)indices.size(), 0, i, 0 });
+        for (uint32_t k = 1; k + 1 < f.numVertices; k++) {
+            indices.push_back(f.firstVertex);
+            indices.push_back(f.firstVertex + k);
+            indices.push_back(f.firstVertex + k + 1);
+        }
+        drawRanges.back().numIndices = (uint32_t)indices.size() - drawRanges.back().firstIndex;
+        drawRanges.back().numFaces++;
+    }
+    profiler.End(drawRanges.size());
+
+    // Baked lighting, needs the final faces and the triangles the engine will draw
+    profiler.Begin("lightmap");
+    std::vector<glm::vec3> albedo;
+    for (const auto& tex : textures) albedo.push_back(tex.albedo);
+    LightmapOptions lightOptions;
+    lightOptions.bounces = options.bounces;
+    lightOptions.ambient = options.ambient >= 0.0f ? options.ambient : ambient;
+    LightmapResult lightmap = BakeLightmaps(all_v, all_f, indices, lights, albedo, lightOptions, options.useCache ? &cache : nullptr);
+    profiler.End(lightmap.luxels);
+
+    // Neighbouring faces share their corners from here on, faces reach theirs through the "FVTX" lump.
+    // Brush sides that are the same plane share it too, through "BSID"
+    profiler.Begin("weld");
+    size_t verticesBeforeWeld = all_v.size();
+    size_t planesBeforeWeld = all_planes.size();
+    std::vector<uint32_t> faceVertices = WeldVertices(all_v, lightmap.uvs, WELD_EPSILON);
+    for (auto& index : indices) index = faceVertices[index];
+    std::vector<uint32_t> brushSides = DeduplicatePlanes(all_planes, CSG_EPSILON);
+    profiler.End(verticesBeforeWeld - all_v.size() + planesBeforeWeld - all_planes.size());
+
+    // Compact vertices go in the "VTXC" lump. Everything after this works on what the engine will decode,
+    // so the collision BVH is built around the same rounded positions physics gets at load
+    std::vector<uint8_t> vertexLump;
+    if (options.vertexFormat != EVertexFormat::Float) {
+        std::vector<uint8_t> encoded;
+        AVertexStreamHeader stream = AVertexFormat::Encode(options.vertexFormat, all_v, encoded);
+        AVertexFormat::Decode(stream, encoded.data(), encoded.size(), all_v);
+        vertexLump.resize(sizeof(stream) + encoded.size());
+        memcpy(vertexLump.data(), &stream, sizeof(stream));
+        memcpy(vertexLump.data() + sizeof(stream), encoded.data(), encoded.size());
+    }
+
+    // Runs of whole faces the engine can skip together when they're off screen or face away. A run
+    // ends where the next face would take it past the vertex or triangle limit, or at a draw range
+    profiler.Begin("clusters");
+    std::vector<ABSPCluster> clusters;
+    std::vector<uint32_t> vertexStamp(all_v.size(), 0);
+    uint32_t stamp = 0;
+    for (const auto& range : drawRanges) {
+        uint32_t first = range.firstFace, numVertices = 0, numTriangles = 0;
+        uint32_t firstIndex = range.firstIndex, faceIndex = range.firstIndex;
+        auto close = [&](uint32_t end, uint32_t endIndex) {
+            if (end == first) return;
+            std::vector<glm::vec3> corners, normals;
+            for (uint32_t i = firstIndex; i < endIndex; i++) {
+                corners.push_back(all_v[indices[i]].position);
+                normals.push_back(all_v[indices[i]].normal);
+            }
+            clusters.push_back({ AMeshOptimizer::ComputeClusterBounds(corners, normals), first, end - first });
+            first = end;
+            firstIndex = endIndex;
+            numVertices = numTriangles = 0;
+            stamp++;
+        };
+        auto stampFace = [&](uint32_t from, uint32_t count) {
+            uint32_t added = 0;
+            for (uint32_t k = from; k < from + count; k++) {
+                if (vertexStamp[indices[k]] != stamp) {
+                    vertexStamp[indices[k]] = stamp;
+                    added++;
+                }
+            }
+            return added;
+        };
+        stamp++;
+        for (uint32_t i = range.firstFace; i < range.firstFace + range.numFaces; i++) {
+            const AFace& f = all_f[i];
+            uint32_t count = f.numVertices >= 3 ? (f.numVertices - 2) * 3 : 0;
+            uint32_t added = stampFace(faceIndex, count);
+            if (i != first && (numVertices + added > CLUSTER_MAX_VERTICES ||
+                               numTriangles + count / 3 > CLUSTER_MAX_TRIANGLES)) {
+                close(i, faceIndex);
+                added = stampFace(faceIndex, count);
+            }
+            numVertices += added;
+            numTriangles += count / 3;
+            faceIndex += count;
+        }
+        close(range.firstFace + range.numFaces, faceIndex);
+    }
+    profiler.End(clusters.size());
+
+    // Collision BVH over the same triangles, the engine attaches it instead of building one
+    profiler.Begin("collision");
+    std::vector<uint8_t> bvhLump = BakeCollisionBvh(all_v, indices);
+    profiler.End(indices.size() / 3);
+
+    profiler.Begin("vis");
+    float averageVisible = 0.0f;
+    std::vector<uint8_t> visLump;
+    size_t portalsReused = 0;
+    if (!tree.nodes.empty())
+        visLump = ComputeVisibility(tree, options.useCache ? &cache : nullptr, &averageVisible, &portalsReused);
+    profiler.End(tree.numClusters);
+
+    // Version 3, every lump aligned and listed in the directory up front
+    BspWriter writer;
+    if (vertexLump.empty()) writer.AddArray("VERT", all_v);
+    else writer.AddArray("VTXC", vertexLump); // compact vertices replace the float ones
+    writer.AddArray("FACE", all_f);
+    writer.AddArray("ENTS", entities);
+    writer.AddArray("PLAN", all_planes);
+    writer.AddArray("BRSH", all_brushes);
+    std::vector<ATextureEntry> textureEntries;
+    std::vector<uint8_t> textureData;
     for (const auto& tex : textures) {
         ATextureEntry te;
         memset(te.name, 0, 64); // super safe
@@ -190,32 +584,188 @@ void CompileMap(const char* inputPath) {
         te.height = tex.height;
         te.format = tex.format;
         te.dataSize = (uint32_t)tex.data.size();
-        out.write((char*)&te, sizeof(te));
+        textureEntries.push_back(te);
+        textureData.insert(textureData.end(), tex.data.begin(), tex.data.end());
     }
-    for (const auto& tex : textures) {
-        out.write((char*)tex.data.data(), tex.data.size());
+    writer.AddArray("TEXE", textureEntries);
+    writer.AddArray("TEXD", textureData);
+    if (!tree.nodes.empty()) {
+        writer.AddArray("NODE", tree.nodes);
+        writer.AddArray("LEAF", tree.leafs);
+        writer.AddArray("LFAC", tree.leafFaces);
+        writer.AddArray("VIS ", visLump);
+    }
+    if (!texLevels.empty())
+        writer.AddArray("MIPS", texLevels);
+    writer.AddArray("INDX", indices);
+    writer.AddArray("FVTX", faceVertices);
+    writer.AddArray("BSID", brushSides);
+    writer.AddArray("DRAW", drawRanges);
+    writer.AddArray("CLUS", clusters);
+    if (!bvhLump.empty())
+        writer.AddArray("BVH ", bvhLump);
+    if (!lightmap.rgb.empty()) {
+        std::vector<uint8_t> lump(sizeof(ABSPLightmapHeader) + lightmap.rgb.size());
+        ABSPLightmapHeader lh = { lightmap.width, lightmap.height };
+        memcpy(lump.data(), &lh, sizeof(lh));
+        memcpy(lump.data() + sizeof(lh), lightmap.rgb.data(), lightmap.rgb.size());
+        writer.AddLump("LMAP", std::move(lump));
+        writer.AddArray("LMUV", lightmap.uvs);
+    }
+    if (options.compress) {
+        profiler.Begin("compress");
+        writer.Compress(EBSPCompression::LZ4);
+        profiler.End(writer.GetRawSize());
     }
-    std::cout << "[Anvil Compiler] Success: world.absp baked with " << all_brushes.size() << " brushes." << std::endl;
+    profiler.Begin("write");
+    uint64_t bytesWritten = 0;
+    if (!writer.Write(outputPath, &bytesWritten)) {
+        log << "[Anvil Compiler] Error: Could not write " << outputPath << std::endl;
+        return false;
+    }
+    profiler.End(bytesWritten);
+    if (options.useCache) {
+        profiler.Begin("cache");
+        cache.Save(cachePath);
+        profiler.End(brushesReused + clipsReused + texturesReused + portalsReused + lightmap.reusedTiles);
+    }
+    log << "[Anvil Compiler] Success: " << outputPath << " baked with " << all_brushes.size() << " brushes." << std::endl;
+    log << "  - CSG: " << facesBeforeCsg << " faces -> " << facesAfterCsg << " visible";
+    if (fill.filled) log << ", " << fill.removedFaces << " more removed by the outside fill";
+    log << std::endl;
+    log << "  - Merge: " << facesAfterCsg << " faces, " << trianglesBeforeMerge << " triangles -> " << facesAfterMerge << " faces, "
+        << trianglesAfterMerge << " triangles (" << tjunctions << " T-junction points added)" << std::endl;
+    log << "  - Weld: " << verticesBeforeWeld << " -> " << all_v.size() << " vertices, " << planesBeforeWeld << " -> "
+        << all_planes.size() << " planes, " << AVertexFormat::GetName(options.vertexFormat) << " vertices of "
+        << AVertexFormat::GetStride(options.vertexFormat) << " bytes" << std::endl;
+    log << "  - Draws: " << drawRanges.size() << " texture ranges, " << indices.size() / 3 << " triangles" << std::endl;
+    log << "  - Clusters: " << clusters.size() << ", " << (clusters.empty() ? 0 : indices.size() / 3 / clusters.size())
+        << " triangles each on average" << std::endl;
+    log << "  - Collision: " << bvhLump.size() / 1024 << " KB quantized BVH" << std::endl;
+    if (!lightmap.rgb.empty()) {
+        log << "  - Lightmap: " << lights.size() << " lights, " << lightmap.luxels << " luxels in a " << lightmap.width << "x" << lightmap.height
+            << " atlas, " << lightmap.rays << " rays, ambient " << lightOptions.ambient << std::endl;
+    }
+    log << "  - BSP: " << tree.nodes.size() << " nodes, " << tree.leafs.size() << " leafs, "
+        << tree.numClusters << " clusters, " << tree.portals.size() << " portals" << std::endl;
+    log << "  - Textures: " << textures.size() << ", " << rawTextureBytes / 1024 << " KB raw -> "
+        << packedTextureBytes / 1024 << " KB block compressed with " << texLevels.size() << " mip levels" << std::endl;
+    if (options.compress)
+        log << "  - Compression: " << writer.GetRawSize() / 1024 << " KB -> " << writer.GetStoredSize() / 1024 << " KB LZ4" << std::endl;
+    log << "  - PVS: " << averageVisible << " clusters visible on average" << std::endl;
+    if (options.useCache) {
+        log << "  - Cache: " << brushesReused << "/" << parsedBrushes.size() << " brushes, " << clipsReused << "/" << parsedBrushes.size()
+            << " CSG clips, " << texturesReused << "/" << textures.size() << " textures, " << lightmap.reusedTiles << "/" << lightmap.tiles
+            << " lightmap tiles, " << portalsReused << "/" << tree.portals.size() * 2 << " vis portals reused" << std::endl;
+    }
+    if (options.profile) ReportProfile(profiler, inputPath, outputPath, log);
+    return true;
+}
+
+bool CompileMesh(const std::string& inputPath, const std::string& outputPath, const MapCompileOptions& options, std::ostream& log) {
+    AStageProfiler profiler;
+    AMeshExportOptions meshOptions;
+    meshOptions.vertexFormat = options.vertexFormat;
+    meshOptions.compress = options.compress;
+    meshOptions.optimize = options.optimizeMeshes;
+    meshOptions.numLODs = options.meshLODs;
+    meshOptions.maxHulls = options.meshHulls;
+    bool ok = AMeshLoader::ExportToAnvMesh(inputPath, outputPath, meshOptions, log, &profiler);
+    if (ok && options.profile) ReportProfile(profiler, inputPath, outputPath, log);
+    return ok;
 }
 
 int main(int argc, char** argv) {
     if (argc < 3) {
-        std::cout << "Usage: Anvil_Compile [map/mesh] [file]" << std::endl;
+        std::cout << "Usage: Anvil_Compile [map/mesh/lexbench] [file] [-o output] [-threads N] [-pow2] [-fill] [-nocache] [-bounces N] [-ambient N] [-profile] [-compactverts] [-quantize] [-compress] [-nomeshopt] [-lods N] [-hulls N]" << std::endl;
+        std::cout << "       Anvil_Compile batch [manifest/directory] [-outdir dir] [-jobs N] [-force] [map options]" << std::endl;
         return 1;
     }
 
+    MapCompileOptions options;
+    BatchOptions batchOptions;
+    std::string outputPath;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-threads" && i + 1 < argc) {
+            ThreadPool::SetDefaultThreadCount((unsigned)std::max(0, atoi(argv[++i])));
+        }
+        else if (arg == "-pow2") {
+            options.powerOfTwo = true;
+        }
+        else if (arg == "-fill") {
+            options.fillOutside = true;
+        }
+        else if (arg == "-nocache") {
+            options.useCache = false;
+        }
+        else if (arg == "-bounces" && i + 1 < argc) {
+            options.bounces = std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "-ambient" && i + 1 < argc) {
+            options.ambient = std::max(0.0f, (float)atof(argv[++i]));
+        }
+        else if (arg == "-o" && i + 1 < argc) {
+            outputPath = argv[++i];
+        }
+        else if (arg == "-outdir" && i + 1 < argc) {
+            batchOptions.outDir = argv[++i];
+        }
+        else if (arg == "-jobs" && i + 1 < argc) {
+            batchOptions.jobs = (unsigned)std::max(0, atoi(argv[++i]));
+        }
+        else if (arg == "-force") {
+            batchOptions.force = true;
+        }
+        else if (arg == "-profile" || arg == "--profile") {
+            options.profile = true;
+        }
+        else if (arg == "-compactverts") {
+            options.vertexFormat = EVertexFormat::Packed;
+        }
+        else if (arg == "-quantize") {
+            options.vertexFormat = EVertexFormat::Quantized;
+        }
+        else if (arg == "-compress") {
+            options.compress = true;
+        }
+        else if (arg == "-nomeshopt") {
+            options.optimizeMeshes = false;
+        }
+        else if (arg == "-lods" && i + 1 < argc) {
+            options.meshLODs = (unsigned)std::max(1, atoi(argv[++i]));
+        }
+        else if (arg == "-hulls" && i + 1 < argc) {
+            options.meshHulls = (unsigned)std::max(0, atoi(argv[++i]));
+        }
+    }
+
     std::string mode = argv[1];
     std::string inputPath = argv[2];
 
     if (mode == "map") {
-        CompileMap(inputPath.c_str());
+        // world.absp in the working directory is what the engine loads by default
+        if (outputPath.empty()) outputPath = "world.absp";
+        return CompileMap(inputPath.c_str(), outputPath, options, std::cout) ? 0 : 1;
+    }
+    else if (mode == "lexbench") {
+        BenchmarkMapLexer(inputPath.c_str());
     }
     else if (mode == "mesh") {
         fs::path p(inputPath);
-        std::string outPath = p.replace_extension(".anvmesh").string();
+        if (outputPath.empty()) outputPath = p.replace_extension(".anvmesh").string();
 
         // Use the centralized loader class for the export!
-        AMeshLoader::ExportToAnvMesh(inputPath, outPath);
+        return CompileMesh(inputPath, outputPath, options, std::cout) ? 0 : 1;
+    }
+    else if (mode == "batch") {
+        std::vector<BatchJob> jobs;
+        if (!CollectBatchJobs(inputPath, batchOptions, jobs)) return 1;
+        size_t failed = RunBatch(jobs, batchOptions, [&](const BatchJob& job, std::ostream& log) {
+            if (job.kind == EBatchKind::Map) return CompileMap(job.input.c_str(), job.output, options, log);
+            return CompileMesh(job.input, job.output, options, log);
+        });
+        return failed ? 1 : 0;
     }
 
     return 0;
@@ -0,0 +1,243 @@
+#include "MapLexer.h"
+#include "AMappedFile.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+bool LooksNumeric(std::string_view text)
+{
+    char c = text.empty() ? 0 : text[0];
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+}
+} // namespace
+
+MapLexer::MapLexer(std::string_view source, std::string fileName)
+    : m_source(source), m_fileName(std::move(fileName))
+{
+}
+
+void MapLexer::Advance()
+{
+    if (m_source[m_pos] == '\n')
+    {
+        m_line++;
+        m_lineStart = m_pos + 1;
+    }
+    m_pos++;
+}
+
+bool MapLexer::Next(MapToken& token)
+{
+    if (m_failed)
+        return false;
+
+    // Whitespace and // comments
+    for (;;)
+    {
+        while (m_pos < m_source.size() && IsSpace(m_source[m_pos]))
+            Advance();
+        if (m_pos + 1 < m_source.size() && m_source[m_pos] == '/' && m_source[m_pos + 1] == '/')
+        {
+            while (m_pos < m_source.size() && m_source[m_pos] != '\n')
+                m_pos++;
+            continue;
+        }
+        break;
+    }
+    if (m_pos >= m_source.size())
+        return false;
+
+    token.line   = m_line;
+    token.column = (uint32_t) (m_pos - m_lineStart + 1);
+    token.quoted = m_source[m_pos] == '"';
+
+    if (token.quoted)
+    {
+        size_t start = ++m_pos;
+        while (m_pos < m_source.size() && m_source[m_pos] != '"' && m_source[m_pos] != '\n')
+            m_pos++;
+        if (m_pos >= m_source.size() || m_source[m_pos] != '"')
+        {
+            Error(token, "unterminated string");
+            return false;
+        }
+        token.text = m_source.substr(start, m_pos - start);
+        m_pos++;
+    }
+    else
+    {
+        size_t start = m_pos;
+        while (m_pos < m_source.size() && !IsSpace(m_source[m_pos]))
+            m_pos++;
+        token.text = m_source.substr(start, m_pos - start);
+    }
+
+    m_tokenCount++;
+    return true;
+}
+
+bool MapLexer::Require(MapToken& token, const char* what)
+{
+    if (Next(token))
+        return true;
+    if (!m_failed)
+    {
+        MapToken end;
+        end.line   = m_line;
+        end.column = (uint32_t) (m_pos - m_lineStart + 1);
+        Error(end, std::string("unexpected end of file, expected ") + what);
+    }
+    return false;
+}
+
+bool MapLexer::Expect(std::string_view symbol)
+{
+    MapToken token;
+    if (!Require(token, std::string(symbol).c_str()))
+        return false;
+    if (token.quoted || token.text != symbol)
+    {
+        Error(token, "expected '" + std::string(symbol) + "' but found '" + std::string(token.text) +
+                         "'");
+        return false;
+    }
+    return true;
+}
+
+bool MapLexer::ExpectNumber(float& out)
+{
+    MapToken token;
+    if (!Require(token, "a number"))
+        return false;
+    if (token.quoted || !ParseMapNumber(token.text, out))
+    {
+        Error(token, "expected a number but found '" + std::string(token.text) + "'");
+        return false;
+    }
+    return true;
+}
+
+void MapLexer::SkipLine()
+{
+    while (m_pos < m_source.size() && m_source[m_pos] != '\n')
+        m_pos++;
+}
+
+void MapLexer::Error(const MapToken& at, const std::string& message)
+{
+    // file(line,col) so Visual Studio can jump to it from the output window
+    std::cout << "[Anvil Compiler] Error: " << m_fileName << "(" << at.line << "," << at.column
+              << "): " << message << std::endl;
+    m_failed = true;
+}
+
+bool ParseMapNumber(std::string_view text, float& out)
+{
+    // from_chars doesn't take a leading plus
+    if (!text.empty() && text[0] == '+')
+        text.remove_prefix(1);
+    const char* end    = text.data() + text.size();
+    auto        result = std::from_chars(text.data(), end, out);
+    return !text.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+bool ParseMapNumbers(std::string_view text, float* out, int count)
+{
+    int found = 0;
+    while (!text.empty())
+    {
+        size_t start = text.find_first_not_of(' ');
+        if (start == std::string_view::npos)
+            break;
+        text.remove_prefix(start);
+        size_t end = std::min(text.find(' '), text.size());
+        if (found == count || !ParseMapNumber(text.substr(0, end), out[found]))
+            return false;
+        found++;
+        text.remove_prefix(end);
+    }
+    return found == count;
+}
+
+void BenchmarkMapLexer(const char* path)
+{
+    using Clock            = std::chrono::steady_clock;
+    constexpr int   PASSES = 5;
+    volatile float  sink   = 0.0f; // keeps the number parsing from being optimized out
+    size_t          bytes  = 0;
+
+    // How the compiler used to read maps: stream extraction into a std::string per token
+    double streamSeconds = 1e30;
+    size_t streamTokens  = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        auto          start = Clock::now();
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "[Anvil Compiler] Error: Map not found " << path << std::endl;
+            return;
+        }
+        std::string token;
+        size_t      count = 0;
+        float       sum   = 0.0f;
+        while (file >> token)
+        {
+            count++;
+            if (LooksNumeric(token))
+                sum += std::strtof(token.c_str(), nullptr);
+        }
+        sink          = sink + sum;
+        streamTokens  = count;
+        streamSeconds = std::min(streamSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    double lexerSeconds = 1e30;
+    size_t lexerTokens  = 0;
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        auto        start = Clock::now();
+        AMappedFile file;
+        if (!file.Open(path))
+        {
+            std::cout << "[Anvil Compiler] Error: Map not found " << path << std::endl;
+            return;
+        }
+        bytes = file.GetSize();
+        MapLexer lex(file.GetText(), path);
+        MapToken token;
+        float    sum = 0.0f, value;
+        while (lex.Next(token))
+        {
+            if (!token.quoted && LooksNumeric(token.text) && ParseMapNumber(token.text, value))
+                sum += value;
+        }
+        sink         = sink + sum;
+        lexerTokens  = lex.GetTokenCount();
+        lexerSeconds = std::min(lexerSeconds, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    auto report = [&](const char* name, size_t tokens, double seconds) {
+        std::cout << "  - " << name << ": " << seconds * 1000.0 << " ms, "
+                  << (size_t) (tokens / seconds) << " tokens/sec, "
+                  << bytes / seconds / (1024.0 * 1024.0) << " MB/sec" << std::endl;
+    };
+    std::cout << "[Anvil Compiler] Lexer benchmark: " << path << " (" << bytes << " bytes, best of "
+              << PASSES << " runs)" << std::endl;
+    report("iostream", streamTokens, streamSeconds);
+    report("MapLexer", lexerTokens, lexerSeconds);
+    std::cout << "  - Speedup: " << streamSeconds / lexerSeconds << "x" << std::endl;
+    // Comments are tokens to the stream version, so the counts can differ a little
+    if (streamTokens != lexerTokens)
+        std::cout << "  - Note: " << streamTokens << " vs " << lexerTokens << " tokens" << std::endl;
+}
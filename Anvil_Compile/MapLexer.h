@@ -0,0 +1,96 @@
+#pragma once
+// MapLexer.h
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+struct MapToken
+{
+    std::string_view text;        // points into the source, quotes stripped
+    uint32_t         line   = 0;  // 1 based
+    uint32_t         column = 0;  // 1 based
+    bool             quoted = false;
+};
+
+/**
+ * @class MapLexer
+ * @brief Splits a Quake .map file into whitespace separated tokens without copying it
+ * Tokens are views into the source buffer, so the buffer has to outlive them. Quoted strings are
+ * a single token and // comments are skipped.
+ */
+class MapLexer
+{
+  public:
+    /**
+     * @param source The whole file
+     * @param fileName Used in diagnostics
+     */
+    MapLexer(std::string_view source, std::string fileName);
+
+    /**
+     * @brief Reads the next token
+     * @return false at the end of the input or after an error
+     */
+    bool Next(MapToken& token);
+    /**
+     * @brief Reads the next token, reporting an error if there is none
+     * @param what What was expected, for the error message
+     */
+    bool Require(MapToken& token, const char* what);
+    /**
+     * @brief Reads the next token and checks it's the given symbol
+     */
+    bool Expect(std::string_view symbol);
+    /**
+     * @brief Reads the next token as a number
+     */
+    bool ExpectNumber(float& out);
+    /**
+     * @brief Skips whatever is left on the current line
+     */
+    void SkipLine();
+
+    /**
+     * @brief Prints a diagnostic with the token's position and stops the lexer
+     */
+    void Error(const MapToken& at, const std::string& message);
+
+    bool Failed() const
+    {
+        return m_failed;
+    }
+    size_t GetTokenCount() const
+    {
+        return m_tokenCount;
+    }
+
+  private:
+    void Advance();
+
+    std::string_view m_source;
+    std::string      m_fileName;
+    size_t           m_pos        = 0;
+    uint32_t         m_line       = 1;
+    size_t           m_lineStart  = 0; // offset of the first character of m_line
+    size_t           m_tokenCount = 0;
+    bool             m_failed     = false;
+};
+
+/**
+ * @brief Parses a number token with std::from_chars
+ * @return false if the token isn't a number or has trailing junk
+ */
+bool ParseMapNumber(std::string_view text, float& out);
+
+/**
+ * @brief Parses a space separated list of numbers, like the value of an "origin" key
+ * @return false unless exactly count numbers were found
+ */
+bool ParseMapNumbers(std::string_view text, float* out, int count);
+
+/**
+ * @brief Times a full tokenize of the file with iostreams and with MapLexer and prints tokens/sec
+ * @param path .map file to read
+ */
+void BenchmarkMapLexer(const char* path);
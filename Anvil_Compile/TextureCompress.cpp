@@ -0,0 +1,342 @@
+#include "TextureCompress.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define ANVIL_BC_SSE2 1
+#include <emmintrin.h>
+#else
+#define ANVIL_BC_SSE2 0
+#endif
+
+namespace
+{
+// 16 RGBA8 pixels of a 4x4 block, row by row
+using Block = uint8_t[64];
+
+uint16_t Pack565(float r, float g, float b)
+{
+    int r5 = std::clamp((int) std::lround(r * 31.0f / 255.0f), 0, 31);
+    int g6 = std::clamp((int) std::lround(g * 63.0f / 255.0f), 0, 63);
+    int b5 = std::clamp((int) std::lround(b * 31.0f / 255.0f), 0, 31);
+    return (uint16_t) ((r5 << 11) | (g6 << 5) | b5);
+}
+
+void Unpack565(uint16_t c, int out[3])
+{
+    int r5 = (c >> 11) & 31, g6 = (c >> 5) & 63, b5 = c & 31;
+    out[0]   = (r5 << 3) | (r5 >> 2);
+    out[1]   = (g6 << 2) | (g6 >> 4);
+    out[2]   = (b5 << 3) | (b5 >> 2);
+}
+
+/**
+ * Picks the closest of the 4 palette colors for every pixel of the block.
+ * Returns the summed squared RGB error, ties go to the lower index.
+ */
+uint32_t SelectColorIndices(const Block block, const int palette[4][3], uint8_t indices[16])
+{
+    uint32_t total = 0;
+#if ANVIL_BC_SSE2
+    const __m128i zero      = _mm_setzero_si128();
+    const __m128i rgbMask   = _mm_set1_epi32(0x00FFFFFF);
+    __m128i       colors[4];
+    for (int k = 0; k < 4; k++)
+    {
+        colors[k] = _mm_set_epi16(0, (short) palette[k][2], (short) palette[k][1], (short) palette[k][0],
+                                  0, (short) palette[k][2], (short) palette[k][1], (short) palette[k][0]);
+    }
+
+    // Four pixels at a time, each widened to 16 bit lanes so madd gives r*r + g*g and b*b
+    for (int q = 0; q < 4; q++)
+    {
+        __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*) (block + q * 16)), rgbMask);
+        __m128i lo = _mm_unpacklo_epi8(px, zero);
+        __m128i hi = _mm_unpackhi_epi8(px, zero);
+
+        __m128i best    = _mm_set1_epi32(INT_MAX);
+        __m128i bestIdx = zero;
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i dl   = _mm_sub_epi16(lo, colors[k]);
+            __m128i dh   = _mm_sub_epi16(hi, colors[k]);
+            __m128  sl   = _mm_castsi128_ps(_mm_madd_epi16(dl, dl));
+            __m128  sh   = _mm_castsi128_ps(_mm_madd_epi16(dh, dh));
+            __m128i d    = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(2, 0, 2, 0))),
+                                         _mm_castps_si128(_mm_shuffle_ps(sl, sh, _MM_SHUFFLE(3, 1, 3, 1))));
+            __m128i less = _mm_cmplt_epi32(d, best);
+            best         = _mm_or_si128(_mm_and_si128(less, d), _mm_andnot_si128(less, best));
+            bestIdx      = _mm_or_si128(_mm_and_si128(less, _mm_set1_epi32(k)), _mm_andnot_si128(less, bestIdx));
+        }
+
+        alignas(16) uint32_t dist[4], idx[4];
+        _mm_store_si128((__m128i*) dist, best);
+        _mm_store_si128((__m128i*) idx, bestIdx);
+        for (int i = 0; i < 4; i++)
+        {
+            indices[q * 4 + i] = (uint8_t) idx[i];
+            total += dist[i];
+        }
+    }
+#else
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t best = UINT_MAX;
+        for (int k = 0; k < 4; k++)
+        {
+            int      dr = block[i * 4] - palette[k][0];
+            int      dg = block[i * 4 + 1] - palette[k][1];
+            int      db = block[i * 4 + 2] - palette[k][2];
+            uint32_t d  = (uint32_t) (dr * dr + dg * dg + db * db);
+            if (d < best)
+            {
+                best       = d;
+                indices[i] = (uint8_t) k;
+            }
+        }
+        total += best;
+    }
+#endif
+    return total;
+}
+
+// Palette order matches the index values: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+uint32_t TryEndpoints(const Block block, uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+    int palette[4][3];
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    for (int j = 0; j < 3; j++)
+    {
+        palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+        palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+    }
+    return SelectColorIndices(block, palette, indices);
+}
+
+/**
+ * Least squares fit of the two endpoints to the pixels, given which palette entry each pixel uses.
+ * Returns false if every pixel sits on the same entry.
+ */
+bool RefineEndpoints(const Block block, const uint8_t indices[16], uint16_t& c0, uint16_t& c1)
+{
+    static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float a = weights[indices[i]], b = 1.0f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int j = 0; j < 3; j++)
+        {
+            ax[j] += a * block[i * 4 + j];
+            bx[j] += b * block[i * 4 + j];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f)
+        return false;
+
+    float e0[3], e1[3];
+    for (int j = 0; j < 3; j++)
+    {
+        e0[j] = (ax[j] * bb - bx[j] * ab) / det;
+        e1[j] = (bx[j] * aa - ax[j] * ab) / det;
+    }
+    c0 = Pack565(e0[0], e0[1], e0[2]);
+    c1 = Pack565(e1[0], e1[1], e1[2]);
+    return true;
+}
+
+void EncodeColorBlock(const Block block, uint8_t* out)
+{
+    uint16_t c0 = 0, c1 = 0;
+    uint8_t  indices[16] = {};
+
+    float mean[3] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int j = 0; j < 3; j++)
+            mean[j] += block[i * 4 + j] / 16.0f;
+    }
+
+    // Covariance of the colors, the endpoints go along its principal axis
+    float cov[6] = {};
+    float mins[3] = {255, 255, 255}, maxs[3] = {};
+    for (int i = 0; i < 16; i++)
+    {
+        float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+        cov[0] += r * r;
+        cov[1] += r * g;
+        cov[2] += r * b;
+        cov[3] += g * g;
+        cov[4] += g * b;
+        cov[5] += b * b;
+        for (int j = 0; j < 3; j++)
+        {
+            mins[j] = std::min(mins[j], (float) block[i * 4 + j]);
+            maxs[j] = std::max(maxs[j], (float) block[i * 4 + j]);
+        }
+    }
+
+    if (mins[0] == maxs[0] && mins[1] == maxs[1] && mins[2] == maxs[2])
+    {
+        // Solid block, both endpoints the same and every index 0
+        c0 = c1 = Pack565(mins[0], mins[1], mins[2]);
+    }
+    else
+    {
+        float axis[3] = {maxs[0] - mins[0], maxs[1] - mins[1], maxs[2] - mins[2]};
+        for (int iter = 0; iter < 4; iter++)
+        {
+            float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+            float m = std::max(std::abs(x), std::max(std::abs(y), std::abs(z)));
+            if (m < 1e-6f)
+                break;
+            axis[0] = x / m;
+            axis[1] = y / m;
+            axis[2] = z / m;
+        }
+
+        int   minPixel = 0, maxPixel = 0;
+        float minDot = 1e30f, maxDot = -1e30f;
+        for (int i = 0; i < 16; i++)
+        {
+            float d = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] + block[i * 4 + 2] * axis[2];
+            if (d < minDot)
+            {
+                minDot   = d;
+                minPixel = i;
+            }
+            if (d > maxDot)
+            {
+                maxDot   = d;
+                maxPixel = i;
+            }
+        }
+        const uint8_t* hi = block + maxPixel * 4;
+        const uint8_t* lo = block + minPixel * 4;
+        c0                = Pack565(hi[0], hi[1], hi[2]);
+        c1                = Pack565(lo[0], lo[1], lo[2]);
+
+        uint32_t error = TryEndpoints(block, c0, c1, indices);
+
+        uint16_t r0 = c0, r1 = c1;
+        uint8_t  refined[16];
+        if (RefineEndpoints(block, indices, r0, r1) && TryEndpoints(block, r0, r1, refined) < error)
+        {
+            c0 = r0;
+            c1 = r1;
+            memcpy(indices, refined, sizeof(indices));
+        }
+    }
+
+    // c0 > c1 selects the four color mode, equal endpoints would mean three colors and black
+    if (c0 < c1)
+    {
+        std::swap(c0, c1);
+        for (auto& i : indices)
+            i ^= 1;
+    }
+    if (c0 == c1)
+        memset(indices, 0, sizeof(indices));
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint32_t) indices[i] << (i * 2);
+    memcpy(out, &c0, 2);
+    memcpy(out + 2, &c1, 2);
+    memcpy(out + 4, &bits, 4);
+}
+
+// Eight level mode, a0 is the largest alpha so index 0 is a0, 1 is a1, 2..7 step from a0 to a1
+void EncodeAlphaBlock(const Block block, uint8_t* out)
+{
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        lo = std::min(lo, (int) block[i * 4 + 3]);
+        hi = std::max(hi, (int) block[i * 4 + 3]);
+    }
+
+    uint64_t bits = 0;
+    if (hi > lo)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int level = (int) std::lround((block[i * 4 + 3] - lo) * 7.0f / (hi - lo));
+            int index = level == 7 ? 0 : level == 0 ? 1 : 8 - level;
+            bits |= (uint64_t) index << (i * 3);
+        }
+    }
+
+    out[0] = (uint8_t) hi;
+    out[1] = (uint8_t) lo;
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (uint8_t) (bits >> (i * 8));
+}
+
+template <typename EncodeFn>
+std::vector<uint8_t> CompressBlocks(const uint8_t* rgba, uint32_t width, uint32_t height,
+                                    uint32_t blockBytes, EncodeFn encode)
+{
+    uint32_t             blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::vector<uint8_t> out(CompressedImageSize(width, height, blockBytes));
+
+    ThreadPool::Get().ParallelFor(blocksY, [&](size_t by) {
+        Block block;
+        for (uint32_t bx = 0; bx < blocksX; bx++)
+        {
+            for (uint32_t y = 0; y < 4; y++)
+            {
+                uint32_t sy = std::min<uint32_t>((uint32_t) by * 4 + y, height - 1);
+                for (uint32_t x = 0; x < 4; x++)
+                {
+                    uint32_t sx = std::min(bx * 4 + x, width - 1);
+                    memcpy(block + (y * 4 + x) * 4, rgba + ((size_t) sy * width + sx) * 4, 4);
+                }
+            }
+            encode(block, out.data() + (by * blocksX + bx) * blockBytes);
+        }
+    });
+    return out;
+}
+} // namespace
+
+bool HasTranslucentPixels(const uint8_t* rgba, size_t numPixels)
+{
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        if (rgba[i * 4 + 3] != 255)
+            return true;
+    }
+    return false;
+}
+
+size_t CompressedImageSize(uint32_t width, uint32_t height, uint32_t blockBytes)
+{
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+std::vector<uint8_t> CompressBC1(const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+    return CompressBlocks(rgba, width, height, 8,
+                          [](const Block block, uint8_t* out) { EncodeColorBlock(block, out); });
+}
+
+std::vector<uint8_t> CompressBC3(const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+    return CompressBlocks(rgba, width, height, 16, [](const Block block, uint8_t* out) {
+        EncodeAlphaBlock(block, out);
+        EncodeColorBlock(block, out + 8);
+    });
+}
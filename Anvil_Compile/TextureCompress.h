@@ -0,0 +1,35 @@
+#pragma once
+// TextureCompress.h
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Checks whether any pixel is not fully opaque
+ * @param rgba RGBA8 pixels
+ * @param numPixels Number of pixels
+ */
+bool HasTranslucentPixels(const uint8_t* rgba, size_t numPixels);
+
+/**
+ * @brief Size of a block compressed image
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param blockBytes 8 for BC1, 16 for BC3
+ */
+size_t CompressedImageSize(uint32_t width, uint32_t height, uint32_t blockBytes);
+
+/**
+ * @brief Compresses RGBA8 pixels to BC1 (DXT1), ignoring alpha
+ * Blocks that hang over the right or bottom edge repeat the last column or row.
+ * @param rgba RGBA8 pixels, width * height * 4 bytes
+ * @return 8 bytes per 4x4 block, row by row
+ */
+std::vector<uint8_t> CompressBC1(const uint8_t* rgba, uint32_t width, uint32_t height);
+
+/**
+ * @brief Compresses RGBA8 pixels to BC3 (DXT5), interpolated alpha followed by a BC1 color block
+ * @param rgba RGBA8 pixels, width * height * 4 bytes
+ * @return 16 bytes per 4x4 block, row by row
+ */
+std::vector<uint8_t> CompressBC3(const uint8_t* rgba, uint32_t width, uint32_t height);
@@ -0,0 +1,147 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+unsigned g_defaultThreads = 0;
+// Set on worker threads so they push to and pop from their own queue
+thread_local ThreadPool* t_pool  = nullptr;
+thread_local size_t      t_queue = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned numThreads)
+{
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Index 0 is shared by the threads outside the pool
+    for (unsigned i = 0; i < numThreads; i++)
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    for (unsigned i = 1; i < numThreads; i++)
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this, (size_t) i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+}
+
+ThreadPool& ThreadPool::Get()
+{
+    static ThreadPool pool(g_defaultThreads);
+    return pool;
+}
+
+void ThreadPool::SetDefaultThreadCount(unsigned numThreads)
+{
+    g_defaultThreads = numThreads;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn, size_t grain)
+{
+    if (count == 0)
+        return;
+    grain = std::max<size_t>(1, grain);
+
+    if (m_workers.empty() || count <= grain)
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    std::atomic<size_t> remaining((count + grain - 1) / grain);
+    for (size_t begin = 0; begin < count; begin += grain)
+    {
+        size_t end = std::min(count, begin + grain);
+        Push([&fn, &remaining, begin, end]() {
+            for (size_t i = begin; i < end; i++)
+                fn(i);
+            remaining.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    // Help out until our own tasks are done, whoever ends up running them
+    while (remaining.load(std::memory_order_acquire) > 0)
+    {
+        if (!RunOne())
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::Push(std::function<void()> task)
+{
+    size_t index = t_pool == this ? t_queue : 0;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->lock);
+        m_queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_wake.notify_one();
+}
+
+bool ThreadPool::RunOne()
+{
+    std::function<void()> task;
+    size_t                self = t_pool == this ? t_queue : 0;
+
+    // Newest work from our own queue first, it's still warm in the cache
+    {
+        TaskQueue&                  q = *m_queues[self];
+        std::lock_guard<std::mutex> lock(q.lock);
+        if (!q.tasks.empty())
+        {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        }
+    }
+
+    // Otherwise steal the oldest task from somebody else
+    if (!task)
+    {
+        size_t start = m_nextQueue.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < m_queues.size() && !task; i++)
+        {
+            TaskQueue& q = *m_queues[(start + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(q.lock);
+            if (!q.tasks.empty())
+            {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+        }
+    }
+
+    if (!task)
+        return false;
+
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+}
+
+void ThreadPool::WorkerLoop(size_t index)
+{
+    t_pool  = this;
+    t_queue = index;
+
+    for (;;)
+    {
+        if (RunOne())
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_wakeLock);
+        m_wake.wait(lock, [this]() { return m_stop || m_queued.load() > 0; });
+        if (m_stop)
+            return;
+    }
+}
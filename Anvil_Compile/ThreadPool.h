@@ -0,0 +1,71 @@
+#pragma once
+// ThreadPool.h
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool
+ * @brief Work-stealing pool used by the compiler stages
+ * Every worker owns a queue, takes work from the back of it and steals from the front of the
+ * others when it runs dry. Threads waiting on a ParallelFor help out instead of sleeping, so
+ * loops can be nested from inside tasks.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * @brief Creates the pool
+     * @param numThreads Total threads doing work, including the caller. 1 runs everything inline
+     */
+    explicit ThreadPool(unsigned numThreads);
+    ~ThreadPool();
+
+    /**
+     * @brief Shared pool for the whole compiler, sized by SetDefaultThreadCount
+     */
+    static ThreadPool& Get();
+    /**
+     * @brief Sets the size of the shared pool, must be called before the first Get()
+     * @param numThreads Thread count, 0 uses every hardware thread
+     */
+    static void        SetDefaultThreadCount(unsigned numThreads);
+
+    /**
+     * @brief Calls fn(i) for every i in [0, count) and returns once all calls are done
+     * @param count Number of items
+     * @param fn Function to run for each item, must be safe to call concurrently
+     * @param grain Items handed out per task
+     */
+    void ParallelFor(size_t count, const std::function<void(size_t)>& fn, size_t grain = 1);
+
+    unsigned GetThreadCount() const
+    {
+        return (unsigned) m_workers.size() + 1;
+    }
+
+  private:
+    struct TaskQueue
+    {
+        std::mutex                        lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void Push(std::function<void()> task);
+    bool RunOne();
+    void WorkerLoop(size_t index);
+
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::vector<std::thread>                m_workers;
+    std::atomic<size_t>                     m_queued{0};
+    std::atomic<size_t>                     m_nextQueue{0};
+    std::mutex                              m_wakeLock;
+    std::condition_variable                 m_wake;
+    bool                                    m_stop = false;
+};
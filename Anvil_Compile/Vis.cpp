@@ -0,0 +1,418 @@
+#include "Vis.h"
+#include "CompileCache.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+constexpr float VIS_EPSILON = 0.001f;
+
+// One way portal, looking out of the cluster that owns it
+struct VisPortal
+{
+    Winding              winding;
+    APlane               plane;   // faces into the cluster it leads to
+    int32_t              cluster; // cluster on the other side
+    std::vector<uint8_t> mightSee;
+    std::vector<uint8_t> vis;
+    bool                 done = false;
+    uint64_t             key  = 0; // its winding and the leafs on both sides
+};
+
+struct VisState
+{
+    std::vector<VisPortal>             portals;
+    std::vector<std::vector<uint32_t>> clusterPortals;
+    size_t                             rowBytes = 0;
+};
+
+struct FlowFrame
+{
+    Winding              source;
+    Winding              pass;
+    APlane               plane;
+    std::vector<uint8_t> mightSee;
+};
+
+bool TestBit(const std::vector<uint8_t>& bits, int32_t i)
+{
+    return (bits[i >> 3] & (1 << (i & 7))) != 0;
+}
+
+void SetBit(std::vector<uint8_t>& bits, int32_t i)
+{
+    bits[i >> 3] |= (uint8_t) (1 << (i & 7));
+}
+
+/**
+ * Flood fill through every portal that is at least partly in front of the source portal.
+ * This is a cheap, conservative bound that the real flow then refines.
+ */
+void BasePortalVis(VisState& s, uint32_t index)
+{
+    VisPortal&        p = s.portals[index];
+    std::vector<bool> inFront(s.portals.size(), false);
+    for (size_t i = 0; i < s.portals.size(); i++)
+    {
+        if (i == index)
+            continue;
+        const VisPortal& q = s.portals[i];
+
+        bool front = false;
+        for (const auto& pt : q.winding)
+        {
+            if (glm::dot(pt, p.plane.normal) - p.plane.distance > VIS_EPSILON)
+            {
+                front = true;
+                break;
+            }
+        }
+        if (!front)
+            continue;
+
+        bool behind = false;
+        for (const auto& pt : p.winding)
+        {
+            if (glm::dot(pt, q.plane.normal) - q.plane.distance < -VIS_EPSILON)
+            {
+                behind = true;
+                break;
+            }
+        }
+        inFront[i] = behind;
+    }
+
+    p.mightSee.assign(s.rowBytes, 0);
+    std::vector<int32_t> stack = {p.cluster};
+    while (!stack.empty())
+    {
+        int32_t cluster = stack.back();
+        stack.pop_back();
+        if (TestBit(p.mightSee, cluster))
+            continue;
+        SetBit(p.mightSee, cluster);
+        for (uint32_t q : s.clusterPortals[cluster])
+        {
+            if (inFront[q])
+                stack.push_back(s.portals[q].cluster);
+        }
+    }
+}
+
+/**
+ * Clips the target to the separating planes made from an edge of source and a point of pass.
+ * Anything seen through pass from source has to be on the pass side of those planes.
+ */
+bool ClipToSeparators(const Winding& source, const Winding& pass, Winding& target, bool flipClip)
+{
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        size_t    l  = (i + 1) % source.size();
+        glm::vec3 v1 = source[l] - source[i];
+
+        for (size_t j = 0; j < pass.size(); j++)
+        {
+            glm::vec3 v2 = pass[j] - source[i];
+            APlane    plane;
+            plane.normal = glm::cross(v1, v2);
+            float len    = glm::length(plane.normal);
+            if (len < VIS_EPSILON * VIS_EPSILON)
+                continue;
+            plane.normal /= len;
+            plane.distance = glm::dot(pass[j], plane.normal);
+
+            // Find out which side of the plane the source portal is on
+            bool   flipTest = false;
+            size_t k;
+            for (k = 0; k < source.size(); k++)
+            {
+                if (k == i || k == l)
+                    continue;
+                float d = glm::dot(source[k], plane.normal) - plane.distance;
+                if (d < -VIS_EPSILON)
+                {
+                    flipTest = false;
+                    break;
+                }
+                if (d > VIS_EPSILON)
+                {
+                    flipTest = true;
+                    break;
+                }
+            }
+            if (k == source.size())
+                continue; // planar with the source portal
+
+            if (flipTest)
+                plane = {-plane.normal, -plane.distance};
+
+            // It only separates if the whole pass portal is on the other side
+            int front = 0;
+            for (k = 0; k < pass.size(); k++)
+            {
+                if (k == j)
+                    continue;
+                float d = glm::dot(pass[k], plane.normal) - plane.distance;
+                if (d < -VIS_EPSILON)
+                    break;
+                if (d > VIS_EPSILON)
+                    front++;
+            }
+            if (k != pass.size() || !front)
+                continue;
+
+            if (flipClip)
+                plane = {-plane.normal, -plane.distance};
+
+            if (!ChopWinding(target, plane, VIS_EPSILON))
+                return false;
+        }
+    }
+    return true;
+}
+
+void RecursiveClusterFlow(VisState& s, const VisPortal& base, int32_t cluster,
+                          const FlowFrame& prev, bool hasPass, std::vector<uint8_t>& vis)
+{
+    SetBit(vis, cluster);
+
+    for (uint32_t index : s.clusterPortals[cluster])
+    {
+        const VisPortal& p = s.portals[index];
+        if (!TestBit(prev.mightSee, p.cluster))
+            continue;
+
+        // Skip portals that can't show anything we haven't seen yet
+        const std::vector<uint8_t>& test = p.done ? p.vis : p.mightSee;
+        FlowFrame                   next;
+        next.mightSee.resize(s.rowBytes);
+        bool more = false;
+        for (size_t j = 0; j < s.rowBytes; j++)
+        {
+            next.mightSee[j] = prev.mightSee[j] & test[j];
+            more |= (next.mightSee[j] & ~vis[j]) != 0;
+        }
+        if (!more)
+            continue;
+
+        // Can't go out a coplanar face
+        APlane backPlane = {-p.plane.normal, -p.plane.distance};
+        if (glm::dot(prev.plane.normal, backPlane.normal) > 1.0f - VIS_EPSILON * VIS_EPSILON)
+            continue;
+
+        next.plane = p.plane;
+        next.pass  = p.winding;
+        if (!ChopWinding(next.pass, base.plane, VIS_EPSILON))
+            continue;
+        next.source = prev.source;
+        if (!ChopWinding(next.source, backPlane, VIS_EPSILON))
+            continue;
+
+        // The second cluster can only be blocked if coplanar
+        if (!hasPass)
+        {
+            RecursiveClusterFlow(s, base, p.cluster, next, true, vis);
+            continue;
+        }
+
+        if (!ChopWinding(next.pass, prev.plane, VIS_EPSILON))
+            continue;
+        if (!ClipToSeparators(next.source, prev.pass, next.pass, false))
+            continue;
+        if (!ClipToSeparators(prev.pass, next.source, next.pass, true))
+            continue;
+
+        RecursiveClusterFlow(s, base, p.cluster, next, true, vis);
+    }
+}
+
+void PortalFlow(VisState& s, uint32_t index)
+{
+    VisPortal& p = s.portals[index];
+
+    FlowFrame head;
+    head.source   = p.winding;
+    head.plane    = p.plane;
+    head.mightSee = p.mightSee;
+
+    std::vector<uint8_t> vis(s.rowBytes, 0);
+    RecursiveClusterFlow(s, p, p.cluster, head, false, vis);
+
+    p.vis  = std::move(vis);
+    p.done = true;
+}
+
+void CompressRow(const std::vector<uint8_t>& row, std::vector<uint8_t>& out)
+{
+    for (size_t j = 0; j < row.size(); j++)
+    {
+        out.push_back(row[j]);
+        if (row[j])
+            continue;
+
+        uint8_t rep = 1;
+        for (j++; j < row.size(); j++)
+        {
+            if (row[j] || rep == 255)
+                break;
+            rep++;
+        }
+        out.push_back(rep);
+        j--;
+    }
+}
+} // namespace
+
+std::vector<uint8_t> ComputeVisibility(const BspTree& tree, CompileCache* cache,
+                                       float* averageVisible, size_t* reusedPortals)
+{
+    uint32_t numClusters = tree.numClusters;
+
+    std::vector<uint64_t> clusterKeys(numClusters, 0);
+    for (size_t i = 0; i < tree.leafs.size(); i++)
+    {
+        if (tree.leafs[i].cluster >= 0)
+            clusterKeys[tree.leafs[i].cluster] = tree.leafKeys[i];
+    }
+    auto portalKey = [&](const Winding& w, const APlane& plane, int32_t from, int32_t to) {
+        uint64_t key = HashBytes(w.data(), w.size() * sizeof(glm::vec3), HashBytes("VISP", 4));
+        key          = HashBytes(&plane, sizeof(plane), key);
+        key          = HashBytes(&clusterKeys[from], sizeof(uint64_t), key);
+        return HashBytes(&clusterKeys[to], sizeof(uint64_t), key);
+    };
+
+    VisState s;
+    s.rowBytes = (numClusters + 7) / 8;
+    s.clusterPortals.resize(numClusters);
+    for (const auto& bp : tree.portals)
+    {
+        int32_t c0 = tree.leafs[bp.leafs[0]].cluster;
+        int32_t c1 = tree.leafs[bp.leafs[1]].cluster;
+
+        VisPortal forward;
+        forward.winding = bp.winding;
+        forward.plane   = bp.plane;
+        forward.cluster = c1;
+        forward.key     = portalKey(bp.winding, bp.plane, c0, c1);
+        s.clusterPortals[c0].push_back((uint32_t) s.portals.size());
+        s.portals.push_back(std::move(forward));
+
+        VisPortal backward;
+        backward.winding = bp.winding;
+        backward.plane   = {-bp.plane.normal, -bp.plane.distance};
+        backward.cluster = c0;
+        backward.key     = portalKey(bp.winding, backward.plane, c1, c0);
+        s.clusterPortals[c1].push_back((uint32_t) s.portals.size());
+        s.portals.push_back(std::move(backward));
+    }
+
+    // The flow out of a portal only ever looks at the portals of the clusters it ends up
+    // seeing. So while those clusters have the same portals, it sees the same thing as last time
+    std::unordered_map<uint64_t, int32_t> stateClusters;
+    std::vector<uint64_t>                 stateKeys(numClusters, 0);
+    for (uint32_t c = 0; c < numClusters; c++)
+    {
+        uint64_t portals = 0;
+        for (uint32_t index : s.clusterPortals[c])
+            portals += HashBytes(&s.portals[index].key, sizeof(uint64_t)); // any order
+        stateKeys[c] = HashBytes(&portals, sizeof(portals), clusterKeys[c]);
+        // Two clusters with the same key can't be told apart, neither gets reused
+        auto added = stateClusters.emplace(stateKeys[c], (int32_t) c);
+        if (!added.second)
+            added.first->second = -1;
+    }
+
+    // Cached as the state keys of the clusters the portal saw
+    size_t               reused = 0;
+    std::vector<uint8_t> cached;
+    for (auto& p : s.portals)
+    {
+        if (!cache || !cache->FindStage(p.key, cached) || cached.size() % sizeof(uint64_t))
+            continue;
+        std::vector<uint8_t> vis(s.rowBytes, 0);
+        bool                 valid = true;
+        for (size_t i = 0; valid && i < cached.size(); i += sizeof(uint64_t))
+        {
+            uint64_t key;
+            memcpy(&key, cached.data() + i, sizeof(key));
+            auto it = stateClusters.find(key);
+            valid   = it != stateClusters.end() && it->second >= 0;
+            if (valid)
+                SetBit(vis, it->second);
+        }
+        if (!valid)
+            continue;
+        p.vis  = std::move(vis);
+        p.done = true;
+        reused++;
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < s.portals.size(); i++)
+    {
+        if (!s.portals[i].done)
+        {
+            BasePortalVis(s, i);
+            order.push_back(i);
+        }
+    }
+
+    // Portals that see the least go first so the others can reuse their results
+    std::vector<size_t> mightCount(s.portals.size(), 0);
+    for (uint32_t i : order)
+    {
+        for (int32_t c = 0; c < (int32_t) numClusters; c++)
+            mightCount[i] += TestBit(s.portals[i].mightSee, c) ? 1 : 0;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return mightCount[a] < mightCount[b]; });
+    for (uint32_t index : order)
+        PortalFlow(s, index);
+
+    if (cache)
+    {
+        for (const auto& p : s.portals)
+        {
+            std::vector<uint8_t> seen;
+            for (int32_t c = 0; c < (int32_t) numClusters; c++)
+            {
+                if (TestBit(p.vis, c))
+                    seen.insert(seen.end(), (const uint8_t*) &stateKeys[c],
+                                (const uint8_t*) &stateKeys[c] + sizeof(uint64_t));
+            }
+            cache->StoreStage(p.key, std::move(seen));
+        }
+    }
+    if (reusedPortals)
+        *reusedPortals = reused;
+
+    // Lump layout: header, one offset per cluster, then the compressed rows
+    std::vector<uint8_t> lump(sizeof(ABSPVisHeader) + numClusters * sizeof(uint32_t));
+    ABSPVisHeader        header = {numClusters};
+    memcpy(lump.data(), &header, sizeof(header));
+
+    size_t               totalVisible = 0;
+    std::vector<uint8_t> row(s.rowBytes);
+    for (uint32_t c = 0; c < numClusters; c++)
+    {
+        std::fill(row.begin(), row.end(), 0);
+        SetBit(row, (int32_t) c);
+        for (uint32_t index : s.clusterPortals[c])
+        {
+            const auto& vis = s.portals[index].vis;
+            for (size_t j = 0; j < s.rowBytes; j++)
+                row[j] |= vis[j];
+        }
+        for (uint32_t k = 0; k < numClusters; k++)
+            totalVisible += TestBit(row, (int32_t) k) ? 1 : 0;
+
+        uint32_t offset = (uint32_t) lump.size();
+        memcpy(lump.data() + sizeof(ABSPVisHeader) + c * sizeof(uint32_t), &offset, sizeof(offset));
+        CompressRow(row, lump);
+    }
+
+    if (averageVisible)
+        *averageVisible = numClusters ? (float) totalVisible / numClusters : 0.0f;
+    return lump;
+}
@@ -0,0 +1,22 @@
+#pragma once
+// Vis.h
+#include "BspTree.h"
+#include <cstdint>
+#include <vector>
+
+class CompileCache;
+
+/**
+ * @brief Computes the potentially visible set of every cluster
+ * Sight lines are flowed through the portals of the tree, clipping each portal against the
+ * separating planes of the portals already passed, the same way Quake's vis does. With a cache,
+ * a portal keeps what it saw last time if none of the clusters it saw have changed their portals.
+ * @param tree Tree built by BuildBspTree
+ * @param cache Results of the last compile, can be null
+ * @param averageVisible Receives the average number of clusters visible from a cluster
+ * @param reusedPortals Receives how many one way portals came from the cache
+ * @return The compressed "VIS " lump
+ */
+std::vector<uint8_t> ComputeVisibility(const BspTree& tree, CompileCache* cache = nullptr,
+                                       float* averageVisible = nullptr,
+                                       size_t* reusedPortals = nullptr);
@@ -0,0 +1,140 @@
+#include "Weld.h"
+#include "Winding.h"
+#include <cmath>
+#include <unordered_map>
+
+namespace
+{
+// Vertex space, a few map units. Only has to be larger than the weld epsilon
+constexpr float WELD_CELL = 0.05f;
+// Normals come straight from the planes, so welded ones are equal to float precision
+constexpr float NORMAL_EPSILON = 0.0001f;
+// Atlas coordinates of different faces are whole luxels apart
+constexpr float LIGHTMAP_EPSILON = 0.000001f;
+
+int64_t CellOf(float v)
+{
+    return (int64_t) std::floor(v / WELD_CELL);
+}
+
+uint64_t CellKey(int64_t x, int64_t y, int64_t z)
+{
+    return ((uint64_t) (x & 0x1FFFFF) << 42) | ((uint64_t) (y & 0x1FFFFF) << 21) |
+           (uint64_t) (z & 0x1FFFFF);
+}
+
+bool NearlyEqual(const glm::vec3& a, const glm::vec3& b, float epsilon)
+{
+    return std::abs(a.x - b.x) <= epsilon && std::abs(a.y - b.y) <= epsilon &&
+           std::abs(a.z - b.z) <= epsilon;
+}
+
+bool NearlyEqual(const glm::vec2& a, const glm::vec2& b, float epsilon)
+{
+    return std::abs(a.x - b.x) <= epsilon && std::abs(a.y - b.y) <= epsilon;
+}
+} // namespace
+
+std::vector<uint32_t> WeldVertices(std::vector<AVertex>& verts, std::vector<glm::vec2>& lightmapUVs,
+                                   float epsilon)
+{
+    bool                   hasLightmap = lightmapUVs.size() == verts.size();
+    std::vector<uint32_t>  remap(verts.size());
+    std::vector<AVertex>   welded;
+    std::vector<glm::vec2> weldedUVs;
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> grid; // cell -> welded vertices in it
+
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        const AVertex& v  = verts[i];
+        int64_t        cx = CellOf(v.position.x);
+        int64_t        cy = CellOf(v.position.y);
+        int64_t        cz = CellOf(v.position.z);
+
+        // The epsilon is smaller than a cell, so a match is at most one cell over
+        int64_t match = -1;
+        for (int64_t x = cx - 1; x <= cx + 1 && match < 0; x++)
+        {
+            for (int64_t y = cy - 1; y <= cy + 1 && match < 0; y++)
+            {
+                for (int64_t z = cz - 1; z <= cz + 1 && match < 0; z++)
+                {
+                    auto cell = grid.find(CellKey(x, y, z));
+                    if (cell == grid.end())
+                        continue;
+                    for (uint32_t w : cell->second)
+                    {
+                        const AVertex& o = welded[w];
+                        if (NearlyEqual(v.position, o.position, epsilon) &&
+                            NearlyEqual(v.uv, o.uv, epsilon) &&
+                            NearlyEqual(v.normal, o.normal, NORMAL_EPSILON) &&
+                            (!hasLightmap ||
+                             NearlyEqual(lightmapUVs[i], weldedUVs[w], LIGHTMAP_EPSILON)))
+                        {
+                            match = w;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (match < 0)
+        {
+            match = (int64_t) welded.size();
+            grid[CellKey(cx, cy, cz)].push_back((uint32_t) match);
+            welded.push_back(v);
+            if (hasLightmap)
+                weldedUVs.push_back(lightmapUVs[i]);
+        }
+        remap[i] = (uint32_t) match;
+    }
+
+    verts.swap(welded);
+    if (hasLightmap)
+        lightmapUVs.swap(weldedUVs);
+    return remap;
+}
+
+std::vector<uint32_t> DeduplicatePlanes(std::vector<APlane>& planes, float distEpsilon)
+{
+    std::vector<uint32_t> remap(planes.size());
+    std::vector<APlane>   unique;
+    // Bucketed by whole units of distance, the epsilon is far smaller
+    std::unordered_map<int64_t, std::vector<uint32_t>> buckets;
+
+    for (size_t i = 0; i < planes.size(); i++)
+    {
+        const APlane& p      = planes[i];
+        int64_t       bucket = (int64_t) std::floor(p.distance);
+
+        int64_t match = -1;
+        for (int64_t b = bucket - 1; b <= bucket + 1 && match < 0; b++)
+        {
+            auto it = buckets.find(b);
+            if (it == buckets.end())
+                continue;
+            for (uint32_t u : it->second)
+            {
+                bool flipped;
+                if (PlanesCoincide(p, unique[u], distEpsilon, &flipped) && !flipped)
+                {
+                    match = u;
+                    break;
+                }
+            }
+        }
+
+        if (match < 0)
+        {
+            match = (int64_t) unique.size();
+            buckets[bucket].push_back((uint32_t) match);
+            unique.push_back(p);
+        }
+        remap[i] = (uint32_t) match;
+    }
+
+    planes.swap(unique);
+    return remap;
+}
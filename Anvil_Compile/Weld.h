@@ -0,0 +1,26 @@
+#pragma once
+// Weld.h
+#include "AnvilBSPFormat.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Merges vertices with the same position, UV, normal and lightmap coordinate
+ * Every face writes its own copy of a corner, welding lets neighbours share one. Candidates are
+ * found through a hashed grid, the first vertex of a welded set is the one that's kept so the
+ * result doesn't depend on anything but the input order.
+ * @param verts Vertices, compacted in place
+ * @param lightmapUVs Lightmap coordinate of every vertex, compacted along with them. May be empty
+ * @param epsilon Largest position and UV difference still welded
+ * @return New index of every old vertex
+ */
+std::vector<uint32_t> WeldVertices(std::vector<AVertex>& verts, std::vector<glm::vec2>& lightmapUVs,
+                                   float epsilon);
+
+/**
+ * @brief Collapses planes that face the same way at the same distance
+ * @param planes Planes, compacted in place keeping the first of each set
+ * @param distEpsilon Largest distance difference still treated as the same plane
+ * @return New index of every old plane
+ */
+std::vector<uint32_t> DeduplicatePlanes(std::vector<APlane>& planes, float distEpsilon);
@@ -0,0 +1,192 @@
+#include "Winding.h"
+#include <cmath>
+
+APlane PlaneFromPoints(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3)
+{
+    glm::vec3 v1 = p2 - p1, v2 = p3 - p1;
+    glm::vec3 n  = glm::normalize(glm::cross(v2, v1));
+    return {n, glm::dot(n, p1)};
+}
+
+Winding BaseWindingForPlane(const APlane& p)
+{
+    glm::vec3 up = (std::abs(p.normal.y) > 0.99f) ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    glm::vec3 r  = glm::normalize(glm::cross(p.normal, up));
+    up           = glm::cross(r, p.normal);
+
+    return {(p.normal * p.distance) + (r * 1e4f) + (up * 1e4f),
+            (p.normal * p.distance) - (r * 1e4f) + (up * 1e4f),
+            (p.normal * p.distance) - (r * 1e4f) - (up * 1e4f),
+            (p.normal * p.distance) + (r * 1e4f) - (up * 1e4f)};
+}
+
+void ClipWinding(Winding& pts, const APlane& plane)
+{
+    Winding     newPts;
+    const float EPS = 0.01f;
+    for (size_t i = 0; i < pts.size(); i++)
+    {
+        glm::vec3 p1 = pts[i], p2 = pts[(i + 1) % pts.size()];
+        float     d1 = glm::dot(p1, plane.normal) - plane.distance;
+        float     d2 = glm::dot(p2, plane.normal) - plane.distance;
+
+        if (d1 <= EPS)
+            newPts.push_back(p1);
+        if ((d1 > EPS && d2 < -EPS) || (d1 < -EPS && d2 > EPS))
+        {
+            float t = d1 / (d1 - d2);
+            newPts.push_back(p1 + t * (p2 - p1));
+        }
+    }
+    pts = newPts;
+}
+
+void SplitWinding(const Winding& in, const APlane& plane, float epsilon, Winding& front,
+                  Winding& back)
+{
+    front.clear();
+    back.clear();
+
+    std::vector<float> dists(in.size());
+    std::vector<int>   sides(in.size());
+    int                counts[3] = {0, 0, 0};
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        dists[i] = glm::dot(in[i], plane.normal) - plane.distance;
+        if (dists[i] > epsilon)
+            sides[i] = SIDE_FRONT;
+        else if (dists[i] < -epsilon)
+            sides[i] = SIDE_BACK;
+        else
+            sides[i] = SIDE_ON;
+        counts[sides[i]]++;
+    }
+
+    // Everything on the plane goes to the front, like qbsp does
+    if (!counts[SIDE_BACK])
+    {
+        front = in;
+        return;
+    }
+    if (!counts[SIDE_FRONT])
+    {
+        back = in;
+        return;
+    }
+
+    for (size_t i = 0; i < in.size(); i++)
+    {
+        size_t           j  = (i + 1) % in.size();
+        const glm::vec3& p1 = in[i];
+
+        if (sides[i] == SIDE_ON)
+        {
+            front.push_back(p1);
+            back.push_back(p1);
+            continue;
+        }
+        if (sides[i] == SIDE_FRONT)
+            front.push_back(p1);
+        else
+            back.push_back(p1);
+
+        if (sides[j] == SIDE_ON || sides[j] == sides[i])
+            continue;
+
+        // Generate a split point, snapping axial planes exactly
+        const glm::vec3& p2 = in[j];
+        float            t  = dists[i] / (dists[i] - dists[j]);
+        glm::vec3        mid;
+        for (int k = 0; k < 3; k++)
+        {
+            if (plane.normal[k] == 1.0f)
+                mid[k] = plane.distance;
+            else if (plane.normal[k] == -1.0f)
+                mid[k] = -plane.distance;
+            else
+                mid[k] = p1[k] + t * (p2[k] - p1[k]);
+        }
+        front.push_back(mid);
+        back.push_back(mid);
+    }
+
+    if (front.size() < 3)
+        front.clear();
+    if (back.size() < 3)
+        back.clear();
+}
+
+EWindingSide ClassifyWinding(const Winding& w, const APlane& plane, float epsilon)
+{
+    bool front = false, back = false;
+    for (const auto& p : w)
+    {
+        float d = glm::dot(p, plane.normal) - plane.distance;
+        if (d > epsilon)
+            front = true;
+        else if (d < -epsilon)
+            back = true;
+    }
+    if (front && back)
+        return SIDE_CROSS;
+    if (front)
+        return SIDE_FRONT;
+    if (back)
+        return SIDE_BACK;
+    return SIDE_ON;
+}
+
+bool ChopWinding(Winding& w, const APlane& plane, float epsilon)
+{
+    switch (ClassifyWinding(w, plane, epsilon))
+    {
+    case SIDE_FRONT:
+        return true;
+    case SIDE_BACK:
+    case SIDE_ON:
+        w.clear();
+        return false;
+    default:
+        break;
+    }
+    Winding front, back;
+    SplitWinding(w, plane, epsilon, front, back);
+    w = std::move(front);
+    return !w.empty();
+}
+
+float WindingArea(const Winding& w)
+{
+    float area = 0.0f;
+    for (size_t i = 2; i < w.size(); i++)
+        area += glm::length(glm::cross(w[i - 1] - w[0], w[i] - w[0])) * 0.5f;
+    return area;
+}
+
+glm::vec3 WindingCenter(const Winding& w)
+{
+    glm::vec3 c(0.0f);
+    for (const auto& p : w)
+        c += p;
+    return w.empty() ? c : c / (float) w.size();
+}
+
+bool PlanesCoincide(const APlane& a, const APlane& b, float distEpsilon, bool* flipped)
+{
+    const float NORMAL_EPS = 0.00001f;
+
+    float d = glm::dot(a.normal, b.normal);
+    if (d > 1.0f - NORMAL_EPS && std::abs(a.distance - b.distance) < distEpsilon)
+    {
+        if (flipped)
+            *flipped = false;
+        return true;
+    }
+    if (d < -1.0f + NORMAL_EPS && std::abs(a.distance + b.distance) < distEpsilon)
+    {
+        if (flipped)
+            *flipped = true;
+        return true;
+    }
+    return false;
+}
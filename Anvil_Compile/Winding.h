@@ -0,0 +1,62 @@
+#pragma once
+// Winding.h
+#include "AnvilBSPFormat.h"
+#include <vector>
+
+// A convex polygon, points in order around the polygon
+using Winding = std::vector<glm::vec3>;
+
+enum EWindingSide
+{
+    SIDE_FRONT,
+    SIDE_BACK,
+    SIDE_ON,
+    SIDE_CROSS
+};
+
+/**
+ * @brief Builds a plane from three points of a Quake .map brush side
+ */
+APlane PlaneFromPoints(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3);
+
+/**
+ * @brief Creates a huge quad lying on the plane, ready to be clipped down to a face
+ */
+Winding BaseWindingForPlane(const APlane& plane);
+
+/**
+ * @brief Clips the winding in place, keeping the part behind the plane
+ */
+void ClipWinding(Winding& pts, const APlane& plane);
+
+/**
+ * @brief Splits a winding by a plane
+ * @param in The winding to split
+ * @param plane The splitting plane
+ * @param epsilon Distance under which a point counts as lying on the plane
+ * @param front Receives the part in front of the plane (empty if none)
+ * @param back Receives the part behind the plane (empty if none)
+ */
+void SplitWinding(const Winding& in, const APlane& plane, float epsilon, Winding& front,
+                  Winding& back);
+
+/**
+ * @brief Tells on which side of the plane the winding lies
+ */
+EWindingSide ClassifyWinding(const Winding& w, const APlane& plane, float epsilon);
+
+/**
+ * @brief Keeps only the part of the winding in front of the plane
+ * @return false if nothing is left
+ */
+bool ChopWinding(Winding& w, const APlane& plane, float epsilon);
+
+float     WindingArea(const Winding& w);
+glm::vec3 WindingCenter(const Winding& w);
+
+/**
+ * @brief Plane equality that ignores orientation
+ * @param distEpsilon Largest distance difference still treated as the same plane
+ * @param flipped Set to true when the planes face opposite directions
+ */
+bool PlanesCoincide(const APlane& a, const APlane& b, float distEpsilon, bool* flipped = nullptr);
@@ -0,0 +1,190 @@
+#include "ABSPFile.h"
+#include "ALZ4.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+bool ABSPFile::Open(const char* path)
+{
+    Close();
+    if (!m_file.Open(path) || m_file.GetSize() < 8 || memcmp(m_file.GetData(), "ABSP", 4) != 0)
+    {
+        Close();
+        return false;
+    }
+    memcpy(&m_version, m_file.GetData() + 4, sizeof(m_version));
+
+    bool valid = m_version >= 3 ? ReadDirectory() : ReadLegacyDirectory();
+    if (!valid)
+        Close();
+    else
+        m_unpacked.resize(m_lumps.size());
+    return valid;
+}
+
+void ABSPFile::Close()
+{
+    m_file.Close();
+    m_lumps.clear();
+    m_unpacked.clear();
+    m_version = 0;
+}
+
+const ABSPLump* ABSPFile::FindLump(const char* id) const
+{
+    for (const auto& lump : m_lumps)
+    {
+        if (memcmp(lump.id, id, 4) == 0)
+            return &lump;
+    }
+    return nullptr;
+}
+
+const uint8_t* ABSPFile::GetLumpData(const char* id, size_t& size) const
+{
+    const ABSPLump* lump = FindLump(id);
+    size                 = 0;
+    if (!lump)
+        return nullptr;
+    if ((EBSPCompression) lump->compression == EBSPCompression::None)
+    {
+        size = (size_t) lump->size;
+        return m_file.GetData() + lump->offset;
+    }
+
+    const Unpacked& unpacked = m_unpacked[lump - m_lumps.data()];
+    if (!unpacked.done)
+        Decompress(lump - m_lumps.data());
+    if (!unpacked.ok)
+        return nullptr;
+    size = unpacked.data.size();
+    return unpacked.data.data();
+}
+
+void ABSPFile::DecompressLumps()
+{
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < m_lumps.size(); i++)
+    {
+        if ((EBSPCompression) m_lumps[i].compression != EBSPCompression::None && !m_unpacked[i].done)
+            pending.push_back(i);
+    }
+    if (pending.empty())
+        return;
+
+    // Biggest first, so the big texture lump doesn't start last and hold everyone up
+    std::sort(pending.begin(), pending.end(),
+              [&](size_t a, size_t b) { return m_lumps[a].rawSize > m_lumps[b].rawSize; });
+
+    // Every lump has its own slot, the workers only share the counter
+    std::atomic<size_t> next{0};
+    auto                work = [&]() {
+        for (size_t i = next++; i < pending.size(); i = next++)
+            Decompress(pending[i]);
+    };
+    size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads        = std::min(numThreads, pending.size());
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < numThreads; t++)
+        threads.emplace_back(work);
+    work();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void ABSPFile::Decompress(size_t index) const
+{
+    const ABSPLump& lump     = m_lumps[index];
+    Unpacked&       unpacked = m_unpacked[index];
+    unpacked.done            = true;
+    unpacked.ok              = false;
+    if ((EBSPCompression) lump.compression == EBSPCompression::LZ4 &&
+        ALZ4::IsValidRawSize((size_t) lump.size, lump.rawSize))
+    {
+        unpacked.data.resize((size_t) lump.rawSize);
+        unpacked.ok = ALZ4::Decompress(m_file.GetData() + lump.offset, (size_t) lump.size,
+                                       unpacked.data.data(), unpacked.data.size());
+    }
+    if (!unpacked.ok)
+    {
+        unpacked.data.clear();
+        std::cout << "[Anvil Engine] Error: Could not decompress lump " << std::string(lump.id, 4)
+                  << std::endl;
+    }
+}
+
+bool ABSPFile::ReadDirectory()
+{
+    ABSPHeaderV3 header;
+    if (m_file.GetSize() < sizeof(header))
+        return false;
+    memcpy(&header, m_file.GetData(), sizeof(header));
+
+    uint64_t directoryEnd = sizeof(header) + (uint64_t) header.numLumps * sizeof(ABSPLump);
+    if (directoryEnd > m_file.GetSize())
+        return false;
+    m_lumps.resize(header.numLumps);
+    memcpy(m_lumps.data(), m_file.GetData() + sizeof(header), m_lumps.size() * sizeof(ABSPLump));
+
+    for (const auto& lump : m_lumps)
+    {
+        if (lump.offset > m_file.GetSize() || lump.size > m_file.GetSize() - lump.offset)
+            return false;
+    }
+    return true;
+}
+
+bool ABSPFile::ReadLegacyDirectory()
+{
+    ABSPHeader header;
+    if (m_file.GetSize() < sizeof(header))
+        return false;
+    memcpy(&header, m_file.GetData(), sizeof(header));
+
+    // The fixed arrays, one after another
+    uint64_t offset = sizeof(header);
+    auto     add    = [&](const char* id, uint64_t size) {
+        if (offset + size > m_file.GetSize())
+            return false;
+        ABSPLump lump;
+        memcpy(lump.id, id, 4);
+        lump.alignment   = 1;
+        lump.offset      = offset;
+        lump.size        = size;
+        lump.compression = (uint32_t) EBSPCompression::None;
+        lump.reserved    = 0;
+        lump.rawSize     = size;
+        m_lumps.push_back(lump);
+        offset += size;
+        return true;
+    };
+    if (!add("VERT", (uint64_t) header.numVertices * sizeof(AVertex)) ||
+        !add("FACE", (uint64_t) header.numFaces * sizeof(AFace)) ||
+        !add("ENTS", (uint64_t) header.numEntities * sizeof(ABspEntity)) ||
+        !add("PLAN", (uint64_t) header.numPlanes * sizeof(APlane)) ||
+        !add("BRSH", (uint64_t) header.numBrushes * sizeof(ABSPBrush)) ||
+        !add("TEXE", (uint64_t) header.numTextures * sizeof(ATextureEntry)))
+        return false;
+
+    uint64_t textureBytes = 0;
+    for (uint32_t i = 0; i < header.numTextures; i++)
+    {
+        ATextureEntry entry;
+        memcpy(&entry, m_file.GetData() + m_lumps.back().offset + i * sizeof(entry), sizeof(entry));
+        textureBytes += entry.dataSize;
+    }
+    if (!add("TEXD", textureBytes))
+        return false;
+
+    // Then the optional chunks up to the end, a truncated one ends the list
+    ABSPChunk chunk;
+    while (offset + sizeof(chunk) <= m_file.GetSize())
+    {
+        memcpy(&chunk, m_file.GetData() + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+        if (!add(chunk.id, chunk.size))
+            break;
+    }
+    return true;
+}
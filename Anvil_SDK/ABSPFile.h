@@ -0,0 +1,106 @@
+#pragma once
+// ABSPFile.h
+#include "ACore.h"
+#include "AMappedFile.h"
+#include "AnvilBSPFormat.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * @class ABSPFile
+ * @brief A mapped .absp and its lump directory
+ * Version 3 files carry the directory, for version 2 it's worked out from the header counts and
+ * the chunks after the texture data, so both read through the same lumps. Nothing but the header
+ * and the directory is touched until a lump is asked for. Compressed lumps are decompressed the
+ * first time they're asked for, or all at once on several threads by DecompressLumps.
+ */
+class ANVIL_API ABSPFile
+{
+  public:
+    /**
+     * @brief Maps a file and reads its lump directory
+     * @param path Path to the .absp
+     * @return false if the file couldn't be mapped or isn't a valid .absp
+     */
+    bool Open(const char* path);
+    void Close();
+
+    uint32_t GetVersion() const
+    {
+        return m_version;
+    }
+    const std::vector<ABSPLump>& GetLumps() const
+    {
+        return m_lumps;
+    }
+
+    /**
+     * @brief Finds a lump by its four character id, like "VERT"
+     * @return The lump or null if the file doesn't have one
+     */
+    const ABSPLump* FindLump(const char* id) const;
+
+    /**
+     * @brief Decompresses every compressed lump, spread over the hardware threads
+     * Without it lumps are decompressed by GetLumpData, which isn't safe to call from several
+     * threads before this has run.
+     */
+    void DecompressLumps();
+
+    /**
+     * @brief Points at a lump in the mapped file, or at its decompressed copy. Valid until the
+     * file is closed
+     * @param size Receives the size in bytes, 0 if the lump is missing or doesn't decompress
+     */
+    const uint8_t* GetLumpData(const char* id, size_t& size) const;
+
+    /**
+     * @brief Views a lump as an array without copying it
+     * @param count Receives the number of whole elements
+     * @return null if the lump is missing or not aligned for T, which version 2 lumps often aren't
+     */
+    template <typename T> const T* GetLumpArray(const char* id, size_t& count) const
+    {
+        size_t         size = 0;
+        const uint8_t* data = GetLumpData(id, size);
+        count               = size / sizeof(T);
+        if (!data || (uintptr_t) data % alignof(T) != 0)
+        {
+            count = 0;
+            return nullptr;
+        }
+        return (const T*) data;
+    }
+
+    /**
+     * @brief Copies a lump into a vector of whole elements
+     * @return false if the file doesn't have the lump, out is left empty then
+     */
+    template <typename T> bool ReadLump(const char* id, std::vector<T>& out) const
+    {
+        size_t         size = 0;
+        const uint8_t* data = GetLumpData(id, size);
+        out.resize(size / sizeof(T));
+        if (!out.empty())
+            memcpy(out.data(), data, out.size() * sizeof(T));
+        return data != nullptr;
+    }
+
+  private:
+    bool ReadDirectory();
+    bool ReadLegacyDirectory();
+    void Decompress(size_t lump) const;
+
+    struct Unpacked
+    {
+        std::vector<uint8_t> data;
+        bool                 done = false;
+        bool                 ok   = false;
+    };
+
+    AMappedFile                   m_file;
+    std::vector<ABSPLump>         m_lumps;
+    mutable std::vector<Unpacked> m_unpacked; // one per lump, only used by compressed ones
+    uint32_t                      m_version = 0;
+};
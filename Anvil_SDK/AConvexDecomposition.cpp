@@ -0,0 +1,511 @@
+#include "AConvexDecomposition.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+struct HullFace
+{
+    uint32_t              v[3];
+    glm::vec3             normal;
+    float                 offset;
+    std::vector<uint32_t> outside; // points above this face, waiting to be added
+    bool                  alive = true;
+};
+
+HullFace MakeFace(const std::vector<glm::vec3>& points, uint32_t a, uint32_t b, uint32_t c)
+{
+    HullFace  face;
+    glm::vec3 normal = glm::cross(points[b] - points[a], points[c] - points[a]);
+    float     length = glm::length(normal);
+    face.v[0]        = a;
+    face.v[1]        = b;
+    face.v[2]        = c;
+    face.normal      = length > 0.0f ? normal / length : glm::vec3(0.0f);
+    face.offset      = glm::dot(face.normal, points[a]);
+    return face;
+}
+
+float Distance(const HullFace& face, const glm::vec3& p)
+{
+    return glm::dot(face.normal, p) - face.offset;
+}
+
+// Hands every point to the face it's furthest above, points below all of them are inside
+void AssignOutside(const std::vector<glm::vec3>& points, const std::vector<uint32_t>& candidates,
+                   std::vector<HullFace>& faces, size_t firstFace, float epsilon)
+{
+    for (uint32_t p : candidates)
+    {
+        float  best     = epsilon;
+        size_t bestFace = SIZE_MAX;
+        for (size_t f = firstFace; f < faces.size(); f++)
+        {
+            float d = faces[f].alive ? Distance(faces[f], points[p]) : 0.0f;
+            if (d > best)
+            {
+                best     = d;
+                bestFace = f;
+            }
+        }
+        if (bestFace != SIZE_MAX)
+            faces[bestFace].outside.push_back(p);
+    }
+}
+
+// A voxel grid with a one voxel border of empty space around the mesh
+struct VoxelGrid
+{
+    glm::vec3 origin;
+    float     size;
+    int       dims[3];
+
+    uint32_t Index(int x, int y, int z) const
+    {
+        return (uint32_t) ((z * dims[1] + y) * dims[0] + x);
+    }
+    void Coords(uint32_t index, int c[3]) const
+    {
+        c[0] = (int) (index % dims[0]);
+        c[1] = (int) (index / dims[0] % dims[1]);
+        c[2] = (int) (index / ((uint32_t) dims[0] * dims[1]));
+    }
+    uint32_t Cell(const glm::vec3& p) const
+    {
+        int c[3];
+        for (int a = 0; a < 3; a++)
+            c[a] = std::clamp((int) ((p[a] - origin[a]) / size), 1, dims[a] - 2);
+        return Index(c[0], c[1], c[2]);
+    }
+};
+
+enum EVoxel : uint8_t
+{
+    VOXEL_EMPTY,
+    VOXEL_SURFACE,
+    VOXEL_OUTSIDE
+};
+} // namespace
+
+AConvexHull AConvexDecomposition::ComputeHull(const std::vector<glm::vec3>& points,
+                                              uint32_t maxVertices, float* volume)
+{
+    AConvexHull hull;
+    if (volume)
+        *volume = 0.0f;
+    if (points.size() < 4)
+        return hull;
+
+    // Start from a tetrahedron of extreme points
+    glm::vec3 boundsMin = points[0], boundsMax = points[0];
+    uint32_t  extremes[6] = {0, 0, 0, 0, 0, 0};
+    for (uint32_t i = 0; i < points.size(); i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (points[i][a] < points[extremes[a * 2]][a])
+                extremes[a * 2] = i;
+            if (points[i][a] > points[extremes[a * 2 + 1]][a])
+                extremes[a * 2 + 1] = i;
+        }
+        boundsMin = glm::min(boundsMin, points[i]);
+        boundsMax = glm::max(boundsMax, points[i]);
+    }
+    float epsilon = glm::length(boundsMax - boundsMin) * 1e-5f;
+
+    uint32_t i0 = 0, i1 = 0;
+    float    widest = -1.0f;
+    for (int a = 0; a < 6; a++)
+    {
+        for (int b = a + 1; b < 6; b++)
+        {
+            float d = glm::length(points[extremes[a]] - points[extremes[b]]);
+            if (d > widest)
+            {
+                widest = d;
+                i0     = extremes[a];
+                i1     = extremes[b];
+            }
+        }
+    }
+    uint32_t  i2 = 0, i3 = 0;
+    float     furthest = 0.0f;
+    glm::vec3 axis     = glm::normalize(points[i1] - points[i0]);
+    for (uint32_t i = 0; i < points.size(); i++)
+    {
+        glm::vec3 offset = points[i] - points[i0];
+        float     d      = glm::length(offset - axis * glm::dot(offset, axis));
+        if (d > furthest)
+        {
+            furthest = d;
+            i2       = i;
+        }
+    }
+    if (widest <= epsilon || furthest <= epsilon)
+        return hull;
+    HullFace base = MakeFace(points, i0, i1, i2);
+    furthest      = 0.0f;
+    for (uint32_t i = 0; i < points.size(); i++)
+    {
+        float d = std::abs(Distance(base, points[i]));
+        if (d > furthest)
+        {
+            furthest = d;
+            i3       = i;
+        }
+    }
+    if (furthest <= epsilon)
+        return hull;
+
+    // Wind the base so the fourth point is behind it, then the other faces follow
+    if (Distance(base, points[i3]) > 0.0f)
+        std::swap(i1, i2);
+    std::vector<HullFace> faces = {MakeFace(points, i0, i1, i2), MakeFace(points, i0, i3, i1),
+                                   MakeFace(points, i1, i3, i2), MakeFace(points, i2, i3, i0)};
+    std::vector<uint32_t> candidates;
+    for (uint32_t i = 0; i < points.size(); i++)
+    {
+        if (i != i0 && i != i1 && i != i2 && i != i3)
+            candidates.push_back(i);
+    }
+    AssignOutside(points, candidates, faces, 0, epsilon);
+
+    uint32_t                                   numVertices = 4;
+    std::vector<size_t>                        visible;
+    std::vector<std::pair<uint32_t, uint32_t>> edges, horizon;
+    while (maxVertices == 0 || numVertices < maxVertices)
+    {
+        // The point furthest out of the whole hull goes in next
+        size_t   from = SIZE_MAX;
+        uint32_t apex = 0;
+        float    best = 0.0f;
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            if (!faces[f].alive)
+                continue;
+            for (uint32_t p : faces[f].outside)
+            {
+                float d = Distance(faces[f], points[p]);
+                if (d > best)
+                {
+                    best = d;
+                    from = f;
+                    apex = p;
+                }
+            }
+        }
+        if (from == SIZE_MAX)
+            break;
+
+        // Faces it can see go, the edges between them and the rest are the horizon
+        visible.clear();
+        edges.clear();
+        for (size_t f = 0; f < faces.size(); f++)
+        {
+            if (faces[f].alive && (f == from || Distance(faces[f], points[apex]) > epsilon))
+            {
+                visible.push_back(f);
+                for (int k = 0; k < 3; k++)
+                    edges.push_back({faces[f].v[k], faces[f].v[(k + 1) % 3]});
+            }
+        }
+        horizon.clear();
+        for (const auto& edge : edges)
+        {
+            if (std::find(edges.begin(), edges.end(), std::make_pair(edge.second, edge.first)) ==
+                edges.end())
+                horizon.push_back(edge);
+        }
+        if (horizon.size() < 3)
+            break;
+
+        candidates.clear();
+        for (size_t f : visible)
+        {
+            faces[f].alive = false;
+            for (uint32_t p : faces[f].outside)
+            {
+                if (p != apex)
+                    candidates.push_back(p);
+            }
+            faces[f].outside.clear();
+        }
+        size_t firstNew = faces.size();
+        for (const auto& edge : horizon)
+            faces.push_back(MakeFace(points, edge.first, edge.second, apex));
+        AssignOutside(points, candidates, faces, firstNew, epsilon);
+        numVertices++;
+    }
+
+    // The vertices still on a face, and the volume as a fan of tetrahedra from the origin
+    std::vector<uint32_t> used;
+    double                total = 0.0;
+    for (const auto& face : faces)
+    {
+        if (!face.alive)
+            continue;
+        const glm::vec3 &a = points[face.v[0]], &b = points[face.v[1]], &c = points[face.v[2]];
+        total += glm::dot(a, glm::cross(b, c)) / 6.0;
+        used.insert(used.end(), face.v, face.v + 3);
+    }
+    std::sort(used.begin(), used.end());
+    used.erase(std::unique(used.begin(), used.end()), used.end());
+    for (uint32_t v : used)
+        hull.points.push_back(points[v]);
+    if (volume)
+        *volume = (float) std::max(total, 0.0);
+    return hull;
+}
+
+std::vector<AConvexHull> AConvexDecomposition::Decompose(const std::vector<MVertex>&  vertices,
+                                                         const std::vector<uint32_t>& indices,
+                                                         const AConvexDecompositionOptions& options)
+{
+    std::vector<AConvexHull> hulls;
+    if (vertices.empty() || indices.size() < 3 || options.maxHulls == 0)
+        return hulls;
+
+    glm::vec3 boundsMin = vertices[0].pos, boundsMax = vertices[0].pos;
+    for (const auto& v : vertices)
+    {
+        boundsMin = glm::min(boundsMin, v.pos);
+        boundsMax = glm::max(boundsMax, v.pos);
+    }
+    glm::vec3 extent  = boundsMax - boundsMin;
+    float     longest = std::max({extent.x, extent.y, extent.z});
+    if (longest <= 0.0f)
+        return hulls;
+
+    VoxelGrid grid;
+    grid.size   = longest / (float) std::max(options.resolution, 1u);
+    grid.origin = boundsMin - glm::vec3(grid.size);
+    for (int a = 0; a < 3; a++)
+        grid.dims[a] = (int) (extent[a] / grid.size) + 3;
+    std::vector<uint8_t> state((size_t) grid.dims[0] * grid.dims[1] * grid.dims[2], VOXEL_EMPTY);
+
+    // Points spread over every triangle, closer than half a voxel. They mark the surface voxels
+    // and are what the hulls are built from in the end
+    std::vector<glm::vec3> samples;
+    std::vector<uint32_t>  sampleCell;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const glm::vec3& a = vertices[indices[i]].pos;
+        const glm::vec3& b = vertices[indices[i + 1]].pos;
+        const glm::vec3& c = vertices[indices[i + 2]].pos;
+        float edge  = std::max({glm::length(b - a), glm::length(c - b), glm::length(a - c)});
+        int   steps = std::max(1, (int) std::ceil(edge / (grid.size * 0.5f)));
+        for (int u = 0; u <= steps; u++)
+        {
+            for (int v = 0; u + v <= steps; v++)
+            {
+                glm::vec3 p = a + (b - a) * ((float) u / steps) + (c - a) * ((float) v / steps);
+                uint32_t  cell = grid.Cell(p);
+                samples.push_back(p);
+                sampleCell.push_back(cell);
+                state[cell] = VOXEL_SURFACE;
+            }
+        }
+    }
+
+    // Everything the border reaches without crossing the surface is outside, the rest is solid
+    std::vector<uint32_t> stack = {0};
+    state[0]                    = VOXEL_OUTSIDE;
+    while (!stack.empty())
+    {
+        int c[3];
+        grid.Coords(stack.back(), c);
+        stack.pop_back();
+        for (int a = 0; a < 3; a++)
+        {
+            for (int d = -1; d <= 1; d += 2)
+            {
+                int n[3] = {c[0], c[1], c[2]};
+                n[a] += d;
+                if (n[a] < 0 || n[a] >= grid.dims[a])
+                    continue;
+                uint32_t index = grid.Index(n[0], n[1], n[2]);
+                if (state[index] == VOXEL_EMPTY)
+                {
+                    state[index] = VOXEL_OUTSIDE;
+                    stack.push_back(index);
+                }
+            }
+        }
+    }
+
+    struct Part
+    {
+        std::vector<uint32_t> voxels;
+        float                 error = 0.0f; // hull volume the voxels don't fill
+        bool                  done  = false;
+    };
+    std::vector<int32_t> label(state.size(), -1);
+    std::vector<Part>    parts(1);
+    for (uint32_t i = 0; i < state.size(); i++)
+    {
+        if (state[i] != VOXEL_OUTSIDE)
+        {
+            label[i] = 0;
+            parts[0].voxels.push_back(i);
+        }
+    }
+
+    // Hull of the voxels in a set, from the corners of the ones at its edge
+    float                  voxelVolume = grid.size * grid.size * grid.size;
+    std::vector<uint64_t>  corners;
+    std::vector<glm::vec3> cornerPoints;
+    auto                   voxelError = [&](const std::vector<uint32_t>& voxels, auto inSet) {
+        corners.clear();
+        uint64_t cornerDims[2] = {(uint64_t) grid.dims[0] + 1, (uint64_t) grid.dims[1] + 1};
+        for (uint32_t voxel : voxels)
+        {
+            int c[3];
+            grid.Coords(voxel, c);
+            bool edge = false;
+            for (int a = 0; a < 3 && !edge; a++)
+            {
+                for (int d = -1; d <= 1 && !edge; d += 2)
+                {
+                    int n[3] = {c[0], c[1], c[2]};
+                    n[a] += d;
+                    edge = !inSet(grid.Index(n[0], n[1], n[2]));
+                }
+            }
+            if (!edge)
+                continue;
+            for (int k = 0; k < 8; k++)
+            {
+                uint64_t x = c[0] + (k & 1), y = c[1] + (k >> 1 & 1), z = c[2] + (k >> 2);
+                corners.push_back((z * cornerDims[1] + y) * cornerDims[0] + x);
+            }
+        }
+        std::sort(corners.begin(), corners.end());
+        corners.erase(std::unique(corners.begin(), corners.end()), corners.end());
+        cornerPoints.clear();
+        for (uint64_t corner : corners)
+        {
+            glm::vec3 p((float) (corner % cornerDims[0]),
+                        (float) (corner / cornerDims[0] % cornerDims[1]),
+                        (float) (corner / (cornerDims[0] * cornerDims[1])));
+            cornerPoints.push_back(grid.origin + p * grid.size);
+        }
+        float hullVolume = 0.0f;
+        ComputeHull(cornerPoints, 0, &hullVolume);
+        return std::max(hullVolume - voxels.size() * voxelVolume, 0.0f);
+    };
+
+    parts[0].error   = voxelError(parts[0].voxels, [&](uint32_t v) { return label[v] == 0; });
+    float totalHull  = parts[0].error + parts[0].voxels.size() * voxelVolume;
+    float errorLimit = totalHull * options.concavity;
+
+    // Split the worst piece at the plane that leaves the least empty hull space on both sides
+    std::vector<uint32_t> sideA, sideB;
+    while (parts.size() < options.maxHulls)
+    {
+        size_t worst = SIZE_MAX;
+        for (size_t i = 0; i < parts.size(); i++)
+        {
+            if (!parts[i].done && parts[i].error > errorLimit &&
+                (worst == SIZE_MAX || parts[i].error > parts[worst].error))
+                worst = i;
+        }
+        if (worst == SIZE_MAX)
+            break;
+
+        int32_t id = (int32_t) worst;
+        int     lo[3] = {INT32_MAX, INT32_MAX, INT32_MAX}, hi[3] = {-1, -1, -1};
+        for (uint32_t voxel : parts[worst].voxels)
+        {
+            int c[3];
+            grid.Coords(voxel, c);
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], c[a]);
+                hi[a] = std::max(hi[a], c[a]);
+            }
+        }
+
+        float bestCost = parts[worst].error, bestA = 0.0f, bestB = 0.0f;
+        int   bestAxis = -1, bestCut = 0;
+        for (int a = 0; a < 3; a++)
+        {
+            for (int step = 1, lastCut = -1; step < 8; step++)
+            {
+                int cut = lo[a] + (hi[a] - lo[a] + 1) * step / 8;
+                if (cut <= lo[a] || cut > hi[a] || cut == lastCut)
+                    continue;
+                lastCut = cut;
+                sideA.clear();
+                sideB.clear();
+                for (uint32_t voxel : parts[worst].voxels)
+                {
+                    int c[3];
+                    grid.Coords(voxel, c);
+                    (c[a] < cut ? sideA : sideB).push_back(voxel);
+                }
+                auto inSide = [&](bool below) {
+                    return [&, below](uint32_t v) {
+                        int c[3];
+                        grid.Coords(v, c);
+                        return label[v] == id && (c[a] < cut) == below;
+                    };
+                };
+                float errorA = voxelError(sideA, inSide(true));
+                float errorB = voxelError(sideB, inSide(false));
+                if (errorA + errorB < bestCost)
+                {
+                    bestCost = errorA + errorB;
+                    bestA    = errorA;
+                    bestB    = errorB;
+                    bestAxis = a;
+                    bestCut  = cut;
+                }
+            }
+        }
+        if (bestAxis < 0)
+        {
+            parts[worst].done = true;
+            continue;
+        }
+
+        Part split;
+        split.error = bestB;
+        std::vector<uint32_t> kept;
+        for (uint32_t voxel : parts[worst].voxels)
+        {
+            int c[3];
+            grid.Coords(voxel, c);
+            if (c[bestAxis] < bestCut)
+                kept.push_back(voxel);
+            else
+            {
+                label[voxel] = (int32_t) parts.size();
+                split.voxels.push_back(voxel);
+            }
+        }
+        parts[worst].voxels.swap(kept);
+        parts[worst].error = bestA;
+        parts.push_back(std::move(split));
+    }
+
+    // Each piece is the hull of the surface inside it, or of its voxels if it has too little
+    std::vector<std::vector<glm::vec3>> pieceSamples(parts.size());
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        if (label[sampleCell[i]] >= 0)
+            pieceSamples[label[sampleCell[i]]].push_back(samples[i]);
+    }
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        AConvexHull hull = ComputeHull(pieceSamples[i], options.maxHullVertices);
+        if (hull.points.empty())
+        {
+            int32_t id = (int32_t) i;
+            voxelError(parts[i].voxels, [&](uint32_t v) { return label[v] == id; });
+            hull = ComputeHull(cornerPoints, options.maxHullVertices);
+        }
+        if (!hull.points.empty())
+            hulls.push_back(std::move(hull));
+    }
+    return hulls;
+}
@@ -0,0 +1,46 @@
+#pragma once
+// AConvexDecomposition.h
+#include "ACore.h"
+#include "AMesh.h"
+#include <cstdint>
+#include <vector>
+
+struct AConvexDecompositionOptions
+{
+    uint32_t maxHulls        = 16;    // splitting stops here even if the pieces are still concave
+    uint32_t maxHullVertices = 32;    // per hull, the points furthest out are kept
+    uint32_t resolution      = 32;    // voxels along the longest side of the mesh
+    float    concavity       = 0.02f; // pieces missing less of their hull than this, relative to
+                                      // the whole mesh's hull, aren't split further
+};
+
+/**
+ * @class AConvexDecomposition
+ * @brief Offline approximate convex decomposition for collision
+ * The mesh is voxelized and its inside filled, then the piece whose hull covers the most empty
+ * space is split by an axis aligned plane until the pieces are convex enough or there are
+ * maxHulls of them. Every piece becomes the hull of the surface inside it. Open meshes work as
+ * well, they just have no inside.
+ */
+class ANVIL_API AConvexDecomposition
+{
+  public:
+    /**
+     * @brief Splits a triangle list into convex hulls
+     * @return The hulls, empty if the mesh has no volume or area
+     */
+    static std::vector<AConvexHull> Decompose(const std::vector<MVertex>&  vertices,
+                                              const std::vector<uint32_t>& indices,
+                                              const AConvexDecompositionOptions& options =
+                                                  AConvexDecompositionOptions());
+
+    /**
+     * @brief Convex hull of a point set (quickhull)
+     * @param maxVertices Stop once the hull has this many vertices, the furthest points go in
+     * first so it's the best hull with that many. 0 for no limit
+     * @param volume Receives the hull's volume, can be null
+     * @return The hull's vertices, empty if the points are flat
+     */
+    static AConvexHull ComputeHull(const std::vector<glm::vec3>& points, uint32_t maxVertices = 0,
+                                   float* volume = nullptr);
+};
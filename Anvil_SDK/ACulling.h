@@ -0,0 +1,68 @@
+#pragma once
+// ACulling.h
+#include "AMath.h"
+#include <cmath>
+
+// Bounding sphere and normal cone of a cluster of triangles, so the whole cluster can be skipped
+// when it's off screen or faces away from the eye
+struct AClusterBounds
+{
+    glm::vec3 center;
+    float     radius;
+    glm::vec3 coneAxis;   // average facing of the triangles
+    float     coneCutoff; // sin of how far the normals spread from the axis, 1 never culls
+};
+
+/**
+ * @struct AFrustum
+ * @brief View frustum planes and the eye, both in whatever space the matrix went to
+ * From projection * view * model the planes are in the mesh's own space, so its clusters are
+ * tested as they are. Facing away survives any transform that doesn't mirror, the cone test is
+ * exact there too.
+ */
+struct AFrustum
+{
+    glm::vec4 planes[6]; // xyz is the normal, pointing inside
+    glm::vec3 eye;
+
+    static AFrustum FromMatrix(const glm::mat4& clip, const glm::vec3& eye)
+    {
+        AFrustum frustum;
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+        for (int i = 0; i < 3; i++)
+        {
+            frustum.planes[i * 2]     = rows[3] + rows[i];
+            frustum.planes[i * 2 + 1] = rows[3] - rows[i];
+        }
+        for (auto& plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        frustum.eye = eye;
+        return frustum;
+    }
+
+    bool IsSphereVisible(const glm::vec3& center, float radius) const
+    {
+        for (const auto& plane : planes)
+        {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief false if the cluster is outside the frustum or every triangle of it faces away
+     */
+    bool IsClusterVisible(const AClusterBounds& bounds) const
+    {
+        if (!IsSphereVisible(bounds.center, bounds.radius))
+            return false;
+        if (bounds.coneCutoff >= 1.0f)
+            return true;
+        glm::vec3 toCluster = bounds.center - eye;
+        return glm::dot(toCluster, bounds.coneAxis) <
+               bounds.coneCutoff * glm::length(toCluster) + bounds.radius;
+    }
+};
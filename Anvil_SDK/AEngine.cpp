@@ -1,7 +1,10 @@
 #include "AEngine.h"
+#include "ABSPFile.h"
+#include "ATextureMips.h"
+#include "AVertexFormat.h"
 #include "IGame.h"
 #include "resource.h"
-#include <fstream>
+#include <cstring>
 #include <iostream>
 
 AEngine* AEngine::s_Instance = nullptr;
@@ -53,13 +56,16 @@ AEngine::AEngine()
 void AEngine::LoadMap(const char* mapName)
 {
     // Construct the full file path by adding the .absp extension
-    std::string   path = std::string(mapName) + ".absp";
-    std::ifstream is(path, std::ios::binary);
-    if (!is)
+    std::string path = std::string(mapName) + ".absp";
+    // Mapped, lumps are read straight out of it and textures uploaded from it
+    ABSPFile    file;
+    if (!file.Open(path.c_str()))
     {
         std::cout << "Engine Error: Could not find " << path << std::endl;
         return;
     }
+    // Compressed lumps all at once on every core, instead of one by one as they're read below
+    file.DecompressLumps();
     for (GLuint tex : m_worldTextures)
         glDeleteTextures(1, &tex);
     m_worldTextures.clear();
@@ -69,79 +75,277 @@ void AEngine::LoadMap(const char* mapName)
         glDeleteBuffers(1, &m_worldVBO);
         glDeleteBuffers(1, &m_worldEBO);
     }
+    if (m_worldLightmapVBO)
+        glDeleteBuffers(1, &m_worldLightmapVBO);
+    if (m_lightmapTexture)
+        glDeleteTextures(1, &m_lightmapTexture);
+    m_worldVAO         = 0;
+    m_worldLightmapVBO = 0;
+    m_lightmapTexture  = 0;
+
+    m_bspNodes.clear();
+    m_bspLeafs.clear();
+    m_leafFaces.clear();
+    m_visData.clear();
+    m_worldClusters.clear();
+    m_faceCluster.clear();
+    m_lastCluster = -1;
+
+    file.ReadLump("VERT", m_worldVerts);
+    file.ReadLump("FACE", m_worldFaces);
+
+    std::vector<ABspEntity> entities;
+    file.ReadLump("ENTS", entities);
+    for (const auto& ent : entities)
+    {
+        m_physicsWorld->AddTrigger(ent.position, ent.size, ent.name);
+        std::cout << "Engine: Registered Trigger Entity -> " << ent.name << std::endl;
+    }
+    std::vector<APlane> mapPlanes;
+    if (file.ReadLump("PLAN", mapPlanes) && !mapPlanes.empty())
+        m_physicsWorld->SetWorldPlanes(mapPlanes);
 
-    ABSPHeader h;
-    is.read((char*) &h, sizeof(h));
-
-    m_worldVerts.resize(h.numVertices);
-    m_worldFaces.resize(h.numFaces);
-    is.read((char*) m_worldVerts.data(), h.numVertices * sizeof(AVertex));
-    is.read((char*) m_worldFaces.data(), h.numFaces * sizeof(AFace));
+    // Textures are uploaded once the mip table further down has been read
+    std::vector<ATextureEntry> texEntries;
+    size_t                     texDataSize = 0;
+    file.ReadLump("TEXE", texEntries);
+    const uint8_t* texData = file.GetLumpData("TEXD", texDataSize);
+
+    std::vector<ATextureLevel> texLevels;
+    std::vector<uint32_t>      indices;
+    std::vector<uint8_t>       bvhLump;
+    std::vector<uint8_t>       lightmapLump;
+    std::vector<glm::vec2>     lightmapUVs;
+    std::vector<uint32_t>      faceVertices;
+    m_drawRanges.clear();
+
+    // Optional lumps, whatever the file doesn't have stays empty
+    file.ReadLump("NODE", m_bspNodes);
+    file.ReadLump("LEAF", m_bspLeafs);
+    file.ReadLump("LFAC", m_leafFaces);
+    file.ReadLump("VIS ", m_visData);
+    file.ReadLump("MIPS", texLevels);
+    file.ReadLump("INDX", indices);
+    file.ReadLump("DRAW", m_drawRanges);
+    file.ReadLump("BVH ", bvhLump);
+    file.ReadLump("LMAP", lightmapLump);
+    file.ReadLump("LMUV", lightmapUVs);
+    file.ReadLump("FVTX", faceVertices);
+    file.ReadLump("CLUS", m_worldClusters);
+    size_t         vertexLumpSize = 0;
+    const uint8_t* vertexLump     = file.GetLumpData("VTXC", vertexLumpSize);
+
+    // Compact vertices replace the float array, physics still gets floats decoded from them
+    m_worldVertexStream = AVertexStreamHeader();
+    m_worldVertexStream.numVertices = (uint32_t) m_worldVerts.size();
+    const uint8_t* vertexData = (const uint8_t*) m_worldVerts.data();
+    if (vertexLump && vertexLumpSize >= sizeof(AVertexStreamHeader))
+    {
+        AVertexStreamHeader stream;
+        memcpy(&stream, vertexLump, sizeof(stream));
+        const uint8_t* data = vertexLump + sizeof(stream);
+        if (AVertexFormat::Decode(stream, data, vertexLumpSize - sizeof(stream), m_worldVerts))
+        {
+            m_worldVertexStream = stream;
+            vertexData          = data;
+        }
+        else
+            std::cout << "Engine Error: Unsupported vertex format in " << path << std::endl;
+    }
 
-    if (h.numEntities > 0)
+    // The data of every texture follows the one before it
+    uint64_t texOffset = 0;
+    for (uint32_t i = 0; i < texEntries.size(); i++)
     {
-        std::vector<ABspEntity> entities(h.numEntities);
-        is.read((char*) entities.data(), h.numEntities * sizeof(ABspEntity));
+        const ATextureEntry& entry = texEntries[i];
+        if (!texData || texOffset + entry.dataSize > texDataSize)
+        {
+            m_worldTextures.push_back(0);
+            continue;
+        }
+        std::vector<ATextureLevel> levels;
+        for (const auto& l : texLevels)
+        {
+            if (l.texture == i && (uint64_t) l.offset + l.size <= entry.dataSize)
+                levels.push_back(l);
+        }
+        m_worldTextures.push_back(ATextureMips::Upload(entry, texData + texOffset, levels));
+        texOffset += entry.dataSize;
+    }
 
-        for (const auto& ent : entities)
+    // Without a complete tree we just draw everything. The compiler writes nodes parent first,
+    // so a child node always comes after its parent and the walk down can't loop
+    bool treeValid = !m_bspNodes.empty() && !m_bspLeafs.empty() &&
+                     m_visData.size() >= sizeof(ABSPVisHeader);
+    ABSPVisHeader visHeader = {};
+    if (treeValid)
+    {
+        memcpy(&visHeader, m_visData.data(), sizeof(visHeader));
+        treeValid = m_visData.size() >=
+                    sizeof(visHeader) + (uint64_t) visHeader.numClusters * sizeof(uint32_t);
+    }
+    for (uint32_t c = 0; c < visHeader.numClusters && treeValid; c++)
+    {
+        uint32_t offset;
+        memcpy(&offset, m_visData.data() + sizeof(visHeader) + c * sizeof(uint32_t), sizeof(offset));
+        treeValid = offset < m_visData.size();
+    }
+    for (size_t i = 0; i < m_bspNodes.size() && treeValid; i++)
+    {
+        for (int32_t child : m_bspNodes[i].children)
         {
-            m_physicsWorld->AddTrigger(ent.position, ent.size, ent.name);
-            std::cout << "Engine: Registered Trigger Entity -> " << ent.name << std::endl;
+            if (child >= 0)
+                treeValid = treeValid && (size_t) child > i && (size_t) child < m_bspNodes.size();
+            else
+                treeValid = treeValid && (uint64_t) (-(int64_t) child - 1) < m_bspLeafs.size();
         }
     }
-    if (h.numPlanes > 0)
+    for (size_t i = 0; i < m_bspLeafs.size() && treeValid; i++)
+    {
+        const ABSPLeaf& leaf = m_bspLeafs[i];
+        treeValid = leaf.cluster < (int64_t) visHeader.numClusters &&
+                    (uint64_t) leaf.firstLeafFace + leaf.numLeafFaces <= m_leafFaces.size();
+    }
+    if (!treeValid)
     {
-        std::vector<APlane> mapPlanes(h.numPlanes);
-        is.read((char*) mapPlanes.data(), h.numPlanes * sizeof(APlane));
+        if (!m_bspNodes.empty())
+            std::cout << "[Anvil Engine] Warning: " << path
+                      << " has a broken BSP tree or vis lump, drawing without them" << std::endl;
+        m_bspNodes.clear();
+        m_bspLeafs.clear();
+        m_leafFaces.clear();
+        m_visData.clear();
+    }
+    m_faceVisFrame.assign(m_worldFaces.size(), 0);
 
-        m_physicsWorld->SetWorldPlanes(mapPlanes);
+    // The compiler already triangulated the faces in order, so each face starts where the
+    // previous one ended
+    m_faceFirstIndex.resize(m_worldFaces.size());
+    uint64_t indexCount = 0;
+    for (size_t i = 0; i < m_worldFaces.size(); i++)
+    {
+        m_faceFirstIndex[i] = (uint32_t) indexCount;
+        indexCount += m_worldFaces[i].numVertices >= 3 ? (m_worldFaces[i].numVertices - 2) * 3 : 0;
     }
-    is.seekg(sizeof(ABSPHeader) + (h.numVertices * sizeof(AVertex)) + (h.numFaces * sizeof(AFace)) +
-                 (h.numEntities * sizeof(ABspEntity)) + (h.numPlanes * sizeof(APlane)) +
-                 (h.numBrushes * sizeof(ABSPBrush)),
-             std::ios::beg);
-    if (h.numTextures > 0)
+    bool indicesValid = indexCount == indices.size() && !m_drawRanges.empty();
+    for (size_t i = 0; i < indices.size() && indicesValid; i++)
+        indicesValid = indices[i] < m_worldVerts.size();
+    for (const auto& r : m_drawRanges)
     {
-        std::vector<ATextureEntry> entries(h.numTextures);
-        is.read((char*) entries.data(), h.numTextures * sizeof(ATextureEntry));
+        indicesValid = indicesValid && (uint64_t) r.firstIndex + r.numIndices <= indices.size() &&
+                       (uint64_t) r.firstFace + r.numFaces <= m_worldFaces.size();
+    }
 
-        for (const auto& te : entries)
+    if (!indicesValid)
+    {
+        // Older files, fan triangulate here and draw each run of faces with the same texture
+        indices.clear();
+        m_drawRanges.clear();
+        bvhLump.clear(); // built for the triangles we just threw away
+        // Welded files keep the corners of every face in the "FVTX" lump
+        auto corner = [&](const AFace& f, uint32_t k) -> uint32_t {
+            uint64_t at = (uint64_t) f.firstVertex + k;
+            if (faceVertices.empty())
+                return (uint32_t) at;
+            return at < faceVertices.size() ? faceVertices[at] : 0;
+        };
+        for (uint32_t i = 0; i < m_worldFaces.size(); i++)
         {
-            std::vector<uint8_t> pixelData(te.dataSize);
-            is.read((char*) pixelData.data(), te.dataSize);
-
-            GLuint texID;
-            glGenTextures(1, &texID);
-            glBindTexture(GL_TEXTURE_2D, texID);
+            const AFace& f = m_worldFaces[i];
+            if (m_drawRanges.empty() || m_drawRanges.back().textureID != f.textureID)
+                m_drawRanges.push_back({f.textureID, (uint32_t) indices.size(), 0, i, 0});
+            for (uint32_t k = 1; k + 1 < f.numVertices; k++)
+            {
+                indices.push_back(corner(f, 0));
+                indices.push_back(corner(f, k));
+                indices.push_back(corner(f, k + 1));
+            }
+            m_drawRanges.back().numIndices =
+                (uint32_t) indices.size() - m_drawRanges.back().firstIndex;
+            m_drawRanges.back().numFaces++;
+        }
+    }
+    m_worldIndexCount = (uint32_t) indices.size();
 
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Clusters only hold whole faces, so they stay good when the indices were rebuilt above
+    for (const auto& cluster : m_worldClusters)
+    {
+        if ((uint64_t) cluster.firstFace + cluster.numFaces > m_worldFaces.size())
+        {
+            std::cout << "[Anvil Engine] Warning: " << path
+                      << " has clusters past the last face, drawing without them" << std::endl;
+            m_worldClusters.clear();
+            break;
+        }
+    }
+    if (!m_worldClusters.empty())
+    {
+        m_faceCluster.assign(m_worldFaces.size(), UINT32_MAX);
+        for (uint32_t c = 0; c < m_worldClusters.size(); c++)
+        {
+            const ABSPCluster& cluster = m_worldClusters[c];
+            for (uint32_t i = cluster.firstFace; i < cluster.firstFace + cluster.numFaces; i++)
+                m_faceCluster[i] = c;
+        }
+    }
+    m_clusterVisible.assign(m_worldClusters.size(), 1);
 
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, te.width, te.height, 0, GL_RGBA,
-                         GL_UNSIGNED_BYTE, pixelData.data());
-            glGenerateMipmap(GL_TEXTURE_2D);
+    m_physicsWorld->SetWorldData(m_worldVerts, indices, bvhLump);
 
-            m_worldTextures.push_back(texID);
+    // The GPU gets 16 bit indices. A draw range whose faces reach across more vertices than those
+    // can address is split before the face that would go out of reach, and every range draws
+    // with its own base vertex. Only a single face that wide keeps the whole map at 32 bits
+    std::vector<ABSPDrawRange> windows;
+    std::vector<int32_t>       windowBase;
+    bool                       shortIndices = true;
+    for (const auto& range : m_drawRanges)
+    {
+        ABSPDrawRange window = {range.textureID, range.firstIndex, 0, range.firstFace, 0};
+        uint32_t      lo = UINT32_MAX, hi = 0;
+        for (uint32_t i = range.firstFace; i < range.firstFace + range.numFaces; i++)
+        {
+            const AFace& f     = m_worldFaces[i];
+            uint32_t     count = f.numVertices >= 3 ? (f.numVertices - 2) * 3 : 0;
+            uint32_t     faceLo = UINT32_MAX, faceHi = 0;
+            for (uint32_t k = m_faceFirstIndex[i]; k < m_faceFirstIndex[i] + count; k++)
+            {
+                faceLo = std::min(faceLo, indices[k]);
+                faceHi = std::max(faceHi, indices[k]);
+            }
+            if (count && faceHi - faceLo > 65535)
+                shortIndices = false;
+            if (count && window.numFaces && std::max(hi, faceHi) - std::min(lo, faceLo) > 65535)
+            {
+                windows.push_back(window);
+                windowBase.push_back((int32_t) lo);
+                window = {range.textureID, m_faceFirstIndex[i], 0, i, 0};
+                lo     = UINT32_MAX;
+                hi     = 0;
+            }
+            lo = std::min(lo, faceLo);
+            hi = std::max(hi, faceHi);
+            window.numIndices += count;
+            window.numFaces++;
         }
+        windows.push_back(window);
+        windowBase.push_back(lo == UINT32_MAX ? 0 : (int32_t) lo);
     }
-    is.close();
-    
-
-    std::vector<uint32_t> indices;
-    for (const auto& f : m_worldFaces)
+    std::vector<uint16_t> gpuIndices;
+    if (shortIndices)
     {
-        for (uint32_t i = 1; i < f.numVertices - 1; i++)
+        m_drawRanges    = std::move(windows);
+        m_drawRangeBase = std::move(windowBase);
+        gpuIndices.resize(indices.size());
+        for (size_t r = 0; r < m_drawRanges.size(); r++)
         {
-            indices.push_back(f.firstVertex);
-            indices.push_back(f.firstVertex + i);
-            indices.push_back(f.firstVertex + i + 1);
+            const ABSPDrawRange& range = m_drawRanges[r];
+            for (uint32_t i = range.firstIndex; i < range.firstIndex + range.numIndices; i++)
+                gpuIndices[i] = (uint16_t) (indices[i] - m_drawRangeBase[r]);
         }
     }
-    m_worldIndexCount = (uint32_t) indices.size();
-
-    m_physicsWorld->SetWorldData(m_worldVerts, m_worldFaces);
+    else
+        m_drawRangeBase.assign(m_drawRanges.size(), 0);
+    m_worldIndexSize = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
 
     glGenVertexArrays(1, &m_worldVAO);
     glGenBuffers(1, &m_worldVBO);
@@ -150,25 +354,118 @@ void AEngine::LoadMap(const char* mapName)
     glBindVertexArray(m_worldVAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, m_worldVBO);
-    glBufferData(GL_ARRAY_BUFFER, m_worldVerts.size() * sizeof(AVertex), m_worldVerts.data(),
+    EVertexFormat vertexFormat = (EVertexFormat) m_worldVertexStream.format;
+    glBufferData(GL_ARRAY_BUFFER,
+                 (GLsizeiptr) m_worldVerts.size() * AVertexFormat::GetStride(vertexFormat), vertexData,
                  GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_worldEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(),
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * m_worldIndexSize,
+                 shortIndices ? (const void*) gpuIndices.data() : (const void*) indices.data(),
                  GL_STATIC_DRAW);
 
     // Vertex attributes
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(AVertex), (void*) 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(AVertex), (void*) offsetof(AVertex, uv));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(AVertex),
-                          (void*) offsetof(AVertex, normal));
-    glEnableVertexAttribArray(2);
+    AVertexFormat::SetupAttributes(vertexFormat);
+
+    // Baked lighting, the coordinates live in their own buffer so AVertex stays the same
+    ABSPLightmapHeader lm = {};
+    if (lightmapLump.size() >= sizeof(lm))
+        memcpy(&lm, lightmapLump.data(), sizeof(lm));
+    if (lm.width && lm.height &&
+        lightmapLump.size() - sizeof(lm) == (uint64_t) lm.width * lm.height * 3 &&
+        lightmapUVs.size() == m_worldVerts.size())
+    {
+        glGenTextures(1, &m_lightmapTexture);
+        glBindTexture(GL_TEXTURE_2D, m_lightmapTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, lm.width, lm.height, 0, GL_RGB, GL_UNSIGNED_BYTE,
+                     lightmapLump.data() + sizeof(lm));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenBuffers(1, &m_worldLightmapVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_worldLightmapVBO);
+        glBufferData(GL_ARRAY_BUFFER, lightmapUVs.size() * sizeof(glm::vec2), lightmapUVs.data(),
+                     GL_STATIC_DRAW);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*) 0);
+        glEnableVertexAttribArray(3);
+    }
 
     glBindVertexArray(0);
     std::cout << "Engine: Loaded " << path << " (" << m_worldIndexCount / 3 << " triangles, "
-              << h.numEntities << " entities)" << std::endl;
+              << entities.size() << " entities, " << m_bspLeafs.size() << " vis leafs)" << std::endl;
+}
+
+/**
+ * Marks the world faces that can be seen from the leaf containing the eye
+ * @param eye Camera position in world space
+ * @return false when the map has no visibility data or the eye is inside solid,
+ *         in which case everything should be drawn
+ */
+bool AEngine::MarkVisibleFaces(const glm::vec3& eye)
+{
+    if (m_bspNodes.empty())
+        return false;
+
+    // Walk down the tree to the leaf the camera is in
+    int32_t node = 0;
+    while (node >= 0)
+    {
+        const ABSPNode& n = m_bspNodes[node];
+        float           d = glm::dot(n.plane.normal, eye) - n.plane.distance;
+        node              = n.children[d >= 0.0f ? 0 : 1];
+    }
+    int32_t cluster = m_bspLeafs[-node - 1].cluster;
+    if (cluster < 0)
+        return false;
+
+    // Same cluster as last frame, the marks are still good
+    if (cluster == m_lastCluster)
+        return true;
+
+    ABSPVisHeader header;
+    memcpy(&header, m_visData.data(), sizeof(header));
+    if ((uint32_t) cluster >= header.numClusters)
+        return false;
+    uint32_t offset;
+    memcpy(&offset, m_visData.data() + sizeof(header) + cluster * sizeof(uint32_t), sizeof(offset));
+
+    // Zero bytes are stored as (0, run length)
+    size_t rowBytes = (header.numClusters + 7) / 8;
+    m_visRow.assign(rowBytes, 0);
+    const uint8_t* in  = m_visData.data() + offset;
+    const uint8_t* end = m_visData.data() + m_visData.size();
+    for (size_t out = 0; out < rowBytes && in < end;)
+    {
+        if (*in)
+        {
+            m_visRow[out++] = *in++;
+            continue;
+        }
+        if (in + 1 >= end)
+            break;
+        out += in[1];
+        in += 2;
+    }
+
+    m_visFrame++;
+    m_lastCluster = cluster;
+    for (const auto& leaf : m_bspLeafs)
+    {
+        if (leaf.cluster < 0 || !(m_visRow[leaf.cluster >> 3] & (1 << (leaf.cluster & 7))))
+            continue;
+        for (uint32_t i = 0; i < leaf.numLeafFaces; i++)
+        {
+            uint32_t face = m_leafFaces[leaf.firstLeafFace + i];
+            if (face < m_faceVisFrame.size())
+                m_faceVisFrame[face] = m_visFrame;
+        }
+    }
+    return true;
 }
 /**
  * Creates a new entity and adds it to the engine's entity list
@@ -212,6 +509,9 @@ void AEngine::Run()
         // Update physics simulation
         m_physicsWorld->Update(m_deltaTime);
 
+        // Meshes loaded in the background go to the GPU a few at a time so no frame hitches
+        m_resourceManager->ProcessUploads(m_uploadBudget);
+
         // Rendering section
         // Clear the screen with a dark gray color
         glClearColor(0.1f, 0.1f, 0.12f, 1.0f);
@@ -228,6 +528,10 @@ void AEngine::Run()
                 glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 5000.0f);
             // Get view matrix from the game instance
             glm::mat4 view = m_game->GetViewMatrix();
+            // Components size things up on screen with these
+            m_cameraPosition = glm::vec3(glm::inverse(view)[3]);
+            m_pixelsPerUnit  = 720.0f / (2.0f * std::tan(glm::radians(45.0f) * 0.5f));
+            m_viewProjection = projection * view;
 
             // Pass projection and view matrices to the shader
             glUniformMatrix4fv(glGetUniformLocation(m_mainShader->GetID(), "projection"), 1,
@@ -241,24 +545,78 @@ void AEngine::Run()
                 m_mainShader->Use();
                 glBindVertexArray(m_worldVAO);
 
-                uint32_t indexOffset = 0;
-                for (const auto& f : m_worldFaces)
+                GLuint program = m_mainShader->GetID();
+                glUniform1i(glGetUniformLocation(program, "ourTexture"), 0);
+                glUniform1i(glGetUniformLocation(program, "lightmap"), 1);
+                glUniform1i(glGetUniformLocation(program, "useLightmap"), m_lightmapTexture != 0);
+                AVertexFormat::SetUniforms(m_mainShader->GetVertexFormatUniforms(),
+                                           m_worldVertexStream);
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, m_lightmapTexture);
+                glActiveTexture(GL_TEXTURE0);
+
+                // Only draw what the camera's leaf can potentially see
+                bool culled = MarkVisibleFaces(m_cameraPosition);
+
+                // Then skip the clusters that are off screen or face away from the camera
+                bool clustered = !m_worldClusters.empty();
+                if (clustered)
                 {
-                    uint32_t indicesForFace = (f.numVertices - 2) * 3;
-                    if (f.textureID < m_worldTextures.size())
+                    AFrustum frustum = AFrustum::FromMatrix(m_viewProjection, m_cameraPosition);
+                    for (size_t c = 0; c < m_worldClusters.size(); c++)
+                        m_clusterVisible[c] = frustum.IsClusterVisible(m_worldClusters[c].bounds);
+                }
+                auto isFaceVisible = [&](uint32_t i) {
+                    if (culled && m_faceVisFrame[i] != m_visFrame)
+                        return false;
+                    return !clustered || m_faceCluster[i] == UINT32_MAX ||
+                           m_clusterVisible[m_faceCluster[i]] != 0;
+                };
+
+                GLenum indexType = m_worldIndexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+                auto   drawIndices = [&](uint32_t first, uint32_t count, GLint base) {
+                    glDrawElementsBaseVertex(GL_TRIANGLES, count, indexType,
+                                             (void*) ((size_t) first * m_worldIndexSize), base);
+                };
+                for (size_t r = 0; r < m_drawRanges.size(); r++)
+                {
+                    const ABSPDrawRange& range = m_drawRanges[r];
+                    GLint                base  = m_drawRangeBase[r];
+                    if (range.textureID < m_worldTextures.size())
                     {
-                        glBindTexture(GL_TEXTURE_2D, m_worldTextures[f.textureID]);
+                        glBindTexture(GL_TEXTURE_2D, m_worldTextures[range.textureID]);
                     }
                     else
                     {
                         glBindTexture(GL_TEXTURE_2D, 0); // Or a white texture
                     }
-                    glDrawElements(GL_TRIANGLES, indicesForFace, GL_UNSIGNED_INT,
-                                   (void*) (indexOffset * sizeof(uint32_t)));
-                    indexOffset += indicesForFace;
+                    if (!culled && !clustered)
+                    {
+                        drawIndices(range.firstIndex, range.numIndices, base);
+                        continue;
+                    }
+
+                    // Visible faces that sit next to each other in the buffer go out as one draw
+                    uint32_t runFirst = 0, runCount = 0;
+                    for (uint32_t i = range.firstFace; i < range.firstFace + range.numFaces; i++)
+                    {
+                        if (isFaceVisible(i))
+                        {
+                            if (runCount == 0)
+                                runFirst = m_faceFirstIndex[i];
+                            uint32_t corners = m_worldFaces[i].numVertices;
+                            runCount += corners >= 3 ? (corners - 2) * 3 : 0;
+                            continue;
+                        }
+                        if (runCount)
+                            drawIndices(runFirst, runCount, base);
+                        runCount = 0;
+                    }
+                    if (runCount)
+                        drawIndices(runFirst, runCount, base);
                 }
-                // Draw the entire world in one single call
                 glBindVertexArray(0);
+                glUniform1i(glGetUniformLocation(program, "useLightmap"), 0);
             }
 
             // Render Entities
@@ -292,6 +650,10 @@ AEngine::~AEngine()
         glDeleteBuffers(1, &m_worldVBO);
         glDeleteBuffers(1, &m_worldEBO);
     }
+    if (m_worldLightmapVBO)
+        glDeleteBuffers(1, &m_worldLightmapVBO);
+    if (m_lightmapTexture)
+        glDeleteTextures(1, &m_lightmapTexture);
 
     delete m_resourceManager;
     delete m_physicsWorld;
@@ -6,6 +6,7 @@
 #include "AnvilBSPFormat.h"
 #include "AnvilPhysics.h"
 #include "AResourceManager.h"
+#include "AVertexFormat.h"
 #include <Windows.h>
 #include <glad/glad.h>
 #include <glfw/glfw3.h>
@@ -82,8 +83,47 @@ class ANVIL_API AEngine
     {
         return m_physicsWorld;
     }
+    /**
+     * @brief Gets the resource manager, meshes loaded through it share their textures
+     */
+    AResourceManager* GetResources()
+    {
+        return m_resourceManager;
+    }
+    /**
+     * @brief Bytes of meshes and textures from LoadMeshAsync that go to the GPU each frame
+     */
+    void SetUploadBudget(size_t bytes)
+    {
+        m_uploadBudget = bytes;
+    }
+    /**
+     * @brief Where the frame being rendered is seen from
+     */
+    const glm::vec3& GetCameraPosition() const
+    {
+        return m_cameraPosition;
+    }
+    /**
+     * @brief How many pixels one unit covers on screen at a distance of one unit, divide by the
+     * distance for anything further away
+     */
+    float GetPixelsPerUnit() const
+    {
+        return m_pixelsPerUnit;
+    }
+    /**
+     * @brief projection * view of the frame being rendered, times a model matrix it gives the
+     * frustum in that model's space (AFrustum::FromMatrix)
+     */
+    const glm::mat4& GetViewProjection() const
+    {
+        return m_viewProjection;
+    }
 
   private:
+    bool MarkVisibleFaces(const glm::vec3& eye);
+
     static AEngine*       s_Instance;                  // Singleton instance of the engine
     std::vector<GLuint>   m_worldTextures;             // Collection of texture IDs
     AnvilPhysics*         m_physicsWorld    = nullptr; // Physics world instance
@@ -95,10 +135,32 @@ class ANVIL_API AEngine
     std::vector<AEntity*> m_entities;                  // Collection of all entities in the scene
     std::vector<AVertex>  m_worldVerts;                // Vertices for the world geometry
     std::vector<AFace>    m_worldFaces;                // Faces for the world geometry
+    std::vector<uint32_t> m_faceFirstIndex;            // First index of each face in the world EBO
+    std::vector<ABSPDrawRange> m_drawRanges;           // One draw per texture when nothing is culled
+    std::vector<int32_t>  m_drawRangeBase;             // Base vertex of each draw range's indices
+    std::vector<ABSPCluster> m_worldClusters;          // Faces culled together, can be empty
+    std::vector<uint32_t> m_faceCluster;               // Cluster of each face, UINT32_MAX for none
+    std::vector<uint8_t>  m_clusterVisible;            // Whether each cluster passed this frame
+    std::vector<ABSPNode> m_bspNodes;                  // BSP tree, empty when the map has no vis
+    std::vector<ABSPLeaf> m_bspLeafs;                  // Leafs of the BSP tree
+    std::vector<uint32_t> m_leafFaces;                 // Faces seen from each leaf
+    std::vector<uint8_t>  m_visData;                   // Compressed potentially visible sets
+    std::vector<uint8_t>  m_visRow;                    // Decompressed PVS of the camera cluster
+    std::vector<uint32_t> m_faceVisFrame;              // Vis frame each face was last marked in
+    uint32_t              m_visFrame    = 0;           // Bumped whenever the camera cluster changes
+    int32_t               m_lastCluster = -1;          // Cluster the faces were last marked for
     uint32_t m_worldVAO = 0, m_worldVBO = 0, m_worldEBO = 0; // VAO, VBO, and EBO for world geometry
+    uint32_t m_worldLightmapVBO = 0; // Lightmap coordinates of the world vertices
+    AVertexStreamHeader m_worldVertexStream; // Layout of the vertices in m_worldVBO
+    GLuint   m_lightmapTexture  = 0; // Baked lighting atlas, 0 when the map has none
     uint32_t m_worldIndexCount = 0;    // Number of indices in the world geometry
+    uint32_t m_worldIndexSize  = 4;    // Bytes per index in m_worldEBO, 2 when they fit
     float    m_lastFrameTime   = 0.0f; // Time of the last frame for delta time calculation
     float    m_deltaTime       = 0.0f;
+    glm::vec3 m_cameraPosition = glm::vec3(0.0f); // Eye of the frame being rendered
+    float     m_pixelsPerUnit  = 1.0f;            // Screen height over the frustum height at 1 unit
+    glm::mat4 m_viewProjection = glm::mat4(1.0f); // projection * view of the frame being rendered
+    size_t    m_uploadBudget   = 8 << 20;         // Async loads uploaded per frame, in bytes
     std::map<std::string, std::function<void()>>
         m_triggerCallbacks; // Map of trigger names to callback functions
 };
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "ALZ4.h"
+#include <cstring>
+
+namespace
+{
+constexpr size_t   MIN_MATCH     = 4;
+constexpr size_t   LAST_LITERALS = 5;  // the block always ends in this many literals
+constexpr size_t   MATCH_LIMIT   = 12; // no match starts closer than this to the end
+constexpr size_t   MAX_OFFSET    = 65535;
+constexpr uint32_t HASH_BITS     = 16;
+
+uint32_t Read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t Hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 and more continue in bytes of 255 until a smaller one
+void WriteLength(std::vector<uint8_t>& out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back((uint8_t) length);
+}
+
+void WriteSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t numLiterals,
+                   size_t offset, size_t matchLength)
+{
+    size_t  extraMatch = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+    uint8_t token      = (uint8_t) ((numLiterals < 15 ? numLiterals : 15) << 4);
+    if (matchLength)
+        token |= (uint8_t) (extraMatch < 15 ? extraMatch : 15);
+    out.push_back(token);
+    if (numLiterals >= 15)
+        WriteLength(out, numLiterals - 15);
+    out.insert(out.end(), literals, literals + numLiterals);
+    if (!matchLength)
+        return;
+    out.push_back((uint8_t) (offset & 0xFF));
+    out.push_back((uint8_t) (offset >> 8));
+    if (extraMatch >= 15)
+        WriteLength(out, extraMatch - 15);
+}
+
+bool ReadLength(const uint8_t* src, size_t srcSize, size_t& ip, size_t& length)
+{
+    uint8_t b;
+    do
+    {
+        if (ip >= srcSize)
+            return false;
+        b = src[ip++];
+        length += b;
+    } while (b == 255);
+    return true;
+}
+} // namespace
+
+void ALZ4::Compress(const uint8_t* src, size_t size, std::vector<uint8_t>& out)
+{
+    out.clear();
+    out.reserve(GetMaxCompressedSize(size));
+
+    size_t anchor = 0;
+    if (size > MATCH_LIMIT)
+    {
+        std::vector<int64_t> table((size_t) 1 << HASH_BITS, -1);
+        size_t               matchEnd = size - LAST_LITERALS;
+        size_t               ip       = 0;
+        size_t               misses   = 0;
+        while (ip + MATCH_LIMIT <= size)
+        {
+            uint32_t sequence = Read32(src + ip);
+            uint32_t h        = Hash(sequence);
+            int64_t  ref      = table[h];
+            table[h]          = (int64_t) ip;
+
+            if (ref < 0 || ip - (size_t) ref > MAX_OFFSET || Read32(src + ref) != sequence)
+            {
+                // Step further the longer nothing matches, incompressible data goes by quickly
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            // Grow the match backwards over literals that repeat as well, then forwards
+            size_t start = ip, from = (size_t) ref;
+            while (start > anchor && from > 0 && src[start - 1] == src[from - 1])
+            {
+                start--;
+                from--;
+            }
+            size_t length = ip - start + MIN_MATCH;
+            while (start + length < matchEnd && src[from + length] == src[start + length])
+                length++;
+
+            WriteSequence(out, src + anchor, start - anchor, start - from, length);
+            ip = anchor = start + length;
+            if (ip >= 2 && ip + MATCH_LIMIT <= size)
+                table[Hash(Read32(src + ip - 2))] = (int64_t) (ip - 2);
+        }
+    }
+    WriteSequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+bool ALZ4::Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    size_t ip = 0, op = 0;
+    while (ip < srcSize)
+    {
+        uint8_t token       = src[ip++];
+        size_t  numLiterals = token >> 4;
+        if (numLiterals == 15 && !ReadLength(src, srcSize, ip, numLiterals))
+            return false;
+        if (numLiterals > srcSize - ip || numLiterals > dstSize - op)
+            return false;
+        memcpy(dst + op, src + ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+        // The last sequence is literals only
+        if (ip == srcSize)
+            break;
+
+        if (srcSize - ip < 2)
+            return false;
+        size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !ReadLength(src, srcSize, ip, length))
+            return false;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > op || length > dstSize - op)
+            return false;
+
+        uint8_t*       d = dst + op;
+        const uint8_t* s = d - offset;
+        if (offset >= length)
+            memcpy(d, s, length);
+        else
+        {
+            // Overlapping, the match repeats the last offset bytes
+            for (size_t i = 0; i < length; i++)
+                d[i] = s[i];
+        }
+        op += length;
+    }
+    return op == dstSize;
+}
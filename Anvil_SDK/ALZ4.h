@@ -0,0 +1,46 @@
+#pragma once
+// ALZ4.h
+#include "ACore.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class ALZ4
+ * @brief LZ4 block compression, no frame and no dependency
+ * The output is plain LZ4 block format, so any LZ4 tool can read lumps written with it. The
+ * compressor is a greedy single probe one: fast, a bit larger than LZ4 HC would get. What matters
+ * is that decompression is a copy loop and runs at memory speed.
+ */
+class ANVIL_API ALZ4
+{
+  public:
+    /**
+     * @brief Compresses a block
+     * @param out Receives the compressed data, replacing whatever it held
+     */
+    static void Compress(const uint8_t* src, size_t size, std::vector<uint8_t>& out);
+
+    /**
+     * @brief Decompresses a block into a buffer of exactly the original size
+     * @return false if the data is corrupt or doesn't decompress to dstSize bytes
+     */
+    static bool Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+    // Worst case of Compress, for data that doesn't compress at all
+    static size_t GetMaxCompressedSize(size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    /**
+     * @brief Whether a block of srcSize bytes can really decompress to rawSize, checked before
+     * the output is allocated. A byte of LZ4 expands to 255 at most, and nothing we write gets
+     * past MAX_RAW_SIZE, so a corrupt size can't ask for gigabytes
+     */
+    static bool IsValidRawSize(size_t srcSize, uint64_t rawSize)
+    {
+        return rawSize <= MAX_RAW_SIZE && rawSize <= (uint64_t) srcSize * 255 + 16;
+    }
+    static constexpr uint64_t MAX_RAW_SIZE = 1ull << 30;
+};
@@ -0,0 +1,93 @@
+#include "AMappedFile.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+AMappedFile::~AMappedFile()
+{
+    Close();
+}
+
+bool AMappedFile::Open(const char* path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t) size.QuadPart;
+
+    // Mapping an empty file fails, but it's still a valid file
+    if (m_size == 0)
+        return true;
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        Close();
+        return false;
+    }
+    m_data = (const uint8_t*) MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    m_file = (void*) (intptr_t) (fd + 1);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t) st.st_size;
+    if (m_size == 0)
+        return true;
+
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    m_data     = data == MAP_FAILED ? nullptr : (const uint8_t*) data;
+#endif
+
+    if (!m_data)
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void AMappedFile::Close()
+{
+#ifdef _WIN32
+    if (m_data)
+        UnmapViewOfFile(m_data);
+    if (m_mapping)
+        CloseHandle(m_mapping);
+    if (m_file)
+        CloseHandle(m_file);
+#else
+    if (m_data)
+        munmap((void*) m_data, m_size);
+    if (m_file)
+        close((int) (intptr_t) m_file - 1);
+#endif
+    m_data    = nullptr;
+    m_size    = 0;
+    m_file    = nullptr;
+    m_mapping = nullptr;
+}
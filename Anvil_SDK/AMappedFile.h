@@ -0,0 +1,53 @@
+#pragma once
+// AMappedFile.h
+#include "ACore.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * @class AMappedFile
+ * @brief Read-only view of a whole file mapped into memory
+ * The data stays valid until the object is closed or destroyed, pages are only read in by the OS
+ * when they are touched.
+ */
+class ANVIL_API AMappedFile
+{
+  public:
+    AMappedFile() = default;
+    ~AMappedFile();
+
+    AMappedFile(const AMappedFile&)            = delete;
+    AMappedFile& operator=(const AMappedFile&) = delete;
+
+    /**
+     * @brief Maps a file, closing whatever was mapped before
+     * @param path Path to the file
+     * @return false if the file couldn't be opened or mapped
+     */
+    bool Open(const char* path);
+    void Close();
+
+    bool IsOpen() const
+    {
+        return m_data != nullptr || m_file != nullptr;
+    }
+    const uint8_t* GetData() const
+    {
+        return m_data;
+    }
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+    std::string_view GetText() const
+    {
+        return std::string_view((const char*) m_data, m_size);
+    }
+
+  private:
+    const uint8_t* m_data    = nullptr;
+    size_t         m_size    = 0;
+    void*          m_file    = nullptr; // OS file handle
+    void*          m_mapping = nullptr; // OS mapping handle, Windows only
+};
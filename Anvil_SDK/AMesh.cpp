@@ -1,50 +1,177 @@
 #include "AMesh.h"
+#include "AShader.h"
+#include <algorithm>
+#include <cstring>
 #include <glad/glad.h>
 
-void AMesh::Draw()
+std::atomic<uint64_t> AMesh::s_nextID{1};
+
+void AMesh::Draw(const AShader* shader, uint32_t lod, const AFrustum* frustum)
 {
-    if (m_textureID != 0)
-    {
-        glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, m_textureID);
-    }
-    else
+    if (!VAO)
+        return;
+    AVertexFormat::SetUniforms(shader->GetVertexFormatUniforms(), m_stream);
+    glBindVertexArray(VAO);
+    glActiveTexture(GL_TEXTURE0);
+
+    const AMeshLOD& range = m_lods[std::min<size_t>(lod, m_lods.size() - 1)];
+    uint32_t        bound = UINT32_MAX;
+    for (const auto& submesh : m_submeshes)
     {
-        glBindTexture(GL_TEXTURE_2D, 0);
+        if (submesh.firstIndex < range.firstIndex ||
+            submesh.firstIndex >= range.firstIndex + range.numIndices)
+            continue;
+        uint32_t texture = submesh.material < m_textures.size() ? m_textures[submesh.material] : 0;
+        auto     draw    = [&](uint32_t first, uint32_t count) {
+            if (texture != bound)
+            {
+                glBindTexture(GL_TEXTURE_2D, texture);
+                bound = texture;
+            }
+            glDrawElementsBaseVertex(GL_TRIANGLES, count,
+                                     m_indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                     (void*) ((size_t) first * m_indexSize), submesh.baseVertex);
+        };
+        uint32_t end = submesh.firstIndex + submesh.numIndices;
+        auto     it  = std::lower_bound(
+            m_clusters.begin(), m_clusters.end(), submesh.firstIndex,
+            [](const AMeshCluster& c, uint32_t first) { return c.firstIndex < first; });
+        if (!frustum || it == m_clusters.end() || it->firstIndex >= end)
+        {
+            draw(submesh.firstIndex, submesh.numIndices);
+            continue;
+        }
+
+        // Visible clusters that sit next to each other in the buffer go out as one draw
+        uint32_t runFirst = 0, runCount = 0;
+        for (; it != m_clusters.end() && it->firstIndex < end; ++it)
+        {
+            if (frustum->IsClusterVisible(it->bounds))
+            {
+                if (runCount == 0)
+                    runFirst = it->firstIndex;
+                runCount += it->numIndices;
+                continue;
+            }
+            if (runCount)
+                draw(runFirst, runCount);
+            runCount = 0;
+        }
+        if (runCount)
+            draw(runFirst, runCount);
     }
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-AMesh::AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID)
+void AMesh::SetSubmeshes(std::vector<AMeshSubmesh> submeshes, std::vector<uint32_t> textures)
+{
+    m_submeshes = std::move(submeshes);
+    m_textures  = std::move(textures);
+}
+
+AMesh::AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID,
+             std::vector<AMeshLOD> lods)
+{
+    m_textures           = {texID};
+    m_vertices           = std::move(verts);
+    m_lods               = std::move(lods);
+    m_stream.numVertices = (uint32_t) m_vertices.size();
+    Upload(indices.data(), indices.size(), sizeof(uint32_t), (const uint8_t*) m_vertices.data());
+}
+
+AMesh::AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID,
+             const AVertexStreamHeader& stream, const uint8_t* streamData,
+             std::vector<AMeshLOD> lods)
+{
+    m_textures  = {texID};
+    m_vertices  = std::move(verts);
+    m_lods      = std::move(lods);
+    m_stream    = stream;
+    Upload(indices.data(), indices.size(), sizeof(uint32_t), streamData);
+}
+
+AMesh::AMesh(const AVertexStreamHeader& stream, const uint8_t* vertexData, const void* indices,
+             size_t numIndices, uint32_t indexSize, uint32_t texID, std::vector<AMeshLOD> lods,
+             bool keepVertices)
 {
-    m_textureID = texID;
-    indexCount  = (uint32_t) indices.size();
-    m_vertices  = verts;
+    std::vector<MVertex> vertices;
+    if (keepVertices)
+        AVertexFormat::Decode(stream, vertexData,
+                              (size_t) stream.numVertices *
+                                  AVertexFormat::GetStride((EVertexFormat) stream.format),
+                              vertices);
+    Create(stream, vertexData, indices, numIndices, indexSize, texID, std::move(lods),
+           std::move(vertices));
+}
+
+void AMesh::Create(const AVertexStreamHeader& stream, const uint8_t* vertexData,
+                   const void* indices, size_t numIndices, uint32_t indexSize, uint32_t texID,
+                   std::vector<AMeshLOD> lods, std::vector<MVertex> vertices)
+{
+    m_textures = {texID};
+    m_lods     = std::move(lods);
+    m_vertices = std::move(vertices);
+    m_stream   = stream;
+    Upload(indices, numIndices, indexSize, vertexData);
+}
+
+void AMesh::Upload(const void* indices, size_t numIndices, uint32_t indexSize,
+                   const uint8_t* vertexData)
+{
+    EVertexFormat format = (EVertexFormat) m_stream.format;
+    uint32_t      stride = AVertexFormat::GetStride(format);
+    if (m_lods.empty())
+        m_lods.push_back({0, (uint32_t) numIndices, 0.0f});
+    for (const auto& lod : m_lods)
+        m_submeshes.push_back({lod.firstIndex, lod.numIndices, 0, 0});
+
+    // The float and packed layouts start with the position, quantized ones are inside the box
+    // the stream header spans, its furthest corner is close enough
+    if (format == EVertexFormat::Quantized)
+    {
+        glm::vec3 corner = glm::max(glm::abs(m_stream.origin),
+                                    glm::abs(m_stream.origin + m_stream.scale * 65535.0f));
+        m_boundingRadius = glm::length(corner);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < m_stream.numVertices; i++)
+        {
+            glm::vec3 pos;
+            memcpy(&pos, vertexData + (size_t) i * stride, sizeof(pos));
+            m_boundingRadius = std::max(m_boundingRadius, glm::length(pos));
+        }
+    }
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
 
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, verts.size() * sizeof(MVertex), verts.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) m_stream.numVertices * stride, vertexData,
+                 GL_STATIC_DRAW);
 
+    // 32 bit indices into few enough vertices get halved, new files come with 16 bit ones
+    std::vector<uint16_t> narrow;
+    if (indexSize == sizeof(uint32_t) && m_stream.numVertices <= 65536)
+    {
+        narrow.resize(numIndices);
+        for (size_t i = 0; i < numIndices; i++)
+            narrow[i] = (uint16_t) ((const uint32_t*) indices)[i];
+        indices   = narrow.data();
+        indexSize = sizeof(uint16_t);
+    }
+    m_indexSize = indexSize;
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(),
-                 GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, indices, GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void*) 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void*) offsetof(MVertex, uv));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex),
-                          (void*) offsetof(MVertex, normal));
-    glEnableVertexAttribArray(2);
+    AVertexFormat::SetupAttributes(format);
 }
 
 AMesh::~AMesh()
 {
+    if (!VAO)
+        return;
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
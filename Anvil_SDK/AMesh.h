@@ -1,9 +1,14 @@
 #pragma once
 #include "ACore.h"
+#include "ACulling.h"
 #include "AMath.h"
+#include "AVertexFormat.h"
+#include <atomic>
 #include <vector>
 #include <cstdint>
 
+class AShader;
+
 struct MVertex
 {
     glm::vec3 pos;
@@ -11,6 +16,47 @@ struct MVertex
     glm::vec3 normal;
 };
 
+/**
+ * @brief A level of detail, a range of the mesh's index buffer
+ * All levels index the same vertices, coarser ones just use fewer of them.
+ */
+struct AMeshLOD
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    float    error; // how far it's off the full mesh at most, in the mesh's units
+};
+
+/**
+ * @brief A range of indices drawn with one material
+ * Every LOD has its own submeshes, inside the LOD's range.
+ */
+struct AMeshSubmesh
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    uint32_t material;
+    int32_t  baseVertex = 0; // added to every index of the range, so 16 bit ones reach any vertex
+};
+
+/**
+ * @brief A few dozen triangles of a submesh that are culled together, a range of its indices
+ */
+struct AMeshCluster
+{
+    AClusterBounds bounds;
+    uint32_t       firstIndex;
+    uint32_t       numIndices;
+};
+
+/**
+ * @brief A convex piece of the mesh for collision, see AConvexDecomposition
+ */
+struct AConvexHull
+{
+    std::vector<glm::vec3> points;
+};
+
 /**
  * @class AMesh
  * @brief Represents a mesh object in the ANVIL engine with vertices, indices, and texture support.
@@ -18,17 +64,144 @@ struct MVertex
 class ANVIL_API AMesh
 {
   public:
-    AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID = 0);
+    /**
+     * @param lods Ranges of indices, finest first. Empty draws all of indices as the only level
+     */
+    AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID = 0,
+          std::vector<AMeshLOD> lods = {});
+    /**
+     * @brief Uploads an already encoded vertex stream instead of the float vertices
+     * @param verts Decoded vertices, kept for GetVertices
+     * @param stream Header of the encoded stream
+     * @param streamData numVertices encoded vertices
+     */
+    AMesh(std::vector<MVertex> verts, std::vector<uint32_t> indices, uint32_t texID,
+          const AVertexStreamHeader& stream, const uint8_t* streamData,
+          std::vector<AMeshLOD> lods = {});
+    /**
+     * @brief Uploads straight from memory the mesh doesn't own, like a mapped .anvmesh, so the
+     * data is never copied on the way to GL
+     * @param vertexData stream.numVertices vertices in the stream's format
+     * @param indexSize 2 for uint16_t indices, 4 for uint32_t
+     * @param keepVertices Decode a copy for GetVertices. Without it GetVertices is empty and
+     * nothing of the mesh stays in CPU memory but its tables
+     */
+    AMesh(const AVertexStreamHeader& stream, const uint8_t* vertexData, const void* indices,
+          size_t numIndices, uint32_t indexSize, uint32_t texID, std::vector<AMeshLOD> lods,
+          bool keepVertices);
+    /**
+     * @brief Empty mesh that draws nothing until Create, what AResourceManager::LoadMeshAsync
+     * hands out while the file is still being read
+     */
+    AMesh() = default;
     ~AMesh();
-    void                        Draw();
+    /**
+     * @brief Uploads an empty mesh in place, same as the constructor that takes a stream
+     * @param vertices Decoded copy for GetVertices, can be empty
+     */
+    void Create(const AVertexStreamHeader& stream, const uint8_t* vertexData, const void* indices,
+                size_t numIndices, uint32_t indexSize, uint32_t texID, std::vector<AMeshLOD> lods,
+                std::vector<MVertex> vertices);
+    /**
+     * @brief false until the mesh has been uploaded
+     */
+    bool IsLoaded() const
+    {
+        return VAO != 0;
+    }
+    /**
+     * @brief What to draw in the mesh's place while it isn't loaded, not owned. Can be null
+     */
+    void SetPlaceholder(AMesh* placeholder)
+    {
+        m_placeholder = placeholder;
+    }
+    AMesh* GetPlaceholder() const
+    {
+        return m_placeholder;
+    }
+    /**
+     * @brief Draws one level of detail, past the last one draws the last one. One draw per
+     * submesh, the texture is only rebound when the material changes
+     * @param shader The program in use, its vertex format uniforms are set for the mesh's stream
+     * @param frustum In the mesh's space. Clusters it can't see are left out, the ones left over
+     * go out as one draw per run of neighbours. Null draws every cluster
+     */
+    void                        Draw(const AShader* shader, uint32_t lod = 0,
+                                     const AFrustum* frustum = nullptr);
+    /**
+     * @brief Splits the LODs by material, replacing the one submesh per LOD with texID
+     * @param textures Texture of every material, not owned by the mesh
+     */
+    void SetSubmeshes(std::vector<AMeshSubmesh> submeshes, std::vector<uint32_t> textures);
+    const std::vector<AMeshSubmesh>& GetSubmeshes() const
+    {
+        return m_submeshes;
+    }
+    /**
+     * @brief Culling clusters of every submesh, sorted by firstIndex
+     */
+    void SetClusters(std::vector<AMeshCluster> clusters)
+    {
+        m_clusters = std::move(clusters);
+    }
+    const std::vector<AMeshCluster>& GetClusters() const
+    {
+        return m_clusters;
+    }
+    /**
+     * @brief Convex pieces baked by the exporter, physics builds a compound shape from them
+     */
+    void SetCollisionHulls(std::vector<AConvexHull> hulls)
+    {
+        m_collisionHulls = std::move(hulls);
+    }
+    const std::vector<AConvexHull>& GetCollisionHulls() const
+    {
+        return m_collisionHulls;
+    }
+    /**
+     * @brief Unique for the life of the program, unlike the mesh's address
+     */
+    uint64_t GetID() const
+    {
+        return m_id;
+    }
+    /**
+     * @brief CPU copy of the vertices, empty if the mesh was loaded without one
+     */
     const std::vector<MVertex>& GetVertices() const
     {
         return m_vertices;
     }
+    const std::vector<AMeshLOD>& GetLODs() const
+    {
+        return m_lods;
+    }
+    /**
+     * @brief Radius of a sphere around the origin that holds every vertex
+     */
+    float GetBoundingRadius() const
+    {
+        return m_boundingRadius;
+    }
 
   private:
-    std::vector<MVertex> m_vertices;
-    uint32_t             VAO, VBO, EBO;
-    uint32_t             indexCount;
-    uint32_t             m_textureID;
+    void Upload(const void* indices, size_t numIndices, uint32_t indexSize,
+                const uint8_t* vertexData);
+
+    std::vector<MVertex>  m_vertices;
+    std::vector<AMeshLOD> m_lods;
+    std::vector<AMeshSubmesh> m_submeshes; // by LOD, then by material
+    std::vector<uint32_t>     m_textures;  // one per material
+    std::vector<AMeshCluster> m_clusters;
+    std::vector<AConvexHull>  m_collisionHulls;
+    AVertexStreamHeader   m_stream;
+    uint32_t              VAO = 0, VBO = 0, EBO = 0;
+    uint32_t              m_indexSize = sizeof(uint32_t); // of the EBO, 2 or 4
+    float                 m_boundingRadius = 0.0f;
+    AMesh*                m_placeholder    = nullptr;
+    uint64_t              m_id             = s_nextID++;
+
+    static std::atomic<uint64_t> s_nextID;
 };
\ No newline at end of file
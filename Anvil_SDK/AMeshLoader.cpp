@@ -1,9 +1,20 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "AMeshLoader.h"
+#include "AConvexDecomposition.h"
+#include "ALZ4.h"
+#include "AMappedFile.h"
+#include "AMeshOptimizer.h"
+#include "AResourceManager.h"
+#include "ATextureMips.h"
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <map>
+#include <set>
 #include <glad/glad.h>
 #include <iostream>
 #include <stb_image.h>
@@ -16,99 +27,414 @@
  * @param texturePath Path to the texture file
  * @return OpenGL texture ID (0 if loading failed)
  */
-uint32_t LoadTextureAuto(const std::string& texturePath)
+uint32_t AMeshLoader::LoadTexture(const std::string& texturePath)
 {
-    int            w, h, channels;  // Width, height, and number of channels for the image
-    unsigned char* pixels = stbi_load(texturePath.c_str(), &w, &h, &channels, 4); // Load image with 4 channels (RGBA)
+    ATextureData texture;
+    if (!ReadTexture(texturePath, texture))
+        return 0;
+    uint32_t texID = ATextureMips::Upload(texture.entry, texture.data.data(), texture.levels);
+    std::cout << "[Anvil Engine] Success: Loaded texture " << texturePath << std::endl;
+    return texID;
+}
 
-    if (pixels)  // Check if image loading was successful
+bool AMeshLoader::ReadTexture(const std::string& texturePath, ATextureData& texture)
+{
+    // A mip chain baked by the compiler next to the image skips decoding and glGenerateMipmap
+    // unless the image was edited after it was baked
+    std::filesystem::path bakedPath = std::filesystem::path(texturePath).replace_extension(".atex");
+    std::error_code       error;
+    bool                  baked = std::filesystem::exists(bakedPath, error);
+    if (baked && std::filesystem::exists(texturePath, error) &&
+        std::filesystem::last_write_time(texturePath, error) >
+            std::filesystem::last_write_time(bakedPath, error))
     {
-        unsigned int texID;  // Variable to store the texture ID
-        glGenTextures(1, &texID);
-        glBindTexture(GL_TEXTURE_2D, texID);  // Bind the texture
-
-        // Create texture and generate mipmaps
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        std::cout << "[Anvil Engine] Warning: " << texturePath << " is newer than "
+                  << bakedPath.string() << ", decoding it instead. Re-export to bake its mips"
+                  << std::endl;
+        baked = false;
+    }
+    if (baked && ATextureMips::Read(bakedPath.string(), texture.entry, texture.levels, texture.data))
+        return true;
 
-        stbi_image_free(pixels);
-        std::cout << "[Anvil Engine] Success: Loaded texture " << texturePath << std::endl;
-        return texID;
+    int            w, h, channels;  // Width, height, and number of channels for the image
+    unsigned char* pixels = stbi_load(texturePath.c_str(), &w, &h, &channels, 4); // Load image with 4 channels (RGBA)
+    if (!pixels)
+    {
+        std::cout << "[Anvil Engine] Warning: No texture found for " << texturePath
+                  << ". Using default white." << std::endl;
+        return false;
     }
 
-    std::cout << "[Anvil Engine] Warning: No texture found for " << texturePath
-              << ". Using default white." << std::endl;
-    return 0;
+    // Just the base level, GL makes the mips
+    texture.entry          = {};
+    texture.entry.width    = (uint32_t) w;
+    texture.entry.height   = (uint32_t) h;
+    texture.entry.format   = (uint32_t) ETextureFormat::RGBA8;
+    texture.entry.dataSize = (uint32_t) w * h * 4;
+    texture.levels.clear();
+    texture.data.assign(pixels, pixels + texture.entry.dataSize);
+    stbi_image_free(pixels);
+    return true;
 }
 
+// A lump of a loaded .anvmesh, in the mapped file or in a copy the loader made of it
+struct AMeshLumpView
+{
+    const uint8_t* data = nullptr;
+    size_t         size = 0;
+};
+
 /**
  * Loads a mesh from a file in the Anvil Engine mesh format.
+ * The file is mapped and GL gets the vertices and indices straight from the mapping, only
+ * compressed lumps are unpacked first.
  * @param path The path to the mesh file.
  * @return A pointer to the loaded AMesh object, or nullptr if loading failed.
  */
-AMesh* AMeshLoader::LoadAnvMesh(const std::string& path)
+AMesh* AMeshLoader::LoadAnvMesh(const std::string& path, AResourceManager* resources,
+                                bool keepVertices)
 {
-    // Open the file in binary mode
-    std::ifstream is(path, std::ios::binary);
-    if (!is)
+    AMeshData data;
+    if (!ReadAnvMesh(path, data, keepVertices))
+        return nullptr;
+
+    // Textures sit next to the model, the resource manager loads each one once
+    std::vector<uint32_t> textures;
+    for (const auto& texture : data.textures)
+    {
+        if (texture.empty())
+            textures.push_back(0);
+        else
+            textures.push_back(resources ? resources->LoadTexture(texture) : LoadTexture(texture));
+    }
+    AMesh* mesh = new AMesh();
+    UploadAnvMesh(data, *mesh, textures);
+    return mesh;
+}
+
+bool AMeshLoader::ReadAnvMesh(const std::string& path, AMeshData& out, bool keepVertices)
+{
+    AMappedFile& file = out.file;
+    if (!file.Open(path.c_str()))
     {
         // Print error message if file couldn't be opened
         std::cout << "[Anvil Engine] Error: Could not open " << path << std::endl;
-        return nullptr;
+        return false;
     }
+    const uint8_t* base     = file.GetData();
+    size_t         fileSize = file.GetSize();
 
-    // Read mesh header from the file
-    AMeshHeader head;
-    is.read((char*) &head, sizeof(AMeshHeader));
+    // Stored lumps point into the mapping, a deque keeps the unpacked ones where they are
+    std::map<std::string, AMeshLumpView> lumps;
+    std::deque<std::vector<uint8_t>>&    unpacked = out.unpacked;
+    auto unpack = [&](const char* id, const uint8_t* data, size_t size, uint64_t rawSize) {
+        if (!ALZ4::IsValidRawSize(size, rawSize))
+            return false;
+        std::vector<uint8_t>& raw = unpacked.emplace_back((size_t) rawSize);
+        if (!ALZ4::Decompress(data, size, raw.data(), raw.size()))
+            return false;
+        lumps[std::string(id, 4)] = {raw.data(), raw.size()};
+        return true;
+    };
+    bool        valid   = true;
+    uint32_t    version = 1;
+    std::string texName;
 
-    // Read vertex data from the file
-    std::vector<MVertex> vertices(head.numVertices);
-    is.read((char*) vertices.data(), head.numVertices * sizeof(MVertex));
+    AMeshHeaderV2 header;
+    if (fileSize >= sizeof(header) && memcmp(base, "AMSH", 4) == 0)
+    {
+        memcpy(&header, base, sizeof(header));
+        version               = header.version;
+        uint64_t directoryEnd = sizeof(header) + (uint64_t) header.numLumps * sizeof(AMeshLump);
+        valid = header.version <= ANVMESH_VERSION && directoryEnd <= fileSize;
+        for (uint32_t i = 0; valid && i < header.numLumps; i++)
+        {
+            AMeshLump lump;
+            memcpy(&lump, base + sizeof(header) + i * sizeof(lump), sizeof(lump));
+            const uint8_t* data = base + lump.offset;
+            if (lump.offset > fileSize || lump.size > fileSize - lump.offset)
+                valid = false;
+            else if ((EBSPCompression) lump.compression == EBSPCompression::None)
+                lumps[std::string(lump.id, 4)] = {data, (size_t) lump.size};
+            else
+                valid = (EBSPCompression) lump.compression == EBSPCompression::LZ4 &&
+                        unpack(lump.id, data, (size_t) lump.size, lump.rawSize);
+        }
+    }
+    else
+    {
+        // Version 1, the header's arrays are lumps just like the chunks after the path
+        AMeshHeader head;
+        uint64_t    offset = sizeof(head);
+        if (fileSize >= sizeof(head))
+            memcpy(&head, base, sizeof(head));
+        uint64_t vertexBytes = (uint64_t) head.numVertices * sizeof(MVertex);
+        uint64_t indexBytes  = (uint64_t) head.numIndices * sizeof(uint32_t);
+        valid = fileSize >= sizeof(head) &&
+                offset + vertexBytes + indexBytes + head.pathLength <= fileSize;
+        if (valid)
+        {
+            if (head.numVertices > 0)
+                lumps["VERT"] = {base + offset, (size_t) vertexBytes};
+            offset += vertexBytes;
+            if (head.numIndices > 0)
+                lumps["INDX"] = {base + offset, (size_t) indexBytes};
+            offset += indexBytes;
+            texName = std::string((const char*) base + offset, head.pathLength);
+            offset += head.pathLength;
+        }
+
+        // Chunks up to the end, a truncated one ends the list
+        AMeshChunk chunk;
+        while (valid && offset + sizeof(chunk) <= fileSize)
+        {
+            memcpy(&chunk, base + offset, sizeof(chunk));
+            offset += sizeof(chunk);
+            if (chunk.size > fileSize - offset)
+                break;
+            const uint8_t* payload = base + offset;
+            offset += chunk.size;
+            AMeshPackedChunk packed;
+            if (std::string(chunk.id, 4) != "LZ4 " || chunk.size < sizeof(packed))
+            {
+                lumps[std::string(chunk.id, 4)] = {payload, chunk.size};
+                continue;
+            }
+            memcpy(&packed, payload, sizeof(packed));
+            valid = unpack(packed.id, payload + sizeof(packed), chunk.size - sizeof(packed),
+                           packed.rawSize);
+        }
 
-    // Read index data from the file
-    std::vector<uint32_t> indices(head.numIndices);
-    is.read((char*) indices.data(), head.numIndices * sizeof(uint32_t));
+        // Coarser LODs go after the full mesh's indices
+        if (valid && lumps.count("INDX") && lumps.count("LODI"))
+        {
+            const AMeshLumpView&  full   = lumps["INDX"];
+            const AMeshLumpView&  coarse = lumps["LODI"];
+            std::vector<uint8_t>& joined = unpacked.emplace_back(full.size + coarse.size);
+            memcpy(joined.data(), full.data, full.size);
+            memcpy(joined.data() + full.size, coarse.data, coarse.size);
+            lumps["INDX"] = {joined.data(), joined.size()};
+        }
+    }
+    if (!valid)
+    {
+        std::cout << "[Anvil Engine] Error: Corrupt or unsupported mesh " << path << std::endl;
+        return false;
+    }
+
+    // Version 1 files can leave the indices off their alignment, those get copied
+    uint32_t       indexSize = lumps.count("IX16") ? sizeof(uint16_t) : sizeof(uint32_t);
+    AMeshLumpView& indexLump = lumps[indexSize == sizeof(uint16_t) ? "IX16" : "INDX"];
+    if ((uintptr_t) indexLump.data % indexSize != 0)
+    {
+        std::vector<uint8_t>& copy =
+            unpacked.emplace_back(indexLump.data, indexLump.data + indexLump.size);
+        indexLump.data = copy.data();
+    }
+    const uint8_t* indices    = indexLump.data;
+    size_t         numIndices = indexLump.size / indexSize;
+
+    std::vector<AMeshLOD> lods;
+    if (lumps.count("LODS"))
+    {
+        const AMeshLumpView& table = lumps["LODS"];
+        lods.resize(table.size / sizeof(AMeshLOD));
+        memcpy(lods.data(), table.data, lods.size() * sizeof(AMeshLOD));
+        for (const auto& lod : lods)
+        {
+            if ((uint64_t) lod.firstIndex + lod.numIndices > numIndices)
+            {
+                std::cout << "[Anvil Engine] Error: Bad LOD table in " << path << std::endl;
+                return false;
+            }
+        }
+    }
 
-    // Read texture path if present
-    std::string texName = "";
-    if (head.pathLength > 0)
+    // Compact vertices, the GPU gets them as they are
+    AVertexStreamHeader stream;
+    const uint8_t*      vertexData = nullptr;
+    if (lumps.count("VTXC"))
+    {
+        const AMeshLumpView& lump = lumps["VTXC"];
+        if (lump.size >= sizeof(stream))
+            memcpy(&stream, lump.data, sizeof(stream));
+        uint32_t stride = AVertexFormat::GetStride((EVertexFormat) stream.format);
+        if (lump.size < sizeof(stream) || stride == 0 ||
+            (uint64_t) stream.numVertices * stride > lump.size - sizeof(stream))
+        {
+            std::cout << "[Anvil Engine] Error: Unsupported vertex format in " << path << std::endl;
+            return false;
+        }
+        vertexData = lump.data + sizeof(stream);
+    }
+    else if (lumps.count("VERT"))
+    {
+        stream.numVertices = (uint32_t) (lumps["VERT"].size / sizeof(MVertex));
+        vertexData         = lumps["VERT"].data;
+    }
+    if (!vertexData || !indices)
     {
-        std::vector<char> pathBuf(head.pathLength);
-        is.read(pathBuf.data(), head.pathLength);
-        texName = std::string(pathBuf.data(), head.pathLength);
+        std::cout << "[Anvil Engine] Error: No geometry in " << path << std::endl;
+        return false;
     }
-    // Close the file
-    is.close();
 
-    // Load texture if a texture path was provided
-    uint32_t texID = 0;
-    if (!texName.empty())
+    // Texture paths of the materials, older files only have the one in the header
+    std::vector<std::string> materials = {texName};
+    if (lumps.count("MATS"))
     {
-        // Get the directory of the model file
-        std::filesystem::path modelPath(path);
-        // Construct the full path to the texture file
-        std::filesystem::path textureFullPath = modelPath.parent_path() / texName;
+        const AMeshLumpView& lump = lumps["MATS"];
+        materials.clear();
+        for (size_t offset = 0; offset + sizeof(uint32_t) <= lump.size;)
+        {
+            uint32_t length;
+            memcpy(&length, lump.data + offset, sizeof(length));
+            offset += sizeof(length);
+            if (length > lump.size - offset)
+                break;
+            materials.emplace_back((const char*) lump.data + offset, length);
+            offset += length;
+        }
+    }
+    std::vector<AMeshSubmesh> submeshes;
+    if (lumps.count("SUBM"))
+    {
+        const AMeshLumpView& lump = lumps["SUBM"];
+        if (version >= 3)
+        {
+            submeshes.resize(lump.size / sizeof(AMeshSubmesh));
+            memcpy(submeshes.data(), lump.data, submeshes.size() * sizeof(AMeshSubmesh));
+        }
+        for (size_t offset = 0; version < 3 && offset + sizeof(AMeshSubmeshV2) <= lump.size;
+             offset += sizeof(AMeshSubmeshV2))
+        {
+            AMeshSubmeshV2 entry;
+            memcpy(&entry, lump.data + offset, sizeof(entry));
+            submeshes.push_back({entry.firstIndex, entry.numIndices, entry.material});
+        }
+        for (const auto& submesh : submeshes)
+        {
+            if ((uint64_t) submesh.firstIndex + submesh.numIndices > numIndices)
+            {
+                std::cout << "[Anvil Engine] Error: Bad submesh table in " << path << std::endl;
+                return false;
+            }
+        }
+    }
+    // Every index the GPU fetches, after its base vertex, has to be one of the vertices.
+    // Without a submesh table the whole buffer is drawn as it is
+    auto rangeValid = [&](uint32_t first, uint32_t count, int32_t baseVertex) {
+        for (uint32_t i = first; i < first + count; i++)
+        {
+            uint32_t index = indexSize == sizeof(uint16_t) ? ((const uint16_t*) indices)[i]
+                                                           : ((const uint32_t*) indices)[i];
+            int64_t  vertex = (int64_t) baseVertex + index;
+            if (vertex < 0 || vertex >= stream.numVertices)
+                return false;
+        }
+        return true;
+    };
+    bool indicesValid = submeshes.empty() ? rangeValid(0, (uint32_t) numIndices, 0) : true;
+    for (const auto& submesh : submeshes)
+    {
+        indicesValid = indicesValid &&
+                       rangeValid(submesh.firstIndex, submesh.numIndices, submesh.baseVertex);
+    }
+    if (!indicesValid)
+    {
+        std::cout << "[Anvil Engine] Error: Indices past the last vertex in " << path << std::endl;
+        return false;
+    }
 
-        // Load the texture and get its ID
-        texID = LoadTextureAuto(textureFullPath.string());
+    for (const auto& material : materials)
+    {
+        out.textures.push_back(
+            material.empty() ? std::string()
+                             : (std::filesystem::path(path).parent_path() / material).string());
     }
 
-    // Create and return a new AMesh object with the loaded data
-    return new AMesh(vertices, indices, texID);
+    out.stream     = stream;
+    out.vertexData = vertexData;
+    out.indices    = indices;
+    out.numIndices = numIndices;
+    out.indexSize  = indexSize;
+    out.lods       = std::move(lods);
+    out.submeshes  = std::move(submeshes);
+    if (keepVertices)
+        AVertexFormat::Decode(stream, vertexData,
+                              (size_t) stream.numVertices *
+                                  AVertexFormat::GetStride((EVertexFormat) stream.format),
+                              out.vertices);
+
+    if (lumps.count("CLUS"))
+    {
+        const AMeshLumpView&       lump     = lumps["CLUS"];
+        std::vector<AMeshCluster>& clusters = out.clusters;
+        clusters.resize(lump.size / sizeof(AMeshCluster));
+        memcpy(clusters.data(), lump.data, clusters.size() * sizeof(AMeshCluster));
+        for (size_t i = 0; i < clusters.size(); i++)
+        {
+            if ((uint64_t) clusters[i].firstIndex + clusters[i].numIndices > numIndices ||
+                (i > 0 && clusters[i].firstIndex < clusters[i - 1].firstIndex))
+            {
+                clusters.clear();
+                std::cout << "[Anvil Engine] Warning: Bad cluster table in " << path
+                          << ", drawing without culling" << std::endl;
+            }
+        }
+    }
+    if (lumps.count("HULL"))
+    {
+        const AMeshLumpView& lump = lumps["HULL"];
+        for (size_t offset = 0; offset + sizeof(uint32_t) <= lump.size;)
+        {
+            uint32_t count;
+            memcpy(&count, lump.data + offset, sizeof(count));
+            offset += sizeof(count);
+            if (count > (lump.size - offset) / sizeof(glm::vec3))
+                break;
+            if (count < 4)
+            {
+                // Flat or empty, no use for collision
+                offset += count * sizeof(glm::vec3);
+                continue;
+            }
+            AConvexHull hull;
+            hull.points.resize(count);
+            memcpy(hull.points.data(), lump.data + offset, count * sizeof(glm::vec3));
+            offset += count * sizeof(glm::vec3);
+            out.hulls.push_back(std::move(hull));
+        }
+    }
+    return true;
+}
+
+void AMeshLoader::UploadAnvMesh(AMeshData& data, AMesh& mesh,
+                                const std::vector<uint32_t>& textures)
+{
+    // Uploaded from the mapping, the tables move over to the mesh
+    uint32_t texID = textures.empty() ? 0 : textures[0];
+    mesh.Create(data.stream, data.vertexData, data.indices, data.numIndices, data.indexSize, texID,
+                std::move(data.lods), std::move(data.vertices));
+    if (!data.submeshes.empty())
+        mesh.SetSubmeshes(std::move(data.submeshes), textures);
+    mesh.SetClusters(std::move(data.clusters));
+    mesh.SetCollisionHulls(std::move(data.hulls));
 }
 // Anvil_Compile loves this
 /**
  * @brief Exports a 3D mesh to AnvMesh format
  * @param input Path to the input mesh file
  * @param output Path to the output AnvMesh file
+ * @param options How the vertices are stored
  */
-void AMeshLoader::ExportToAnvMesh(const std::string& input, const std::string& output)
+bool AMeshLoader::ExportToAnvMesh(const std::string& input, const std::string& output,
+                                  const AMeshExportOptions& options, std::ostream& log,
+                                  AStageProfiler* profiler)
 {
+    AStageProfiler  unused;
+    AStageProfiler& stages = profiler ? *profiler : unused;
+    stages.Begin("import");
+
     Assimp::Importer importer;
     // Process everything: Triangulate, Flip UVs for OpenGL, and Join identical vertices to save space
     // space
@@ -118,54 +444,54 @@ void AMeshLoader::ExportToAnvMesh(const std::string& input, const std::string& o
 
     if (!scene || !scene->mRootNode)
     {
-        std::cout << "[Anvil Compiler] Assimp Error: " << importer.GetErrorString() << std::endl;
-        return;
+        log << "[Anvil Compiler] Assimp Error: " << importer.GetErrorString() << std::endl;
+        return false;
     }
 
     std::vector<MVertex>  allVertices;
     std::vector<uint32_t> allIndices;
-    std::string           textureFileName = "";
 
-    if (scene->HasMaterials())
-    {
-        aiMaterial* mat = scene->mMaterials[0];
-        aiString    str;
-        if (mat->GetTexture(aiTextureType_DIFFUSE, 0, &str) == AI_SUCCESS)
-        {
-            const aiTexture* embeddedTex = scene->GetEmbeddedTexture(str.C_Str());
+    // The engine's materials are just a diffuse texture, embedded ones are written out next to
+    // the output
+    std::set<std::string> extracted;
+    auto                  materialTexture = [&](uint32_t index) -> std::string {
+        aiString str;
+        if (index >= scene->mNumMaterials ||
+            scene->mMaterials[index]->GetTexture(aiTextureType_DIFFUSE, 0, &str) != AI_SUCCESS)
+            return "";
 
-            if (embeddedTex)
-            {
-                std::filesystem::path outPath(output);
-                textureFileName =
-                    outPath.stem().string() + "_embedded." +
-                    (embeddedTex->achFormatHint[0] ? embeddedTex->achFormatHint : "png");
-                std::filesystem::path finalTexPath = outPath.parent_path() / textureFileName;
-
-                std::ofstream texOut(finalTexPath, std::ios::binary);
-                if (embeddedTex->mHeight == 0)
-                {
-                    texOut.write((char*) embeddedTex->pcData, embeddedTex->mWidth);
-                }
-                else
-                {
-                    std::cout << "[Anvil Compiler] Warning: Raw ARGB texture not extracted. Use "
-                                 "PNG/JPG embedded."
-                              << std::endl;
-                }
-                texOut.close();
-            }
-            else
-            {
-                std::filesystem::path p(str.C_Str());
-                textureFileName = p.filename().string();
-            }
+        const aiTexture* embeddedTex = scene->GetEmbeddedTexture(str.C_Str());
+        if (!embeddedTex)
+            return std::filesystem::path(str.C_Str()).filename().string();
+
+        uint32_t embeddedIndex = 0;
+        while (embeddedIndex < scene->mNumTextures && scene->mTextures[embeddedIndex] != embeddedTex)
+            embeddedIndex++;
+        std::filesystem::path outPath(output);
+        std::string           textureFileName =
+            outPath.stem().string() + "_embedded" +
+            (embeddedIndex ? std::to_string(embeddedIndex) : "") + "." +
+            (embeddedTex->achFormatHint[0] ? embeddedTex->achFormatHint : "png");
+        if (!extracted.insert(textureFileName).second)
+            return textureFileName;
+        std::filesystem::path finalTexPath = outPath.parent_path() / textureFileName;
+
+        std::ofstream texOut(finalTexPath, std::ios::binary);
+        if (embeddedTex->mHeight == 0)
+        {
+            texOut.write((char*) embeddedTex->pcData, embeddedTex->mWidth);
         }
-    }
+        else
+        {
+            log << "[Anvil Compiler] Warning: Raw ARGB texture not extracted. Use "
+                   "PNG/JPG embedded."
+                << std::endl;
+        }
+        texOut.close();
+        return textureFileName;
+    };
 
-    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
-    {
-        aiMesh*  mesh       = scene->mMeshes[m];
+    auto appendMesh = [&](const aiMesh* mesh) {
         uint32_t vertOffset = (uint32_t) allVertices.size();
 
         for (uint32_t i = 0; i < mesh->mNumVertices; i++)
@@ -194,24 +520,312 @@ void AMeshLoader::ExportToAnvMesh(const std::string& input, const std::string& o
             for (uint32_t j = 0; j < face.mNumIndices; j++)
                 allIndices.push_back(face.mIndices[j] + vertOffset);
         }
+    };
+
+    // Materials with the same texture are the same material here. One submesh per texture, in
+    // the order they're first used, holding every Assimp mesh drawn with it
+    std::vector<std::string> materials;
+    std::vector<uint32_t>    meshMaterial(scene->mNumMeshes);
+    for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+    {
+        std::string texture = materialTexture(scene->mMeshes[m]->mMaterialIndex);
+        auto        found   = std::find(materials.begin(), materials.end(), texture);
+        meshMaterial[m]     = (uint32_t) (found - materials.begin());
+        if (found == materials.end())
+            materials.push_back(texture);
+    }
+    std::vector<AMeshSubmesh> submeshes;
+    for (uint32_t material = 0; material < materials.size(); material++)
+    {
+        uint32_t firstIndex = (uint32_t) allIndices.size();
+        for (unsigned int m = 0; m < scene->mNumMeshes; m++)
+        {
+            if (meshMaterial[m] == material)
+                appendMesh(scene->mMeshes[m]);
+        }
+        if (allIndices.size() > firstIndex)
+            submeshes.push_back({firstIndex, (uint32_t) allIndices.size() - firstIndex, material});
     }
+    stages.End(allVertices.size());
 
-    std::ofstream os(output, std::ios::binary);
-    AMeshHeader   header;
-    header.numVertices = (uint32_t) allVertices.size();
-    header.numIndices  = (uint32_t) allIndices.size();
-    header.pathLength  = (uint32_t) textureFileName.length();
+    // Every submesh is its own draw, so each one is reordered and simplified on its own
+    auto submeshIndices = [&](const AMeshSubmesh& submesh) {
+        return std::vector<uint32_t>(allIndices.begin() + submesh.firstIndex,
+                                     allIndices.begin() + submesh.firstIndex + submesh.numIndices);
+    };
 
-    os.write((char*) &header, sizeof(AMeshHeader));
-    os.write((char*) allVertices.data(), allVertices.size() * sizeof(MVertex));
-    os.write((char*) allIndices.data(), allIndices.size() * sizeof(uint32_t));
-    if (header.pathLength > 0)
-        os.write(textureFileName.c_str(), header.pathLength);
+    // Triangles in vertex cache order, then regrouped for overdraw. The draw is the same
+    // triangles, only cheaper
+    float acmrBefore = AMeshOptimizer::ComputeACMR(allIndices, allVertices.size());
+    float acmrAfter  = acmrBefore;
+    if (options.optimize)
+    {
+        stages.Begin("optimize");
+        for (const auto& submesh : submeshes)
+        {
+            std::vector<uint32_t> range = submeshIndices(submesh);
+            AMeshOptimizer::OptimizeVertexCache(range, allVertices.size());
+            AMeshOptimizer::OptimizeOverdraw(range, allVertices);
+            std::copy(range.begin(), range.end(), allIndices.begin() + submesh.firstIndex);
+        }
+        acmrAfter = AMeshOptimizer::ComputeACMR(allIndices, allVertices.size());
+        stages.End(allIndices.size() / 3);
+    }
 
+    // Coarser levels with half the triangles of the one before, each simplified from the full
+    // mesh so its error is measured against that. They go after it in the same index buffer,
+    // with their own submeshes
+    std::vector<AMeshLOD> lods = {{0, (uint32_t) allIndices.size(), 0.0f}};
+    if (options.numLODs > 1 && !allIndices.empty())
+    {
+        stages.Begin("lods");
+        glm::vec3 boundsMin = allVertices[0].pos, boundsMax = allVertices[0].pos;
+        for (const auto& v : allVertices)
+        {
+            boundsMin = glm::min(boundsMin, v.pos);
+            boundsMax = glm::max(boundsMax, v.pos);
+        }
+        float maxError = glm::length(boundsMax - boundsMin) * options.lodMaxError;
+
+        std::vector<AMeshSubmesh>          fullDetail = submeshes;
+        std::vector<std::vector<uint32_t>> fullIndices;
+        std::vector<uint32_t>              lastCount;
+        for (const auto& submesh : fullDetail)
+        {
+            fullIndices.push_back(submeshIndices(submesh));
+            lastCount.push_back(submesh.numIndices);
+        }
+        while (lods.size() < options.numLODs)
+        {
+            AMeshLOD                  lod = {(uint32_t) allIndices.size(), 0, 0.0f};
+            std::vector<uint32_t>     level;
+            std::vector<AMeshSubmesh> levelSubmeshes;
+            for (size_t i = 0; i < fullDetail.size(); i++)
+            {
+                std::vector<uint32_t> part   = fullIndices[i];
+                size_t                target = lastCount[i] / 6 * 3;
+                float error = AMeshOptimizer::Simplify(part, allVertices, target, maxError);
+                lod.error   = std::max(lod.error, error);
+                if (options.optimize)
+                    AMeshOptimizer::OptimizeVertexCache(part, allVertices.size());
+                lastCount[i] = (uint32_t) part.size();
+                if (part.empty())
+                    continue;
+                levelSubmeshes.push_back({lod.firstIndex + (uint32_t) level.size(),
+                                          (uint32_t) part.size(), fullDetail[i].material});
+                level.insert(level.end(), part.begin(), part.end());
+            }
+            // Stop once it hits the error limit or the locked seams, another level barely helps
+            if (level.empty() || level.size() > lods.back().numIndices * 3 / 4)
+                break;
+            lod.numIndices = (uint32_t) level.size();
+            lods.push_back(lod);
+            allIndices.insert(allIndices.end(), level.begin(), level.end());
+            submeshes.insert(submeshes.end(), levelSubmeshes.begin(), levelSubmeshes.end());
+        }
+        stages.End(lods.size());
+    }
+
+    // Vertices in the order the full mesh fetches them, the LODs only use some of the same ones
+    if (options.optimize)
+        AMeshOptimizer::OptimizeVertexFetch(allVertices, allIndices);
+    uint32_t fullIndices = lods[0].numIndices;
+
+    // Convex pieces of the full mesh, so physics doesn't hull every vertex when a body spawns
+    std::vector<AConvexHull> hulls;
+    if (options.maxHulls > 0)
+    {
+        stages.Begin("hulls");
+        AConvexDecompositionOptions hullOptions;
+        hullOptions.maxHulls = options.maxHulls;
+        hulls = AConvexDecomposition::Decompose(
+            allVertices, std::vector<uint32_t>(allIndices.begin(), allIndices.begin() + fullIndices),
+            hullOptions);
+        stages.End(hulls.size());
+    }
+
+    // 16 bit indices unless a triangle reaches across more vertices than they can, ranges that
+    // do are split into pieces with their own base vertex
+    std::vector<uint16_t>     shortIndices;
+    std::vector<AMeshSubmesh> pieces = submeshes;
+    bool useShort = AMeshOptimizer::SplitForShortIndices(allIndices, pieces, shortIndices);
+    if (useShort)
+        submeshes = std::move(pieces);
+
+    // Small runs of triangles the engine can skip when they're off screen or face away
+    stages.Begin("clusters");
+    std::vector<AMeshCluster> clusters =
+        AMeshOptimizer::BuildClusters(allIndices, allVertices, submeshes);
+    // Backs of an open or double sided mesh show, so only closed LODs get facing cones
+    for (const auto& lod : lods)
+    {
+        if (AMeshOptimizer::IsClosed(allIndices, allVertices, lod.firstIndex, lod.numIndices))
+            continue;
+        for (auto& cluster : clusters)
+        {
+            if (cluster.firstIndex >= lod.firstIndex &&
+                cluster.firstIndex < lod.firstIndex + lod.numIndices)
+                cluster.bounds.coneCutoff = 1.0f;
+        }
+    }
+    stages.End(clusters.size());
+
+    stages.Begin("write");
+    // Lumps are collected first so the directory can go in front of them
+    struct PendingLump
+    {
+        AMeshLump            lump;
+        std::vector<uint8_t> data;
+    };
+    std::vector<PendingLump> pending;
+    uint64_t                 rawBytes = 0, storedBytes = 0;
+    auto                     addLump    = [&](const char* id, const void* data, size_t size) {
+        PendingLump& entry = pending.emplace_back();
+        memcpy(entry.lump.id, id, 4);
+        entry.lump.alignment   = ANVMESH_LUMP_ALIGNMENT;
+        entry.lump.compression = (uint32_t) EBSPCompression::None;
+        entry.lump.reserved    = 0;
+        entry.lump.rawSize     = size;
+        rawBytes += size;
+        if (options.compress && size <= ALZ4::MAX_RAW_SIZE)
+            ALZ4::Compress((const uint8_t*) data, size, entry.data);
+        if (!entry.data.empty() && entry.data.size() < size)
+            entry.lump.compression = (uint32_t) EBSPCompression::LZ4;
+        else
+            entry.data.assign((const uint8_t*) data, (const uint8_t*) data + size);
+        entry.lump.size = entry.data.size();
+        storedBytes += entry.lump.size;
+    };
+    if (options.vertexFormat != EVertexFormat::Float)
+    {
+        std::vector<uint8_t> lump;
+        AVertexStreamHeader  stream = AVertexFormat::Encode(options.vertexFormat, allVertices, lump);
+        lump.insert(lump.begin(), (uint8_t*) &stream, (uint8_t*) &stream + sizeof(stream));
+        addLump("VTXC", lump.data(), lump.size());
+    }
+    else
+        addLump("VERT", allVertices.data(), allVertices.size() * sizeof(MVertex));
+    // Every LOD in one index buffer, the table says where each one starts
+    if (useShort)
+        addLump("IX16", shortIndices.data(), shortIndices.size() * sizeof(uint16_t));
+    else
+        addLump("INDX", allIndices.data(), allIndices.size() * sizeof(uint32_t));
+    if (lods.size() > 1)
+        addLump("LODS", lods.data(), lods.size() * sizeof(AMeshLOD));
+    if (!hulls.empty())
+    {
+        std::vector<uint8_t> table;
+        for (const auto& hull : hulls)
+        {
+            uint32_t count = (uint32_t) hull.points.size();
+            table.insert(table.end(), (uint8_t*) &count, (uint8_t*) &count + sizeof(count));
+            table.insert(table.end(), (const uint8_t*) hull.points.data(),
+                         (const uint8_t*) (hull.points.data() + count));
+        }
+        addLump("HULL", table.data(), table.size());
+    }
+    // Texture paths, written even for a single material now that there's no header for it
+    {
+        std::vector<uint8_t> table;
+        for (const auto& material : materials)
+        {
+            uint32_t length = (uint32_t) material.size();
+            table.insert(table.end(), (uint8_t*) &length, (uint8_t*) &length + sizeof(length));
+            table.insert(table.end(), material.begin(), material.end());
+        }
+        addLump("MATS", table.data(), table.size());
+    }
+    addLump("SUBM", submeshes.data(), submeshes.size() * sizeof(AMeshSubmesh));
+    addLump("CLUS", clusters.data(), clusters.size() * sizeof(AMeshCluster));
+
+    // Lay the lumps out after the directory, each at a multiple of its alignment
+    uint64_t offset = sizeof(AMeshHeaderV2) + pending.size() * sizeof(AMeshLump);
+    for (auto& entry : pending)
+    {
+        uint64_t alignment = entry.lump.alignment;
+        offset             = (offset + alignment - 1) / alignment * alignment;
+        entry.lump.offset  = offset;
+        offset += entry.lump.size;
+    }
+
+    std::ofstream os(output, std::ios::binary);
+    AMeshHeaderV2 header = {{'A', 'M', 'S', 'H'}, ANVMESH_VERSION, (uint32_t) pending.size(), 0};
+    os.write((const char*) &header, sizeof(header));
+    for (const auto& entry : pending)
+        os.write((const char*) &entry.lump, sizeof(AMeshLump));
+    uint64_t position = sizeof(header) + pending.size() * sizeof(AMeshLump);
+    for (const auto& entry : pending)
+    {
+        static const char padding[ANVMESH_LUMP_ALIGNMENT] = {};
+        os.write(padding, (std::streamsize) (entry.lump.offset - position));
+        os.write((const char*) entry.data.data(), (std::streamsize) entry.data.size());
+        position = entry.lump.offset + entry.lump.size;
+    }
+
+    uint64_t bytesWritten = position;
     os.close();
+    if (os.fail())
+    {
+        log << "[Anvil Compiler] Error: Could not write " << output << std::endl;
+        return false;
+    }
+    stages.End(bytesWritten);
 
-    std::cout << "[Anvil Compiler] SUCCESS: " << output << std::endl;
-    std::cout << "  - Vertices: " << allVertices.size() << std::endl;
-    std::cout << "  - Texture: " << (textureFileName.empty() ? "NONE" : textureFileName)
-              << std::endl;
+    log << "[Anvil Compiler] SUCCESS: " << output << std::endl;
+    log << "  - Vertices: " << allVertices.size() << " ("
+        << AVertexFormat::GetName(options.vertexFormat) << ", "
+        << AVertexFormat::GetStride(options.vertexFormat) << " bytes each)" << std::endl;
+    log << "  - Indices: " << (useShort ? 16 : 32) << " bit" << std::endl;
+    if (options.optimize)
+        log << "  - Vertex cache: ACMR " << acmrBefore << " -> " << acmrAfter << std::endl;
+    for (size_t i = 0; i < lods.size(); i++)
+        log << "  - LOD " << i << ": " << lods[i].numIndices / 3 << " triangles, error "
+            << lods[i].error << std::endl;
+    if (options.compress)
+        log << "  - Compression: " << rawBytes / 1024 << " KB -> " << storedBytes / 1024 << " KB LZ4"
+            << std::endl;
+    if (submeshes.size() > lods.size())
+        log << "  - Submeshes: " << submeshes.size() << " over " << lods.size() << " LODs, "
+            << materials.size() << " materials" << std::endl;
+    if (!clusters.empty())
+        log << "  - Clusters: " << clusters.size() << ", "
+            << allIndices.size() / 3 / clusters.size() << " triangles each on average" << std::endl;
+    if (!hulls.empty())
+    {
+        size_t numPoints = 0;
+        for (const auto& hull : hulls)
+            numPoints += hull.points.size();
+        log << "  - Collision: " << hulls.size() << " convex hulls, " << numPoints << " points"
+            << std::endl;
+    }
+    for (const auto& material : materials)
+        log << "  - Texture: " << (material.empty() ? "NONE" : material) << std::endl;
+
+    // Bake the mip chain next to every texture so the engine can upload it as is
+    for (const auto& material : materials)
+    {
+        if (material.empty())
+            continue;
+        stages.Begin("mips");
+        std::filesystem::path texPath = std::filesystem::path(output).parent_path() / material;
+        int                   w, h, channels;
+        unsigned char*        pixels = stbi_load(texPath.string().c_str(), &w, &h, &channels, 4);
+        if (pixels)
+        {
+            std::vector<AMipLevel> levels = ATextureMips::Build(pixels, w, h, false);
+            stbi_image_free(pixels);
+
+            std::filesystem::path bakedPath = std::filesystem::path(texPath).replace_extension(".atex");
+            if (ATextureMips::Save(bakedPath.string(), material, levels))
+                log << "  - Mips: " << levels.size() << " levels baked to "
+                    << bakedPath.filename().string() << std::endl;
+            stages.End(levels.size());
+        }
+        else
+        {
+            stages.End();
+            log << "  - Mips: " << texPath.string() << " not found, left to the engine" << std::endl;
+        }
+    }
+    return true;
 }
\ No newline at end of file
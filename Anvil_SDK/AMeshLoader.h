@@ -1,9 +1,17 @@
 #pragma once
+#include "AMappedFile.h"
 #include "AMesh.h"
+#include "AStageProfiler.h"
+#include "AVertexFormat.h"
+#include <deque>
+#include <iostream>
 #include <string>
 #include <vector>
 
-// mesh.anvmesh
+class AResourceManager;
+
+// mesh.anvmesh, version 1: this header, the vertices and indices it counts, the texture path and
+// then AMeshChunks up to the end. Version 2 starts with AMeshHeaderV2 instead.
 struct AMeshHeader
 {
     uint32_t numVertices = 0;
@@ -11,10 +19,145 @@ struct AMeshHeader
     uint32_t pathLength = 0;
 };
 
+constexpr uint32_t ANVMESH_VERSION = 3;
+
+// Enough for the vertex stream and every table, the GL upload doesn't need more
+constexpr uint32_t ANVMESH_LUMP_ALIGNMENT = 16;
+
+// Version 2: this header, numLumps AMeshLump entries, then the lumps, each at a multiple of its
+// alignment. Stored lumps are uploaded straight out of the mapped file, compressed ones are
+// unpacked on load. The ids are the chunk ids below, except that "INDX" holds every LOD's
+// indices and there's no "LODI", and the texture paths are always in "MATS".
+// Version 3 has "IX16" with uint16_t indices instead of "INDX" when they fit, and "SUBM" is
+// always there and holds whole AMeshSubmesh entries, base vertex included. Before that they
+// were AMeshSubmeshV2.
+struct AMeshHeaderV2
+{
+    char     magic[4]; // "AMSH"
+    uint32_t version;  // 2 or 3
+    uint32_t numLumps;
+    uint32_t reserved;
+};
+
+struct AMeshSubmeshV2
+{
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    uint32_t material;
+};
+
+// The same directory entry as ABSP version 3
+using AMeshLump = ABSPLump;
+
+// Version 1 chunks after the texture path, the same layout as ABSPChunk. With numVertices or
+// numIndices at 0 the arrays come from these instead:
+// "VTXC": AVertexStreamHeader + encoded vertices
+// "VERT": MVertex array
+// "INDX": uint32_t indices
+// "LODI": uint32_t indices of the coarser LODs, they follow the others in the index buffer
+// "LODS": AMeshLOD per level, finest first, ranges of the index buffer
+// "MATS": per material a uint32_t length and the texture path, empty for none. The header's path
+//         is the first material's
+// "SUBM": AMeshSubmesh array, by LOD and then by material
+// "HULL": per convex hull a uint32_t point count and the points as glm::vec3
+// "CLUS": AMeshCluster array, sorted by firstIndex, ranges of the index buffer
+// "LZ4 ": AMeshPackedChunk, then another chunk's payload as an LZ4 block (ALZ4)
+struct AMeshChunk
+{
+    char     id[4];
+    uint32_t size;
+};
+
+struct AMeshPackedChunk
+{
+    char     id[4];   // the chunk it holds
+    uint32_t rawSize; // its payload size once decompressed
+};
+
+struct AMeshExportOptions
+{
+    EVertexFormat vertexFormat = EVertexFormat::Float; // Packed and Quantized go in a "VTXC" chunk
+    bool          compress     = false; // LZ4 every lump that gets smaller from it
+    bool          optimize     = true;  // reorder for the vertex cache, overdraw and vertex fetch
+    uint32_t      numLODs      = 4;     // levels of detail with the full mesh, 1 for none
+    float         lodMaxError  = 0.02f; // how far a LOD may be off, relative to the bounds' diagonal
+    uint32_t      maxHulls     = 16;    // convex hulls for HIGH_FIDELITY collision, 0 for none
+};
+
+// A texture read and decoded without GL, ATextureMips::Upload makes the GL one
+struct ATextureData
+{
+    ATextureEntry              entry = {};
+    std::vector<ATextureLevel> levels; // empty when GL makes the mips
+    std::vector<uint8_t>       data;
+};
+
+// Everything LoadAnvMesh reads from a .anvmesh before it touches GL. The pointers are into the
+// mapping or into unpacked, so it has to stay alive until the mesh is uploaded
+struct AMeshData
+{
+    AMappedFile                      file;
+    std::deque<std::vector<uint8_t>> unpacked; // lumps that were compressed or misaligned
+    AVertexStreamHeader              stream;
+    const uint8_t*                   vertexData = nullptr;
+    const void*                      indices    = nullptr;
+    size_t                           numIndices = 0;
+    uint32_t                         indexSize  = sizeof(uint32_t);
+    std::vector<AMeshLOD>            lods;
+    std::vector<std::string>         textures;  // full path of every material's, empty for none
+    std::vector<AMeshSubmesh>        submeshes;
+    std::vector<AMeshCluster>        clusters;
+    std::vector<AConvexHull>         hulls;
+    std::vector<MVertex>             vertices;  // decoded for GetVertices, if asked to
+};
+
 class ANVIL_API AMeshLoader
 {
   public:
-    static void ExportToAnvMesh(const std::string& inputPath, const std::string& outputPath);
+    /**
+     * @brief Converts a model Assimp can read to .anvmesh, baking the mips of its texture
+     * @param options How the vertices are stored
+     * @param log Where progress and errors go
+     * @param profiler Receives the import, optimize, lods, hulls, clusters, write and mips
+     * stages, can be null
+     * @return false if the model couldn't be read or the output couldn't be written
+     */
+    static bool ExportToAnvMesh(const std::string& inputPath, const std::string& outputPath,
+                                const AMeshExportOptions& options = AMeshExportOptions(),
+                                std::ostream& log = std::cout, AStageProfiler* profiler = nullptr);
+
+    /**
+     * @brief Maps a .anvmesh and uploads it to GL from the mapping
+     * @param resources Shares the textures with other meshes, without it every mesh loads its own
+     * @param keepVertices Keep a CPU copy of the vertices for AMesh::GetVertices. Only physics on
+     * meshes without baked hulls needs it
+     */
+    static AMesh* LoadAnvMesh(const std::string& path, AResourceManager* resources = nullptr,
+                              bool keepVertices = true);
+    /**
+     * @brief The file half of LoadAnvMesh, maps and checks the mesh without touching GL so it
+     * can run on any thread
+     * @return false if the file is missing or corrupt, the reason is printed
+     */
+    static bool ReadAnvMesh(const std::string& path, AMeshData& out, bool keepVertices = true);
+    /**
+     * @brief The GL half of LoadAnvMesh, creates an empty mesh from what ReadAnvMesh read and
+     * moves its tables over
+     * @param textures GL texture of every material in data.textures
+     */
+    static void UploadAnvMesh(AMeshData& data, AMesh& mesh,
+                              const std::vector<uint32_t>& textures);
 
-    static AMesh* LoadAnvMesh(const std::string& path);
+    /**
+     * @brief Loads a texture from file and creates an OpenGL texture object, from its baked mips
+     * if the compiler left an .atex next to it
+     * @param texturePath Path to the texture file
+     * @return OpenGL texture ID (0 if loading failed)
+     */
+    static uint32_t LoadTexture(const std::string& texturePath);
+    /**
+     * @brief Reads and decodes what LoadTexture would upload, without GL
+     * @return false if there's neither an image nor an .atex at the path
+     */
+    static bool ReadTexture(const std::string& texturePath, ATextureData& texture);
 };
\ No newline at end of file
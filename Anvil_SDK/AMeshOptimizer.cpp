@@ -0,0 +1,705 @@
+#include "AMeshOptimizer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <tuple>
+
+namespace
+{
+// Forsyth's LRU cache model and scoring, the constants are the ones from his write-up
+constexpr int   CACHE_SIZE          = 32;
+constexpr float CACHE_DECAY_POWER   = 1.5f;
+constexpr float LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float VALENCE_BOOST_SCALE = 2.0f;
+constexpr float VALENCE_BOOST_POWER = 0.5f;
+
+float VertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The last triangle's vertices get a fixed score so it isn't simply repeated
+        if (cachePosition < 3)
+            score = LAST_TRIANGLE_SCORE;
+        else
+        {
+            float scale = 1.0f / (CACHE_SIZE - 3);
+            score       = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+        }
+    }
+    // Vertices with few triangles left get finished off, so they don't linger
+    return score + VALENCE_BOOST_SCALE * std::pow((float) remainingTriangles, -VALENCE_BOOST_POWER);
+}
+
+// Rebuilds the triangles in the given order
+void GatherTriangles(std::vector<uint32_t>& indices, const std::vector<uint32_t>& order)
+{
+    std::vector<uint32_t> result(indices.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        for (int k = 0; k < 3; k++)
+            result[i * 3 + k] = indices[order[i] * 3 + k];
+    }
+    indices.swap(result);
+}
+
+// Sum of squared distances to a set of planes, as the upper half of a symmetric 4x4 matrix
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+    double a11 = 0, a12 = 0, a13 = 0;
+    double a22 = 0, a23 = 0;
+    double a33    = 0;
+    double weight = 0;
+
+    void AddPlane(const glm::vec3& n, double d, double w)
+    {
+        a00 += w * n.x * n.x;
+        a01 += w * n.x * n.y;
+        a02 += w * n.x * n.z;
+        a03 += w * n.x * d;
+        a11 += w * n.y * n.y;
+        a12 += w * n.y * n.z;
+        a13 += w * n.y * d;
+        a22 += w * n.z * n.z;
+        a23 += w * n.z * d;
+        a33 += w * d * d;
+        weight += w;
+    }
+
+    void Add(const Quadric& q)
+    {
+        a00 += q.a00;
+        a01 += q.a01;
+        a02 += q.a02;
+        a03 += q.a03;
+        a11 += q.a11;
+        a12 += q.a12;
+        a13 += q.a13;
+        a22 += q.a22;
+        a23 += q.a23;
+        a33 += q.a33;
+        weight += q.weight;
+    }
+
+    // Mean squared distance of p to the planes
+    static double Error(const Quadric& q, const Quadric& r, const glm::vec3& p)
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = (q.a00 + r.a00) * x * x + (q.a11 + r.a11) * y * y + (q.a22 + r.a22) * z * z;
+        e += 2.0 * ((q.a01 + r.a01) * x * y + (q.a02 + r.a02) * x * z + (q.a12 + r.a12) * y * z);
+        e += 2.0 * ((q.a03 + r.a03) * x + (q.a13 + r.a13) * y + (q.a23 + r.a23) * z);
+        e += q.a33 + r.a33;
+        double w = q.weight + r.weight;
+        return w > 0.0 ? std::max(e, 0.0) / w : 0.0;
+    }
+};
+} // namespace
+
+void AMeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t numVertices)
+{
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return;
+
+    // Triangles of every vertex, the first remaining[v] of them are the ones not drawn yet
+    std::vector<uint32_t> remaining(numVertices, 0), firstTriangle(numVertices + 1, 0);
+    for (size_t i = 0; i < numTriangles * 3; i++)
+        remaining[indices[i]]++;
+    for (size_t v = 0; v < numVertices; v++)
+        firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+    std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+    std::vector<uint32_t> filled(numVertices, 0);
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v                                      = indices[t * 3 + k];
+            vertexTriangles[firstTriangle[v] + filled[v]++] = (uint32_t) t;
+        }
+    }
+
+    std::vector<float> vertexScore(numVertices);
+    for (size_t v = 0; v < numVertices; v++)
+        vertexScore[v] = VertexScore(-1, remaining[v]);
+    std::vector<float> triangleScore(numTriangles);
+    std::vector<bool>  drawn(numTriangles, false);
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] +
+                           vertexScore[indices[t * 3 + 2]];
+    }
+
+    std::vector<uint32_t> order;
+    order.reserve(numTriangles);
+    std::vector<uint32_t> cache, nextCache;
+    size_t                scanFrom = 0;
+    int64_t               best     = -1;
+
+    while (order.size() < numTriangles)
+    {
+        // Nothing in the cache has triangles left, start somewhere new
+        if (best < 0)
+        {
+            while (drawn[scanFrom])
+                scanFrom++;
+            best = (int64_t) scanFrom;
+        }
+
+        uint32_t t = (uint32_t) best;
+        drawn[t]   = true;
+        order.push_back(t);
+
+        // The triangle's vertices go to the front of the cache, everything else moves back
+        nextCache.clear();
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[t * 3 + k];
+            nextCache.push_back(v);
+
+            // Take the triangle out of the vertex's remaining ones
+            uint32_t* list = vertexTriangles.data() + firstTriangle[v];
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                if (list[i] == t)
+                {
+                    std::swap(list[i], list[remaining[v] - 1]);
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+        for (uint32_t v : cache)
+        {
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        }
+
+        // Rescore everything that was or is in the cache, vertices pushed out score as uncached
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            uint32_t v     = nextCache[i];
+            float    score = VertexScore(i < (size_t) CACHE_SIZE ? (int) i : -1, remaining[v]);
+            float    delta = score - vertexScore[v];
+            vertexScore[v] = score;
+
+            const uint32_t* list = vertexTriangles.data() + firstTriangle[v];
+            for (uint32_t j = 0; j < remaining[v]; j++)
+                triangleScore[list[j]] += delta;
+        }
+
+        // The next triangle is the best one that uses a cached vertex
+        best            = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < std::min(nextCache.size(), (size_t) CACHE_SIZE); i++)
+        {
+            const uint32_t* list = vertexTriangles.data() + firstTriangle[nextCache[i]];
+            for (uint32_t j = 0; j < remaining[nextCache[i]]; j++)
+            {
+                if (triangleScore[list[j]] > bestScore)
+                {
+                    bestScore = triangleScore[list[j]];
+                    best      = list[j];
+                }
+            }
+        }
+
+        if (nextCache.size() > (size_t) CACHE_SIZE)
+            nextCache.resize(CACHE_SIZE);
+        cache.swap(nextCache);
+    }
+
+    GatherTriangles(indices, order);
+}
+
+void AMeshOptimizer::OptimizeOverdraw(std::vector<uint32_t>& indices,
+                                      const std::vector<MVertex>& vertices, float threshold)
+{
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles < 2)
+        return;
+    float acmrBefore = ComputeACMR(indices, vertices.size());
+
+    // Clusters start where the FIFO cache misses all three vertices, it's empty of anything
+    // useful there so moving the cluster costs next to nothing
+    std::vector<uint32_t> cacheTime(vertices.size(), 0);
+    const uint32_t        cacheSize = 16;
+    uint32_t              time      = cacheSize + 1;
+    std::vector<size_t>   clusterStart;
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[t * 3 + k];
+            if (time - cacheTime[v] > cacheSize)
+            {
+                cacheTime[v] = time++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterStart.push_back(t);
+    }
+    clusterStart.push_back(numTriangles);
+    size_t numClusters = clusterStart.size() - 1;
+    if (numClusters < 2)
+        return;
+
+    // Area weighted centroid of the whole mesh
+    glm::vec3 meshCentroid(0.0f);
+    float     meshArea = 0.0f;
+    for (size_t t = 0; t < numTriangles; t++)
+    {
+        const glm::vec3& a    = vertices[indices[t * 3]].pos;
+        const glm::vec3& b    = vertices[indices[t * 3 + 1]].pos;
+        const glm::vec3& c    = vertices[indices[t * 3 + 2]].pos;
+        float            area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) * (area / 3.0f);
+        meshArea += area;
+    }
+    meshCentroid /= std::max(meshArea, 1e-20f);
+
+    // Clusters that face away from the middle are the ones most likely in front
+    std::vector<float> key(numClusters);
+    for (size_t i = 0; i < numClusters; i++)
+    {
+        glm::vec3 centroid(0.0f), normal(0.0f);
+        float     area = 0.0f;
+        for (size_t t = clusterStart[i]; t < clusterStart[i + 1]; t++)
+        {
+            const glm::vec3& a     = vertices[indices[t * 3]].pos;
+            const glm::vec3& b     = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3& c     = vertices[indices[t * 3 + 2]].pos;
+            glm::vec3        cross = glm::cross(b - a, c - a);
+            float            size  = glm::length(cross);
+            centroid += (a + b + c) * (size / 3.0f);
+            normal += cross;
+            area += size;
+        }
+        centroid /= std::max(area, 1e-20f);
+        float length = glm::length(normal);
+        key[i]       = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+    }
+
+    std::vector<uint32_t> clusterOrder(numClusters);
+    for (size_t i = 0; i < numClusters; i++)
+        clusterOrder[i] = (uint32_t) i;
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(),
+                     [&](uint32_t a, uint32_t b) { return key[a] > key[b]; });
+
+    std::vector<uint32_t> order;
+    order.reserve(numTriangles);
+    for (uint32_t c : clusterOrder)
+    {
+        for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+            order.push_back((uint32_t) t);
+    }
+    std::vector<uint32_t> reordered = indices;
+    GatherTriangles(reordered, order);
+    if (ComputeACMR(reordered, vertices.size()) <= acmrBefore * threshold)
+        indices.swap(reordered);
+}
+
+void AMeshOptimizer::OptimizeVertexFetch(std::vector<MVertex>& vertices, std::vector<uint32_t>& indices)
+{
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<MVertex>  result;
+    result.reserve(vertices.size());
+    for (auto& index : indices)
+    {
+        if (remap[index] == UINT32_MAX)
+        {
+            remap[index] = (uint32_t) result.size();
+            result.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(result);
+}
+
+float AMeshOptimizer::Simplify(std::vector<uint32_t>& indices, const std::vector<MVertex>& vertices,
+                               size_t targetIndexCount, float maxError)
+{
+    size_t numVertices = vertices.size();
+    if (indices.size() <= targetIndexCount)
+        return 0.0f;
+
+    // Vertices that share a position with another one sit on a seam, moving them would tear it
+    std::vector<bool>     locked(numVertices, false);
+    std::vector<uint32_t> sorted(numVertices);
+    for (size_t i = 0; i < numVertices; i++)
+        sorted[i] = (uint32_t) i;
+    auto byPosition = [&](uint32_t a, uint32_t b) {
+        const glm::vec3 &p = vertices[a].pos, &q = vertices[b].pos;
+        return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+    };
+    std::sort(sorted.begin(), sorted.end(), byPosition);
+    for (size_t i = 1; i < numVertices; i++)
+    {
+        if (vertices[sorted[i]].pos == vertices[sorted[i - 1]].pos)
+            locked[sorted[i]] = locked[sorted[i - 1]] = true;
+    }
+
+    // So do the ends of edges with a triangle on one side only
+    std::vector<uint64_t> edges;
+    auto                  gatherEdges = [&]() {
+        edges.clear();
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint64_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+                edges.push_back(a < b ? (a << 32 | b) : (b << 32 | a));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+    };
+    gatherEdges();
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t run = i;
+        while (run < edges.size() && edges[run] == edges[i])
+            run++;
+        if (run - i == 1)
+            locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFF] = true;
+        i = run;
+    }
+
+    // Every vertex starts with the planes of its triangles, weighted by area
+    std::vector<Quadric> quadrics(numVertices);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const glm::vec3& a = vertices[indices[i]].pos;
+        const glm::vec3& b = vertices[indices[i + 1]].pos;
+        const glm::vec3& c = vertices[indices[i + 2]].pos;
+        glm::vec3        normal = glm::cross(b - a, c - a);
+        float            area   = glm::length(normal);
+        if (area <= 0.0f)
+            continue;
+        normal /= area;
+        for (int k = 0; k < 3; k++)
+            quadrics[indices[i + k]].AddPlane(normal, -glm::dot(normal, a), area);
+    }
+
+    struct Collapse
+    {
+        uint32_t from, to;
+        double   error;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap(numVertices), firstTriangle(numVertices + 1), vertexTriangles;
+    std::vector<bool>     touched(numVertices);
+    double                maxSquared = (double) maxError * maxError, worst = 0.0;
+
+    // Each pass collapses the cheapest edges that don't share a neighbourhood, then rebuilds
+    while (indices.size() > targetIndexCount)
+    {
+        collapses.clear();
+        for (size_t i = 0; i < edges.size(); i++)
+        {
+            if (i > 0 && edges[i] == edges[i - 1])
+                continue;
+            uint32_t a = (uint32_t) (edges[i] >> 32), b = (uint32_t) (edges[i] & 0xFFFFFFFF);
+            const Quadric &qa = quadrics[a], &qb = quadrics[b];
+            double toB = locked[a] ? DBL_MAX : Quadric::Error(qa, qb, vertices[b].pos);
+            double toA = locked[b] ? DBL_MAX : Quadric::Error(qa, qb, vertices[a].pos);
+            if (toB == DBL_MAX && toA == DBL_MAX)
+                continue;
+            collapses.push_back(toB <= toA ? Collapse{a, b, toB} : Collapse{b, a, toA});
+        }
+        std::sort(collapses.begin(), collapses.end(),
+                  [](const Collapse& x, const Collapse& y) { return x.error < y.error; });
+
+        // Triangles around every vertex, to check collapses for flipped triangles
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (uint32_t v : indices)
+            firstTriangle[v + 1]++;
+        for (size_t v = 0; v < numVertices; v++)
+            firstTriangle[v + 1] += firstTriangle[v];
+        vertexTriangles.resize(indices.size());
+        std::vector<uint32_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            vertexTriangles[filled[indices[i]]++] = (uint32_t) (i / 3);
+
+        for (size_t v = 0; v < numVertices; v++)
+            remap[v] = (uint32_t) v;
+        std::fill(touched.begin(), touched.end(), false);
+        size_t numTriangles = indices.size() / 3, collapsed = 0;
+        for (const Collapse& c : collapses)
+        {
+            if (c.error > maxSquared || numTriangles * 3 <= targetIndexCount)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            // The triangles that stay must not turn over, the ones on the edge disappear
+            bool   flips   = false;
+            size_t removed = 0;
+            for (uint32_t j = firstTriangle[c.from]; j < firstTriangle[c.from + 1] && !flips; j++)
+            {
+                const uint32_t* tri = indices.data() + vertexTriangles[j] * 3;
+                if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to)
+                {
+                    removed++;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = vertices[tri[k]].pos;
+                    q[k] = tri[k] == c.from ? vertices[c.to].pos : p[k];
+                }
+                glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                glm::vec3 after  = glm::cross(q[1] - q[0], q[2] - q[0]);
+                flips            = glm::dot(before, after) <= 0.0f;
+            }
+            if (flips)
+                continue;
+
+            for (uint32_t j = firstTriangle[c.from]; j < firstTriangle[c.from + 1]; j++)
+            {
+                for (int k = 0; k < 3; k++)
+                    touched[indices[vertexTriangles[j] * 3 + k]] = true;
+            }
+            remap[c.from] = c.to;
+            quadrics[c.to].Add(quadrics[c.from]);
+            worst = std::max(worst, c.error);
+            numTriangles -= removed;
+            collapsed++;
+        }
+        if (collapsed == 0)
+            break;
+
+        // Drop the triangles that collapsed to a line
+        size_t write = 0;
+        for (size_t i = 0; i < indices.size(); i += 3)
+        {
+            uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            indices[write++] = a;
+            indices[write++] = b;
+            indices[write++] = c;
+        }
+        indices.resize(write);
+        gatherEdges();
+    }
+    return (float) std::sqrt(worst);
+}
+
+bool AMeshOptimizer::SplitForShortIndices(const std::vector<uint32_t>& indices,
+                                          std::vector<AMeshSubmesh>&   submeshes,
+                                          std::vector<uint16_t>&       shortIndices)
+{
+    constexpr uint32_t maxSpan = 65535;
+    shortIndices.assign(indices.size(), 0);
+    std::vector<AMeshSubmesh> pieces;
+    for (const auto& submesh : submeshes)
+    {
+        // Grow a piece until the next triangle would take its vertices too far apart
+        uint32_t first = submesh.firstIndex, lo = UINT32_MAX, hi = 0;
+        auto     close = [&](uint32_t end) {
+            if (end == first)
+                return;
+            for (uint32_t i = first; i < end; i++)
+                shortIndices[i] = (uint16_t) (indices[i] - lo);
+            pieces.push_back({first, end - first, submesh.material, (int32_t) lo});
+            first = end;
+        };
+        uint32_t end = submesh.firstIndex + submesh.numIndices;
+        for (uint32_t i = submesh.firstIndex; i + 2 < end; i += 3)
+        {
+            uint32_t triLo = std::min({indices[i], indices[i + 1], indices[i + 2]});
+            uint32_t triHi = std::max({indices[i], indices[i + 1], indices[i + 2]});
+            if (triHi - triLo > maxSpan)
+                return false;
+            if (std::max(hi, triHi) - std::min(lo, triLo) > maxSpan)
+            {
+                close(i);
+                lo = triLo;
+                hi = triHi;
+                continue;
+            }
+            lo = std::min(lo, triLo);
+            hi = std::max(hi, triHi);
+        }
+        close(end);
+    }
+    submeshes = std::move(pieces);
+    return true;
+}
+
+std::vector<AMeshCluster> AMeshOptimizer::BuildClusters(const std::vector<uint32_t>&     indices,
+                                                        const std::vector<MVertex>&      vertices,
+                                                        const std::vector<AMeshSubmesh>& submeshes,
+                                                        uint32_t maxVertices, uint32_t maxTriangles)
+{
+    std::vector<AMeshCluster> clusters;
+    std::vector<uint32_t>     stamp(vertices.size(), 0); // cluster a vertex was last counted in
+    uint32_t                  current = 0;
+    std::vector<glm::vec3>    corners, normals;
+    for (const auto& submesh : submeshes)
+    {
+        uint32_t first = submesh.firstIndex, numVertices = 0;
+        auto     close = [&](uint32_t end) {
+            if (end == first)
+                return;
+            corners.clear();
+            normals.clear();
+            for (uint32_t i = first; i < end; i++)
+            {
+                corners.push_back(vertices[indices[i]].pos);
+                normals.push_back(vertices[indices[i]].normal);
+            }
+            clusters.push_back({ComputeClusterBounds(corners, normals), first, end - first});
+            first       = end;
+            numVertices = 0;
+            current++;
+        };
+        current++;
+        uint32_t end = submesh.firstIndex + submesh.numIndices;
+        for (uint32_t i = submesh.firstIndex; i + 2 < end; i += 3)
+        {
+            uint32_t added = 0;
+            for (uint32_t k = 0; k < 3; k++)
+                added += stamp[indices[i + k]] != current;
+            if (numVertices + added > maxVertices || (i - first) / 3 >= maxTriangles)
+                close(i);
+            for (uint32_t k = 0; k < 3; k++)
+            {
+                if (stamp[indices[i + k]] != current)
+                {
+                    stamp[indices[i + k]] = current;
+                    numVertices++;
+                }
+            }
+        }
+        close(end);
+    }
+    return clusters;
+}
+
+bool AMeshOptimizer::IsClosed(const std::vector<uint32_t>& indices,
+                              const std::vector<MVertex>& vertices, uint32_t firstIndex,
+                              uint32_t numIndices)
+{
+    if (numIndices < 3)
+        return false;
+
+    // Corners at the same position are the same corner, give or take float noise along seams
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    for (uint32_t i = firstIndex; i < firstIndex + numIndices; i++)
+    {
+        lo = glm::min(lo, vertices[indices[i]].pos);
+        hi = glm::max(hi, vertices[indices[i]].pos);
+    }
+    float cell = std::max(glm::length(hi - lo) * 1e-5f, 1e-12f);
+    std::map<std::tuple<int64_t, int64_t, int64_t>, uint32_t> welded;
+    std::vector<uint32_t> position(vertices.size(), UINT32_MAX);
+    auto                  weld = [&](uint32_t v) {
+        if (position[v] == UINT32_MAX)
+        {
+            glm::vec3 p   = (vertices[v].pos - lo) / cell;
+            auto      key = std::make_tuple((int64_t) std::lround(p.x), (int64_t) std::lround(p.y),
+                                            (int64_t) std::lround(p.z));
+            position[v]   = welded.emplace(key, (uint32_t) welded.size()).first->second;
+        }
+        return position[v];
+    };
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> edges;
+    for (uint32_t i = firstIndex; i + 2 < firstIndex + numIndices; i += 3)
+    {
+        // Triangles squashed to a line or a point, like the ones at a UV sphere's poles, don't
+        // cover anything
+        uint32_t corner[3] = {weld(indices[i]), weld(indices[i + 1]), weld(indices[i + 2])};
+        if (corner[0] == corner[1] || corner[1] == corner[2] || corner[2] == corner[0])
+            continue;
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            uint32_t a = corner[k], b = corner[(k + 1) % 3];
+            edges[{std::min(a, b), std::max(a, b)}]++;
+        }
+    }
+    for (const auto& [edge, count] : edges)
+    {
+        if (count != 2)
+            return false;
+    }
+    return !edges.empty();
+}
+
+AClusterBounds AMeshOptimizer::ComputeClusterBounds(const std::vector<glm::vec3>& corners,
+                                                    const std::vector<glm::vec3>& normals)
+{
+    AClusterBounds bounds = {glm::vec3(0.0f), 0.0f, glm::vec3(0.0f, 0.0f, 1.0f), 1.0f};
+    if (corners.empty())
+        return bounds;
+
+    // Sphere around the middle of the box, not the smallest one but close enough to cull with
+    glm::vec3 lo = corners[0], hi = corners[0];
+    for (const auto& p : corners)
+    {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    bounds.center = (lo + hi) * 0.5f;
+    for (const auto& p : corners)
+        bounds.radius = std::max(bounds.radius, glm::length(p - bounds.center));
+
+    // Facing of every triangle, flipped to the side its vertex normals are on
+    std::vector<glm::vec3> facing;
+    glm::vec3              sum(0.0f);
+    for (size_t i = 0; i + 2 < corners.size(); i += 3)
+    {
+        glm::vec3 n   = glm::cross(corners[i + 1] - corners[i], corners[i + 2] - corners[i]);
+        float     len = glm::length(n);
+        if (len < 1e-12f)
+            continue;
+        n /= len;
+        if (glm::dot(n, normals[i] + normals[i + 1] + normals[i + 2]) < 0.0f)
+            n = -n;
+        facing.push_back(n);
+        sum += n;
+    }
+    if (facing.empty() || glm::length(sum) < 1e-6f)
+        return bounds;
+
+    // The cone needs every normal within 90 degrees of the axis, a wide one would almost never
+    // cull anyway so it's left at 1
+    glm::vec3 axis   = glm::normalize(sum);
+    float     minDot = 1.0f;
+    for (const auto& n : facing)
+        minDot = std::min(minDot, glm::dot(n, axis));
+    bounds.coneAxis = axis;
+    if (minDot > 0.1f)
+        bounds.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    return bounds;
+}
+
+float AMeshOptimizer::ComputeACMR(const std::vector<uint32_t>& indices, size_t numVertices,
+                                  uint32_t cacheSize)
+{
+    size_t numTriangles = indices.size() / 3;
+    if (numTriangles == 0)
+        return 0.0f;
+
+    // A vertex is in the FIFO if fewer than cacheSize vertices went in after it
+    std::vector<uint32_t> cacheTime(numVertices, 0);
+    uint32_t              time   = cacheSize + 1;
+    size_t                misses = 0;
+    for (size_t i = 0; i < numTriangles * 3; i++)
+    {
+        uint32_t v = indices[i];
+        if (time - cacheTime[v] > cacheSize)
+        {
+            cacheTime[v] = time++;
+            misses++;
+        }
+    }
+    return (float) misses / (float) numTriangles;
+}
@@ -0,0 +1,98 @@
+#pragma once
+// AMeshOptimizer.h
+#include "ACore.h"
+#include "AMesh.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * @class AMeshOptimizer
+ * @brief Offline reordering of indexed triangle lists for the GPU
+ * Run in this order: vertex cache, overdraw, vertex fetch. Each pass keeps the triangles and
+ * their winding, only the order changes.
+ */
+class ANVIL_API AMeshOptimizer
+{
+  public:
+    /**
+     * @brief Reorders triangles so they reuse recently transformed vertices (Forsyth's algorithm)
+     * @param indices Triangle list, reordered in place
+     * @param numVertices Number of vertices the indices point into
+     */
+    static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t numVertices);
+
+    /**
+     * @brief Moves outward facing groups of triangles to the front so they fill the depth buffer
+     * before the ones they hide (Tipsify style). Triangles are only regrouped where the vertex
+     * cache starts over anyway.
+     * @param threshold How much worse the ACMR may get, 1.05 allows 5%. The old order is kept if
+     * the new one is worse than that
+     */
+    static void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<MVertex>& vertices,
+                                 float threshold = 1.05f);
+
+    /**
+     * @brief Puts vertices in the order the indices first use them and drops unused ones
+     * @param vertices Reordered in place
+     * @param indices Rewritten to the new vertex order
+     */
+    static void OptimizeVertexFetch(std::vector<MVertex>& vertices, std::vector<uint32_t>& indices);
+
+    /**
+     * @brief Collapses edges by quadric error (Garland and Heckbert) until the triangle list is down
+     * to targetIndexCount or the next collapse would move the surface more than maxError. A vertex
+     * is only ever merged into another one, so the result still indexes the same vertex array.
+     * Vertices on open borders and on uv or normal seams stay put
+     * @param indices Triangle list, simplified in place
+     * @return How far the result is off the original surface, root mean square in the mesh's units
+     */
+    static float Simplify(std::vector<uint32_t>& indices, const std::vector<MVertex>& vertices,
+                          size_t targetIndexCount, float maxError);
+
+    /**
+     * @brief Converts a triangle list to 16 bit indices, splitting ranges whose vertices are more
+     * than 65536 apart into pieces that each get their own base vertex
+     * @param submeshes Ranges of indices, replaced by the pieces
+     * @param shortIndices Receives indices - baseVertex of their piece, where indices had them
+     * @return false if a single triangle spans more than 65536 vertices, only 32 bit indices
+     * work for the mesh then
+     */
+    static bool SplitForShortIndices(const std::vector<uint32_t>& indices,
+                                     std::vector<AMeshSubmesh>&   submeshes,
+                                     std::vector<uint16_t>&       shortIndices);
+
+    /**
+     * @brief Cuts every submesh into clusters of at most maxVertices vertices and maxTriangles
+     * triangles. The triangles keep their order, so the vertex cache order survives and every
+     * cluster is a range of the index buffer
+     * @return The clusters, sorted by firstIndex
+     */
+    static std::vector<AMeshCluster> BuildClusters(const std::vector<uint32_t>&     indices,
+                                                   const std::vector<MVertex>&      vertices,
+                                                   const std::vector<AMeshSubmesh>& submeshes,
+                                                   uint32_t maxVertices  = 64,
+                                                   uint32_t maxTriangles = 124);
+
+    /**
+     * @brief Whether the triangles enclose a volume: every edge, by position so UV seams don't
+     * count, is shared by exactly two of them. Only then are their backs never seen from outside
+     */
+    static bool IsClosed(const std::vector<uint32_t>& indices, const std::vector<MVertex>& vertices,
+                         uint32_t firstIndex, uint32_t numIndices);
+
+    /**
+     * @brief Bounding sphere and normal cone of some triangles
+     * @param corners Three per triangle
+     * @param normals One per corner. They only pick the front of each triangle, so the
+     * winding doesn't have to be consistent
+     */
+    static AClusterBounds ComputeClusterBounds(const std::vector<glm::vec3>& corners,
+                                               const std::vector<glm::vec3>& normals);
+
+    /**
+     * @brief Average cache miss ratio: vertices transformed per triangle on a FIFO cache. 3 is no
+     * reuse at all, around 0.6 is as good as it gets
+     */
+    static float ComputeACMR(const std::vector<uint32_t>& indices, size_t numVertices,
+                             uint32_t cacheSize = 16);
+};
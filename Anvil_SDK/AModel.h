@@ -18,11 +18,11 @@ class ANVIL_API AModel
         }
     }
 
-    void Draw()
+    void Draw(const AShader* shader)
     {
         for (auto* mesh : m_meshes)
         {
-            mesh->Draw();
+            mesh->Draw(shader);
         }
     }
 
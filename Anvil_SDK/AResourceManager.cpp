@@ -1,12 +1,182 @@
 #include "AResourceManager.h"
+#include "ATextureMips.h"
+#include <algorithm>
+#include <glad/glad.h>
+#include <iostream>
 
-AMesh* AResourceManager::LoadMesh(const std::string& name, const std::string& path)
+AResourceManager::~AResourceManager()
+{
+    // Whatever the workers are reading gets thrown away, the meshes are deleted below
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers)
+        worker.join();
+
+    for (auto& p : m_meshes)
+        delete p.second;
+    for (auto& p : m_textures)
+    {
+        if (p.second)
+            glDeleteTextures(1, &p.second);
+    }
+}
+
+AMesh* AResourceManager::LoadMesh(const std::string& name, const std::string& path,
+                                  bool keepVertices)
 {
     if (m_meshes.count(name))
         return m_meshes[name];
 
-    AMesh* mesh = AMeshLoader::LoadAnvMesh(path);
+    AMesh* mesh = AMeshLoader::LoadAnvMesh(path, this, keepVertices);
     if (mesh)
         m_meshes[name] = mesh;
     return mesh;
+}
+
+AMesh* AResourceManager::LoadMeshAsync(const std::string& name, const std::string& path,
+                                       AMesh* placeholder, bool keepVertices)
+{
+    if (m_meshes.count(name))
+        return m_meshes[name];
+
+    AMesh* mesh = new AMesh();
+    mesh->SetPlaceholder(placeholder);
+    m_meshes[name] = mesh;
+
+    auto request          = std::make_unique<AMeshRequest>();
+    request->mesh         = mesh;
+    request->path         = path;
+    request->keepVertices = keepVertices;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_requests.push_back(std::move(request));
+    }
+    // Started on first use, most of the loading is waiting on the disk so a couple is plenty
+    if (m_workers.empty())
+    {
+        unsigned numWorkers = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+        for (unsigned i = 0; i < numWorkers; i++)
+            m_workers.emplace_back(&AResourceManager::WorkerMain, this);
+    }
+    m_wake.notify_one();
+    return mesh;
+}
+
+void AResourceManager::WorkerMain()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_stopping || !m_requests.empty(); });
+        if (m_stopping)
+            return;
+        std::unique_ptr<AMeshRequest> request = std::move(m_requests.front());
+        m_requests.pop_front();
+        m_inFlight++;
+        lock.unlock();
+
+        request->data = std::make_unique<AMeshData>();
+        request->read = AMeshLoader::ReadAnvMesh(request->path, *request->data,
+                                                 request->keepVertices);
+        for (const auto& texture : request->data->textures)
+        {
+            if (texture.empty() || request->textures.count(texture))
+                continue;
+            {
+                std::lock_guard<std::mutex> textureLock(m_mutex);
+                if (m_textures.count(texture))
+                    continue;
+            }
+            // Two meshes with the same texture in flight both decode it, the second is dropped
+            auto decoded = std::make_unique<ATextureData>();
+            if (!AMeshLoader::ReadTexture(texture, *decoded))
+                decoded.reset();
+            request->textures[texture] = std::move(decoded);
+        }
+
+        lock.lock();
+        m_inFlight--;
+        m_uploads.push_back(std::move(request));
+    }
+}
+
+uint32_t AResourceManager::ProcessUploads(size_t byteBudget)
+{
+    uint32_t uploaded = 0;
+    size_t   spent    = 0;
+    while (uploaded == 0 || spent < byteBudget)
+    {
+        std::unique_ptr<AMeshRequest> request;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_uploads.empty())
+                break;
+            request = std::move(m_uploads.front());
+            m_uploads.pop_front();
+        }
+        if (!request->read)
+            continue;
+
+        AMeshData&            data = *request->data;
+        std::vector<uint32_t> textures;
+        for (const auto& path : data.textures)
+        {
+            // Only this thread adds textures, so one that isn't cached now won't be by the upload
+            uint32_t texID  = 0;
+            bool     cached = path.empty();
+            if (!cached)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto                        it = m_textures.find(path);
+                if (it != m_textures.end())
+                {
+                    texID  = it->second;
+                    cached = true;
+                }
+            }
+            auto read = request->textures.find(path);
+            if (!cached && read != request->textures.end() && read->second)
+            {
+                const ATextureData& texture = *read->second;
+                texID = ATextureMips::Upload(texture.entry, texture.data.data(), texture.levels);
+                spent += texture.data.size();
+                std::cout << "[Anvil Engine] Success: Loaded texture " << path << std::endl;
+            }
+            if (!cached)
+            {
+                // Missing ones are cached as 0 too, ReadTexture already said why
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_textures[path] = texID;
+            }
+            textures.push_back(texID);
+        }
+        spent += (size_t) data.stream.numVertices *
+                     AVertexFormat::GetStride((EVertexFormat) data.stream.format) +
+                 data.numIndices * data.indexSize;
+        AMeshLoader::UploadAnvMesh(data, *request->mesh, textures);
+        uploaded++;
+    }
+    return uploaded;
+}
+
+size_t AResourceManager::GetPendingCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_requests.size() + m_inFlight + m_uploads.size();
+}
+
+uint32_t AResourceManager::LoadTexture(const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto                        it = m_textures.find(path);
+        if (it != m_textures.end())
+            return it->second;
+    }
+    uint32_t texID = AMeshLoader::LoadTexture(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_textures[path] = texID;
 }
\ No newline at end of file
@@ -1,17 +1,18 @@
 #pragma once
 #include "AMesh.h"
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include "AMeshLoader.h"
 
 class ANVIL_API AResourceManager
 {
   public:
-    ~AResourceManager()
-    {
-        for (auto& p : m_meshes)
-            delete p.second;
-    }
+    ~AResourceManager();
     void RegisterMesh(const std::string& name, AMesh* mesh)
     {
         m_meshes[name] = mesh;
@@ -21,8 +22,58 @@ class ANVIL_API AResourceManager
         return m_meshes[name];
     }
 
-    AMesh* LoadMesh(const std::string& name, const std::string& path);
+    /**
+     * @brief Loads a mesh once under a name, later calls with the same name get the same one
+     * @param keepVertices false drops the CPU copy of the vertices, see AMeshLoader::LoadAnvMesh
+     */
+    AMesh* LoadMesh(const std::string& name, const std::string& path, bool keepVertices = true);
+    /**
+     * @brief Same as LoadMesh but returns right away, the file is read and its textures decoded
+     * on worker threads and ProcessUploads puts it on the GPU later. Until then the mesh isn't
+     * loaded (AMesh::IsLoaded) and has no vertices or hulls, so physics should wait for it.
+     * A mesh that fails to load stays that way, the reason is printed
+     * @param placeholder Drawn in its place until it's loaded, can be null for nothing
+     */
+    AMesh* LoadMeshAsync(const std::string& name, const std::string& path,
+                         AMesh* placeholder = nullptr, bool keepVertices = true);
+    /**
+     * @brief Uploads meshes the workers have finished, call once a frame on the GL thread
+     * @param byteBudget Roughly how many bytes of vertices, indices and textures to upload. A
+     * mesh goes up whole, at least one goes per call so a big one doesn't wait forever
+     * @return How many meshes were uploaded
+     */
+    uint32_t ProcessUploads(size_t byteBudget);
+    /**
+     * @brief Meshes from LoadMeshAsync that aren't uploaded yet
+     */
+    size_t GetPendingCount();
+    /**
+     * @brief Loads a texture once, later calls with the same path get the same one
+     * @return OpenGL texture ID, 0 if it couldn't be loaded
+     */
+    uint32_t LoadTexture(const std::string& path);
 
   private:
-    std::map<std::string, AMesh*> m_meshes;
+    // A LoadMeshAsync call, and what the worker read for it
+    struct AMeshRequest
+    {
+        AMesh*                     mesh = nullptr;
+        std::string                path;
+        bool                       keepVertices = true;
+        bool                       read         = false; // data is good
+        std::unique_ptr<AMeshData> data;
+        std::map<std::string, std::unique_ptr<ATextureData>> textures; // the uncached ones
+    };
+    void WorkerMain();
+
+    std::map<std::string, AMesh*>   m_meshes;
+    std::map<std::string, uint32_t> m_textures; // shared with the workers, under m_mutex
+
+    std::mutex                                m_mutex;
+    std::condition_variable                   m_wake;
+    std::deque<std::unique_ptr<AMeshRequest>> m_requests;     // waiting for a worker
+    std::deque<std::unique_ptr<AMeshRequest>> m_uploads;      // read, waiting for ProcessUploads
+    size_t                                    m_inFlight = 0; // being read by a worker
+    std::vector<std::thread>                  m_workers;
+    bool                                      m_stopping = false;
 };
\ No newline at end of file
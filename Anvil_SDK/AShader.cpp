@@ -81,6 +81,8 @@ void AShader::Compile(const char* vCode, const char* fCode)
     // Clean up - delete the shader objects as they're linked into the program
     glDeleteShader(v);
     glDeleteShader(f);
+
+    m_vertexFormatUniforms = AVertexFormat::GetUniforms(m_ID);
 }
 
 void AShader::CheckCompileErrors(uint32_t shader, std::string type)
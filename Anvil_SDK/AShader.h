@@ -1,6 +1,7 @@
 #pragma once
 // AShader.h
 #include "ACore.h"
+#include "AVertexFormat.h"
 #include <sstream>
 #include <string_view>
 
@@ -16,9 +17,14 @@ class ANVIL_API AShader
     {
         return m_ID;
     }
+    const AVertexFormatUniforms& GetVertexFormatUniforms() const
+    {
+        return m_vertexFormatUniforms;
+    }
 
   private:
-    uint32_t    m_ID;
+    uint32_t              m_ID;
+    AVertexFormatUniforms m_vertexFormatUniforms; // looked up at link, meshes set them every draw
     void        Compile(const char* vCode, const char* fCode);
     std::string LoadFromResource(int resID);
 };
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include "AStageProfiler.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+std::string JsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if ((unsigned char) c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) c);
+                out += escaped;
+            }
+            else
+                out += c;
+        }
+    }
+    return out + "\"";
+}
+
+double ToMB(double bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+// Across every profiler in the process, to tell whether a stage had the memory to itself
+std::atomic<uint32_t> g_runningStages{0};
+std::atomic<uint64_t> g_begunStages{0};
+} // namespace
+
+void AStageProfiler::Begin(const char* name)
+{
+    if (m_running)
+        End();
+    m_stages.push_back({name});
+    m_startStage  = ++g_begunStages;
+    m_alone       = ++g_runningStages == 1;
+    m_startMemory = GetCurrentMemory();
+    m_running     = true;
+    m_start       = Clock::now();
+}
+
+void AStageProfiler::End(uint64_t items)
+{
+    if (!m_running)
+        return;
+    AProfileStage& stage = m_stages.back();
+    stage.seconds        = std::chrono::duration<double>(Clock::now() - m_start).count();
+    stage.items          = items;
+    stage.peakBytes      = GetPeakMemory();
+    stage.memoryDelta    = (int64_t) GetCurrentMemory() - (int64_t) m_startMemory;
+    stage.ownMemory      = m_alone && g_runningStages == 1 && g_begunStages == m_startStage;
+    g_runningStages--;
+    m_running            = false;
+}
+
+double AStageProfiler::GetTotalSeconds() const
+{
+    double total = 0.0;
+    for (const auto& stage : m_stages)
+        total += stage.seconds;
+    return total;
+}
+
+void AStageProfiler::PrintTable(std::ostream& out, const std::string& title) const
+{
+    std::ostringstream table;
+    table << std::fixed << std::setprecision(1);
+    table << "[Anvil Compiler] Profile: " << title << std::endl;
+    table << "  " << std::left << std::setw(12) << "Stage" << std::right << std::setw(12) << "Time ms"
+          << std::setw(12) << "Items" << std::setw(12) << "Peak MB" << std::setw(12) << "Delta MB"
+          << std::endl;
+    for (const auto& stage : m_stages)
+    {
+        table << "  " << std::left << std::setw(12) << stage.name << std::right << std::setw(12)
+              << stage.seconds * 1000.0 << std::setw(12) << stage.items;
+        if (stage.ownMemory)
+            table << std::setw(12) << ToMB((double) stage.peakBytes) << std::setw(12)
+                  << ToMB((double) stage.memoryDelta);
+        else
+            table << std::setw(12) << "-" << std::setw(12) << "-";
+        table << std::endl;
+    }
+    table << "  " << std::left << std::setw(12) << "total" << std::right << std::setw(12)
+          << GetTotalSeconds() * 1000.0 << std::endl;
+    // One write, so tables from parallel compiles don't interleave
+    out << table.str();
+}
+
+std::string AStageProfiler::ToJson(const std::string& input) const
+{
+    std::ostringstream json;
+    json << "{\n  \"input\": " << JsonString(input) << ",\n  \"totalSeconds\": " << GetTotalSeconds()
+         << ",\n  \"stages\": [";
+    for (size_t i = 0; i < m_stages.size(); i++)
+    {
+        const AProfileStage& s = m_stages[i];
+        json << (i ? ",\n" : "\n") << "    {\"name\": " << JsonString(s.name)
+             << ", \"seconds\": " << s.seconds << ", \"items\": " << s.items;
+        // Null when other work shared the process during the stage
+        if (s.ownMemory)
+            json << ", \"peakBytes\": " << s.peakBytes << ", \"memoryDelta\": " << s.memoryDelta << "}";
+        else
+            json << ", \"peakBytes\": null, \"memoryDelta\": null}";
+    }
+    json << "\n  ]\n}\n";
+    return json.str();
+}
+
+bool AStageProfiler::SaveJson(const std::string& path, const std::string& input) const
+{
+    std::ofstream out(path, std::ios::binary);
+    out << ToJson(input);
+    return out.good();
+}
+
+uint64_t AStageProfiler::GetCurrentMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize;
+#else
+    // Resident pages are the second number
+    unsigned long long size = 0, resident = 0;
+    FILE*              statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (uint64_t) sysconf(_SC_PAGESIZE);
+#endif
+}
+
+uint64_t AStageProfiler::GetPeakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (uint64_t) usage.ru_maxrss * 1024; // KB on Linux
+#endif
+}
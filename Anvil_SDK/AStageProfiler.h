@@ -0,0 +1,80 @@
+#pragma once
+// AStageProfiler.h
+#include "ACore.h"
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One finished stage, memory is for the whole process
+struct AProfileStage
+{
+    std::string name;
+    double      seconds     = 0.0;
+    uint64_t    items       = 0; // whatever the stage counts: brushes, faces, bytes...
+    uint64_t    peakBytes   = 0; // process peak once the stage was done
+    int64_t     memoryDelta = 0; // change of the process working set over the stage
+    bool        ownMemory   = true; // false when a stage of another profiler overlapped it
+};
+
+/**
+ * @class AStageProfiler
+ * @brief Wall time, memory and item counts of a pipeline run one stage after another
+ * Stages can't nest, beginning one ends the one still running. Memory is read from the OS for the
+ * whole process, so it only belongs to a stage when no other profiler had a stage running at the
+ * same time. Stages that overlapped one (parallel batch compiles) leave the memory columns blank.
+ */
+class ANVIL_API AStageProfiler
+{
+  public:
+    AStageProfiler() = default;
+    AStageProfiler(const AStageProfiler&)            = delete;
+    AStageProfiler& operator=(const AStageProfiler&) = delete;
+    ~AStageProfiler()
+    {
+        End(); // an early return can leave a stage running
+    }
+
+    /**
+     * @brief Starts timing a stage, ending the current one with no items
+     * @param name Stage name, also the JSON key so keep it short and stable
+     */
+    void Begin(const char* name);
+    /**
+     * @brief Ends the current stage
+     * @param items Number of things the stage handled
+     */
+    void End(uint64_t items = 0);
+
+    const std::vector<AProfileStage>& GetStages() const
+    {
+        return m_stages;
+    }
+    double GetTotalSeconds() const;
+
+    /**
+     * @brief Prints the stages as a table
+     * @param title Printed above the table, usually the input file
+     */
+    void PrintTable(std::ostream& out, const std::string& title) const;
+    /**
+     * @brief The stages as a JSON object
+     * @param input Input file, stored with the stages so reports can be told apart
+     */
+    std::string ToJson(const std::string& input) const;
+    bool        SaveJson(const std::string& path, const std::string& input) const;
+
+    static uint64_t GetCurrentMemory();
+    static uint64_t GetPeakMemory();
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<AProfileStage> m_stages;
+    Clock::time_point          m_start;
+    uint64_t                   m_startMemory = 0;
+    uint64_t                   m_startStage  = 0; // g_begunStages when the stage began
+    bool                       m_alone       = false;
+    bool                       m_running     = false;
+};
@@ -0,0 +1,317 @@
+#include "ATextureMips.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <glad/glad.h>
+#include <iostream>
+
+// S3TC is an extension, glad leaves these out unless it was generated with it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+namespace
+{
+// Linear, premultiplied RGBA
+struct LinearImage
+{
+    uint32_t           width  = 0;
+    uint32_t           height = 0;
+    std::vector<float> texels;
+};
+
+struct Tap
+{
+    uint32_t index;
+    float    weight;
+};
+
+float SrgbToLinear(float c)
+{
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float LinearToSrgb(float c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+}
+
+uint32_t NearestPowerOfTwo(uint32_t v)
+{
+    uint32_t p = 1;
+    while (p * 2 <= v)
+        p *= 2;
+    return (v - p) > (p * 2 - v) ? p * 2 : p;
+}
+
+/**
+ * Tent filter taps for resampling one axis. The filter is widened to the scale factor when
+ * shrinking so every source texel contributes, and wraps around the edges.
+ */
+std::vector<std::vector<Tap>> MakeTaps(uint32_t srcSize, uint32_t dstSize)
+{
+    std::vector<std::vector<Tap>> taps(dstSize);
+    float                         scale  = (float) srcSize / dstSize;
+    float                         radius = std::max(1.0f, scale);
+    for (uint32_t d = 0; d < dstSize; d++)
+    {
+        float center = (d + 0.5f) * scale;
+        int   first  = (int) std::floor(center - radius);
+        int   last   = (int) std::ceil(center + radius);
+        float total  = 0.0f;
+        for (int s = first; s <= last; s++)
+        {
+            float w = 1.0f - std::abs(s + 0.5f - center) / radius;
+            if (w <= 0.0f)
+                continue;
+            int wrapped = ((s % (int) srcSize) + (int) srcSize) % (int) srcSize;
+            taps[d].push_back({(uint32_t) wrapped, w});
+            total += w;
+        }
+        for (auto& t : taps[d])
+            t.weight /= total;
+    }
+    return taps;
+}
+
+LinearImage Resample(const LinearImage& src, uint32_t width, uint32_t height)
+{
+    // Rows first, then columns
+    auto        xTaps = MakeTaps(src.width, width);
+    LinearImage rows;
+    rows.width  = width;
+    rows.height = src.height;
+    rows.texels.assign((size_t) width * src.height * 4, 0.0f);
+    for (uint32_t y = 0; y < src.height; y++)
+    {
+        const float* in  = src.texels.data() + (size_t) y * src.width * 4;
+        float*       out = rows.texels.data() + (size_t) y * width * 4;
+        for (uint32_t x = 0; x < width; x++)
+        {
+            for (const Tap& t : xTaps[x])
+            {
+                for (int c = 0; c < 4; c++)
+                    out[x * 4 + c] += in[t.index * 4 + c] * t.weight;
+            }
+        }
+    }
+
+    auto        yTaps = MakeTaps(src.height, height);
+    LinearImage dst;
+    dst.width  = width;
+    dst.height = height;
+    dst.texels.assign((size_t) width * height * 4, 0.0f);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        float* out = dst.texels.data() + (size_t) y * width * 4;
+        for (const Tap& t : yTaps[y])
+        {
+            const float* in = rows.texels.data() + (size_t) t.index * width * 4;
+            for (size_t i = 0; i < (size_t) width * 4; i++)
+                out[i] += in[i] * t.weight;
+        }
+    }
+    return dst;
+}
+
+LinearImage Decode(const uint8_t* rgba, uint32_t width, uint32_t height)
+{
+    float toLinear[256];
+    for (int i = 0; i < 256; i++)
+        toLinear[i] = SrgbToLinear(i / 255.0f);
+
+    LinearImage img;
+    img.width  = width;
+    img.height = height;
+    img.texels.resize((size_t) width * height * 4);
+    for (size_t i = 0; i < (size_t) width * height; i++)
+    {
+        float a                = rgba[i * 4 + 3] / 255.0f;
+        img.texels[i * 4]      = toLinear[rgba[i * 4]] * a;
+        img.texels[i * 4 + 1]  = toLinear[rgba[i * 4 + 1]] * a;
+        img.texels[i * 4 + 2]  = toLinear[rgba[i * 4 + 2]] * a;
+        img.texels[i * 4 + 3]  = a;
+    }
+    return img;
+}
+
+AMipLevel Encode(const LinearImage& img)
+{
+    AMipLevel level;
+    level.width  = img.width;
+    level.height = img.height;
+    level.pixels.resize((size_t) img.width * img.height * 4);
+    for (size_t i = 0; i < (size_t) img.width * img.height; i++)
+    {
+        const float* t = img.texels.data() + i * 4;
+        float        a = std::clamp(t[3], 0.0f, 1.0f);
+        for (int c = 0; c < 3; c++)
+        {
+            float linear             = a > 0.0f ? std::clamp(t[c] / a, 0.0f, 1.0f) : 0.0f;
+            level.pixels[i * 4 + c] = (uint8_t) std::lround(LinearToSrgb(linear) * 255.0f);
+        }
+        level.pixels[i * 4 + 3] = (uint8_t) std::lround(a * 255.0f);
+    }
+    return level;
+}
+} // namespace
+
+std::vector<AMipLevel> ATextureMips::Build(const uint8_t* rgba, uint32_t width, uint32_t height,
+                                           bool powerOfTwo)
+{
+    std::vector<AMipLevel> levels;
+    if (!rgba || width == 0 || height == 0)
+        return levels;
+
+    uint32_t baseWidth  = powerOfTwo ? NearestPowerOfTwo(width) : width;
+    uint32_t baseHeight = powerOfTwo ? NearestPowerOfTwo(height) : height;
+
+    LinearImage img = Decode(rgba, width, height);
+    if (baseWidth != width || baseHeight != height)
+    {
+        img = Resample(img, baseWidth, baseHeight);
+        levels.push_back(Encode(img));
+    }
+    else
+    {
+        // The base level stays exactly what the artist made
+        levels.push_back({width, height, std::vector<uint8_t>(rgba, rgba + (size_t) width * height * 4)});
+    }
+
+    while (img.width > 1 || img.height > 1)
+    {
+        img = Resample(img, std::max(1u, img.width / 2), std::max(1u, img.height / 2));
+        levels.push_back(Encode(img));
+    }
+    return levels;
+}
+
+uint32_t ATextureMips::Upload(const ATextureEntry& entry, const uint8_t* data,
+                              const std::vector<ATextureLevel>& levels)
+{
+    GLuint texID;
+    glGenTextures(1, &texID);
+    glBindTexture(GL_TEXTURE_2D, texID);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    ETextureFormat format     = (ETextureFormat) entry.format;
+    bool           compressed = format == ETextureFormat::BC1 || format == ETextureFormat::BC3;
+    GLenum         glFormat   = format == ETextureFormat::BC1   ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+                                : format == ETextureFormat::BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+                                : format == ETextureFormat::RGB8 ? GL_RGB
+                                                                 : GL_RGBA;
+
+    std::vector<ATextureLevel> chain = levels;
+    if (chain.empty())
+        chain.push_back({0, entry.width, entry.height, 0, entry.dataSize});
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint) chain.size() - 1);
+
+    for (size_t i = 0; i < chain.size(); i++)
+    {
+        const ATextureLevel& l = chain[i];
+        if (compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, (GLint) i, glFormat, l.width, l.height, 0, l.size,
+                                   data + l.offset);
+        else
+            glTexImage2D(GL_TEXTURE_2D, (GLint) i, glFormat, l.width, l.height, 0, glFormat,
+                         GL_UNSIGNED_BYTE, data + l.offset);
+    }
+
+    if (levels.empty())
+    {
+        // Old files, the GPU has to make the chain. Compressed formats can't, so no mips there
+        if (compressed)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        else
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+    }
+    return texID;
+}
+
+bool ATextureMips::Save(const std::string& path, const std::string& name,
+                        const std::vector<AMipLevel>& levels)
+{
+    if (levels.empty())
+        return false;
+    std::ofstream os(path, std::ios::binary);
+    if (!os)
+        return false;
+
+    ATextureFileHeader header = {{'A', 'T', 'E', 'X'}, 1, (uint32_t) levels.size()};
+    ATextureEntry      entry;
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+    entry.width  = levels[0].width;
+    entry.height = levels[0].height;
+    entry.format = (uint32_t) ETextureFormat::RGBA8;
+
+    std::vector<ATextureLevel> table;
+    uint32_t                   offset = 0;
+    for (const auto& l : levels)
+    {
+        table.push_back({0, l.width, l.height, offset, (uint32_t) l.pixels.size()});
+        offset += (uint32_t) l.pixels.size();
+    }
+    entry.dataSize = offset;
+
+    os.write((char*) &header, sizeof(header));
+    os.write((char*) &entry, sizeof(entry));
+    os.write((char*) table.data(), table.size() * sizeof(ATextureLevel));
+    for (const auto& l : levels)
+        os.write((char*) l.pixels.data(), l.pixels.size());
+    return (bool) os;
+}
+
+uint32_t ATextureMips::Load(const std::string& path)
+{
+    ATextureEntry              entry;
+    std::vector<ATextureLevel> levels;
+    std::vector<uint8_t>       data;
+    if (!Read(path, entry, levels, data))
+        return 0;
+    return Upload(entry, data.data(), levels);
+}
+
+bool ATextureMips::Read(const std::string& path, ATextureEntry& entry,
+                        std::vector<ATextureLevel>& levels, std::vector<uint8_t>& data)
+{
+    std::ifstream is(path, std::ios::binary);
+    if (!is)
+        return false;
+
+    ATextureFileHeader header;
+    if (!is.read((char*) &header, sizeof(header)) || memcmp(header.magic, "ATEX", 4) != 0 ||
+        header.version != 1 || header.numLevels == 0 || !is.read((char*) &entry, sizeof(entry)))
+    {
+        std::cout << "[Anvil Engine] Warning: " << path << " is not a valid .atex file" << std::endl;
+        return false;
+    }
+
+    levels.resize(header.numLevels);
+    data.resize(entry.dataSize);
+    is.read((char*) levels.data(), levels.size() * sizeof(ATextureLevel));
+    is.read((char*) data.data(), data.size());
+    if (!is)
+    {
+        std::cout << "[Anvil Engine] Warning: " << path << " is truncated" << std::endl;
+        return false;
+    }
+    for (const auto& l : levels)
+    {
+        if ((uint64_t) l.offset + l.size > data.size())
+            return false;
+    }
+    return true;
+}
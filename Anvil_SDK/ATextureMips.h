@@ -0,0 +1,74 @@
+#pragma once
+// ATextureMips.h
+#include "ACore.h"
+#include "AnvilBSPFormat.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One level of a mip chain, RGBA8
+struct AMipLevel
+{
+    uint32_t             width;
+    uint32_t             height;
+    std::vector<uint8_t> pixels;
+};
+
+// .atex, a texture baked next to the image it came from:
+// ATextureFileHeader, ATextureEntry, ATextureLevel[numLevels], then the level data
+struct ATextureFileHeader
+{
+    char     magic[4]; // "ATEX"
+    uint32_t version;  // 1
+    uint32_t numLevels;
+};
+
+/**
+ * @class ATextureMips
+ * @brief Offline mip chain generation and upload of the precomputed levels
+ */
+class ANVIL_API ATextureMips
+{
+  public:
+    /**
+     * @brief Builds a mip chain down to 1x1
+     * Colors are filtered in linear space with alpha premultiplied, so dark fringes and halos
+     * around transparent texels don't show up in the smaller levels. Texels wrap at the edges
+     * since textures are drawn with GL_REPEAT.
+     * @param rgba sRGB RGBA8 pixels
+     * @param width Image width
+     * @param height Image height
+     * @param powerOfTwo Resamples the base level to the nearest power of two size first
+     */
+    static std::vector<AMipLevel> Build(const uint8_t* rgba, uint32_t width, uint32_t height,
+                                        bool powerOfTwo);
+
+    /**
+     * @brief Creates a GL texture from a texture entry and its levels
+     * Without levels the data is taken as the base level and mips are generated on the GPU,
+     * which is what older .absp files need.
+     * @param entry Format and base size
+     * @param data Texture data, levels point into it
+     * @param levels Mip levels, base level first
+     * @return The texture ID
+     */
+    static uint32_t Upload(const ATextureEntry& entry, const uint8_t* data,
+                           const std::vector<ATextureLevel>& levels);
+
+    /**
+     * @brief Writes an RGBA8 mip chain to an .atex file
+     */
+    static bool Save(const std::string& path, const std::string& name,
+                     const std::vector<AMipLevel>& levels);
+    /**
+     * @brief Loads an .atex file into a GL texture
+     * @return The texture ID, 0 if the file is missing or invalid
+     */
+    static uint32_t Load(const std::string& path);
+    /**
+     * @brief Reads an .atex file for Upload, without GL
+     * @return false if the file is missing or invalid
+     */
+    static bool Read(const std::string& path, ATextureEntry& entry,
+                     std::vector<ATextureLevel>& levels, std::vector<uint8_t>& data);
+};
@@ -0,0 +1,261 @@
+#include "AVertexFormat.h"
+#include "AMesh.h"
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <glad/glad.h>
+#include <glm/gtc/packing.hpp>
+
+namespace
+{
+float SignNotZero(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Works on anything with a position, UV and normal, get returns them as pointers
+template <typename TVertex, typename TGet>
+AVertexStreamHeader EncodeVertices(EVertexFormat format, const std::vector<TVertex>& verts,
+                                   std::vector<uint8_t>& out, TGet get)
+{
+    AVertexStreamHeader header;
+    header.format      = (uint32_t) format;
+    header.numVertices = (uint32_t) verts.size();
+
+    uint32_t stride = AVertexFormat::GetStride(format);
+    out.assign((size_t) stride * verts.size(), 0);
+    if (format == EVertexFormat::Float)
+    {
+        memcpy(out.data(), verts.data(), out.size());
+        return header;
+    }
+
+    if (format == EVertexFormat::Quantized && !verts.empty())
+    {
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        for (const auto& v : verts)
+        {
+            lo = glm::min(lo, *get(v).position);
+            hi = glm::max(hi, *get(v).position);
+        }
+        header.origin = lo;
+        for (int i = 0; i < 3; i++)
+            header.scale[i] = hi[i] > lo[i] ? (hi[i] - lo[i]) / 65535.0f : 1.0f;
+    }
+
+    for (size_t i = 0; i < verts.size(); i++)
+    {
+        auto      v   = get(verts[i]);
+        uint8_t*  dst = out.data() + i * stride;
+        glm::vec2 oct = AVertexFormat::OctEncode(*v.normal);
+        uint16_t  uv[2]     = {glm::packHalf1x16(v.uv->x), glm::packHalf1x16(v.uv->y)};
+        int16_t   normal[2] = {(int16_t) glm::packSnorm1x16(oct.x), (int16_t) glm::packSnorm1x16(oct.y)};
+        if (format == EVertexFormat::Packed)
+        {
+            APackedVertex p;
+            p.position = *v.position;
+            memcpy(p.uv, uv, sizeof(uv));
+            memcpy(p.normal, normal, sizeof(normal));
+            memcpy(dst, &p, sizeof(p));
+        }
+        else
+        {
+            AQuantizedVertex q = {};
+            for (int k = 0; k < 3; k++)
+            {
+                float steps   = ((*v.position)[k] - header.origin[k]) / header.scale[k];
+                q.position[k] = (uint16_t) glm::clamp(std::round(steps), 0.0f, 65535.0f);
+            }
+            memcpy(q.uv, uv, sizeof(uv));
+            memcpy(q.normal, normal, sizeof(normal));
+            memcpy(dst, &q, sizeof(q));
+        }
+    }
+    return header;
+}
+
+template <typename TVertex, typename TGet>
+bool DecodeVertices(const AVertexStreamHeader& header, const uint8_t* data, size_t size,
+                    std::vector<TVertex>& out, TGet get)
+{
+    EVertexFormat format = (EVertexFormat) header.format;
+    uint32_t      stride = AVertexFormat::GetStride(format);
+    if (stride == 0 || size < (uint64_t) stride * header.numVertices)
+        return false;
+
+    out.resize(header.numVertices);
+    if (format == EVertexFormat::Float)
+    {
+        memcpy(out.data(), data, (size_t) stride * header.numVertices);
+        return true;
+    }
+
+    for (size_t i = 0; i < out.size(); i++)
+    {
+        auto           v   = get(out[i]);
+        const uint8_t* src = data + i * stride;
+        const uint16_t* uv;
+        const int16_t*  normal;
+        APackedVertex    p;
+        AQuantizedVertex q;
+        if (format == EVertexFormat::Packed)
+        {
+            memcpy(&p, src, sizeof(p));
+            *v.position = p.position;
+            uv          = p.uv;
+            normal      = p.normal;
+        }
+        else
+        {
+            memcpy(&q, src, sizeof(q));
+            *v.position = header.origin +
+                          glm::vec3(q.position[0], q.position[1], q.position[2]) * header.scale;
+            uv     = q.uv;
+            normal = q.normal;
+        }
+        *v.uv     = glm::vec2(glm::unpackHalf1x16(uv[0]), glm::unpackHalf1x16(uv[1]));
+        *v.normal = AVertexFormat::OctDecode(glm::vec2(glm::unpackSnorm1x16((uint16_t) normal[0]),
+                                                       glm::unpackSnorm1x16((uint16_t) normal[1])));
+    }
+    return true;
+}
+
+template <typename TVec3, typename TVec2> struct VertexRefs
+{
+    TVec3* position;
+    TVec2* uv;
+    TVec3* normal;
+};
+
+template <typename TVertex> auto RefsOf(TVertex& v)
+{
+    using Vec3 = std::conditional_t<std::is_const_v<TVertex>, const glm::vec3, glm::vec3>;
+    using Vec2 = std::conditional_t<std::is_const_v<TVertex>, const glm::vec2, glm::vec2>;
+    if constexpr (std::is_same_v<std::remove_const_t<TVertex>, AVertex>)
+        return VertexRefs<Vec3, Vec2>{&v.position, &v.uv, &v.normal};
+    else
+        return VertexRefs<Vec3, Vec2>{&v.pos, &v.uv, &v.normal};
+}
+} // namespace
+
+uint32_t AVertexFormat::GetStride(EVertexFormat format)
+{
+    switch (format)
+    {
+    case EVertexFormat::Float:
+        return sizeof(AVertex);
+    case EVertexFormat::Packed:
+        return sizeof(APackedVertex);
+    case EVertexFormat::Quantized:
+        return sizeof(AQuantizedVertex);
+    default:
+        return 0;
+    }
+}
+
+const char* AVertexFormat::GetName(EVertexFormat format)
+{
+    switch (format)
+    {
+    case EVertexFormat::Float:
+        return "float";
+    case EVertexFormat::Packed:
+        return "packed";
+    case EVertexFormat::Quantized:
+        return "quantized";
+    default:
+        return "unknown";
+    }
+}
+
+AVertexStreamHeader AVertexFormat::Encode(EVertexFormat format, const std::vector<AVertex>& verts,
+                                          std::vector<uint8_t>& out)
+{
+    return EncodeVertices(format, verts, out, [](const AVertex& v) { return RefsOf(v); });
+}
+
+AVertexStreamHeader AVertexFormat::Encode(EVertexFormat format, const std::vector<MVertex>& verts,
+                                          std::vector<uint8_t>& out)
+{
+    return EncodeVertices(format, verts, out, [](const MVertex& v) { return RefsOf(v); });
+}
+
+bool AVertexFormat::Decode(const AVertexStreamHeader& header, const uint8_t* data, size_t size,
+                           std::vector<AVertex>& out)
+{
+    return DecodeVertices(header, data, size, out, [](AVertex& v) { return RefsOf(v); });
+}
+
+bool AVertexFormat::Decode(const AVertexStreamHeader& header, const uint8_t* data, size_t size,
+                           std::vector<MVertex>& out)
+{
+    return DecodeVertices(header, data, size, out, [](MVertex& v) { return RefsOf(v); });
+}
+
+void AVertexFormat::SetupAttributes(EVertexFormat format)
+{
+    GLsizei stride = (GLsizei) GetStride(format);
+    switch (format)
+    {
+    case EVertexFormat::Packed:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*) offsetof(APackedVertex, position));
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*) offsetof(APackedVertex, uv));
+        glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, (void*) offsetof(APackedVertex, normal));
+        break;
+    case EVertexFormat::Quantized:
+        // Whole steps, base.vert scales them back into place
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, stride,
+                              (void*) offsetof(AQuantizedVertex, position));
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*) offsetof(AQuantizedVertex, uv));
+        glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride, (void*) offsetof(AQuantizedVertex, normal));
+        break;
+    default:
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*) offsetof(AVertex, position));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*) offsetof(AVertex, uv));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*) offsetof(AVertex, normal));
+        break;
+    }
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+}
+
+AVertexFormatUniforms AVertexFormat::GetUniforms(uint32_t program)
+{
+    AVertexFormatUniforms uniforms;
+    uniforms.positionOrigin = glGetUniformLocation(program, "positionOrigin");
+    uniforms.positionScale  = glGetUniformLocation(program, "positionScale");
+    uniforms.octNormals     = glGetUniformLocation(program, "octNormals");
+    return uniforms;
+}
+
+void AVertexFormat::SetUniforms(const AVertexFormatUniforms& uniforms,
+                                const AVertexStreamHeader&   header)
+{
+    glUniform3f(uniforms.positionOrigin, header.origin.x, header.origin.y, header.origin.z);
+    glUniform3f(uniforms.positionScale, header.scale.x, header.scale.y, header.scale.z);
+    glUniform1i(uniforms.octNormals, (EVertexFormat) header.format != EVertexFormat::Float);
+}
+
+glm::vec2 AVertexFormat::OctEncode(const glm::vec3& normal)
+{
+    float     sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    glm::vec3 n   = sum > 0.0f ? normal / sum : glm::vec3(0.0f, 0.0f, 1.0f);
+    if (n.z >= 0.0f)
+        return glm::vec2(n.x, n.y);
+    // Lower half folds over the diagonals
+    return glm::vec2((1.0f - std::abs(n.y)) * SignNotZero(n.x), (1.0f - std::abs(n.x)) * SignNotZero(n.y));
+}
+
+glm::vec3 AVertexFormat::OctDecode(const glm::vec2& encoded)
+{
+    glm::vec3 n(encoded.x, encoded.y, 1.0f - std::abs(encoded.x) - std::abs(encoded.y));
+    if (n.z < 0.0f)
+    {
+        float x = (1.0f - std::abs(n.y)) * SignNotZero(n.x);
+        float y = (1.0f - std::abs(n.x)) * SignNotZero(n.y);
+        n.x     = x;
+        n.y     = y;
+    }
+    return glm::normalize(n);
+}
@@ -0,0 +1,109 @@
+#pragma once
+// AVertexFormat.h
+#include "ACore.h"
+#include "AMath.h"
+#include "AnvilBSPFormat.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct MVertex;
+
+// Layouts the compiler and the mesh exporter can store vertices in. All of them carry the
+// position, UV and normal of AVertex / MVertex, the compact ones trade precision for size.
+enum class EVertexFormat : uint32_t
+{
+    Float     = 0, // AVertex / MVertex, 32 bytes
+    Packed    = 1, // APackedVertex, 20 bytes
+    Quantized = 2, // AQuantizedVertex, 16 bytes
+};
+
+// Full position, half float UV and an octahedral normal
+struct APackedVertex
+{
+    glm::vec3 position;
+    uint16_t  uv[2];     // half floats
+    int16_t   normal[2]; // octahedral, snorm
+};
+
+// Position in 16 bit steps across the bounds of the stream, see AVertexStreamHeader
+struct AQuantizedVertex
+{
+    uint16_t position[3];
+    uint16_t padding;
+    uint16_t uv[2];     // half floats
+    int16_t  normal[2]; // octahedral, snorm
+};
+
+// Written in front of compact vertex data. A position is origin + position * scale, which is
+// just the position for the float layouts.
+struct AVertexStreamHeader
+{
+    uint32_t  format = (uint32_t) EVertexFormat::Float; // EVertexFormat
+    uint32_t  numVertices = 0;
+    glm::vec3 origin = glm::vec3(0.0f);
+    glm::vec3 scale  = glm::vec3(1.0f);
+};
+
+// Where SetUniforms puts the stream's decode parameters, looked up once per program
+struct AVertexFormatUniforms
+{
+    int32_t positionOrigin = -1;
+    int32_t positionScale  = -1;
+    int32_t octNormals     = -1;
+};
+
+/**
+ * @class AVertexFormat
+ * @brief Converts vertices between the float and the compact layouts and sets up GL for them
+ * The decode is the one the engine runs, so positions the compiler reads back from Decode are
+ * exactly the ones collision will see at runtime.
+ */
+class ANVIL_API AVertexFormat
+{
+  public:
+    static uint32_t GetStride(EVertexFormat format);
+    static const char* GetName(EVertexFormat format);
+
+    /**
+     * @brief Encodes vertices into one of the layouts
+     * @param format Layout to write
+     * @param verts Vertices to encode
+     * @param out Receives numVertices * GetStride(format) bytes
+     * @return The header to store in front of the data
+     */
+    static AVertexStreamHeader Encode(EVertexFormat format, const std::vector<AVertex>& verts,
+                                      std::vector<uint8_t>& out);
+    static AVertexStreamHeader Encode(EVertexFormat format, const std::vector<MVertex>& verts,
+                                      std::vector<uint8_t>& out);
+
+    /**
+     * @brief Decodes a stream back to floats
+     * @param header Header stored in front of the data
+     * @param data Encoded vertices
+     * @param size Bytes available at data
+     * @return false if the format is unknown or the data is too short
+     */
+    static bool Decode(const AVertexStreamHeader& header, const uint8_t* data, size_t size,
+                       std::vector<AVertex>& out);
+    static bool Decode(const AVertexStreamHeader& header, const uint8_t* data, size_t size,
+                       std::vector<MVertex>& out);
+
+    /**
+     * @brief Points attributes 0 to 2 at the bound GL_ARRAY_BUFFER
+     */
+    static void SetupAttributes(EVertexFormat format);
+    /**
+     * @brief Looks up the uniforms SetUniforms needs, once after the program is linked
+     */
+    static AVertexFormatUniforms GetUniforms(uint32_t program);
+    /**
+     * @brief Sets what base.vert needs to decode the stream: positionOrigin, positionScale and
+     * octNormals. Must be called for every draw with the program in use.
+     */
+    static void SetUniforms(const AVertexFormatUniforms& uniforms,
+                            const AVertexStreamHeader&   header);
+
+    static glm::vec2 OctEncode(const glm::vec3& normal);
+    static glm::vec3 OctDecode(const glm::vec2& encoded);
+};
@@ -1,8 +1,11 @@
 #pragma once
+#include "ACulling.h"
 #include "AMath.h"
 #include <vector>
 #include <cstdint>
 
+// With a "BSID" lump the planes of a brush are the ones at brushSides[firstPlane ..
+// firstPlane + numPlanes], without one they are the planes themselves
 struct ABSPBrush
 {
     uint32_t firstPlane;
@@ -16,6 +19,8 @@ struct ABspEntity
     glm::vec3 size;
 
 };
+// Version 2 and older, the fixed arrays follow in this order and the optional lumps come after
+// the texture data as ABSPChunks. Version 3 starts with ABSPHeaderV3 instead.
 struct ABSPHeader
 {
     char     magic[4]; // "ABSP"
@@ -28,6 +33,38 @@ struct ABSPHeader
     uint32_t numTextures;
 };
 
+constexpr uint32_t ABSP_VERSION = 3;
+
+// Version 3: this header, numLumps ABSPLump entries, then the lumps. Each one starts at a multiple
+// of its alignment, so a mapped file can be read in place and a reader only touches the lumps it
+// asks for (ABSPFile). The fixed arrays of version 2 are lumps as well: "VERT" AVertex,
+// "FACE" AFace, "ENTS" ABspEntity, "PLAN" APlane, "BRSH" ABSPBrush, "TEXE" ATextureEntry and
+// "TEXD" the data of every texture one after another. Any lump can be compressed on its own.
+struct ABSPHeaderV3
+{
+    char     magic[4]; // "ABSP"
+    uint32_t version;  // 3
+    uint32_t numLumps;
+    uint32_t reserved;
+};
+
+enum class EBSPCompression : uint32_t
+{
+    None = 0,
+    LZ4  = 1, // LZ4 block, see ALZ4
+};
+
+struct ABSPLump
+{
+    char     id[4];       // the same ids as ABSPChunk
+    uint32_t alignment;   // offset is a multiple of this
+    uint64_t offset;      // from the start of the file
+    uint64_t size;        // in bytes, as stored
+    uint32_t compression; // EBSPCompression
+    uint32_t reserved;
+    uint64_t rawSize; // in bytes once decompressed, the same as size for stored lumps
+};
+
 struct AVertex
 {
     glm::vec3 position;
@@ -35,6 +72,8 @@ struct AVertex
     glm::vec3 normal;
 };
 
+// With an "FVTX" lump the corners of a face are the vertices at faceVertices[firstVertex ..
+// firstVertex + numVertices], without one they are the vertices themselves
 struct AFace
 {
     uint32_t firstVertex;
@@ -47,10 +86,106 @@ struct APlane
     float     distance;
 };
 
+// ATextureEntry::format. The raw formats are the channel counts older compilers wrote
+enum class ETextureFormat : uint32_t
+{
+    RGB8  = 3,
+    RGBA8 = 4,
+    BC1   = 5, // DXT1, 8 bytes per 4x4 block, opaque
+    BC3   = 6, // DXT5, 16 bytes per 4x4 block, interpolated alpha
+};
+
 struct ATextureEntry {
     char name[64]; // texture name from the .map file , like "float/wood1" or sum like that
 	uint32_t width;
 	uint32_t height;
-	uint32_t format; // GL_RGB or GL_RGBA
+	uint32_t format; // ETextureFormat
     uint32_t dataSize;
-};
\ No newline at end of file
+};
+
+// "MIPS" lump, one entry per mip level, grouped by texture and going down from the base level.
+// offset is from the start of that texture's data. Textures without entries only have level 0.
+struct ATextureLevel
+{
+    uint32_t texture; // index into the texture entries
+    uint32_t width;
+    uint32_t height;
+    uint32_t offset;
+    uint32_t size;
+};
+
+// Optional lumps appended after the texture data of version 2 files. Each one starts with an
+// ABSPChunk header, readers skip the ids they don't know so older .absp files keep loading.
+struct ABSPChunk
+{
+    char     id[4]; // "NODE", "LEAF", "LFAC", "VIS ", "MIPS", "INDX", "DRAW", "BVH ",
+                    // "LMAP", "LMUV", "FVTX", "BSID", "VTXC"
+    uint32_t size;  // payload size in bytes, not counting this header
+};
+
+// "NODE" lump, node 0 is the root
+struct ABSPNode
+{
+    APlane  plane;
+    int32_t children[2]; // front, back. >= 0 is a node index, < 0 is -(leaf + 1)
+};
+
+// "LEAF" lump, faces of a leaf are leafFaces[firstLeafFace .. firstLeafFace + numLeafFaces]
+// "LFAC" lump holds those face indices as uint32_t
+struct ABSPLeaf
+{
+    int32_t  cluster; // row in the visibility lump, -1 for solid leaves
+    uint32_t firstLeafFace;
+    uint32_t numLeafFaces;
+};
+
+// "INDX" lump: uint32_t vertex indices, every face fan triangulated in face order.
+// "DRAW" lump: the ranges of it that share a texture. The compiler sorts faces by texture, so
+// every texture is a single range and the faces of a range are next to each other as well.
+struct ABSPDrawRange
+{
+    uint32_t textureID;
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    uint32_t firstFace;
+    uint32_t numFaces;
+};
+
+// "CLUS" lump: runs of whole faces inside a draw range, about 64 vertices and 124 triangles
+// each, that the engine culls together before it draws
+struct ABSPCluster
+{
+    AClusterBounds bounds;
+    uint32_t       firstFace;
+    uint32_t       numFaces;
+};
+
+// "FVTX" lump: uint32_t vertex index of every face corner. Faces that meet share vertices.
+// "BSID" lump: uint32_t plane index of every brush side. Brushes that share a plane share it.
+// "VTXC" lump: AVertexStreamHeader, then the vertices in a compact layout (AVertexFormat.h).
+// Maps that have it leave out the AVertex array ("VERT" lump, or numVertices = 0 in version 2).
+
+// "BVH " lump: this header, then a btOptimizedBvh serialized in place over the "INDX" triangles.
+// The serialized tree is only valid for the Bullet version and pointer size it was made with.
+struct ABSPBvhHeader
+{
+    uint32_t bulletVersion; // BT_BULLET_VERSION
+    uint32_t pointerSize;
+    uint32_t numVertices;
+    uint32_t numTriangles;
+};
+
+// "LMAP" lump: this header, then width * height RGB8 luxels. 128 leaves the texture as it is,
+// 255 is twice as bright. "LMUV" lump: a glm::vec2 atlas coordinate for every vertex.
+struct ABSPLightmapHeader
+{
+    uint32_t width;
+    uint32_t height;
+};
+
+// "VIS " lump: uint32_t numClusters, uint32_t offsets[numClusters], then the rows.
+// Each row is (numClusters + 7) / 8 bits, zero bytes are run-length encoded as (0, count).
+struct ABSPVisHeader
+{
+    uint32_t numClusters;
+};
@@ -1,5 +1,7 @@
 ﻿#include "AnvilPhysics.h"
 #include "AEngine.h"
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <print>
 #include <set>
@@ -67,6 +69,14 @@ AnvilPhysics::~AnvilPhysics()
     }
     delete m_meshShape;
     delete m_triangleMesh;
+    btAlignedFree(m_bvhBuffer);
+
+    for (auto& [meshID, compound] : m_hullShapes)
+    {
+        for (int i = 0; i < compound->getNumChildShapes(); i++)
+            delete compound->getChildShape(i);
+        delete compound;
+    }
 
     for (auto* t : m_triggers)
     {
@@ -102,6 +112,10 @@ ABody* AnvilPhysics::CreateBody(glm::vec3 pos, glm::vec3 size, float mass, bool
             break;
         }
 		case ECollisionQuality::HIGH_FIDELITY:
+            if (mesh)
+                shape = GetHullShape(mesh);
+            if (shape)
+                break;
             if (mesh)
             {
                 const std::vector<MVertex>& verts = mesh->GetVertices();
@@ -166,47 +180,101 @@ ABody* AnvilPhysics::CreateBody(glm::vec3 pos, glm::vec3 size, float mass, bool
 }
 
 /**
- * Sets up the physics world data from vertex and face information
+ * Builds the compound of a mesh's baked convex hulls once, every body spawned from that mesh
+ * shares it afterwards
+ * @param mesh Mesh with collision hulls from the exporter
+ * @return The shared shape, owned by AnvilPhysics
+ */
+btCollisionShape* AnvilPhysics::GetHullShape(const AMesh* mesh)
+{
+    auto it = m_hullShapes.find(mesh->GetID());
+    if (it != m_hullShapes.end())
+        return it->second;
+
+    // Fewer than 4 points has no volume, without any proper hull the caller falls back
+    const std::vector<AConvexHull>& hulls = mesh->GetCollisionHulls();
+    size_t numHulls = std::count_if(hulls.begin(), hulls.end(),
+                                    [](const AConvexHull& hull) { return hull.points.size() >= 4; });
+    if (numHulls == 0)
+        return nullptr;
+    btCompoundShape* compound = new btCompoundShape(true, (int) numHulls);
+    btTransform      identity;
+    identity.setIdentity();
+    for (const auto& hull : hulls)
+    {
+        if (hull.points.size() < 4)
+            continue;
+        // The points are already in mesh space, so no child offsets
+        btConvexHullShape* child = new btConvexHullShape(&hull.points[0].x, (int) hull.points.size(),
+                                                         sizeof(glm::vec3));
+        child->setMargin(0.01f);
+        compound->addChildShape(identity, child);
+    }
+    m_hullShapes[mesh->GetID()] = compound;
+    return compound;
+}
+
+/**
+ * Sets up the physics world data from the world's vertices and triangle indices
  * @param verts Vector of vertices defining the mesh
- * @param faces Vector of faces defining the mesh connectivity
+ * @param indices Triangle list indexing into verts, as the compiler wrote it
+ * @param bakedBvh "BVH " lump built by the compiler for these triangles, empty to build it here
  */
-void AnvilPhysics::SetWorldData(const std::vector<AVertex>& verts, const std::vector<AFace>& faces)
+void AnvilPhysics::SetWorldData(const std::vector<AVertex>& verts, const std::vector<uint32_t>& indices,
+                                const std::vector<uint8_t>& bakedBvh)
 {
-    // Build triangle mesh
-    m_triangleMesh = new btTriangleMesh();
-    m_vbo.clear();  // Clear existing vertex buffer data
-    m_ibo.clear();  // Clear existing index buffer data
+    // A new map replaces the old world body
+    if (m_worldBody)
+    {
+        m_dynamicsWorld->removeRigidBody(m_worldBody);
+        delete m_worldBody->getMotionState();
+        delete m_worldBody;
+        delete m_meshShape;
+        delete m_triangleMesh;
+        btAlignedFree(m_bvhBuffer);
+        m_worldBody = nullptr;
+        m_bvhBuffer = nullptr;
+    }
 
-    // Process vertices and add them to the vertex buffer object (VBO)
-    for (const auto& v : verts)
+    // Bullet reads the triangles straight out of these, no copy into a btTriangleMesh
+    m_vbo.resize(verts.size() * 3);
+    for (size_t i = 0; i < verts.size(); i++)
     {
-        // Push vertex position coordinates (x, y, z) into VBO
-        m_vbo.push_back(v.position.x);
-        m_vbo.push_back(v.position.y);
-        m_vbo.push_back(v.position.z);
+        m_vbo[i * 3]     = verts[i].position.x;
+        m_vbo[i * 3 + 1] = verts[i].position.y;
+        m_vbo[i * 3 + 2] = verts[i].position.z;
     }
+    m_ibo.assign(indices.begin(), indices.end());
+
+    m_triangleMesh = new btTriangleIndexVertexArray((int) (m_ibo.size() / 3), m_ibo.data(),
+                                                    3 * sizeof(int), (int) verts.size(),
+                                                    m_vbo.data(), 3 * sizeof(float));
 
-    // Process faces and generate triangles for the index buffer object (IBO)
-    for (const auto& f : faces)
+    // Attach the compiler's BVH if it was made for exactly these triangles by this Bullet
+    btOptimizedBvh* bvh = nullptr;
+    ABSPBvhHeader   header;
+    if (bakedBvh.size() > sizeof(header))
     {
-        // Generate triangles using fan triangulation
-        for (uint32_t i = 1; i < f.numVertices - 1; i++)
+        memcpy(&header, bakedBvh.data(), sizeof(header));
+        if (header.bulletVersion == BT_BULLET_VERSION && header.pointerSize == sizeof(void*) &&
+            header.numVertices == verts.size() && header.numTriangles == m_ibo.size() / 3)
         {
-            int i0 = f.firstVertex;
-            int i1 = f.firstVertex + i;
-            int i2 = f.firstVertex + i + 1;
-            // Add triangle vertices to IBO
-            m_ibo.push_back(i0);      // First vertex of the face
-            m_ibo.push_back(i1);
-            m_ibo.push_back(i2);
-            const btVector3 v0(m_vbo[i0*3], m_vbo[i0*3+1], m_vbo[i0*3+2]);
-            const btVector3 v1(m_vbo[i1*3], m_vbo[i1*3+1], m_vbo[i1*3+2]);
-            const btVector3 v2(m_vbo[i2*3], m_vbo[i2*3+1], m_vbo[i2*3+2]);
-            m_triangleMesh->addTriangle(v0, v1, v2);
-       }
+            // Deserializing in place needs 16 byte alignment and the buffer has to outlive the shape
+            unsigned size = (unsigned) (bakedBvh.size() - sizeof(header));
+            m_bvhBuffer   = btAlignedAlloc(size, 16);
+            memcpy(m_bvhBuffer, bakedBvh.data() + sizeof(header), size);
+            bvh = btOptimizedBvh::deSerializeInPlace(m_bvhBuffer, size, false);
+            if (!bvh)
+            {
+                btAlignedFree(m_bvhBuffer);
+                m_bvhBuffer = nullptr;
+            }
+        }
     }
 
-    m_meshShape = new btBvhTriangleMeshShape(m_triangleMesh, true);
+    m_meshShape = new btBvhTriangleMeshShape(m_triangleMesh, true, bvh == nullptr);
+    if (bvh)
+        m_meshShape->setOptimizedBvh(bvh);
     btTransform startTransform;
     startTransform.setIdentity();
     btDefaultMotionState* motionState = new btDefaultMotionState(startTransform);
@@ -216,7 +284,8 @@ void AnvilPhysics::SetWorldData(const std::vector<AVertex>& verts, const std::ve
                                    btCollisionObject::CF_STATIC_OBJECT);
     m_dynamicsWorld->addRigidBody(m_worldBody);
 
-    std::cout << "[Anvil] World Physics Mesh Baked." << std::endl; // not baked lmao
+    std::cout << "[Anvil] World Physics Mesh " << (bvh ? "loaded from the baked BVH." : "built.")
+              << std::endl;
 }
 void AnvilPhysics::Update(float dt)
 {
@@ -70,7 +70,8 @@ class ANVIL_API AnvilPhysics
     void       Update(float dt);
     ABody*     CreateBody(glm::vec3 pos, glm::vec3 size, float mass, bool isStatic,
                           ECollisionQuality quality = ECollisionQuality::BALANCED, AMesh* mesh = nullptr);
-    void       SetWorldData(const std::vector<AVertex>& verts, const std::vector<AFace>& faces);
+    void       SetWorldData(const std::vector<AVertex>& verts, const std::vector<uint32_t>& indices,
+                            const std::vector<uint8_t>& bakedBvh = {});
     RaycastHit CastRay(glm::vec3 origin, glm::vec3 direction, float maxDistance,
                        const std::vector<AEntity*>& entities);
     bool       IsGrounded(ABody* body);
@@ -90,6 +91,11 @@ class ANVIL_API AnvilPhysics
     static glm::vec3 toGlm(const btVector3& v);
 
   private:
+    /**
+     * @brief Compound of the mesh's baked hulls, null if it has none with a volume
+     */
+    btCollisionShape* GetHullShape(const AMesh* mesh);
+
     btDefaultCollisionConfiguration*     m_collisionConfiguration = nullptr;
     btCollisionDispatcher*               m_dispatcher             = nullptr;
     btBroadphaseInterface*               m_broadphase             = nullptr;
@@ -97,9 +103,14 @@ class ANVIL_API AnvilPhysics
     btDiscreteDynamicsWorld*             m_dynamicsWorld          = nullptr;
 
     // World static body (mesh)
-    btRigidBody*            m_worldBody    = nullptr;
-    btTriangleMesh*         m_triangleMesh = nullptr;
-    btBvhTriangleMeshShape* m_meshShape    = nullptr;
+    btRigidBody*                m_worldBody    = nullptr;
+    btTriangleIndexVertexArray* m_triangleMesh = nullptr; // Points into m_vbo and m_ibo
+    btBvhTriangleMeshShape*     m_meshShape    = nullptr;
+    void*                       m_bvhBuffer    = nullptr; // Baked BVH, deserialized in place
+
+    // Compounds of the baked hulls, one per mesh and shared by all its bodies. By AMesh::GetID,
+    // a pointer could come back for another mesh once the first one is deleted
+    std::unordered_map<uint64_t, btCompoundShape*> m_hullShapes;
 
     // All bodies created (for cleanup & syncing)
     std::vector<ABody*> m_bodies;
@@ -0,0 +1,52 @@
+#include "MeshComponent.h"
+#include "AEngine.h"
+#include <algorithm>
+
+void MeshComponent::OnRender(AShader* shader)
+{
+    // Early return if mesh or owner is not valid
+    if (!m_mesh || !m_owner)
+        return;
+    // Still loading, its placeholder stands in if it has one
+    AMesh* mesh = m_mesh->IsLoaded() ? m_mesh : m_mesh->GetPlaceholder();
+    if (!mesh)
+        return;
+    // Initialize model matrix as identity matrix
+    glm::mat4 model = glm::mat4(1.0f);
+
+    // Apply transformations in order: translation, rotation, scaling
+    model = glm::translate(model, m_owner->position);                              // Move to owner's position
+    model = glm::rotate(model, glm::radians(m_owner->rotation.y), {0, 1, 0}); // Rotate around Y-axis
+    model = glm::scale(model, m_owner->scale);                                     // Apply scaling
+
+    // The frustum goes into the mesh's own space so its bounds and clusters are tested untouched
+    AEngine*  engine  = AEngine::Get();
+    glm::vec4 camera  = glm::vec4(engine->GetCameraPosition(), 1.0f);
+    glm::vec3 eye     = glm::vec3(glm::inverse(model) * camera);
+    AFrustum  frustum = AFrustum::FromMatrix(engine->GetViewProjection() * model, eye);
+    if (!frustum.IsSphereVisible(glm::vec3(0.0f), mesh->GetBoundingRadius()))
+        return;
+
+    // Set the model matrix uniform in the shader
+    glUniformMatrix4fv(glGetUniformLocation(shader->GetID(), "model"), 1, GL_FALSE,
+                       glm::value_ptr(model));
+
+    // Distance to the nearest point of the bounding sphere, so big meshes up close stay detailed
+    const std::vector<AMeshLOD>& lods = mesh->GetLODs();
+    uint32_t                     lod  = 0;
+    if (lods.size() > 1)
+    {
+        float    scale    = std::max({m_owner->scale.x, m_owner->scale.y, m_owner->scale.z});
+        float    distance = glm::length(m_owner->position - engine->GetCameraPosition()) -
+                         mesh->GetBoundingRadius() * scale;
+        float pixels = engine->GetPixelsPerUnit() * scale / std::max(distance, 0.001f);
+        for (lod = (uint32_t) lods.size() - 1; lod > 0; lod--)
+        {
+            if (lods[lod].error * pixels <= m_lodPixelError)
+                break;
+        }
+    }
+    // A mirroring scale turns the triangles around and breaks the cone test, draw every cluster
+    const glm::vec3& scale = m_owner->scale;
+    mesh->Draw(shader, lod, scale.x * scale.y * scale.z < 0.0f ? nullptr : &frustum);
+}
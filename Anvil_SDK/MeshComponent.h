@@ -30,30 +30,21 @@ class ANVIL_API MeshComponent : public IComponent
         // The actual update logic should be implemented in derived classes
     }
 /**
- * Renders the mesh component using the specified shader
+ * Renders the mesh component using the specified shader, at the coarsest level of detail
+ * whose error stays under the pixel limit on screen
  * @param shader The shader program to use for rendering
  */
-    void OnRender(AShader* shader) override
-    {
-    // Early return if mesh or owner is not valid
-        if (!m_mesh || !m_owner)
-            return;
-    // Initialize model matrix as identity matrix
-        glm::mat4 model = glm::mat4(1.0f);
-
-    
-    // Apply transformations in order: translation, rotation, scaling
-        model           = glm::translate(model, m_owner->position);           // Move to owner's position
-        model           = glm::rotate(model, glm::radians(m_owner->rotation.y), {0, 1, 0}); // Rotate around Y-axis
-        model           = glm::scale(model, m_owner->scale);                  // Apply scaling
+    void OnRender(AShader* shader) override;
 
-    // Set the model matrix uniform in the shader
-        glUniformMatrix4fv(glGetUniformLocation(shader->GetID(), "model"), 1, GL_FALSE,
-    // Draw the mesh
-                           glm::value_ptr(model));
-        m_mesh->Draw();
+    /**
+     * @brief How many pixels a LOD may be off on screen before a finer one is drawn
+     */
+    void SetLODPixelError(float pixels)
+    {
+        m_lodPixelError = pixels;
     }
 
   private:
     AMesh* m_mesh;
+    float  m_lodPixelError = 1.0f;
 };
\ No newline at end of file
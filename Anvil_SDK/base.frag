@@ -3,8 +3,14 @@ out vec4 FragColor;
 
 in vec2 TexCoords; 
 in vec3 Normal;
+in vec2 LightmapCoords;
 uniform sampler2D ourTexture;
+uniform sampler2D lightmap;
+uniform bool useLightmap;
 
 void main() {
     FragColor = texture(ourTexture, TexCoords);
+    // 128 in the lightmap leaves the texture as it is, brighter values overbright it
+    if (useLightmap)
+        FragColor.rgb *= texture(lightmap, LightmapCoords).rgb * 2.0;
 }
\ No newline at end of file
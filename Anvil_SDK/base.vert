@@ -2,16 +2,32 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoords;
 layout (location = 2) in vec3 aNormal;
+layout (location = 3) in vec2 aLightmapCoords;
 
 out vec2 TexCoords;
 out vec3 Normal;
+out vec2 LightmapCoords;
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Compact vertex streams, see AVertexFormat
+uniform vec3 positionOrigin;
+uniform vec3 positionScale;
+uniform bool octNormals;
+
+vec3 OctDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main() {
     TexCoords = aTexCoords;
-    Normal = aNormal;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    Normal = octNormals ? OctDecode(aNormal.xy) : aNormal;
+    LightmapCoords = aLightmapCoords;
+    vec3 position = positionOrigin + aPos * positionScale;
+    gl_Position = projection * view * model * vec4(position, 1.0);
 }
\ No newline at end of file
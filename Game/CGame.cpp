@@ -32,7 +32,7 @@ void CGame::OnInit(AEngine* engine)
 
     m_camera = new ACamera(glm::vec3(-3, 2, 0));
 
-    AMesh* modelMesh = AMeshLoader::LoadAnvMesh("model.anvmesh");
+    AMesh* modelMesh = engine->GetResources()->LoadMesh("model", "model.anvmesh");
     if (modelMesh) {
         m_crate = engine->CreateEntity("PhysicsCrate");
         m_crate->position = glm::vec3(0, 5.0f, 0);